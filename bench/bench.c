@@ -0,0 +1,580 @@
+/**
+ * @author      Arno Lievens (arnolievens@gmail.com)
+ * @date        14/10/2026
+ * @file        bench.c
+ * @brief       benchmarks of analysis, drawing and switching
+ * @copyright   Copyright (c) 2021 Arno Lievens
+ */
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <gtk/gtk.h>
+#include <math.h>
+#include <mpv/client.h>
+#include <sndfile.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../include/config.h"
+#include "../include/player.h"
+#include "../include/timeline.h"
+#include "../include/track.h"
+#include "../include/tracklist.h"
+
+/**
+ * Number of generated files, file i is BENCH_SECONDS * (i + 1) long
+ * half of them are wav, the other half flac
+ */
+#define BENCH_FILES                 8
+#define BENCH_SECONDS               30
+
+/**
+ * Sample rate and channels of the generated files
+ */
+#define BENCH_RATE                  44100
+#define BENCH_CHANNELS              2
+
+/**
+ * Widths of the timeline drawn, in pixels
+ */
+static const gint bench_widths[] = {320, 720, 1440, 2880};
+
+/**
+ * Height of the timeline drawn, in pixels
+ */
+#define BENCH_HEIGHT                48
+
+/**
+ * Number of draws per width and track
+ */
+#define BENCH_DRAWS                 50
+
+/**
+ * Number of switches measured and the time to wait for each (s)
+ */
+#define BENCH_SWITCHES              20
+#define BENCH_SWITCH_TIMEOUT        2.0
+
+/**
+ * Time to wait for the startup to complete (s)
+ */
+#define BENCH_STARTUP_TIMEOUT       5.0
+
+/**
+ * A generated file
+ */
+typedef struct BenchFile {
+    char* path;                 /**< absolute path */
+    const char* format;         /**< "wav" or "flac" */
+    double seconds;             /**< length */
+    gint64 bytes;               /**< size on disk */
+    Track* track;               /**< analyzed track */
+} BenchFile;
+
+/**
+ * Write a file of synthetic music
+ *
+ * a sine with a slow loudness envelope and some noise so the loudness, the
+ * waveform and the flac encoder all have something to work with
+ *
+ * @param file the file to be written, path, format and seconds must be set
+ * @return 0 on success, -1 when failed
+ */
+static int bench_generate(BenchFile* file);
+
+/**
+ * Time probing and analyzing the files
+ *
+ * the analysis cache is bypassed, cache hits are timed separately
+ *
+ * @param files the generated files
+ * @param n number of files
+ */
+static void bench_analyze(BenchFile* files, size_t n);
+
+/**
+ * Time the startup phases as with the files passed on the command line
+ *
+ * the player and the tracklist are created, the files pushed and the window
+ * built as the application does, then the main loop runs until the window
+ * is painted, every file is listed and mpv is ready
+ * the files were analyzed before so they are cache hits
+ *
+ * @param files the analyzed files
+ * @param n number of files
+ */
+static void bench_startup(BenchFile* files, size_t n);
+
+/**
+ * Draw callback recording the first paint
+ *
+ * @param widget the window
+ * @param cr unused
+ * @param data gint64 receiving the time of the first paint
+ * @return FALSE
+ */
+static gboolean bench_first_draw(GtkWidget* widget, cairo_t* cr, gpointer data);
+
+/**
+ * Time drawing the timeline for each track and width
+ *
+ * full: the waveform is rendered, cached: only the cursors are drawn over
+ * the cached waveform
+ *
+ * @param player player that provides the current track
+ * @param files the analyzed files
+ * @param n number of files
+ */
+static void bench_draw(Player* player, BenchFile* files, size_t n);
+
+/**
+ * Time switching tracks, from player_load_track to playback-restart
+ *
+ * @param player the player
+ * @param files the analyzed files
+ * @param n number of files
+ */
+static void bench_switch(Player* player, BenchFile* files, size_t n);
+
+/**
+ * Wait for playback-restart while handling the player events
+ *
+ * @param player the player
+ * @param client client handle receiving the events of the player core
+ * @param since start of the measurement (monotonic us)
+ * @return the latency in seconds or -1 on timeout
+ */
+static double bench_wait_restart(Player* player, mpv_handle* client, gint64 since);
+
+/**
+ * Remove the temporary directory with the cache written by the benchmarks
+ *
+ * @param dir the temporary directory, the generated files are removed
+ */
+static void bench_cleanup(const char* dir);
+
+/**
+ * Seconds since a monotonic timestamp
+ *
+ * @param since monotonic time in us
+ * @return seconds elapsed
+ */
+static double bench_elapsed(gint64 since);
+
+
+/*******************************************************************************
+ * main
+ */
+
+
+int main(int argc, char** argv)
+{
+    BenchFile files[BENCH_FILES] = {0};
+    gchar* dir, * cache;
+    Player* player;
+    int status = EXIT_FAILURE;
+
+    /* all output is one json object per line on stdout
+     * progress and errors go to stderr
+     */
+
+    if (!(dir = g_dir_make_tmp("alphabet-bench-XXXXXX", NULL))) {
+        fprintf(stderr, "failed to create temporary directory\n");
+        return EXIT_FAILURE;
+    }
+
+    /* the cache of the user is left alone */
+    cache = g_build_filename(dir, "cache", NULL);
+    g_setenv("XDG_CACHE_HOME", cache, TRUE);
+
+    for (size_t i = 0; i < BENCH_FILES; i++) {
+        files[i].format = i % 2 ? "flac" : "wav";
+        files[i].seconds = BENCH_SECONDS * (double)(i + 1);
+        files[i].path = g_strdup_printf("%s/bench-%02zu.%s", dir, i, files[i].format);
+
+        fprintf(stderr, "generating %s\n", files[i].path);
+        if (bench_generate(&files[i]) < 0) goto done;
+    }
+
+    bench_analyze(files, BENCH_FILES);
+
+    /* drawing and switching need a display and an audio output, the null
+     * output keeps the audio device out of the numbers
+     */
+
+    if (!gtk_init_check(&argc, &argv)) {
+        fprintf(stderr, "no display, skipping draw and switch benchmarks\n");
+        status = EXIT_SUCCESS;
+        goto done;
+    }
+
+    bench_startup(files, BENCH_FILES);
+
+    if (!(player = player_init())) goto done;
+    player_wait(player);
+    mpv_set_property_string(player->mpv, "ao", "null");
+
+    bench_draw(player, files, BENCH_FILES);
+    bench_switch(player, files, BENCH_FILES);
+
+    player_free(player);
+    status = EXIT_SUCCESS;
+
+done:
+    for (size_t i = 0; i < BENCH_FILES; i++) {
+        if (files[i].path) g_unlink(files[i].path);
+        track_free(files[i].track);
+        g_free(files[i].path);
+    }
+    bench_cleanup(dir);
+    g_free(cache);
+    g_free(dir);
+    return status;
+}
+
+
+/*******************************************************************************
+ * static functions
+ *
+ */
+
+
+int bench_generate(BenchFile* file)
+{
+    SF_INFO info = {0};
+    SNDFILE* sf;
+    GStatBuf st;
+    float frames[4096 * BENCH_CHANNELS];
+    int64_t total = (int64_t)(file->seconds * BENCH_RATE);
+    uint32_t noise = 22222;
+
+    info.samplerate = BENCH_RATE;
+    info.channels = BENCH_CHANNELS;
+    info.format = strcmp(file->format, "flac") == 0
+        ? SF_FORMAT_FLAC | SF_FORMAT_PCM_16
+        : SF_FORMAT_WAV | SF_FORMAT_PCM_16;
+
+    if (!(sf = sf_open(file->path, SFM_WRITE, &info))) {
+        fprintf(stderr, "%s\n", sf_strerror(NULL));
+        return -1;
+    }
+    sf_set_string(sf, SF_STR_TITLE, "bench");
+    sf_set_string(sf, SF_STR_ARTIST, "alphabet");
+
+    for (int64_t i = 0; i < total;) {
+        sf_count_t n = (sf_count_t)MIN(total - i, 4096);
+
+        for (sf_count_t k = 0; k < n; k++, i++) {
+            double t = (double)i / BENCH_RATE;
+            double envelope = 0.3 + 0.25 * sin(2 * G_PI * t / 7.0);
+            double sample = envelope * sin(2 * G_PI * 440.0 * t);
+
+            for (int c = 0; c < BENCH_CHANNELS; c++) {
+                noise = noise * 1664525u + 1013904223u;
+                frames[k * BENCH_CHANNELS + c] =
+                    (float)(sample + 0.05 * ((double)noise / UINT32_MAX - 0.5));
+            }
+        }
+        if (sf_writef_float(sf, frames, n) != n) {
+            fprintf(stderr, "%s\n", sf_strerror(sf));
+            sf_close(sf);
+            return -1;
+        }
+    }
+    sf_close(sf);
+
+    if (g_stat(file->path, &st) != 0) return -1;
+    file->bytes = (gint64)st.st_size;
+    return 0;
+}
+
+void bench_analyze(BenchFile* files, size_t n)
+{
+    const char* formats[] = {"wav", "flac"};
+
+    for (size_t f = 0; f < ELEMENTS(formats); f++) {
+        double probe = 0.0, analyze = 0.0, cached = 0.0, seconds = 0.0;
+        gint64 bytes = 0;
+        size_t count = 0;
+
+        for (size_t i = 0; i < n; i++) {
+            BenchFile* file = &files[i];
+            Track* track;
+            gint64 start;
+
+            if (strcmp(file->format, formats[f]) != 0) continue;
+
+            start = g_get_monotonic_time();
+            if (!(track = track_probe(NULL, file->path))) continue;
+            probe += bench_elapsed(start);
+
+            start = g_get_monotonic_time();
+            track_analyze(track, NULL, NULL, NULL);
+            analyze += bench_elapsed(start);
+
+            start = g_get_monotonic_time();
+            track_free(track_new_from_cache(NULL, file->path));
+            cached += bench_elapsed(start);
+
+            file->track = track;
+            bytes += file->bytes;
+            seconds += file->seconds;
+            count++;
+        }
+        if (!count) continue;
+
+        printf("{\"bench\":\"analyze\",\"version\":\"%s\",\"format\":\"%s\","
+                "\"files\":%zu,\"mb\":%.3f,\"audio_s\":%.1f,"
+                "\"probe_s\":%.6f,\"analyze_s\":%.6f,\"cache_s\":%.6f,"
+                "\"files_per_s\":%.3f,\"mb_per_s\":%.3f,\"realtime\":%.1f}\n",
+                VERSION, formats[f], count, (double)bytes / 1e6, seconds,
+                probe, analyze, cached,
+                (double)count / (probe + analyze),
+                (double)bytes / 1e6 / (probe + analyze),
+                seconds / (probe + analyze));
+        fflush(stdout);
+    }
+}
+
+void bench_startup(BenchFile* files, size_t n)
+{
+    GtkWidget* window, * scrolled;
+    Player* player;
+    Tracklist* tracklist;
+    gint64 start, painted = 0;
+    double init, push, window_s = -1.0, listed = -1.0, ready = -1.0;
+    gint rows = 0, rows_painted = 0;
+
+    start = g_get_monotonic_time();
+    if (!(player = player_init())) return;
+    init = bench_elapsed(start);
+
+    if (!(tracklist = tracklist_new(player))) {
+        player_free(player);
+        return;
+    }
+    for (size_t i = 0; i < n; i++) {
+        tracklist_append_file(tracklist, g_file_new_for_path(files[i].path));
+    }
+    push = bench_elapsed(start);
+
+    /* an offscreen window is painted like a mapped one, without showing */
+
+    window = gtk_offscreen_window_new();
+    gtk_window_set_default_size(GTK_WINDOW(window), WINDOW_X, WINDOW_Y);
+    scrolled = gtk_scrolled_window_new(NULL, NULL);
+    gtk_container_add(GTK_CONTAINER(window), scrolled);
+    tracklist_init(tracklist);
+    gtk_container_add(GTK_CONTAINER(scrolled), GTK_WIDGET(tracklist->tree));
+    g_signal_connect(window, "draw", G_CALLBACK(bench_first_draw), &painted);
+    gtk_widget_show_all(window);
+
+    while (bench_elapsed(start) < BENCH_STARTUP_TIMEOUT
+            && (window_s < 0 || listed < 0 || ready < 0))
+    {
+        if (!g_main_context_iteration(NULL, FALSE)) g_usleep(1000);
+
+        rows = gtk_tree_model_iter_n_children(GTK_TREE_MODEL(tracklist->list), NULL);
+        if (painted && window_s < 0) {
+            window_s = (double)(painted - start) / G_USEC_PER_SEC;
+            rows_painted = rows;
+        }
+        if (rows == (gint)n && listed < 0) listed = bench_elapsed(start);
+        if (player->ready && ready < 0) ready = bench_elapsed(start);
+    }
+
+    printf("{\"bench\":\"startup\",\"version\":\"%s\",\"files\":%zu,"
+            "\"init_ms\":%.3f,\"push_ms\":%.3f,\"window_ms\":%.3f,"
+            "\"rows_at_paint\":%d,\"listed_ms\":%.3f,\"ready_ms\":%.3f}\n",
+            VERSION, n, init * 1e3, push * 1e3, window_s * 1e3,
+            rows_painted, listed * 1e3, ready * 1e3);
+    fflush(stdout);
+
+    tracklist_free(tracklist);
+    gtk_widget_destroy(window);
+    player_free(player);
+}
+
+gboolean bench_first_draw(GtkWidget* widget, UNUSED cairo_t* cr, gpointer data)
+{
+    *(gint64*)data = g_get_monotonic_time();
+    g_signal_handlers_disconnect_by_func(widget, bench_first_draw, data);
+    return FALSE;
+}
+
+void bench_draw(Player* player, BenchFile* files, size_t n)
+{
+    GtkWidget* window;
+    Timeline* timeline;
+    cairo_surface_t* surface;
+    cairo_t* cr;
+
+    /* an offscreen window realizes the drawing area without showing it */
+
+    timeline = timeline_new(player);
+    window = gtk_offscreen_window_new();
+    gtk_container_add(GTK_CONTAINER(window), timeline->box);
+    gtk_widget_show_all(window);
+
+    for (size_t i = 0; i < n; i++) {
+        if (!files[i].track) continue;
+
+        player->current = files[i].track;
+        player->position = files[i].seconds / 2;
+
+        for (size_t j = 0; j < ELEMENTS(bench_widths); j++) {
+            gint w = bench_widths[j];
+            double full = 0.0, cached = 0.0;
+
+            gtk_widget_set_size_request(timeline->darea, w, BENCH_HEIGHT);
+            gtk_window_resize(GTK_WINDOW(window), 1, 1);
+            while (gtk_widget_get_allocated_width(timeline->darea) != w
+                    && g_main_context_iteration(NULL, FALSE));
+
+            surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, w, BENCH_HEIGHT);
+            cr = cairo_create(surface);
+
+            for (int k = 0; k < BENCH_DRAWS; k++) {
+                gint64 start;
+
+                timeline->wave_track = NULL;
+                start = g_get_monotonic_time();
+                gtk_widget_draw(timeline->darea, cr);
+                full += bench_elapsed(start);
+
+                start = g_get_monotonic_time();
+                gtk_widget_draw(timeline->darea, cr);
+                cached += bench_elapsed(start);
+            }
+
+            cairo_destroy(cr);
+            cairo_surface_destroy(surface);
+
+            printf("{\"bench\":\"draw\",\"version\":\"%s\",\"waveform_len\":%zu,"
+                    "\"width\":%d,\"allocated\":%d,"
+                    "\"full_us\":%.1f,\"cached_us\":%.1f}\n",
+                    VERSION, files[i].track->waveform_len, w,
+                    gtk_widget_get_allocated_width(timeline->darea),
+                    full / BENCH_DRAWS * 1e6, cached / BENCH_DRAWS * 1e6);
+            fflush(stdout);
+        }
+    }
+
+    player->current = NULL;
+    gtk_widget_destroy(window);
+    timeline_free(timeline);
+}
+
+void bench_switch(Player* player, BenchFile* files, size_t n)
+{
+    mpv_handle* client;
+    GArray* latencies;
+    double open;
+    gint64 start;
+    size_t count = 0, timeouts = 0;
+
+    if (!files[0].track) return;
+
+    /* a second client on the same core sees playback-restart without
+     * touching the event handling of the player
+     */
+
+    if (!(client = mpv_create_client(player->mpv, "bench"))) {
+        fprintf(stderr, "failed creating bench client\n");
+        return;
+    }
+    latencies = g_array_new(FALSE, FALSE, sizeof(double));
+
+    for (size_t i = 0; i < n; i++) {
+        if (files[i].track) player_add_track(player, files[i].track);
+    }
+
+    start = g_get_monotonic_time();
+    player_load_track(player, files[0].track);
+    open = bench_wait_restart(player, client, start);
+
+    /* every switch restarts from the marker, as when comparing a passage */
+
+    player->marker = 1.0;
+
+    for (int k = 0; k < BENCH_SWITCHES; k++) {
+        Track* track = files[(size_t)(k + 1) % n].track;
+        double latency;
+
+        if (!track) continue;
+
+        start = g_get_monotonic_time();
+        player_load_track(player, track);
+        latency = bench_wait_restart(player, client, start);
+
+        if (latency < 0) timeouts++;
+        else g_array_append_val(latencies, latency);
+        count++;
+    }
+
+    if (latencies->len) {
+        double sum = 0.0, max = 0.0;
+        for (guint i = 0; i < latencies->len; i++) {
+            double latency = g_array_index(latencies, double, i);
+            sum += latency;
+            max = MAX(max, latency);
+        }
+        printf("{\"bench\":\"switch\",\"version\":\"%s\",\"switches\":%zu,"
+                "\"timeouts\":%zu,\"open_ms\":%.3f,"
+                "\"mean_ms\":%.3f,\"max_ms\":%.3f}\n",
+                VERSION, count, timeouts, open * 1e3,
+                sum / latencies->len * 1e3, max * 1e3);
+        fflush(stdout);
+    }
+
+    player_stop(player);
+    for (size_t i = 0; i < n; i++) {
+        if (files[i].track) player_remove_track(player, files[i].track);
+    }
+    g_array_free(latencies, TRUE);
+    mpv_destroy(client);
+}
+
+double bench_wait_restart(Player* player, mpv_handle* client, gint64 since)
+{
+    while (bench_elapsed(since) < BENCH_SWITCH_TIMEOUT) {
+        mpv_event* event;
+
+        player_event_handler(player);
+        event = mpv_wait_event(client, 0.001);
+        if (event->event_id == MPV_EVENT_PLAYBACK_RESTART) {
+            return bench_elapsed(since);
+        }
+    }
+    return -1.0;
+}
+
+void bench_cleanup(const char* dir)
+{
+    gchar* cache = g_build_filename(dir, "cache", ID, NULL);
+    GDir* entries;
+    const gchar* name;
+
+    if ((entries = g_dir_open(cache, 0, NULL))) {
+        while ((name = g_dir_read_name(entries))) {
+            gchar* path = g_build_filename(cache, name, NULL);
+            g_unlink(path);
+            g_free(path);
+        }
+        g_dir_close(entries);
+    }
+    g_rmdir(cache);
+    g_free(cache);
+
+    cache = g_build_filename(dir, "cache", NULL);
+    g_rmdir(cache);
+    g_free(cache);
+    g_rmdir(dir);
+}
+
+double bench_elapsed(gint64 since)
+{
+    return (double)(g_get_monotonic_time() - since) / G_USEC_PER_SEC;
+}
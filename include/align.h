@@ -0,0 +1,34 @@
+/**
+ * @author      Arno Lievens (arnolievens@gmail.com)
+ * @date        14/10/2026
+ * @file        align.h
+ * @brief       estimate the time offset between two tracks
+ * @copyright   Copyright (c) 2021 Arno Lievens
+ */
+
+#ifndef ALIGN_H
+#define ALIGN_H
+
+#include "track.h"
+
+/**
+ * Estimate the offset of track against reference
+ *
+ * the offset is found in two passes, each an fft cross-correlation
+ *  - coarse: the loudness waveforms of both tracks (one point per
+ *    TIME_WINDOW), max ALIGN_MAX_OFFSET seconds either way
+ *  - fine: ALIGN_WINDOW seconds of mono pcm at full rate around the
+ *    strongest onset of reference, max one waveform point either way
+ * the fine pass is skipped when the sample rates differ
+ *
+ * both tracks must be analyzed, blocks while decoding the fine windows
+ *
+ * @param reference the track to align to
+ * @param track the track to be aligned
+ * @param offset destination of the offset in seconds, positive when the
+ *        content of track starts later than the content of reference
+ * @return 0 on success, -1 when no offset could be estimated
+ */
+extern int align_track(Track* reference, Track* track, double* offset);
+
+#endif
@@ -0,0 +1,44 @@
+/**
+ * @author      Arno Lievens (arnolievens@gmail.com)
+ * @date        14/10/2026
+ * @file        analyze.h
+ * @brief       headless batch analysis
+ * @copyright   Copyright (c) 2021 Arno Lievens
+ */
+
+#ifndef ANALYZE_H
+#define ANALYZE_H
+
+/**
+ * Command line option selecting the headless mode
+ */
+#define ANALYZE_OPTION "--analyze"
+
+/**
+ * Check the command line for ANALYZE_OPTION
+ *
+ * @param argc number of arguments
+ * @param argv the arguments
+ * @return 1 when the headless mode is requested, 0 otherwise
+ */
+extern int analyze_requested(int argc, char** argv);
+
+/**
+ * Analyze files without gui or player
+ *
+ *     alphabet --analyze [--format=csv|json] [--jobs=N] [--waveform] paths...
+ *
+ * directories are searched recursively for audio files, the files are
+ * analyzed on --jobs threads (default one per core) using the analysis
+ * cache, one record per file is written to stdout as soon as it finishes
+ *  - csv: a header line followed by one line per file
+ *  - json: one object per line (json lines)
+ *
+ * @param argc number of arguments
+ * @param argv the arguments
+ * @return EXIT_SUCCESS when all files were analyzed, EXIT_FAILURE when one
+ *         or more files failed, 2 on invalid arguments
+ */
+extern int analyze_main(int argc, char** argv);
+
+#endif
@@ -0,0 +1,71 @@
+/**
+ * @author      Arno Lievens (arnolievens@gmail.com)
+ * @date        14/10/2026
+ * @file        bufio.h
+ * @brief       buffered file input with read ahead for libav
+ * @copyright   Copyright (c) 2021 Arno Lievens
+ */
+
+#ifndef BUFIO_H
+#define BUFIO_H
+
+#include <glib.h>
+#include <libavformat/avio.h>
+#include <stdint.h>
+
+#include "fingerprint.h"
+
+/**
+ * Buffered input of a file
+ *
+ * the file is read in large blocks, with read ahead the next block is read
+ * on a separate thread while the current one is being decoded
+ * libav reads through an AVIOContext with the BufIO as opaque
+ *
+ * the kernel is told the file is read sequentially and which block comes
+ * after the one being read ahead (posix_fadvise where available)
+ * the blocks start at multiples of the block size, so they can be hashed
+ * into the fingerprint of the content while the file is decoded
+ */
+typedef struct BufIO {
+    int fd;                     /**< the open file */
+    int64_t size;               /**< size of the file, -1 = unknown */
+    size_t block;               /**< bytes per read */
+    unsigned char* data;        /**< current block */
+    int64_t start;              /**< file offset of data */
+    size_t len;                 /**< bytes in data */
+    size_t pos;                 /**< bytes of data already read */
+    unsigned char* next;        /**< block being read ahead, NULL = no read ahead */
+    int64_t next_start;         /**< file offset of next, -1 = not requested */
+    ssize_t next_len;           /**< bytes in next, -errno when failed */
+    int busy;                   /**< next is being read */
+    int quit;                   /**< read ahead thread must exit */
+    GThread* thread;            /**< read ahead thread */
+    GMutex lock;                /**< guards next, next_start, next_len, busy, quit */
+    GCond cond;                 /**< signals requests and finished reads */
+    Fingerprint* fingerprint;   /**< hashes the blocks read or NULL */
+} BufIO;
+
+/**
+ * Constructor
+ *
+ * @param path the file to be opened
+ * @param block bytes per read
+ * @param prefetch read the next block ahead on a separate thread
+ * @param fingerprint hashes the blocks read or NULL, block must be a
+ * multiple of FINGERPRINT_BLOCK
+ * @return an AVIOContext for AVFormatContext.pb or NULL when failed
+ */
+extern AVIOContext* bufio_open(const char* path, size_t block, int prefetch,
+        Fingerprint* fingerprint);
+
+/**
+ * Free all resources
+ *
+ * the format context must be closed first, pb is set to NULL
+ *
+ * @param pb the context created by bufio_open or NULL
+ */
+extern void bufio_close(AVIOContext** pb);
+
+#endif
@@ -0,0 +1,76 @@
+/**
+ * @author      Arno Lievens (arnolievens@gmail.com)
+ * @date        14/10/2026
+ * @file        cache.h
+ * @brief       persistent analysis cache
+ * @copyright   Copyright (c) 2021 Arno Lievens
+ */
+
+#ifndef CACHE_H
+#define CACHE_H
+
+#include "../include/track.h"
+
+/**
+ * Cache file format version
+ *
+ * bump whenever the layout of a cache entry or the analysis changes
+ * entries with a different version are ignored (and overwritten)
+ */
+#define CACHE_VERSION 6
+
+/**
+ * Fill track with the analysis results stored in the cache
+ *
+ * the entry is keyed on path, file size, modification time and the analysis
+ * parameters (TIME_WINDOW, CACHE_VERSION)
+ * when the file itself is not in the cache but its fingerprint is known,
+ * the entry of an identical file (copy, rename, symlink) is used when the
+ * hash of the whole file is known and matches the one of the entry
+ * on a hit lufs, peak, true_peak, length, sample_rate, waveform and tags
+ * are set, true_peak is NAN when the entry was saved before it was measured
+ *
+ * @param track the track to be filled, path must be set
+ * @return TRUE when a valid entry was found, FALSE otherwise
+ */
+extern gboolean cache_load(Track* track);
+
+/**
+ * Get the waveform stored in the cache
+ *
+ * used to re-hydrate an evicted waveform, the track itself is not changed
+ * the entry is found like cache_load finds it
+ *
+ * @param track the track, path must be set
+ * @param waveform destination of the newly allocated points, free with free
+ * @param len destination of the number of points
+ * @return TRUE when a valid entry was found, FALSE otherwise
+ */
+extern gboolean cache_load_waveform(Track* track, int16_t** waveform,
+        size_t* len);
+
+/**
+ * Store the analysis results of track in the cache
+ *
+ * failing to write the cache is not fatal, the track will simply be
+ * analyzed again next time
+ * the waveform of an evicted track is taken from its current entry
+ * with a fingerprint and a known hash of the whole file the entry is
+ * stored under the fingerprint as well
+ *
+ * @param track the analyzed track
+ */
+extern void cache_save(Track* track);
+
+/**
+ * Check for the entry of a file that may be identical
+ *
+ * only the fingerprint (size, head and tail) is compared, nothing is
+ * hashed, a match must be confirmed with the hash of the whole file
+ *
+ * @param track the track, path and fingerprint must be set
+ * @return TRUE when an entry with the same fingerprint was found
+ */
+extern gboolean cache_find_copy(Track* track);
+
+#endif
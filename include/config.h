@@ -57,6 +57,27 @@
  */
 #define COLOR_TIMELINE_WAVE         "rgba(206,106,29,0.5)"
 
+/**
+ * fraction of the timeline height used by the spectrogram lane (key s)
+ */
+#define TIMELINE_SPECTROGRAM_HEIGHT 0.5
+
+/**
+ * max number of columns of a spectrogram, each takes SPECTROGRAM_BINS
+ * bytes on every level
+ */
+#define SPECTROGRAM_COLUMNS         8192
+
+/**
+ * levels down to SPECTROGRAM_RANGE dB below full scale are shown
+ */
+#define SPECTROGRAM_RANGE           120.0
+
+/**
+ * number of finished spectrograms of previous tracks kept in memory
+ */
+#define SPECTROGRAM_RECENT          4
+
 /**
  * waveform in timeline is offset so that the avg LUFs is
  * at TIMELINE_AVG_HEIGHT * height of the widget (ref from the top)
@@ -66,6 +87,143 @@
  */
 #define TIMELINE_AVG_HEIGHT         0.5
 
+/**
+ * max number of threads decoding and analyzing files
+ * 0 means one thread per core
+ */
+#define LOADER_DECODE_THREADS       0
+
+/**
+ * max number of threads probing files (file info and cache lookups)
+ * kept low so spinning disks and network shares are not thrashed by seeks
+ */
+#define LOADER_IO_THREADS           2
+
+/**
+ * max number of loaded tracks added to the tracklist per frame
+ */
+#define LOADER_BATCH                64
+
+/**
+ * number of directory entries fetched per request while importing a
+ * directory, the files of each batch are queued right away
+ */
+#define LOADER_ENUMERATE_BATCH      128
+
+/**
+ * max bytes and duration (us) libav may read to find the stream info when
+ * only the tags and header of a file are needed
+ * most containers (wav, flac, ogg, mp4) carry everything in the header and
+ * are not read beyond it at all
+ */
+#define DECODER_PROBESIZE           32768
+#define DECODER_ANALYZEDURATION     500000
+
+/**
+ * measure loudness and peaks with the built-in vectorized meter (r128)
+ * instead of libebur128
+ */
+#define R128_BUILTIN                1
+
+/**
+ * feed every analysis to libebur128 as well and print results of the
+ * built-in meter that differ more than R128_VALIDATE_TOLERANCE (LU or dB)
+ * analysis is about twice as slow, for testing only
+ */
+#define R128_VALIDATE               0
+#define R128_VALIDATE_TOLERANCE     0.01
+
+/**
+ * bytes read from a file at once while decoding
+ * the next block is read ahead on a separate thread, so on network shares
+ * a round trip is paid once per block instead of once per libav buffer
+ */
+#define BUFIO_BLOCK                 (1 << 20)
+
+/**
+ * bytes read from a file at once while probing, no read ahead
+ */
+#define BUFIO_PROBE_BLOCK           65536
+
+/**
+ * size of the buffer libav parses from, filled from the current block
+ */
+#define BUFIO_AVIO_BUFFER           65536
+
+/**
+ * bytes hashed at the start and at the end of a file for its fingerprint
+ * identical files are analyzed once and share their cache entry, a match
+ * is confirmed by the hash of the whole file, built from the hashes of
+ * blocks of this size while the file is decoded
+ * BUFIO_BLOCK must be a multiple of it
+ */
+#define FINGERPRINT_BLOCK           (1 << 20)
+
+/**
+ * max bytes of waveforms kept in memory for the listed tracks
+ * the waveforms of the least recently selected tracks beyond this are freed
+ * and loaded from the analysis cache again when selected
+ */
+#define RESIDENCY_BUDGET            (32 << 20)
+
+/**
+ * max number of tracks kept open by the player for instant switching
+ * each one holds an open file and demuxer in mpv, switching to a track
+ * beyond this number reloads the file
+ */
+#define PLAYER_SOURCES              32
+
+/**
+ * time-stretch (mpv scaletempo2) of the varispeed, in ms
+ * the latency added by the stretch is about window + search, the search
+ * (one per window) is most of the cpu
+ * only the selected audio track is stretched, the other open tracks of
+ * PLAYER_SOURCES are not decoded so they add nothing
+ */
+#define PLAYER_STRETCH_WINDOW       20
+#define PLAYER_STRETCH_SEARCH       15
+
+/**
+ * speeds where time-stretch is muted, beyond the max the stretch would
+ * need more than max times real-time input
+ */
+#define PLAYER_STRETCH_MIN_SPEED    0.25
+#define PLAYER_STRETCH_MAX_SPEED    4.0
+
+/**
+ * range of the varispeed control, narrowed to PLAYER_STRETCH_MIN_SPEED ..
+ * PLAYER_STRETCH_MAX_SPEED while time-stretch is on
+ */
+#define VARISPEED_MIN_SPEED         0.1
+#define VARISPEED_MAX_SPEED         10.0
+
+/**
+ * max memory (MiB) for the decoded loop regions of all tracks together
+ * tracks that do not fit are looped from disk
+ */
+#define LOOP_CACHE_BUDGET           512
+
+/**
+ * seconds decoded before loop start and after loop stop
+ * so seeking around the loop points stays in memory
+ */
+#define LOOP_CACHE_PREROLL          1.0
+
+/**
+ * max number of threads decoding loop regions
+ */
+#define LOOP_CACHE_THREADS          2
+
+/**
+ * max offset (seconds) between a track and the reference when aligning
+ */
+#define ALIGN_MAX_OFFSET            30.0
+
+/**
+ * length (seconds) of the full rate window used to refine the alignment
+ */
+#define ALIGN_WINDOW                2.0
+
 /**
  * Convert double to duration string
  *
@@ -0,0 +1,115 @@
+/**
+ * @author      Arno Lievens (arnolievens@gmail.com)
+ * @date        14/10/2026
+ * @file        decoder.h
+ * @brief       libav audio decoder
+ * @copyright   Copyright (c) 2021 Arno Lievens
+ */
+
+#ifndef DECODER_H
+#define DECODER_H
+
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+#include <libswresample/swresample.h>
+#include <stdint.h>
+
+#include "fingerprint.h"
+
+/**
+ * Decoder
+ *
+ * opens an audio file once and provides the container metadata, stream
+ * info and interleaved float PCM frames of the best audio stream
+ */
+typedef struct Decoder {
+    AVFormatContext* format;    /**< demuxer, metadata is in format->metadata */
+    AVIOContext* io;            /**< buffered input of the file (bufio) */
+    AVCodecContext* codec;      /**< decoder of the audio stream */
+    SwrContext* swr;            /**< converts decoded frames to packed float */
+    AVPacket* packet;           /**< packet read from the demuxer */
+    AVFrame* frame;             /**< frame received from the decoder */
+    int stream;                 /**< index of the decoded audio stream */
+    unsigned int channels;      /**< number of channels */
+    unsigned int sample_rate;   /**< sample rate in Hz */
+    int64_t frames;             /**< estimated number of frames, 0 = unknown */
+    float* buffer;              /**< converted frames not yet read */
+    size_t buffer_size;         /**< capacity of buffer in frames */
+    size_t buffer_len;          /**< number of frames in buffer */
+    size_t buffer_pos;          /**< number of frames already read */
+    int eof;                    /**< demuxer reached end of file */
+    int64_t seek_to;            /**< frames before this one are dropped, -1 */
+    int error;                  /**< seek could not be completed exactly */
+    Fingerprint* fingerprint;   /**< hashes the bytes read or NULL */
+} Decoder;
+
+/**
+ * Constructor
+ *
+ * open file, read the stream info and open the decoder of the best audio
+ * stream
+ *
+ * @param path the file to be decoded
+ * @return the newly created decoder or NULL when failed
+ */
+extern Decoder* decoder_open(const char* path);
+
+/**
+ * Constructor
+ *
+ * same as decoder_open, the blocks read from the file are hashed into
+ * fingerprint on the way
+ *
+ * @param path the file to be decoded
+ * @param fingerprint the fingerprint of the content or NULL, not owned
+ * @return the newly created decoder or NULL when failed
+ */
+extern Decoder* decoder_open_hashed(const char* path, Fingerprint* fingerprint);
+
+/**
+ * Constructor
+ *
+ * open file and read the container metadata and stream info only
+ * the stream info is searched (max DECODER_PROBESIZE bytes) only when the
+ * header does not have the sample rate, channels or duration
+ * no decoder is opened, the result can not be read or seeked
+ *
+ * @param path the file to be probed
+ * @return the newly created decoder or NULL when failed
+ */
+extern Decoder* decoder_probe(const char* path);
+
+/**
+ * Read interleaved frames
+ *
+ * dest must be large enough to hold frames * channels floats
+ * less than frames are only returned at the end of the file
+ *
+ * @param this the decoder object
+ * @param dest destination of the decoded samples
+ * @param frames the number of frames to be read
+ * @return number of frames read, 0 at end of file or on error
+ */
+extern size_t decoder_read(Decoder* this, float* dest, size_t frames);
+
+/**
+ * Seek to an exact frame
+ *
+ * the demuxer seeks to the nearest point before frame, decoded frames
+ * up to the requested one are dropped based on their timestamps
+ * the next read starts exactly at frame
+ *
+ * @param this the decoder object
+ * @param frame index of the frame to seek to
+ * @return 0 on success, a negative AVERROR when the file can not be seeked
+ */
+extern int decoder_seek(Decoder* this, int64_t frame);
+
+/**
+ * Free all resources
+ *
+ * @param this the decoder object
+ */
+extern void decoder_close(Decoder* this);
+
+#endif
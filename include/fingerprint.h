@@ -0,0 +1,115 @@
+/**
+ * @author      Arno Lievens (arnolievens@gmail.com)
+ * @date        14/10/2026
+ * @file        fingerprint.h
+ * @brief       content hash of audio files
+ * @copyright   Copyright (c) 2021 Arno Lievens
+ */
+
+#ifndef FINGERPRINT_H
+#define FINGERPRINT_H
+
+#include <gio/gio.h>
+#include <glib.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Number of hex digits of a fingerprint (SHA1)
+ */
+#define FINGERPRINT_LEN 40
+
+/**
+ * Number of bytes of the digest of a block (SHA1)
+ */
+#define FINGERPRINT_DIGEST 20
+
+/**
+ * Hash of the entire content of a file, built from its blocks
+ *
+ * the blocks of FINGERPRINT_BLOCK bytes are hashed on their own, in any
+ * order and by any number of readers (eg. the segments of an analysis),
+ * the content hash is the hash of the size and the digests of all blocks
+ */
+typedef struct Fingerprint {
+    GMutex lock;                /**< guards all fields */
+    int64_t size;               /**< size of the file, -1 = not known yet */
+    size_t n_blocks;            /**< number of blocks of size */
+    guint8* digests;            /**< FINGERPRINT_DIGEST bytes per block */
+    guint8* hashed;             /**< the digest of a block is set */
+    size_t missing;             /**< number of blocks not hashed yet */
+    int failed;                 /**< the size changed or allocation failed */
+} Fingerprint;
+
+/**
+ * Hash the size, head and tail of a file
+ *
+ * the size and the first and last FINGERPRINT_BLOCK bytes are hashed, small
+ * files are hashed entirely
+ * copies, renamed files and symlinks of the same file get the same
+ * fingerprint, files that differ in their tags (usually stored in the head)
+ * do not
+ * files re-rendered to the same length with the same head and tail (eg
+ * silence and fades) do as well, so a match only finds candidates that
+ * must be confirmed with fingerprint_content
+ *
+ * @param path the file
+ * @return FINGERPRINT_LEN hex digits, free with free, NULL when failed
+ */
+extern char* fingerprint_file(const char* path);
+
+/**
+ * Hash the entire content of a file
+ *
+ * the file is read once, in blocks of FINGERPRINT_BLOCK bytes
+ * only needed when the file is not read otherwise, a file that is decoded
+ * is hashed on the way with a Fingerprint
+ * the cancellable is checked for each block
+ *
+ * @param path the file
+ * @param cancellable aborts the hash or NULL
+ * @return FINGERPRINT_LEN hex digits, free with free, NULL when failed or
+ * cancelled
+ */
+extern char* fingerprint_content(const char* path, GCancellable* cancellable);
+
+/**
+ * Constructor
+ *
+ * @return the newly created Fingerprint or NULL when failed
+ */
+extern Fingerprint* fingerprint_new(void);
+
+/**
+ * Hash the blocks of a file in data
+ *
+ * thread safe, blocks that are hashed already are skipped
+ * offset must be a multiple of FINGERPRINT_BLOCK, only whole blocks (or
+ * the last one of the file) are hashed
+ *
+ * @param this the fingerprint object
+ * @param size size of the file
+ * @param offset position of data in the file
+ * @param data the bytes read
+ * @param len number of bytes
+ */
+extern void fingerprint_add(Fingerprint* this, int64_t size, int64_t offset,
+        const unsigned char* data, size_t len);
+
+/**
+ * Get the content hash once every block is hashed
+ *
+ * @param this the fingerprint object
+ * @return FINGERPRINT_LEN hex digits, free with free, NULL when blocks are
+ * missing or failed
+ */
+extern char* fingerprint_finish(Fingerprint* this);
+
+/**
+ * Free all resources
+ *
+ * @param this the fingerprint object or NULL
+ */
+extern void fingerprint_free(Fingerprint* this);
+
+#endif
@@ -0,0 +1,186 @@
+/**
+ * @author      Arno Lievens (arnolievens@gmail.com)
+ * @date        14/10/2026
+ * @file        loader.h
+ * @brief       bounded scheduler for loading tracks from files
+ * @copyright   Copyright (c) 2021 Arno Lievens
+ */
+
+#ifndef LOADER_H
+#define LOADER_H
+
+#include <gtk/gtk.h>
+
+#include "track.h"
+
+/**
+ * Kind of result
+ */
+typedef enum LoaderEvent {
+    LOADER_TRACK_ADDED,         /**< tags and stream info of a file are known */
+    LOADER_TRACK_CHANGED,       /**< analysis results or offset of a track changed */
+} LoaderEvent;
+
+/**
+ * A loaded file or analysis progress
+ */
+typedef struct LoaderResult {
+    LoaderEvent event;          /**< kind of result */
+    Track* track;               /**< the track */
+    gpointer data;              /**< the data passed to loader_push (ADDED) */
+} LoaderResult;
+
+/**
+ * Called on the main thread with a batch of results
+ *
+ * a track is ADDED as soon as its header is read (or found in the cache)
+ * and CHANGED while it's being analyzed, check its state to see whether the
+ * analysis finished
+ * the loader releases its references to the tracks and destroys the data of
+ * each result when the callback returns, use track_ref to keep a track
+ *
+ * @param results the loaded tracks in the order they finished
+ * @param n number of results (max LOADER_BATCH)
+ * @param user_data the user_data passed to loader_new
+ */
+typedef void (*LoaderCallback)(LoaderResult* results, guint n,
+        gpointer user_data);
+
+/**
+ * Loader object
+ *
+ * files are handled in two stages, each with its own bounded thread pool
+ *  - io: file info, mimetype check, cache lookup or header probe
+ *    (LOADER_IO_THREADS)
+ *  - decode: decoding and r128 analysis, alignment (LOADER_DECODE_THREADS)
+ *    the true peak of an analyzed track is measured in a second pass which
+ *    only starts when no analysis or alignment is waiting
+ * cache hits never reach the decode stage, so they are not stuck behind
+ * files that are being analyzed
+ * directories are enumerated asynchronously on the main context, the audio
+ * files are queued batch by batch as they are discovered
+ *
+ * finished files are queued and handed to the callback on the main thread
+ * in batches, one batch per frame of the clock widget (or per idle when no
+ * clock is set) so large imports do not starve the gui
+ *
+ * decode jobs of a track share a GCancellable and a priority, removed rows
+ * are cancelled and the rows the user looks at are analyzed first
+ *
+ * the loader is reference counted, every pending file holds a reference
+ * so jobs that finish after loader_free can still clean up safely
+ */
+typedef struct Loader {
+    GThreadPool* io;            /**< pool probing files */
+    GThreadPool* decode;        /**< pool analyzing files */
+    LoaderCallback callback;    /**< result handler, called on main thread */
+    gpointer user_data;         /**< closure for callback */
+    GAsyncQueue* results;       /**< finished jobs waiting for the main thread */
+    gint scheduled;             /**< a drain is pending on the main thread */
+    GtkWidget* clock;           /**< widget whose frame clock paces draining */
+    guint tick;                 /**< tick callback id on clock, 0 = none */
+    gint ref;                   /**< reference count (atomic) */
+    gint closed;                /**< set by loader_free, results dropped */
+    GHashTable* tasks;          /**< LoaderTask of each track with decode jobs */
+    GHashTable* shares;         /**< LoaderShare of each fingerprint being analyzed */
+    GCancellable* cancellable;  /**< cancels the enumerations, by loader_free */
+    GMutex lock;                /**< guards tasks, shares, closed and decode for pushing */
+} Loader;
+
+/**
+ * Constructor
+ *
+ * @param callback called on the main thread with each batch of loaded tracks
+ * @param user_data closure for callback
+ * @return the newly created loader or NULL when failed to create threadpools
+ */
+extern Loader* loader_new(LoaderCallback callback, gpointer user_data);
+
+/**
+ * Pace delivery of results to the frame clock of widget
+ *
+ * the widget must be mapped for its tick callback to run, results are
+ * delivered from idle callbacks until that is the case
+ *
+ * @param this the loader object
+ * @param widget the widget or NULL to use idle callbacks only
+ */
+extern void loader_set_clock(Loader* this, GtkWidget* widget);
+
+/**
+ * Load file or directory asynchronously
+ *
+ * the file is owned by the loader and unreffed when finished
+ * data is passed to the callback with the ADDED result and destroyed on the
+ * main thread using destroy afterwards (also when loading failed)
+ * a directory is searched recursively, every audio file found gets its own
+ * copy of data made with copy on the main thread (NULL when copy is NULL),
+ * other files are skipped
+ * a directory found in visited is skipped and the directories enumerated
+ * are added, pushes sharing visited list a directory once
+ *
+ * @param this the loader object
+ * @param file the file or directory to be loaded
+ * @param visited ID_FILE of the directories enumerated (main thread) or NULL
+ * @param data closure for callback
+ * @param copy function to copy data for the files of a directory or NULL
+ * @param destroy function to free data or NULL
+ */
+extern void loader_push(Loader* this, GFile* file, GHashTable* visited,
+        gpointer data, GBoxedCopyFunc copy, GDestroyNotify destroy);
+
+/**
+ * Estimate the offset of a track asynchronously
+ *
+ * runs on the decode pool, track->offset is set and a CHANGED result is
+ * delivered when done
+ *
+ * @param this the loader object
+ * @param reference the track to align to, must be analyzed
+ * @param track the track to be aligned, must be analyzed
+ */
+extern void loader_align(Loader* this, Track* reference, Track* track);
+
+/**
+ * Abort the decode jobs of a track
+ *
+ * queued jobs are dropped, a running analysis stops within a TIME_WINDOW
+ * and the track fails, nothing happens when the track has no jobs
+ *
+ * @param this the loader object
+ * @param track the track
+ */
+extern void loader_cancel(Loader* this, Track* track);
+
+/**
+ * Set the priority of the decode jobs of a track
+ *
+ * jobs with a lower value are started first (eg G_PRIORITY_HIGH), new jobs
+ * get G_PRIORITY_DEFAULT, true peak jobs always come after all others
+ * the queue is only reordered by loader_sort so several priorities can be
+ * changed in one go
+ *
+ * @param this the loader object
+ * @param track the track
+ * @param priority the priority
+ */
+extern void loader_set_priority(Loader* this, Track* track, gint priority);
+
+/**
+ * Reorder the queued decode jobs after their priorities changed
+ *
+ * @param this the loader object
+ */
+extern void loader_sort(Loader* this);
+
+/**
+ * Free all resources
+ *
+ * pending files are dropped, running analyses are cancelled and their
+ * results discarded
+ *
+ * @param this the loader object
+ */
+extern void loader_free(Loader* this);
+
+#endif
@@ -0,0 +1,126 @@
+/**
+ * @author      Arno Lievens (arnolievens@gmail.com)
+ * @date        14/10/2026
+ * @file        loopcache.h
+ * @brief       decoded pcm of the loop region of each track
+ * @copyright   Copyright (c) 2021 Arno Lievens
+ */
+
+#ifndef LOOPCACHE_H
+#define LOOPCACHE_H
+
+#include <glib.h>
+#include <mpv/client.h>
+
+#include "track.h"
+
+/**
+ * Protocol under which the decoded regions are offered to mpv
+ */
+#define LOOP_CACHE_PROTOCOL "alphabet-loop"
+
+/**
+ * Called on the main thread when the region of a track is decoded
+ *
+ * @param track the track
+ * @param data closure passed to loop_cache_new
+ */
+typedef void (*LoopCacheReady)(Track* track, void* data);
+
+/**
+ * Loop cache object
+ *
+ * while a loop is set, the loop region of each requested track (plus
+ * LOOP_CACHE_PREROLL on both sides, shifted by the offset of the track)
+ * is decoded once into memory, max LOOP_CACHE_BUDGET MiB for all tracks
+ * together
+ *
+ * the regions are offered to mpv as float wav streams so looping and
+ * switching never touch the disk or the decoder of the original file
+ *
+ * the cache is reference counted, decode jobs and open mpv streams hold a
+ * reference so they can finish safely after loop_cache_free
+ */
+typedef struct LoopCache {
+    GThreadPool* pool;          /**< pool decoding regions */
+    GMutex lock;                /**< guards buffers, ids, used */
+    GHashTable* buffers;        /**< Track* -> LoopBuffer* of the region */
+    GHashTable* ids;            /**< stream id -> LoopBuffer* of the region */
+    guint next_id;              /**< id of the next buffer */
+    guint generation;           /**< incremented on each region change */
+    double start;               /**< first second of the region, incl preroll */
+    double stop;                /**< last second of the region, incl preroll */
+    size_t used;                /**< bytes of decoded pcm */
+    LoopCacheReady ready;       /**< ready handler, called on main thread */
+    void* ready_data;           /**< closure for ready */
+    gint ref;                   /**< reference count (atomic) */
+    gint closed;                /**< set by loop_cache_free (atomic) */
+} LoopCache;
+
+/**
+ * Constructor
+ *
+ * @param ready called when the region of a track is decoded
+ * @param data closure for ready
+ * @return the newly created cache or NULL when failed
+ */
+extern LoopCache* loop_cache_new(LoopCacheReady ready, void* data);
+
+/**
+ * Offer the decoded regions to mpv
+ *
+ * must be called before mpv_initialize
+ *
+ * @param this the loop cache object
+ * @param mpv the mpv handle
+ * @return 0 on success or a negative mpv error
+ */
+extern int loop_cache_register(LoopCache* this, mpv_handle* mpv);
+
+/**
+ * Set the loop region
+ *
+ * all regions decoded so far are dropped when the region changes, open
+ * streams keep playing the old region until they are closed
+ *
+ * @param this the loop cache object
+ * @param start loop start in seconds
+ * @param stop loop stop in seconds, or <= start to clear the region
+ */
+extern void loop_cache_set_region(LoopCache* this, double start, double stop);
+
+/**
+ * Decode the region of a track in the background
+ *
+ * does nothing when no region is set or the track was already requested
+ *
+ * @param this the loop cache object
+ * @param track the track to be decoded, a reference is taken
+ */
+extern void loop_cache_request(LoopCache* this, Track* track);
+
+/**
+ * Get the stream of a decoded region
+ *
+ * @param this the loop cache object
+ * @param track the track
+ * @param position the position (seconds) that should be playable
+ * @param url destination of the url that mpv can open
+ * @param n size of url
+ * @param origin destination of the position the stream starts at
+ * @return 1 when the region is decoded and contains position, 0 otherwise
+ */
+extern int loop_cache_lookup(LoopCache* this, Track* track, double position,
+        char* url, size_t n, double* origin);
+
+/**
+ * Free all resources
+ *
+ * pending regions are dropped, a region being decoded is finished in the
+ * background and discarded
+ *
+ * @param this the loop cache object
+ */
+extern void loop_cache_free(LoopCache* this);
+
+#endif
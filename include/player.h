@@ -9,6 +9,7 @@
 #ifndef PLAYER_H
 #define PLAYER_H
 
+#include "../include/loopcache.h"
 #include "../include/track.h"
 
 #include <mpv/client.h>
@@ -19,6 +20,44 @@ typedef enum PlayState {
     PLAY_STATE_PAUSE,
 } PlayState;
 
+/**
+ * State that changed since the ui last looked at the player
+ */
+typedef enum PlayerDirty {
+    PLAYER_DIRTY_POSITION   = 1 << 0, /**< time-pos changed */
+    PLAYER_DIRTY_STATE      = 1 << 1, /**< play, pause or stop */
+    PLAYER_DIRTY_TRACK      = 1 << 2, /**< another track or its length */
+    PLAYER_DIRTY_LOOP       = 1 << 3, /**< loop start or stop */
+    PLAYER_DIRTY_MARKER     = 1 << 4, /**< marker set or cleared */
+} PlayerDirty;
+
+/**
+ * Playback clock
+ *
+ * the last position reported by mpv and when it was reported
+ * written by the event handler, read by player_get_position from any
+ * thread without blocking: seq is odd while a write is in progress and
+ * readers retry when it changed while they copied the fields
+ */
+typedef struct PlayerClock {
+    gint seq;                   /**< sequence counter (atomic) */
+    double position;            /**< position in seconds at time */
+    gint64 time;                /**< monotonic time of position (us) */
+    double speed;               /**< playback speed */
+    int playing;                /**< position advances with time */
+} PlayerClock;
+
+/**
+ * A track kept open in mpv as an audio track of the loaded file
+ */
+typedef struct PlayerSource {
+    Track* track;               /**< the track (referenced) */
+    int64_t aid;                /**< mpv audio track id, -1 = not available */
+    int added;                  /**< audio-add was sent for the loaded file */
+    char* url;                  /**< what was added, path or loop cache url */
+    double origin;              /**< position of the stream's start */
+} PlayerSource;
+
 typedef struct Player {
     mpv_handle* mpv;
     Track* current;
@@ -29,13 +68,56 @@ typedef struct Player {
     PlayState play_state;
     int rtn;
     double speed;
+    int stretch;                /**< the pitch is kept when the speed changes */
     double min_lufs;
+    double volume;              /**< mpv volume of the current track */
+    guint dirty;
+    void (*event_callback)(void*);
+    PlayerClock clock;
+    GArray* sources;            /**< PlayerSource of each known track */
+    Track* primary;             /**< the track passed to loadfile (referenced) */
+    int loaded;                 /**< primary is loaded, sources can be added */
+    LoopCache* loop_cache;      /**< decoded loop regions */
+    int looping;                /**< the loaded file is a loop region */
+    double origin;              /**< position of the loaded file's start */
+    gint64 restart_since;       /**< last switch waiting for playback-restart (stats) */
+    gint64 reconfig_since;      /**< last switch waiting for audio-reconfig (stats) */
+    double gain;                /**< replaygain preamp in dB */
+    GThread* init_thread;       /**< runs mpv_initialize, NULL once joined */
+    guint init_source;          /**< idle finishing the initialization or 0 */
+    gint64 init_since;          /**< start of player_init (stats) */
+    int ready;                  /**< mpv is initialized, commands are sent */
+    int queued_open;            /**< current is opened once ready */
+    int queued_pause;           /**< pause set once ready, -1 = unchanged */
 } Player;
 
 extern void player_set_gain(Player* this, double gain);
 
+/**
+ * Set the playback speed
+ *
+ * speeds outside VARISPEED_MIN_SPEED .. VARISPEED_MAX_SPEED are ignored,
+ * with time-stretch on the speed is clamped to PLAYER_STRETCH_MIN_SPEED ..
+ * PLAYER_STRETCH_MAX_SPEED
+ *
+ * @param this the player object
+ * @param speed the speed, 1.0 = normal
+ */
 extern void player_set_speed(Player* this, double speed);
 
+/**
+ * Keep the pitch when the speed changes (time-stretch) or not (varispeed)
+ *
+ * the stretch filter is inserted in or removed from the audio chain,
+ * changing the speed afterwards does not touch the chain, the stretch is
+ * muted at speeds outside PLAYER_STRETCH_MIN_SPEED .. PLAYER_STRETCH_MAX_SPEED
+ * so the speed is clamped to that range while the stretch is on
+ *
+ * @param this the player object
+ * @param stretch TRUE for time-stretch
+ */
+extern void player_set_stretch(Player* this, int stretch);
+
 extern void player_stop(Player* this);
 
 extern void player_pause(Player* this);
@@ -50,16 +132,103 @@ extern void player_mark(Player* this);
 
 extern void player_goto(Player* this, double position);
 
+/**
+ * Get the current playback position
+ *
+ * extrapolated from the last position reported by mpv, never waits for
+ * the mpv core
+ *
+ * @param this the player object
+ * @return the position in seconds
+ */
 extern double player_get_position(Player* this);
 
+/**
+ * Play track
+ *
+ * positions are translated with the offsets of both tracks so the same
+ * moment of the music keeps playing
+ * when track is known to the player and the loaded file has it open as an
+ * audio track, only the audio track and volume are switched, otherwise the
+ * file is (re)loaded
+ *
+ * @param this the player object
+ * @param track the track to play
+ */
 extern void player_load_track(Player* this, Track* track);
 
-extern int player_event_handler(Player* this);
+/**
+ * Keep track open for instant switching
+ *
+ * the track is added as an external audio track to the loaded file (and
+ * every file loaded later on), max PLAYER_SOURCES tracks are kept open
+ *
+ * @param this the player object
+ * @param track the track, a reference is taken
+ */
+extern void player_add_track(Player* this, Track* track);
+
+/**
+ * Close track that was added with player_add_track
+ *
+ * @param this the player object
+ * @param track the track, its reference is released
+ */
+extern void player_remove_track(Player* this, Track* track);
+
+/**
+ * Set the loudness all tracks are matched to
+ *
+ * the volume of the current track is updated right away, without reloading
+ *
+ * @param this the player object
+ * @param min_lufs lowest loudness of the tracks
+ */
+extern void player_set_min_lufs(Player* this, double min_lufs);
+
+/**
+ * Handle all pending mpv events
+ *
+ * must be called on the main thread after the event callback fired
+ * the queue is drained completely so one call per frame is enough
+ *
+ * @param this the player object
+ * @return the PlayerDirty flags set since the last call, cleared on return
+ */
+extern guint player_event_handler(Player* this);
 
+/**
+ * Set the event callback
+ *
+ * called from the mpv thread when events are available and from the main
+ * thread when its state is changed by the ui, it must only schedule a call
+ * to player_event_handler
+ *
+ * @param this the player object
+ * @param event_callback the callback, passed this
+ */
 extern void player_set_event_callback(Player* this, void(*event_callback)(void*));
 
+/**
+ * Constructor
+ *
+ * mpv is initialized on a thread of its own so the window does not wait for
+ * it, until then the commands only change the state of the player: the last
+ * track loaded is opened, and played or paused, once mpv is ready
+ *
+ * @return the newly created Player or NULL when failed
+ */
 extern Player* player_init(void);
 
+/**
+ * Wait until mpv is initialized and the queued commands are sent
+ *
+ * this happens on its own in the main loop, for callers without one
+ *
+ * @param this the player object
+ */
+extern void player_wait(Player* this);
+
 extern void player_free(Player* this);
 
 #endif
@@ -0,0 +1,150 @@
+/**
+ * @author      Arno Lievens (arnolievens@gmail.com)
+ * @date        14/10/2026
+ * @file        r128.h
+ * @brief       built-in EBU R128 loudness and peak meter
+ * @copyright   Copyright (c) 2021 Arno Lievens
+ */
+
+#ifndef R128_H
+#define R128_H
+
+#include <ebur128.h>
+#include <glib.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Channels filtered at once, one lane of a vector each
+ */
+#define R128_LANES 4
+
+/**
+ * Taps of the true peak interpolation filter (same as libebur128)
+ */
+#define R128_TAPS 49
+
+/**
+ * Max oversampling factor of the true peak meter
+ */
+#define R128_FACTOR 4
+
+/**
+ * Vector of R128_LANES doubles, compiled to SSE2/AVX2/AVX-512 or NEON
+ */
+typedef double R128Vec __attribute__((vector_size(R128_LANES * sizeof(double))));
+
+/**
+ * What is measured, the gated loudness is only measured with R128_MODE_I
+ */
+typedef enum R128Mode {
+    R128_MODE_I = 1 << 0,           /**< integrated and window loudness */
+    R128_MODE_SAMPLE_PEAK = 1 << 1, /**< sample peak */
+    R128_MODE_TRUE_PEAK = 1 << 2,   /**< true peak (4x oversampled) */
+} R128Mode;
+
+/**
+ * Loudness meter
+ *
+ * measures like libebur128 (same filters, gating blocks, window and true
+ * peak interpolator) with the channels of each frame filtered side by side
+ * in vectors, the kernels are compiled for several instruction sets and
+ * selected at runtime
+ *
+ * with R128_VALIDATE the same frames are fed to libebur128 and every result
+ * is cross-checked, without R128_BUILTIN libebur128 measures on its own
+ */
+typedef struct R128 {
+    unsigned int channels;      /**< channels of the frames */
+    unsigned int sample_rate;   /**< sample rate in Hz */
+    int mode;                   /**< R128Mode flags */
+    size_t groups;              /**< vectors per frame, channels / R128_LANES */
+    R128Vec b[5];               /**< K-weighting filter numerator */
+    R128Vec a[5];               /**< K-weighting filter denominator */
+    R128Vec* weight;            /**< channel weights, 0 for unused lanes */
+    R128Vec* v;                 /**< filter state, 4 vectors per group */
+    R128Vec* peak;              /**< sample peak of each lane */
+    size_t step;                /**< frames per 100ms gating step */
+    size_t step_frames;         /**< frames of the current step */
+    double step_energy;         /**< energy of the current step */
+    double steps[4];            /**< energy of the last 4 steps (one block) */
+    size_t steps_done;          /**< number of finished steps */
+    double* energy;             /**< weighted energy of the last frames */
+    size_t energy_len;          /**< frames in energy (at least 400ms) */
+    size_t energy_pos;          /**< index of the next frame in energy */
+    GArray* blocks;             /**< energy of the blocks above -70 LUFS */
+    unsigned int factor;        /**< true peak oversampling, 0 = none */
+    unsigned int delay;         /**< frames in the interpolator history */
+    R128Vec coeff[R128_FACTOR][R128_TAPS]; /**< interpolator taps of each phase */
+    unsigned int index[R128_FACTOR][R128_TAPS]; /**< history of each tap */
+    unsigned int taps[R128_FACTOR]; /**< non-zero taps of each phase */
+    R128Vec* z;                 /**< interpolator history, delay per group */
+    unsigned int zi;            /**< index of the next frame in z */
+    R128Vec* true_peak;         /**< interpolated peak of each lane */
+    ebur128_state* reference;   /**< libebur128 state or NULL */
+} R128;
+
+/**
+ * Constructor
+ *
+ * @param channels channels of the frames
+ * @param sample_rate sample rate in Hz
+ * @param mode R128Mode flags
+ * @return the newly created meter or NULL when failed
+ */
+extern R128* r128_new(unsigned int channels, unsigned int sample_rate, int mode);
+
+/**
+ * Measure interleaved frames
+ *
+ * @param this the meter
+ * @param src frames * channels samples
+ * @param frames number of frames
+ */
+extern void r128_add_frames(R128* this, const float* src, size_t frames);
+
+/**
+ * Loudness of the last frames
+ *
+ * @param this the meter
+ * @param window length of the window in ms, max 400
+ * @return loudness in LUFS, -inf for silence, NAN when window is too long
+ */
+extern double r128_loudness_window(R128* this, unsigned long window);
+
+/**
+ * Gated (integrated) loudness of all frames so far
+ *
+ * @param this the meter
+ * @return loudness in LUFS, -inf when no block passed the gates
+ */
+extern double r128_loudness_global(R128* this);
+
+/**
+ * Gated loudness of several meters, as if they measured one file
+ *
+ * @param meters the meters
+ * @param n number of meters
+ * @return loudness in LUFS, -inf when no block passed the gates
+ */
+extern double r128_loudness_global_multiple(R128** meters, size_t n);
+
+/**
+ * Highest peak of all channels
+ *
+ * the true peak is never lower than the sample peak
+ *
+ * @param this the meter
+ * @param true_peak TRUE for the true peak, FALSE for the sample peak
+ * @return the peak level (1.0 = full scale)
+ */
+extern double r128_peak(R128* this, gboolean true_peak);
+
+/**
+ * Free all resources
+ *
+ * @param this the meter or NULL
+ */
+extern void r128_free(R128* this);
+
+#endif
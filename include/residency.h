@@ -0,0 +1,102 @@
+/**
+ * @author      Arno Lievens (arnolievens@gmail.com)
+ * @date        14/10/2026
+ * @file        residency.h
+ * @brief       memory budget for the waveforms of listed tracks
+ * @copyright   Copyright (c) 2021 Arno Lievens
+ */
+
+#ifndef RESIDENCY_H
+#define RESIDENCY_H
+
+#include <glib.h>
+#include <stddef.h>
+
+#include "track.h"
+
+/**
+ * Tells whether a track must keep its waveform regardless of the budget
+ *
+ * @param track the track
+ * @param data closure passed to residency_new
+ * @return TRUE when the waveform must not be evicted
+ */
+typedef gboolean (*ResidencyPinned)(Track* track, void* data);
+
+/**
+ * Waveform residency
+ *
+ * keeps the tracks in least recently used order, when the waveforms of all
+ * tracks exceed the budget the least recently used ones are evicted
+ * lufs, peaks and length stay in memory, an evicted waveform is loaded from
+ * the analysis cache when its track is used again
+ * the tracks are not referenced, they must be removed before they are freed
+ */
+typedef struct Residency {
+    GQueue lru;                 /**< tracks, most recently used first */
+    GHashTable* links;          /**< Track* -> its link in lru */
+    size_t budget;              /**< max bytes of resident waveforms */
+    ResidencyPinned pinned;     /**< tracks that are never evicted or NULL */
+    void* pinned_data;          /**< closure for pinned */
+} Residency;
+
+/**
+ * Constructor
+ *
+ * @param budget max bytes of resident waveforms
+ * @param pinned tracks that are never evicted or NULL
+ * @param data closure for pinned
+ * @return the newly created Residency or NULL when failed
+ */
+extern Residency* residency_new(size_t budget, ResidencyPinned pinned,
+        void* data);
+
+/**
+ * Start tracking a track as the most recently used one
+ *
+ * does nothing when the track is tracked already
+ *
+ * @param this the residency object
+ * @param track the track
+ */
+extern void residency_add(Residency* this, Track* track);
+
+/**
+ * Mark a track as the most recently used one and load its waveform
+ *
+ * the cache entry is read on the calling thread, it is only a few KiB
+ *
+ * @param this the residency object
+ * @param track the track, added when not tracked yet
+ * @return 0 on success, -1 when the waveform could not be loaded
+ */
+extern int residency_touch(Residency* this, Track* track);
+
+/**
+ * Stop tracking a track
+ *
+ * @param this the residency object
+ * @param track the track
+ */
+extern void residency_remove(Residency* this, Track* track);
+
+/**
+ * Evict the least recently used waveforms until the budget is met
+ *
+ * pinned tracks are counted but never evicted
+ *
+ * @param this the residency object
+ * @return the number of bytes freed
+ */
+extern size_t residency_trim(Residency* this);
+
+/**
+ * Free all resources
+ *
+ * the tracks themselves are not freed
+ *
+ * @param this the residency object or NULL
+ */
+extern void residency_free(Residency* this);
+
+#endif
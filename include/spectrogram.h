@@ -0,0 +1,144 @@
+/**
+ * @author      Arno Lievens (arnolievens@gmail.com)
+ * @date        14/10/2026
+ * @file        spectrogram.h
+ * @brief       tiled spectrogram computed in the background
+ * @copyright   Copyright (c) 2021 Arno Lievens
+ */
+
+#ifndef SPECTROGRAM_H
+#define SPECTROGRAM_H
+
+#include <glib.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "track.h"
+
+/**
+ * Points of the fft, the channels are mixed to mono first
+ */
+#define SPECTROGRAM_FFT 512
+
+/**
+ * Rows of a column, linear in frequency from 0 to the nyquist frequency
+ */
+#define SPECTROGRAM_BINS (SPECTROGRAM_FFT / 2)
+
+/**
+ * Columns of a tile
+ */
+#define SPECTROGRAM_TILE 256
+
+/**
+ * Columns of level 0 per second of audio, at most SPECTROGRAM_COLUMNS
+ */
+#define SPECTROGRAM_COLUMNS_PER_SECOND 50
+
+/**
+ * Number of levels, a column of level k covers 2^k columns of level 0
+ * SPECTROGRAM_TILE must be a multiple of 2^(SPECTROGRAM_LEVELS - 1)
+ */
+#define SPECTROGRAM_LEVELS 6
+
+/**
+ * Called on the main thread when tiles were finished
+ *
+ * @param data closure passed to spectrogram_new
+ */
+typedef void (*SpectrogramReady)(void* data);
+
+/**
+ * A block of SPECTROGRAM_TILE columns
+ *
+ * the data is only read after done is set, each byte is the level of a
+ * bin where 0 is SPECTROGRAM_RANGE dB below full scale and 255 is full scale
+ */
+typedef struct SpectrogramTile {
+    uint8_t* data;              /**< SPECTROGRAM_BINS rows, highest frequency first */
+    size_t columns;             /**< number of columns, the last tile may be short */
+    gint done;                  /**< all columns are computed (atomic) */
+} SpectrogramTile;
+
+/**
+ * A zoom level
+ */
+typedef struct SpectrogramLevel {
+    SpectrogramTile* tiles;     /**< the tiles, in order of time */
+    size_t n_tiles;             /**< number of tiles */
+    size_t columns;             /**< number of columns */
+} SpectrogramLevel;
+
+/**
+ * Spectrogram
+ *
+ * the file of the track is decoded again on a thread of its own, each bin
+ * of a column of level 0 is the highest level of the fft frames starting
+ * within the column, the columns of the other levels hold the highest of
+ * the 2 columns below so short events stay visible when zoomed out
+ * the number of columns is limited to SPECTROGRAM_COLUMNS so the memory
+ * does not depend on the length or sample rate of the file
+ */
+typedef struct Spectrogram {
+    Track* track;               /**< reference to the track */
+    size_t columns;             /**< number of columns of level 0 */
+    SpectrogramLevel levels[SPECTROGRAM_LEVELS]; /**< the zoom levels */
+    gint tiles_done;            /**< number of finished tiles (atomic) */
+    SpectrogramReady ready;     /**< tiles finished handler or NULL */
+    void* ready_data;           /**< closure for ready */
+    gint scheduled;             /**< a ready call is pending (atomic) */
+    gint cancelled;             /**< the thread must stop (atomic) */
+    gint ref;                   /**< reference count (atomic) */
+} Spectrogram;
+
+/**
+ * Constructor
+ *
+ * starts computing right away, the tiles are finished in order of time
+ *
+ * @param track an analyzed track
+ * @param ready called (coalesced) on the main thread when tiles are finished
+ * @param data closure for ready
+ * @return the newly created Spectrogram or NULL when failed
+ */
+extern Spectrogram* spectrogram_new(Track* track, SpectrogramReady ready,
+        void* data);
+
+/**
+ * Choose the level to draw at a width
+ *
+ * @param this the spectrogram object
+ * @param width width in pixels
+ * @return the coarsest level with at least width columns, or level 0
+ */
+extern int spectrogram_level(Spectrogram* this, size_t width);
+
+/**
+ * Get a finished tile
+ *
+ * @param this the spectrogram object
+ * @param level the level
+ * @param index index of the tile
+ * @return the tile or NULL when not finished yet
+ */
+extern SpectrogramTile* spectrogram_tile(Spectrogram* this, int level,
+        size_t index);
+
+/**
+ * Check whether all tiles are finished
+ *
+ * @param this the spectrogram object
+ * @return TRUE when the tiles of every level are finished
+ */
+extern gboolean spectrogram_finished(Spectrogram* this);
+
+/**
+ * Stop computing and release the spectrogram
+ *
+ * ready is no longer called
+ *
+ * @param this the spectrogram object or NULL
+ */
+extern void spectrogram_free(Spectrogram* this);
+
+#endif
@@ -0,0 +1,89 @@
+/**
+ * @author      Arno Lievens (arnolievens@gmail.com)
+ * @date        14/10/2026
+ * @file        stats.h
+ * @brief       timing probes on the hot paths
+ * @copyright   Copyright (c) 2021 Arno Lievens
+ */
+
+#ifndef STATS_H
+#define STATS_H
+
+#include <glib.h>
+#include <stdio.h>
+
+/**
+ * Environment variable enabling the probes, any non-empty value
+ */
+#define STATS_ENV "ALPHABET_STATS"
+
+/**
+ * Environment variable with the mpv log level to capture (eg "v", "debug")
+ */
+#define STATS_MPV_LOG_ENV "ALPHABET_MPV_LOG"
+
+/**
+ * Number of histogram buckets, bucket k counts durations below 2^k us
+ */
+#define STATS_BUCKETS 32
+
+/**
+ * Timed points
+ */
+typedef enum StatsProbe {
+    STATS_FILE_OPEN,            /**< decoder_open, header and stream info */
+    STATS_TAGS,                 /**< reading the tags of a file */
+    STATS_R128,                 /**< loudness and waveform analysis */
+    STATS_IO_WAIT,              /**< a file waiting for the io pool */
+    STATS_DECODE_WAIT,          /**< a file waiting for the decode pool */
+    STATS_LIST_INSERT,          /**< inserting a row in the tracklist */
+    STATS_LOAD_TRACK,           /**< issuing the commands of a track switch */
+    STATS_RESTART,              /**< track switch to mpv playback-restart */
+    STATS_AUDIO_RECONFIG,       /**< track switch to mpv audio-reconfig */
+    STATS_MPV_INIT,             /**< mpv_initialize on the init thread */
+    STATS_PLAYER_READY,         /**< player_init to queued commands sent */
+    STATS_STARTUP_WINDOW,       /**< process start to first paint of the window */
+    STATS_PROBES,
+} StatsProbe;
+
+/**
+ * Enable the probes when STATS_ENV is set
+ *
+ * must be called before any thread is started
+ *
+ * @return 1 when enabled, 0 otherwise
+ */
+extern int stats_init(void);
+
+/**
+ * Start timing
+ *
+ * @return the start time, 0 when disabled
+ */
+extern gint64 stats_begin(void);
+
+/**
+ * Stop timing and add the duration to the histogram of probe
+ *
+ * thread safe, does nothing when start is 0
+ *
+ * @param probe the probe
+ * @param start the value returned by stats_begin
+ */
+extern void stats_end(StatsProbe probe, gint64 start);
+
+/**
+ * Seconds since stats_init, for timestamping log messages
+ *
+ * @return the time in seconds
+ */
+extern double stats_time(void);
+
+/**
+ * Print count, mean, percentiles, max and the histogram of every probe
+ *
+ * @param stream destination
+ */
+extern void stats_dump(FILE* stream);
+
+#endif
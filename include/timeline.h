@@ -12,6 +12,7 @@
 #include <gtk/gtk.h>
 
 #include "../include/player.h"
+#include "../include/spectrogram.h"
 
 typedef struct {
     GtkWidget* box;
@@ -21,6 +22,24 @@ typedef struct {
     GdkRGBA marker;
     GdkRGBA wave;
     GtkImage* image;
+    GtkWidget* darea;               /**< the drawing area */
+    cairo_surface_t* surface;       /**< cached rendering of the waveform */
+    Track* wave_track;              /**< track rendered in surface */
+    gint wave_w;                    /**< width of surface */
+    gint wave_h;                    /**< height of surface */
+    size_t wave_len;                /**< number of points rendered */
+    gdouble wave_lufs;              /**< loudness used to render */
+    Track* drawn_track;             /**< track of the last draw */
+    gdouble drawn_loop_start;       /**< loop start of the last draw */
+    gdouble drawn_loop_stop;        /**< loop stop of the last draw */
+    gdouble drawn_marker;           /**< marker of the last draw */
+    gdouble drawn_x;                /**< playhead of the last draw, -1 = none */
+    gboolean spectrogram_shown;     /**< the spectrogram lane is shown */
+    Spectrogram* spectrogram;       /**< spectrogram of the current track or NULL */
+    GQueue recent;                  /**< finished spectrograms, most recent first */
+    cairo_surface_t** tiles;        /**< uploaded tiles of tiles_level or NULL */
+    size_t n_tiles;                 /**< number of tiles */
+    gint tiles_level;               /**< level of tiles, -1 = none */
 } Timeline;
 
 /**
@@ -41,6 +60,16 @@ extern Timeline* timeline_new(Player* player);
 */
 extern void timeline_update(Timeline* this);
 
+/**
+ * Show or hide the spectrogram lane
+ *
+ * the spectrogram of the current track is computed in the background while
+ * the lane is shown, tiles are drawn as they are finished
+ *
+ * @param this the timeline object
+ */
+extern void timeline_toggle_spectrogram(Timeline* this);
+
 /**
  * Free all resources
  *
@@ -9,7 +9,11 @@
 #ifndef TRACK_H
 #define TRACK_H
 
+#include <gio/gio.h>
+#include <stdint.h>
+
 #include "config.h"
+#include "waveform.h"
 
 /**
  * Waveform loudness scanning time window
@@ -19,6 +23,52 @@
  */
 #define TIME_WINDOW 200UL
 
+/**
+ * Minimum length of an analysis segment
+ * long files are split in segments that are analyzed in parallel (max one per
+ * core), files shorter than two segments are analyzed serially
+ * the helper threads of all files share one budget of one per core
+ * in seconds
+ */
+#define TRACK_SEGMENT_LENGTH 120
+
+/**
+ * Number of waveform points between progress updates while analyzing
+ * the partial loudness is recalculated on each update
+ */
+#define TRACK_PROGRESS_INTERVAL 25
+
+/**
+ * Waveform points are stored as loudness in centi-LU (1/100 LU)
+ * silence is clamped to TRACK_LEVEL_MIN
+ */
+#define TRACK_LEVEL_SCALE 100.0
+#define TRACK_LEVEL_MIN INT16_MIN
+#define TRACK_LEVEL_MAX INT16_MAX
+
+/**
+ * Analysis state of a track
+ */
+typedef enum TrackState {
+    TRACK_STATE_PENDING,    /**< only tags and stream info are known */
+    TRACK_STATE_ANALYZING,  /**< lufs, peak and waveform are partial */
+    TRACK_STATE_READY,      /**< analysis finished, true_peak may follow */
+    TRACK_STATE_FAILED,     /**< analysis failed, results are incomplete */
+} TrackState;
+
+struct Track;
+
+/**
+ * Called from the analyzing thread when new results are available
+ *
+ * calls are coalesced: after a call no new call is made until the dirty
+ * flag of the track is cleared
+ *
+ * @param track the track being analyzed
+ * @param data closure passed to track_analyze
+ */
+typedef void (*TrackProgress)(struct Track* track, void* data);
+
 /**
  * Track
  *
@@ -28,16 +78,29 @@ typedef struct Track {
     char* name;             /**< file basename or TITLE/NAME tag */
     char* path;             /**< file absolute path */
     double length;          /**< estimated length (samplerate * samples */
-    int offset;             /**< TODO: auto*align */
+    double offset;          /**< start of the content relative to the reference (s) */
     double lufs;            /**< averge loudness level as calculated by r128 */
-    double peak;            /**< true peak level */
+    double peak;            /**< sample peak level */
+    double true_peak;       /**< true peak level, NAN until measured */
     char* artist;           /**< ARTIST tag if present or NULL */
     char* album;            /**< ALBUM tag if present or NULL */
     char* date;             /**< DATE tag if present or NULL */
     char* format;           /**< TODO: audio file format eg flac, mp3, wav */
     char* sample_rate;      /**< sample rate eg 44100 96000 */
-    double* waveform;       /**< */
-    size_t waveform_len;    /**< */
+    char* fingerprint;      /**< hash of size, head and tail of the file or NULL */
+    char* content;          /**< hash of the whole file or NULL, see track_content */
+    int16_t* waveform;      /**< loudness per TIME_WINDOW (centi-LU) */
+    size_t waveform_len;    /**< number of waveform points */
+    size_t waveform_size;   /**< allocated number of waveform points */
+    Waveform lod;           /**< min/max pyramid of waveform for drawing */
+    gboolean evicted;       /**< waveform and lod were freed, still in the cache */
+    GMutex lock;            /**< guards waveform, lod, evicted, length, lufs, peaks, offset */
+    gint state;             /**< TrackState (atomic) */
+    gint dirty;             /**< progress was reported (atomic) */
+    gint ref;               /**< reference count (atomic) */
+    TrackProgress progress; /**< progress handler while analyzing */
+    void* progress_data;    /**< closure for progress */
+    GCancellable* cancellable; /**< aborts the analysis while analyzing or NULL */
 } Track;
 
 /**
@@ -52,6 +115,181 @@ typedef struct Track {
  */
 extern Track* track_new(const char* name, const char* path);
 
+/**
+ * Constructor
+ *
+ * create new track from the analysis cache only
+ * the file itself is not opened
+ *
+ * @param path absolute path of the file
+ * @param name displayed name of the file
+ * @return the newly created Track or NULL when not in the cache
+ */
+extern Track* track_new_from_cache(const char* name, const char* path);
+
+/**
+ * Constructor
+ *
+ * create new track by decoding and analyzing the file, ignoring the cache
+ * the results are stored in the cache afterwards
+ *
+ * @param path absolute path of the file
+ * @param name displayed name of the file
+ * @return the newly created Track or NULL when failed
+ */
+extern Track* track_scan(const char* name, const char* path);
+
+/**
+ * Constructor
+ *
+ * create new track with tags and stream info only (TRACK_STATE_PENDING)
+ * length is estimated from the header, call track_analyze for the rest
+ * the fingerprint of the file is calculated as well
+ *
+ * @param path absolute path of the file
+ * @param name displayed name of the file
+ * @return the newly created Track or NULL when the file can not be decoded
+ */
+extern Track* track_probe(const char* name, const char* path);
+
+/**
+ * Fill a probed track with the cache entry of an identical file
+ *
+ * the entry is found through the fingerprint, a renamed or copied file
+ * is not analyzed again, the whole file is hashed to confirm it is one
+ * so this takes as long as reading the file
+ * the results are taken over like track_share does, the track may be
+ * listed already, the entry is stored under the path of track too
+ *
+ * @param this a track created by track_probe
+ * @param cancellable aborts the hash or NULL
+ * @return 0 on success (TRACK_STATE_READY), -1 when not in the cache
+ */
+extern int track_restore(Track* this, GCancellable* cancellable);
+
+/**
+ * Hash of the whole file
+ *
+ * the analysis hashes the file while decoding it, otherwise (eg. for a
+ * copy of a file that is in the cache) the first call reads the entire file
+ * thread safe, the string stays valid as long as the track
+ *
+ * @param this the track object
+ * @param cancellable aborts reading the file or NULL
+ * @return FINGERPRINT_LEN hex digits or NULL when the file can not be read
+ */
+extern const char* track_content(Track* this, GCancellable* cancellable);
+
+/**
+ * Take the analysis results of a track with identical audio
+ *
+ * lufs, peaks and length are copied, the waveform is not: it's loaded from
+ * the cache entry of source (through the fingerprint) when it is needed
+ * the state of source is taken over, a missing true peak stays missing
+ *
+ * @param this the track object
+ * @param source an analyzed track with the same content
+ */
+extern void track_share(Track* this, Track* source);
+
+/**
+ * Calculate loudness, sample peak and waveform
+ *
+ * the results are published while analyzing
+ * waveform_len grows, lufs and peak are updated every TRACK_PROGRESS_INTERVAL
+ * points, read them with the lock held
+ * progress is called from the analyzing thread(s), a final call is made
+ * when the state changed to READY or FAILED
+ * the results are stored in the cache afterwards
+ * a cancelled analysis stops within a TIME_WINDOW and fails
+ *
+ * @param this a track created by track_probe
+ * @param cancellable aborts the analysis or NULL
+ * @param progress progress handler or NULL
+ * @param data closure for progress
+ * @return 0 on success, -1 when the track could not be analyzed
+ */
+extern int track_analyze(Track* this, GCancellable* cancellable,
+        TrackProgress progress, void* data);
+
+/**
+ * Measure the true peak level
+ *
+ * the 4x oversampling of the true peak meter is the most expensive part of
+ * the analysis so it has a pass of its own, run after track_analyze
+ * sets true_peak and updates the cache, true_peak stays NAN when failed or
+ * cancelled
+ *
+ * @param this an analyzed track
+ * @param cancellable aborts the measurement or NULL
+ * @return 0 on success, -1 when failed
+ */
+extern int track_set_true_peak(Track* this, GCancellable* cancellable);
+
+/**
+ * Get the analysis state
+ *
+ * @param this the track object
+ * @return the TrackState
+ */
+extern TrackState track_get_state(Track* this);
+
+/**
+ * Acquire a reference
+ *
+ * @param this the track object
+ * @return the track object
+ */
+extern Track* track_ref(Track* this);
+
+/**
+ * Free the waveform of an analyzed track
+ *
+ * lufs, peaks and length are kept, the waveform can be loaded from the
+ * cache again with track_waveform_load
+ * only READY tracks are evicted, others are still being (re)analyzed or
+ * have no cache entry to load from
+ *
+ * @param this the track object
+ * @return the number of bytes freed
+ */
+extern size_t track_waveform_evict(Track* this);
+
+/**
+ * Load an evicted waveform from the cache
+ *
+ * does nothing when the waveform is resident, the file is read without
+ * the lock held
+ *
+ * @param this the track object
+ * @return 0 on success, -1 when the cache entry is gone or invalid
+ */
+extern int track_waveform_load(Track* this);
+
+/**
+ * Get the memory used by the waveform and its pyramid
+ *
+ * @param this the track object
+ * @return size in bytes, 0 when evicted
+ */
+extern size_t track_waveform_bytes(Track* this);
+
+/**
+ * Convert loudness to a waveform point
+ *
+ * @param lufs loudness in LUFS, -inf for silence
+ * @return the loudness in centi-LU, clamped to the int16 range
+ */
+extern int16_t track_level_encode(double lufs);
+
+/**
+ * Convert a waveform point to loudness
+ *
+ * @param level the loudness in centi-LU
+ * @return the loudness in LUFS
+ */
+extern double track_level_decode(int16_t level);
+
 /**
  * Print all track properties
  *
@@ -59,7 +297,9 @@ extern Track* track_new(const char* name, const char* path);
  */
 extern void track_print(Track* this);
 /**
- * Free all resources
+ * Release a reference
+ *
+ * all resources are freed when the last reference is released
  *
  * @param this the track object
  */
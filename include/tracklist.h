@@ -11,18 +11,21 @@
 
 #include <gtk/gtk.h>
 
+#include "loader.h"
 #include "player.h"
+#include "residency.h"
+#include "trackmodel.h"
 
 /**
  * Columns of the treeview widget
  */
 typedef enum TracklistColumn{
-    TRACKLIST_COLUMN_NAME,
-    TRACKLIST_COLUMN_LUFS,
-    TRACKLIST_COLUMN_PEAK,
-    TRACKLIST_COLUMN_DURATION,
-    TRACKLIST_COLUMN_DATA,
-    TRACKLIST_COLUMNS
+    TRACKLIST_COLUMN_NAME = TRACK_MODEL_COLUMN_NAME,
+    TRACKLIST_COLUMN_LUFS = TRACK_MODEL_COLUMN_LUFS,
+    TRACKLIST_COLUMN_PEAK = TRACK_MODEL_COLUMN_PEAK,
+    TRACKLIST_COLUMN_DURATION = TRACK_MODEL_COLUMN_DURATION,
+    TRACKLIST_COLUMN_DATA = TRACK_MODEL_COLUMN_DATA,
+    TRACKLIST_COLUMNS = TRACK_MODEL_COLUMNS
 } TracklistColum;
 
 /**
@@ -43,11 +46,20 @@ typedef enum TracklistEntry {
  * storage of tracks as well as treeview widget
  */
 typedef struct {
-    GtkListStore* list;         /**< data structure of the tree */
+    TrackModel* list;           /**< data structure of the tree */
     GtkTreeView* tree;          /**< gui widget (file-manager-like) */
     Player* player;             /**< reference to the player object */
     gdouble min_lufs;           /**< min val of all track.lugfs */
-    GThreadPool* load_thread;   /**< thread pool for loading tracks */
+    GSequence* loudness;        /**< analyzed tracks ordered by lufs */
+    Loader* loader;             /**< async loading of tracks */
+    GHashTable* pending;        /**< rows of tracks being analyzed */
+    GHashTable* aligned;        /**< tracks whose offset was requested */
+    Track* reference;           /**< first analyzed track, offsets are relative to it */
+    Residency* residency;       /**< memory budget of the waveforms */
+    GtkAdjustment* vadjustment; /**< scroll position the analysis priorities follow */
+    guint priorities;           /**< idle source updating the priorities, 0 = none */
+    void (*changed)(Track*, void*); /**< called when analysis progressed */
+    void* changed_data;         /**< closure for changed */
 } Tracklist;
 
 /**
@@ -58,7 +70,7 @@ typedef struct {
  * call init to create the actual tree
  *
  * @param player reference to the player object used to playstart selected row
- * @return Tracklist newly created object or NULL when failed to load threadpool
+ * @return Tracklist newly created object or NULL when failed to create loader
  */
 extern Tracklist* tracklist_new(Player* player);
 
@@ -103,7 +115,7 @@ extern void tracklist_append_file(Tracklist* this, GFile* file);
  * all Tracks can be free-ed by tracklist_free
  * track will be inserted in the list before or after (pos) given row (path)
  * set path to NULL to append
- * file will be free-ed when async loader has finished
+ * path is copied, file will be free-ed when async loader has finished
  *
  * @param this tracklist object
  * @param file file to be added
@@ -120,18 +132,22 @@ extern void tracklist_insert_file(Tracklist* this, GFile* file, GtkTreePath* pat
 extern void tracklist_remove_selected(Tracklist* this);
 
 /**
- * Create a new track from file
+ * Set the function called when the analysis of a track progressed
  *
- * tracklist_add_file calls this function in a threadpool
- * return track free-ed by tracklist_free or track_free
+ * called on the main thread after the row of the track was updated,
+ * also for the final results
  *
- * @param file the file used to create a track
- * @return the newly created track or NULL
+ * @param this tracklist object
+ * @param changed the callback or NULL
+ * @param data closure for changed
  */
-extern Track* tracklist_file_to_track(Tracklist* this, GFile* file);
+extern void tracklist_set_changed_callback(Tracklist* this,
+        void (*changed)(Track*, void*), void* data);
 
 /**
- * Re-calculate the lowest average loudness of all tracks
+ * Set the lowest average loudness of all tracks in the player
+ *
+ * the lowest loudness is the first entry of the loudness index
  *
  * @param this the tracklist object
  */
@@ -0,0 +1,99 @@
+/**
+ * @author      Arno Lievens (arnolievens@gmail.com)
+ * @date        14/10/2026
+ * @file        trackmodel.h
+ * @brief       list model of tracks for the tracklist tree
+ * @copyright   Copyright (c) 2021 Arno Lievens
+ */
+
+#ifndef TRACK_MODEL_H
+#define TRACK_MODEL_H
+
+#include <gtk/gtk.h>
+
+#include "track.h"
+
+/**
+ * Columns of the model
+ *
+ * NAME, LUFS, PEAK and DURATION are strings, formatted when they are read
+ * DATA is the Track pointer
+ */
+typedef enum TrackModelColumn {
+    TRACK_MODEL_COLUMN_NAME,
+    TRACK_MODEL_COLUMN_LUFS,
+    TRACK_MODEL_COLUMN_PEAK,
+    TRACK_MODEL_COLUMN_DURATION,
+    TRACK_MODEL_COLUMN_DATA,
+    TRACK_MODEL_COLUMNS
+} TrackModelColumn;
+
+/**
+ * Track model
+ *
+ * GtkTreeModel and GtkTreeSortable over a contiguous array of rows
+ * each row holds the track and its sort keys: a collation key of the name
+ * and the lufs, peak and length as numbers, so sorting a column compares
+ * numbers and never touches the tracks
+ * cells are only formatted when the tree reads them, ie for visible rows
+ *
+ * the model does not own the tracks, iters are invalidated by any change
+ */
+#define TRACK_TYPE_MODEL (track_model_get_type())
+G_DECLARE_FINAL_TYPE(TrackModel, track_model, TRACK, MODEL, GObject)
+
+/**
+ * Constructor
+ *
+ * @return the newly created model, unsorted
+ */
+extern TrackModel* track_model_new(void);
+
+/**
+ * Insert a track
+ *
+ * when sorted the track is inserted at its sorted position instead
+ *
+ * @param this the model
+ * @param track the track
+ * @param position insert before this row, -1 to append
+ * @param iter set to the new row or NULL
+ */
+extern void track_model_insert(TrackModel* this, Track* track, gint position,
+        GtkTreeIter* iter);
+
+/**
+ * Remove a row
+ *
+ * @param this the model
+ * @param iter the row, set to the next row
+ * @return TRUE when iter is valid (there is a next row)
+ */
+extern gboolean track_model_remove(TrackModel* this, GtkTreeIter* iter);
+
+/**
+ * Move a row before or after another one
+ *
+ * like gtk_list_store_move_before and gtk_list_store_move_after, a NULL
+ * position moves the row to the end (before) or the start (after)
+ * only valid when the model is unsorted
+ *
+ * @param this the model
+ * @param iter the row to be moved
+ * @param position the row to move to or NULL
+ * @param after move after position instead of before
+ */
+extern void track_model_move(TrackModel* this, GtkTreeIter* iter,
+        GtkTreeIter* position, gboolean after);
+
+/**
+ * Refresh the sort keys of a row after its track changed
+ *
+ * emits row-changed and moves the row when sorted
+ *
+ * @param this the model
+ * @param iter the row
+ */
+extern void track_model_changed(TrackModel* this, GtkTreeIter* iter);
+
+#endif
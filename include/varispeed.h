@@ -15,6 +15,7 @@ typedef struct {
     Player* player;
     GtkWidget* box;
     GtkWidget* spin;
+    GtkWidget* stretch;         /**< keeps the pitch when on */
 } Varispeed;
 
 /**
@@ -0,0 +1,107 @@
+/**
+ * @author      Arno Lievens (arnolievens@gmail.com)
+ * @date        14/10/2026
+ * @file        waveform.h
+ * @brief       min/max level-of-detail pyramid of a waveform
+ * @copyright   Copyright (c) 2021 Arno Lievens
+ */
+
+#ifndef WAVEFORM_H
+#define WAVEFORM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Max number of reduced levels
+ * level k holds the min and max of blocks of 2^k waveform points
+ */
+#define WAVEFORM_LEVELS 16
+
+/**
+ * A reduced level of the pyramid
+ */
+typedef struct WaveformLevel {
+    int16_t* min;               /**< lowest point of each block */
+    int16_t* max;               /**< highest point of each block */
+    size_t len;                 /**< number of blocks */
+    size_t size;                /**< allocated number of blocks */
+} WaveformLevel;
+
+/**
+ * Waveform pyramid
+ *
+ * the points themselves are not stored, they are level 0 and passed to
+ * waveform_range by the owner
+ * the pyramid is built while points are appended, the last block of each
+ * level covers the points appended so far so a growing waveform can be
+ * queried at any time
+ */
+typedef struct Waveform {
+    WaveformLevel levels[WAVEFORM_LEVELS]; /**< levels 1 .. WAVEFORM_LEVELS */
+    size_t len;                 /**< number of points appended */
+} Waveform;
+
+/**
+ * Initialize an empty pyramid
+ *
+ * @param this the waveform object
+ */
+extern void waveform_init(Waveform* this);
+
+/**
+ * Append a point
+ *
+ * updates one block per level
+ *
+ * @param this the waveform object
+ * @param point the new point
+ * @return 0 on success, -1 when failed to allocate
+ */
+extern int waveform_push(Waveform* this, int16_t point);
+
+/**
+ * Append many points
+ *
+ * @param this the waveform object
+ * @param points the new points
+ * @param len number of points
+ * @return 0 on success, -1 when failed to allocate
+ */
+extern int waveform_append(Waveform* this, const int16_t* points, size_t len);
+
+/**
+ * Get the lowest and highest point in a range
+ *
+ * the range is covered by the largest blocks that fit, so the cost is
+ * logarithmic in the length of the range
+ *
+ * @param this the waveform object
+ * @param points the points the pyramid was built from (level 0)
+ * @param from first point of the range
+ * @param to point after the last one of the range, clipped to len
+ * @param min destination of the lowest point
+ * @param max destination of the highest point
+ * @return 0 on success, -1 when the range is empty
+ */
+extern int waveform_range(Waveform* this, const int16_t* points, size_t from,
+        size_t to, int16_t* min, int16_t* max);
+
+/**
+ * Remove all points and free the levels
+ *
+ * the pyramid can be used again afterwards
+ *
+ * @param this the waveform object
+ */
+extern void waveform_clear(Waveform* this);
+
+/**
+ * Get the memory allocated for the levels
+ *
+ * @param this the waveform object
+ * @return size in bytes
+ */
+extern size_t waveform_bytes(Waveform* this);
+
+#endif
@@ -0,0 +1,300 @@
+/**
+ * @author      Arno Lievens (arnolievens@gmail.com)
+ * @date        14/10/2026
+ * @file        align.c
+ * @brief       estimate the time offset between two tracks
+ * @copyright   Copyright (c) 2021 Arno Lievens
+ */
+
+#include <glib.h>
+#include <libavutil/mem.h>
+#include <libavutil/tx.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../include/config.h"
+#include "../include/decoder.h"
+#include "../include/track.h"
+
+#include "../include/align.h"
+
+/**
+ * Cross-correlate two signals
+ *
+ * finds the lag for which b[n + lag] matches a[n] best, within
+ * [min_lag, max_lag]
+ *
+ * @param a first signal
+ * @param a_len number of samples in a
+ * @param b second signal
+ * @param b_len number of samples in b
+ * @param min_lag lowest lag to consider (may be negative)
+ * @param max_lag highest lag to consider
+ * @param lag destination of the best lag
+ * @return 0 on success, -1 when failed
+ */
+static int align_correlate(const float* a, size_t a_len, const float* b,
+        size_t b_len, ptrdiff_t min_lag, ptrdiff_t max_lag, ptrdiff_t* lag);
+
+/**
+ * Get the loudness envelope of a track
+ *
+ * the waveform points converted to power with the mean removed, so
+ * silence and loud passages weigh in as they sound
+ *
+ * @param track the track
+ * @param len destination of the number of points
+ * @return the envelope (free with free) or NULL when failed
+ */
+static float* align_envelope(Track* track, size_t* len);
+
+/**
+ * Decode a mono window of a track
+ *
+ * all channels are summed
+ *
+ * @param path the file
+ * @param start first second of the window
+ * @param length length of the window in seconds
+ * @param sample_rate destination of the sample rate
+ * @param len destination of the number of samples
+ * @return the samples (free with free) or NULL when failed
+ */
+static float* align_read(const char* path, double start, double length,
+        unsigned int* sample_rate, size_t* len);
+
+
+/*******************************************************************************
+ * extern functions
+ */
+
+
+int align_track(Track* reference, Track* track, double* offset)
+{
+    float* a = NULL, * b = NULL;
+    size_t a_len, b_len, onset = 0;
+    unsigned int a_rate, b_rate;
+    ptrdiff_t lag, range;
+    double point = TIME_WINDOW / 1000.0;
+    double coarse, margin, a_start, b_start;
+    int16_t rise = INT16_MIN;
+    int status = -1;
+
+    if (    track_get_state(reference) != TRACK_STATE_READY
+            || track_get_state(track) != TRACK_STATE_READY)
+    {
+        return -1;
+    }
+
+    /* coarse: envelopes, one point per TIME_WINDOW */
+
+    if (!(a = align_envelope(reference, &a_len))) goto done;
+    if (!(b = align_envelope(track, &b_len))) goto done;
+
+    range = (ptrdiff_t)(ALIGN_MAX_OFFSET / point);
+    if (align_correlate(a, a_len, b, b_len, -range, range, &lag) < 0) goto done;
+    coarse = (double)lag * point;
+    *offset = coarse;
+    status = 0;
+
+    /* the strongest rise in loudness of the reference is the sharpest
+     * feature to line up at full rate
+     */
+
+    g_mutex_lock(&reference->lock);
+    for (size_t i = 1; i < reference->waveform_len; i++) {
+        int16_t d = (int16_t)CLAMP(reference->waveform[i] - reference->waveform[i-1],
+                INT16_MIN, INT16_MAX);
+        if (d > rise) {
+            rise = d;
+            onset = i;
+        }
+    }
+    g_mutex_unlock(&reference->lock);
+
+    free(a);
+    free(b);
+    a = b = NULL;
+
+    /* fine: the window of track is wider by one point on both sides */
+
+    margin = point;
+    a_start = MAX((double)onset * point - ALIGN_WINDOW / 2, 0.0);
+    b_start = MAX(a_start + coarse - margin, 0.0);
+
+    if (!(a = align_read(reference->path, a_start, ALIGN_WINDOW, &a_rate, &a_len))) goto done;
+    if (!(b = align_read(track->path, b_start, ALIGN_WINDOW + 2 * margin, &b_rate, &b_len))) goto done;
+    if (a_rate != b_rate) goto done;
+
+    /* offset = b_start - a_start + lag / rate, kept within coarse +- margin */
+
+    if (align_correlate(a, a_len, b, b_len,
+            (ptrdiff_t)((coarse - margin - (b_start - a_start)) * a_rate),
+            (ptrdiff_t)((coarse + margin - (b_start - a_start)) * a_rate),
+            &lag) < 0)
+    {
+        goto done;
+    }
+    *offset = b_start - a_start + (double)lag / a_rate;
+
+done:
+    free(a);
+    free(b);
+    return status;
+}
+
+
+/*******************************************************************************
+ * static functions
+ *
+ */
+
+
+int align_correlate(const float* a, size_t a_len, const float* b,
+size_t b_len, ptrdiff_t min_lag, ptrdiff_t max_lag, ptrdiff_t* lag)
+{
+    AVTXContext* fwd = NULL, * inv = NULL;
+    av_tx_fn fwd_fn, inv_fn;
+    AVComplexFloat* in = NULL, * fa = NULL, * fb = NULL;
+    float scale = 1.0f, best = -INFINITY;
+    size_t n = 1;
+    int status = -1;
+
+    if (!a_len || !b_len || min_lag > max_lag) return -1;
+
+    /* zero padded to a power of two of at least a_len + b_len so the
+     * circular correlation does not wrap onto itself
+     * lag k >= 0 lands at index k, lag -k at index n - k
+     */
+
+    while (n < a_len + b_len) n <<= 1;
+    if (n > INT32_MAX) return -1;
+
+    min_lag = MAX(min_lag, -(ptrdiff_t)a_len + 1);
+    max_lag = MIN(max_lag, (ptrdiff_t)b_len - 1);
+    if (min_lag > max_lag) return -1;
+
+    in = av_malloc(n * sizeof(AVComplexFloat));
+    fa = av_malloc(n * sizeof(AVComplexFloat));
+    fb = av_malloc(n * sizeof(AVComplexFloat));
+    if (!in || !fa || !fb) {
+        fprintf(stderr, "failed to allocate alignment buffers\n");
+        goto done;
+    }
+
+    if (    av_tx_init(&fwd, &fwd_fn, AV_TX_FLOAT_FFT, 0, (int)n, &scale, 0) < 0
+            || av_tx_init(&inv, &inv_fn, AV_TX_FLOAT_FFT, 1, (int)n, &scale, 0) < 0)
+    {
+        fprintf(stderr, "failed to create fft of size %zu\n", n);
+        goto done;
+    }
+
+    memset(in, 0, n * sizeof(AVComplexFloat));
+    for (size_t i = 0; i < a_len; i++) in[i].re = a[i];
+    fwd_fn(fwd, fa, in, sizeof(AVComplexFloat));
+
+    memset(in, 0, n * sizeof(AVComplexFloat));
+    for (size_t i = 0; i < b_len; i++) in[i].re = b[i];
+    fwd_fn(fwd, fb, in, sizeof(AVComplexFloat));
+
+    /* conj(A) * B */
+
+    for (size_t i = 0; i < n; i++) {
+        float re = fa[i].re * fb[i].re + fa[i].im * fb[i].im;
+        float im = fa[i].re * fb[i].im - fa[i].im * fb[i].re;
+        fa[i].re = re;
+        fa[i].im = im;
+    }
+    inv_fn(inv, in, fa, sizeof(AVComplexFloat));
+
+    for (ptrdiff_t k = min_lag; k <= max_lag; k++) {
+        size_t i = k < 0 ? n - (size_t)(-k) : (size_t)k;
+        if (in[i].re > best) {
+            best = in[i].re;
+            *lag = k;
+        }
+    }
+    status = 0;
+
+done:
+    av_tx_uninit(&fwd);
+    av_tx_uninit(&inv);
+    av_free(in);
+    av_free(fa);
+    av_free(fb);
+    return status;
+}
+
+float* align_envelope(Track* track, size_t* len)
+{
+    float* envelope;
+    double mean = 0.0;
+
+    /* the waveform may have been evicted while the job was queued */
+    if (track_waveform_load(track) < 0) return NULL;
+
+    g_mutex_lock(&track->lock);
+
+    if (!track->waveform_len || !(envelope = malloc(track->waveform_len * sizeof(float)))) {
+        g_mutex_unlock(&track->lock);
+        return NULL;
+    }
+
+    *len = track->waveform_len;
+    for (size_t i = 0; i < *len; i++) {
+        envelope[i] = (float)pow(10.0, track_level_decode(track->waveform[i]) / 10.0);
+        mean += envelope[i];
+    }
+
+    g_mutex_unlock(&track->lock);
+
+    mean /= (double)*len;
+    for (size_t i = 0; i < *len; i++) envelope[i] -= (float)mean;
+
+    return envelope;
+}
+
+float* align_read(const char* path, double start, double length,
+unsigned int* sample_rate, size_t* len)
+{
+    Decoder* decoder;
+    float* frames = NULL, * mono = NULL;
+    size_t n;
+
+    if (!(decoder = decoder_open(path))) return NULL;
+
+    n = (size_t)(length * decoder->sample_rate);
+
+    if (start > 0.0 && decoder_seek(decoder, (int64_t)(start * decoder->sample_rate)) < 0) {
+        goto done;
+    }
+
+    if (    !(frames = malloc(n * decoder->channels * sizeof(float)))
+            || !(mono = calloc(n, sizeof(float))))
+    {
+        fprintf(stderr, "failed to allocate alignment window\n");
+        goto done;
+    }
+
+    *len = decoder_read(decoder, frames, n);
+    if (decoder->error || !*len) {
+        free(mono);
+        mono = NULL;
+        goto done;
+    }
+
+    for (size_t i = 0; i < *len; i++) {
+        for (unsigned int c = 0; c < decoder->channels; c++) {
+            mono[i] += frames[i * decoder->channels + c];
+        }
+    }
+    *sample_rate = decoder->sample_rate;
+
+done:
+    free(frames);
+    decoder_close(decoder);
+    return mono;
+}
@@ -8,6 +8,7 @@
 
 #include <assert.h>
 #include <errno.h>
+#include <glib-unix.h>
 #include <gtk/gtk.h>
 #include <signal.h>
 #include <stdint.h>
@@ -20,9 +21,11 @@
 #include <gtkosxapplication.h>
 #endif
 
+#include "../include/analyze.h"
 #include "../include/config.h"
 #include "../include/counter.h"
 #include "../include/player.h"
+#include "../include/stats.h"
 #include "../include/timeline.h"
 #include "../include/track.h"
 #include "../include/tracklist.h"
@@ -37,6 +40,21 @@ Transport* transport;
 Varispeed* varispeed;
 GtkWidget* button;
 
+/**
+ * ui update scheduling
+ *
+ * the player events are handled once per frame of ui_clock, ui_wakeup is set
+ * when the player fired its event callback since the last frame
+ */
+static GtkWidget* ui_clock;
+static guint ui_tick;
+static gint ui_wakeup;
+
+/**
+ * start of the process for the startup probes, 0 when disabled
+ */
+static gint64 startup;
+
 /**
  * activate callback
  *
@@ -65,9 +83,28 @@ static void on_startup(GApplication* alphabet, gpointer data);
 
 /**
  * update the UI elements
- * no data is passed, just a trigger to update
+ *
+ * only the widgets showing state flagged in dirty are touched
+ *
+ * @param dirty PlayerDirty flags returned by the player event handler
  */
-static gboolean update_ui(gpointer data);
+static void update_ui(guint dirty);
+
+/**
+ * schedule handling of player events (main thread)
+ *
+ * installs the tick callback on ui_clock, or handles the events right away
+ * when ui_clock is not mapped (yet)
+ */
+static gboolean schedule_ui(gpointer data);
+
+/**
+ * tick callback
+ *
+ * handles the player events of one frame and removes itself when the
+ * player was quiet during the last frame
+ */
+static gboolean on_tick(GtkWidget* widget, GdkFrameClock* frame_clock, gpointer data);
 
 /**
  * player event callback
@@ -75,9 +112,39 @@ static gboolean update_ui(gpointer data);
  * connect the player callback method to the player event
  * called functions must be short and non-blocking
  * wil be called whenever player changes state (eg, play, position update, ...)
+ * may run on the mpv thread, only the first wakeup of a frame adds an idle
  */
 static void event_callback(gpointer data);
 
+/**
+ * SIGUSR1 handler
+ *
+ * dump the timing probes to stderr
+ */
+static gboolean on_sigusr1(gpointer data);
+
+/**
+ * tracklist changed callback
+ *
+ * redraw the timeline while the current track is being analyzed
+ */
+static void track_changed(Track* track, void* data);
+
+/**
+ * draw callback of the window, once
+ *
+ * times the startup up to the first paint
+ */
+static gboolean on_first_draw(GtkWidget* window, cairo_t* cr, gpointer data);
+
+/**
+ * run a file chooser and add the selected files or folders
+ *
+ * @param window parent of the dialog
+ * @param action GTK_FILE_CHOOSER_ACTION_OPEN or _SELECT_FOLDER
+ */
+static void add_from_chooser(GtkWindow* window, GtkFileChooserAction action);
+
 /**
  * open event for macos
  *
@@ -90,21 +157,35 @@ static gboolean on_open_osx(GtkosxApplication* app, char* path, gpointer data);
 
 
 void on_click_add(GtkWindow* window)
+{
+    add_from_chooser(window, GTK_FILE_CHOOSER_ACTION_OPEN);
+}
+
+void on_click_add_folder(GtkWindow* window)
+{
+    add_from_chooser(window, GTK_FILE_CHOOSER_ACTION_SELECT_FOLDER);
+}
+
+void add_from_chooser(GtkWindow* window, GtkFileChooserAction action)
 {
     GtkFileChooserNative *chsr;
-    GtkFileChooserAction action = GTK_FILE_CHOOSER_ACTION_OPEN;
 
     chsr = gtk_file_chooser_native_new(
-            "Add file", window, action, "_Add", "_Cancel");
+            action == GTK_FILE_CHOOSER_ACTION_OPEN ? "Add file" : "Add folder",
+            window, action, "_Add", "_Cancel");
 
     gtk_file_chooser_set_select_multiple(GTK_FILE_CHOOSER(chsr), TRUE);
 
     if (gtk_native_dialog_run(GTK_NATIVE_DIALOG(chsr)) == GTK_RESPONSE_ACCEPT) {
 
-        GSList* filelist = gtk_file_chooser_get_files(GTK_FILE_CHOOSER(chsr));
-        do tracklist_append_file(tracklist, filelist->data);
-        while ((filelist = filelist->next));
+        /* folders are searched recursively by the loader
+         * the files are owned by the tracklist, only the list is freed
+         */
 
+        GSList* filelist = gtk_file_chooser_get_files(GTK_FILE_CHOOSER(chsr));
+        for (GSList* item = filelist; item; item = item->next) {
+            tracklist_append_file(tracklist, item->data);
+        }
         g_slist_free(filelist);
 
     }
@@ -134,6 +215,10 @@ gboolean keypress_handler(GtkWidget *window, GdkEventKey *event)
             gtk_button_clicked(GTK_BUTTON(transport->loop));
             return TRUE;
 
+        case GDK_KEY_s:
+            timeline_toggle_spectrogram(timeline);
+            return TRUE;
+
         case GDK_KEY_space:
             gtk_button_clicked(GTK_BUTTON(transport->play));
             return TRUE;
@@ -161,24 +246,80 @@ gboolean keypress_handler(GtkWidget *window, GdkEventKey *event)
     return FALSE;
 }
 
-gboolean update_ui(UNUSED gpointer data)
+void update_ui(guint dirty)
 {
+    if (!dirty) return;
+
     timeline_update(timeline);
-    counter_update(counter);
-    transport_update(transport);
-    return FALSE;
+
+    if (dirty & PLAYER_DIRTY_POSITION) {
+        counter_update(counter);
+    }
+
+    if (dirty & (PLAYER_DIRTY_STATE | PLAYER_DIRTY_LOOP | PLAYER_DIRTY_MARKER)) {
+        transport_update(transport);
+    }
+}
+
+gboolean schedule_ui(UNUSED gpointer data)
+{
+    if (ui_tick) return G_SOURCE_REMOVE;
+
+    if (ui_clock && gtk_widget_get_mapped(ui_clock)) {
+        ui_tick = gtk_widget_add_tick_callback(ui_clock, on_tick, NULL, NULL);
+    } else {
+        g_atomic_int_set(&ui_wakeup, 0);
+        update_ui(player_event_handler(player));
+    }
+    return G_SOURCE_REMOVE;
+}
+
+gboolean on_tick(UNUSED GtkWidget* widget, UNUSED GdkFrameClock* frame_clock,
+UNUSED gpointer data)
+{
+    /* a wakeup after the flag is cleared adds an idle that finds the tick
+     * still installed, so it is handled by the next frame
+     * once removed, the next wakeup installs the tick again
+     */
+
+    if (!g_atomic_int_compare_and_exchange(&ui_wakeup, 1, 0)) {
+        ui_tick = 0;
+        return G_SOURCE_REMOVE;
+    }
+
+    update_ui(player_event_handler(player));
+    return G_SOURCE_CONTINUE;
+}
+
+void event_callback(UNUSED gpointer data)
+{
+    if (g_atomic_int_compare_and_exchange(&ui_wakeup, 0, 1)) {
+        g_idle_add(schedule_ui, NULL);
+    }
+}
+
+gboolean on_sigusr1(UNUSED gpointer data)
+{
+    stats_dump(stderr);
+    return G_SOURCE_CONTINUE;
 }
 
-void event_callback(gpointer data)
+void track_changed(Track* track, UNUSED void* data)
 {
-    g_idle_add(G_SOURCE_FUNC(player_event_handler), data);
-    g_idle_add(G_SOURCE_FUNC(update_ui), data);
+    if (track == player->current) timeline_update(timeline);
+}
+
+gboolean on_first_draw(GtkWidget* window, UNUSED cairo_t* cr, gpointer data)
+{
+    stats_end(STATS_STARTUP_WINDOW, startup);
+    g_signal_handlers_disconnect_by_func(window, on_first_draw, data);
+    return FALSE;
 }
 
 void on_activate(GtkApplication* alphabet)
 {
     GtkWidget* window, * box, * scrolled;
-    GtkWidget* bar;//, * button;
+    GtkWidget* bar, * folder;//, * button;
 
 #ifdef MAC_INTEGRATION
     GtkosxApplication* osx = g_object_new(GTKOSX_TYPE_APPLICATION, NULL);
@@ -195,6 +336,9 @@ void on_activate(GtkApplication* alphabet)
             G_CALLBACK(keypress_handler), NULL);
     g_signal_connect(window, "destroy",
             G_CALLBACK(on_destroy), alphabet);
+    if (startup) {
+        g_signal_connect(window, "draw", G_CALLBACK(on_first_draw), NULL);
+    }
 
     box = gtk_box_new(GTK_ORIENTATION_VERTICAL, 0);
     gtk_container_add(GTK_CONTAINER(window), box);
@@ -216,6 +360,12 @@ void on_activate(GtkApplication* alphabet)
     g_signal_connect_swapped(button, "clicked",
             G_CALLBACK(on_click_add), window);
 
+    folder = gtk_button_new_from_icon_name("folder-open-symbolic", ICON_SIZE);
+    gtk_action_bar_pack_start(GTK_ACTION_BAR(bar), folder);
+    gtk_widget_show_all(folder);
+    g_signal_connect_swapped(folder, "clicked",
+            G_CALLBACK(on_click_add_folder), window);
+
     counter = counter_new(player);
     gtk_action_bar_pack_start(GTK_ACTION_BAR(bar), counter->box);
 
@@ -229,9 +379,15 @@ void on_activate(GtkApplication* alphabet)
     gtk_action_bar_pack_end(GTK_ACTION_BAR(bar), transport->box_control);
     gtk_action_bar_pack_end(GTK_ACTION_BAR(bar), transport->box_movement);
 
-    /* event_callback will be called whenever player received event */
+    /* event_callback will be called whenever player received event
+     * the events are handled at the frame rate of the window
+     */
+    ui_clock = window;
     player_set_event_callback(player, event_callback);
 
+    /* partial analysis results are drawn as they come in */
+    tracklist_set_changed_callback(tracklist, track_changed, NULL);
+
 #ifdef MAC_INTEGRATION
     g_signal_connect(osx, "NSApplicationOpenFile", G_CALLBACK(on_open_osx), NULL);
     gtkosx_application_set_use_quartz_accelerators(osx, TRUE);
@@ -241,6 +397,10 @@ void on_activate(GtkApplication* alphabet)
 
 void on_startup(UNUSED GApplication* alphabet, UNUSED gpointer data)
 {
+    /* mpv is initialized in the background while the window is built, the
+     * tracks selected in the meantime are played once it is ready
+     */
+
     player = player_init();
     if (!player) exit(EXIT_FAILURE);
 
@@ -260,12 +420,12 @@ void on_open(GApplication *alphabet, GFile **files, gint n, UNUSED const char* h
     for (gint i = 0; i < n; i++) {
 
         /* files will be free-ed by tracklist when finnished (async)
-         * the files array here is apparently owned by gtk and must therefore
-         * be duplicated for consistency
+         * the files array here is owned by gtk, a reference is enough
+         * the loader probes them on its io threads while the window is built
+         * so cache hits are listed before the first paint
          */
 
-        GFile* file = g_file_dup(files[i]);
-        tracklist_append_file(tracklist, file);
+        tracklist_append_file(tracklist, g_object_ref(files[i]));
     }
 
     /* gtk does not automatically emit "activate" signal when "open" signal
@@ -286,6 +446,9 @@ gboolean on_open_osx(UNUSED GtkosxApplication* app, char* path, UNUSED gpointer
 
 gboolean on_destroy(UNUSED GtkWidget* window, UNUSED GtkApplication* alphabet)
 {
+    /* the tick callback is removed with the window */
+    ui_clock = NULL;
+    ui_tick = 0;
     tracklist_free(tracklist);
     transport_free(transport);
     timeline_free(timeline);
@@ -296,13 +459,27 @@ gboolean on_destroy(UNUSED GtkWidget* window, UNUSED GtkApplication* alphabet)
 
 int main(int argc, char *argv[])
 {
-    int status;
+    int status, stats;
     GtkApplication* alphabet;
 
     GApplicationFlags flags = G_APPLICATION_ALLOW_REPLACEMENT
                             | G_APPLICATION_REPLACE
                             | G_APPLICATION_HANDLES_OPEN;
 
+    /* the probes are enabled with ALPHABET_STATS, they are dumped on exit
+     * and on SIGUSR1
+     */
+
+    if ((stats = stats_init())) g_unix_signal_add(SIGUSR1, on_sigusr1, NULL);
+    startup = stats_begin();
+
+    /* headless mode, neither gtk nor mpv are initialized */
+    if (analyze_requested(argc, argv)) {
+        status = analyze_main(argc, argv);
+        if (stats) stats_dump(stderr);
+        return status;
+    }
+
     alphabet = gtk_application_new(ID, flags);
 
     g_signal_connect(alphabet, "startup", G_CALLBACK(on_startup), NULL);
@@ -313,5 +490,6 @@ int main(int argc, char *argv[])
 
     g_application_quit(G_APPLICATION(alphabet));
 
+    if (stats) stats_dump(stderr);
     return status;
 }
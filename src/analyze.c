@@ -0,0 +1,440 @@
+/**
+ * @author      Arno Lievens (arnolievens@gmail.com)
+ * @date        14/10/2026
+ * @file        analyze.c
+ * @brief       headless batch analysis
+ * @copyright   Copyright (c) 2021 Arno Lievens
+ */
+
+#include <gio/gio.h>
+#include <glib.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../include/config.h"
+#include "../include/track.h"
+
+#include "../include/analyze.h"
+
+/**
+ * Output format of the records
+ */
+typedef enum AnalyzeFormat {
+    ANALYZE_FORMAT_CSV,         /**< comma separated values with header */
+    ANALYZE_FORMAT_JSON,        /**< one json object per line */
+} AnalyzeFormat;
+
+/**
+ * State of a batch
+ */
+typedef struct Analyze {
+    AnalyzeFormat format;       /**< output format */
+    gboolean waveform;          /**< include the waveform in each record */
+    GThreadPool* pool;          /**< pool analyzing files */
+    GMutex lock;                /**< guards stdout */
+    gint failed;                /**< number of files that failed (atomic) */
+    GHashTable* visited;        /**< ID_FILE of the directories enumerated */
+} Analyze;
+
+/**
+ * Analyze a file and write its record
+ *
+ * pool function
+ *
+ * @param data the absolute path of the file, freed when done
+ * @param user_data the batch
+ */
+static void analyze_file(gpointer data, gpointer user_data);
+
+/**
+ * Queue a file or all audio files in a directory (recursive)
+ *
+ * @param this the batch
+ * @param file the file or directory
+ * @param recursed file was found in a directory, only audio files are queued
+ */
+static void analyze_queue(Analyze* this, GFile* file, gboolean recursed);
+
+/**
+ * Format the record of a track
+ *
+ * @param this the batch
+ * @param track the analyzed track
+ * @param record destination
+ */
+static void analyze_record(Analyze* this, Track* track, GString* record);
+
+/**
+ * Start a field
+ *
+ * adds the separator, and the key for json
+ *
+ * @param this the batch
+ * @param record destination
+ * @param key name of the field
+ */
+static void analyze_key(Analyze* this, GString* record, const char* key);
+
+/**
+ * Append a string field
+ *
+ * quoted for csv, escaped for json, NULL is written as an empty field
+ * (csv) or null (json)
+ *
+ * @param this the batch
+ * @param record destination
+ * @param str the string or NULL
+ */
+static void analyze_string(Analyze* this, GString* record, const char* str);
+
+/**
+ * Append a number field
+ *
+ * written with g_ascii_formatd so the decimal separator does not depend on
+ * the locale, infinity and nan (eg. the loudness of silence) are written as
+ * an empty field (csv) or null (json)
+ *
+ * @param this the batch
+ * @param record destination
+ * @param format printf format for a single double
+ * @param value the number
+ */
+static void analyze_number(Analyze* this, GString* record, const char* format,
+        double value);
+
+
+/*******************************************************************************
+ * extern functions
+ */
+
+
+int analyze_requested(int argc, char** argv)
+{
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--") == 0) break;
+        if (strcmp(argv[i], ANALYZE_OPTION) == 0) return 1;
+    }
+    return 0;
+}
+
+int analyze_main(int argc, char** argv)
+{
+    Analyze this = {0};
+    GOptionContext* context;
+    GError* err = NULL;
+    gboolean analyze = FALSE;
+    gchar* format = NULL;
+    gchar** paths = NULL;
+    gint jobs = 0;
+    int status = 2;
+
+    GOptionEntry entries[] = {
+        {"analyze", 0, 0, G_OPTION_ARG_NONE, &analyze,
+            "Analyze files without starting the player", NULL},
+        {"format", 'f', 0, G_OPTION_ARG_STRING, &format,
+            "Output format: csv (default) or json", "FORMAT"},
+        {"jobs", 'j', 0, G_OPTION_ARG_INT, &jobs,
+            "Number of files analyzed in parallel (default: one per core)", "N"},
+        {"waveform", 'w', 0, G_OPTION_ARG_NONE, &this.waveform,
+            "Include the loudness waveform (LU per TIME_WINDOW)", NULL},
+        {G_OPTION_REMAINING, 0, 0, G_OPTION_ARG_FILENAME_ARRAY, &paths,
+            NULL, "PATH..."},
+        {NULL, 0, 0, 0, NULL, NULL, NULL},
+    };
+
+    context = g_option_context_new("- analyze loudness of audio files");
+    g_option_context_add_main_entries(context, entries, NULL);
+
+    if (!g_option_context_parse(context, &argc, &argv, &err)) {
+        g_printerr("%s\n", err->message);
+        g_error_free(err);
+        goto done;
+    }
+
+    if (!format || g_ascii_strcasecmp(format, "csv") == 0) {
+        this.format = ANALYZE_FORMAT_CSV;
+    } else if (g_ascii_strcasecmp(format, "json") == 0) {
+        this.format = ANALYZE_FORMAT_JSON;
+    } else {
+        g_printerr("Unknown format \"%s\"\n", format);
+        goto done;
+    }
+
+    if (!paths || !paths[0]) {
+        g_printerr("No files to analyze\n");
+        goto done;
+    }
+
+    if (jobs <= 0) jobs = (gint)g_get_num_processors();
+
+    /* files are queued while the directories are still being searched, the
+     * pool starts analyzing the first file right away
+     */
+
+    g_mutex_init(&this.lock);
+    this.pool = g_thread_pool_new(analyze_file, &this, jobs, FALSE, &err);
+    if (err) {
+        g_printerr("%s\n", err->message);
+        g_error_free(err);
+        g_mutex_clear(&this.lock);
+        goto done;
+    }
+
+    if (this.format == ANALYZE_FORMAT_CSV) {
+        printf("path,name,artist,album,date,sample_rate,length,lufs,peak,true_peak,status%s\n",
+                this.waveform ? ",waveform" : "");
+        fflush(stdout);
+    }
+
+    this.visited = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    for (gchar** path = paths; *path; path++) {
+        GFile* file = g_file_new_for_commandline_arg(*path);
+        analyze_queue(&this, file, FALSE);
+        g_object_unref(file);
+    }
+    g_hash_table_destroy(this.visited);
+
+    /* wait for the queued files to finish */
+    g_thread_pool_free(this.pool, FALSE, TRUE);
+    g_mutex_clear(&this.lock);
+
+    status = g_atomic_int_get(&this.failed) ? EXIT_FAILURE : EXIT_SUCCESS;
+
+done:
+    g_option_context_free(context);
+    g_free(format);
+    g_strfreev(paths);
+    return status;
+}
+
+
+/*******************************************************************************
+ * static functions
+ *
+ */
+
+
+void analyze_file(gpointer data, gpointer user_data)
+{
+    Analyze* this = user_data;
+    char* path = data;
+    char* name = g_path_get_basename(path);
+    GString* record = g_string_new(NULL);
+    Track* track;
+
+    /* the cache is shared with the gui, files analyzed by either are
+     * not decoded again
+     */
+
+    if (!(track = track_new(name, path)) || track_get_state(track) != TRACK_STATE_READY) {
+        g_printerr("Error analyzing file \"%s\"\n", path);
+        g_atomic_int_inc(&this->failed);
+    } else if (isnan(track->true_peak)) {
+        track_set_true_peak(track, NULL);
+    }
+
+    if (track) analyze_record(this, track, record);
+
+    g_mutex_lock(&this->lock);
+    if (track) {
+        fputs(record->str, stdout);
+        fflush(stdout);
+    }
+    g_mutex_unlock(&this->lock);
+
+    track_free(track);
+    g_string_free(record, TRUE);
+    g_free(name);
+    g_free(path);
+}
+
+void analyze_queue(Analyze* this, GFile* file, gboolean recursed)
+{
+    GFileEnumerator* children;
+    GFileInfo* info;
+    GError* err = NULL;
+    const char* id;
+    char* path;
+
+    if (!(path = g_file_get_path(file))) {
+        gchar* uri = g_file_get_uri(file);
+        g_printerr("Error loading file \"%s\": Not a local file\n", uri);
+        g_atomic_int_inc(&this->failed);
+        g_free(uri);
+        return;
+    }
+
+    info = g_file_query_info(file,
+            G_FILE_ATTRIBUTE_STANDARD_TYPE ","
+            G_FILE_ATTRIBUTE_STANDARD_CONTENT_TYPE ","
+            G_FILE_ATTRIBUTE_ID_FILE,
+            G_FILE_QUERY_INFO_NONE, NULL, &err);
+    if (err) {
+        g_printerr("%s\n", err->message);
+        g_error_free(err);
+        g_atomic_int_inc(&this->failed);
+        g_free(path);
+        return;
+    }
+
+    if (g_file_info_get_file_type(info) != G_FILE_TYPE_DIRECTORY) {
+        const char* type = g_file_info_get_content_type(info);
+
+        /* files named on the command line are always analyzed so they are
+         * reported when they fail, other files in a directory are skipped
+         */
+
+        if (!recursed || (type && (g_strstr_len(type, -1, "audio")
+                        || g_strstr_len(type, -1, "org.xiph.flac"))))
+        {
+            g_thread_pool_push(this->pool, path, NULL);
+            path = NULL;
+        }
+        g_object_unref(info);
+        g_free(path);
+        return;
+    }
+    g_free(path);
+
+    /* symlinks to directories are followed, a directory reached again
+     * (eg a link to a parent) ends the recursion
+     */
+
+    id = g_file_info_get_attribute_string(info, G_FILE_ATTRIBUTE_ID_FILE);
+    if (id && !g_hash_table_add(this->visited, g_strdup(id))) {
+        g_object_unref(info);
+        return;
+    }
+    g_object_unref(info);
+
+    children = g_file_enumerate_children(file,
+            G_FILE_ATTRIBUTE_STANDARD_NAME,
+            G_FILE_QUERY_INFO_NONE, NULL, &err);
+    if (err) {
+        g_printerr("%s\n", err->message);
+        g_error_free(err);
+        g_atomic_int_inc(&this->failed);
+        return;
+    }
+
+    while ((info = g_file_enumerator_next_file(children, NULL, &err))) {
+        GFile* child = g_file_get_child(file, g_file_info_get_name(info));
+        analyze_queue(this, child, TRUE);
+        g_object_unref(child);
+        g_object_unref(info);
+    }
+    if (err) {
+        g_printerr("%s\n", err->message);
+        g_error_free(err);
+    }
+    g_object_unref(children);
+}
+
+void analyze_record(Analyze* this, Track* track, GString* record)
+{
+    const char* status = track_get_state(track) == TRACK_STATE_READY ? "ok" : "failed";
+    char num[G_ASCII_DTOSTR_BUF_SIZE];
+    int json = this->format == ANALYZE_FORMAT_JSON;
+
+    /* numbers are written with g_ascii_formatd so the decimal separator
+     * does not depend on the locale
+     */
+
+    if (json) g_string_append_c(record, '{');
+
+    analyze_key(this, record, "path");
+    analyze_string(this, record, track->path);
+    analyze_key(this, record, "name");
+    analyze_string(this, record, track->name);
+    analyze_key(this, record, "artist");
+    analyze_string(this, record, track->artist);
+    analyze_key(this, record, "album");
+    analyze_string(this, record, track->album);
+    analyze_key(this, record, "date");
+    analyze_string(this, record, track->date);
+    analyze_key(this, record, "sample_rate");
+    g_string_append(record, track->sample_rate ? track->sample_rate : "0");
+    analyze_key(this, record, "length");
+    analyze_number(this, record, "%.3f", track->length);
+    analyze_key(this, record, "lufs");
+    analyze_number(this, record, "%.2f", track->lufs);
+    analyze_key(this, record, "peak");
+    analyze_number(this, record, "%.6f", track->peak);
+    analyze_key(this, record, "true_peak");
+    analyze_number(this, record, "%.6f", track->true_peak);
+    analyze_key(this, record, "status");
+    analyze_string(this, record, status);
+
+    if (this->waveform) {
+        analyze_key(this, record, "waveform");
+        g_string_append_c(record, json ? '[' : '"');
+        for (size_t i = 0; i < track->waveform_len; i++) {
+            if (i) g_string_append_c(record, json ? ',' : ' ');
+            g_string_append(record, g_ascii_formatd(num, sizeof(num), "%.2f",
+                        track_level_decode(track->waveform[i])));
+        }
+        g_string_append_c(record, json ? ']' : '"');
+    }
+
+    if (json) g_string_append_c(record, '}');
+    g_string_append_c(record, '\n');
+}
+
+void analyze_key(Analyze* this, GString* record, const char* key)
+{
+    if (this->format == ANALYZE_FORMAT_CSV) {
+        if (record->len) g_string_append_c(record, ',');
+        return;
+    }
+    if (record->len > 1) g_string_append_c(record, ',');
+    g_string_append_printf(record, "\"%s\":", key);
+}
+
+void analyze_string(Analyze* this, GString* record, const char* str)
+{
+    if (this->format == ANALYZE_FORMAT_CSV) {
+        if (!str) return;
+        if (!strpbrk(str, ",\"\r\n")) {
+            g_string_append(record, str);
+            return;
+        }
+        g_string_append_c(record, '"');
+        for (const char* c = str; *c; c++) {
+            if (*c == '"') g_string_append_c(record, '"');
+            g_string_append_c(record, *c);
+        }
+        g_string_append_c(record, '"');
+        return;
+    }
+
+    if (!str) {
+        g_string_append(record, "null");
+        return;
+    }
+    g_string_append_c(record, '"');
+    for (const unsigned char* c = (const unsigned char*)str; *c; c++) {
+        if (*c == '"' || *c == '\\') {
+            g_string_append_c(record, '\\');
+            g_string_append_c(record, (gchar)*c);
+        } else if (*c < 0x20) {
+            g_string_append_printf(record, "\\u%04x", *c);
+        } else {
+            g_string_append_c(record, (gchar)*c);
+        }
+    }
+    g_string_append_c(record, '"');
+}
+
+void analyze_number(Analyze* this, GString* record, const char* format,
+        double value)
+{
+    char num[G_ASCII_DTOSTR_BUF_SIZE];
+
+    if (!isfinite(value)) {
+        analyze_string(this, record, NULL);
+        return;
+    }
+    g_string_append(record, g_ascii_formatd(num, sizeof(num), format, value));
+}
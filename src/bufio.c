@@ -0,0 +1,353 @@
+/**
+ * @author      Arno Lievens (arnolievens@gmail.com)
+ * @date        14/10/2026
+ * @file        bufio.c
+ * @brief       buffered file input with read ahead for libav
+ * @copyright   Copyright (c) 2021 Arno Lievens
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <libavformat/avio.h>
+#include <libavutil/error.h>
+#include <libavutil/mem.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "../include/config.h"
+
+#include "../include/bufio.h"
+
+/**
+ * Read size bytes at offset, retried until complete or end of file
+ *
+ * @param fd the file
+ * @param dest destination of size bytes
+ * @param size number of bytes to be read
+ * @param offset position in the file
+ * @return the number of bytes read or -errno when failed
+ */
+static ssize_t bufio_pread(int fd, unsigned char* dest, size_t size,
+        int64_t offset);
+
+/**
+ * Make the block at the current position the current block
+ *
+ * the block read ahead is used when it is the right one, anything else is
+ * read right away, then the block after it is requested
+ * the block starts at a multiple of the block size, pos is set to the
+ * current position within it
+ *
+ * @param this the bufio object
+ * @return 0 on success or a negative AVERROR
+ */
+static int bufio_fill(BufIO* this);
+
+/**
+ * Read ahead thread
+ *
+ * reads the requested block into next until quit is set
+ *
+ * @param data the bufio object
+ * @return NULL
+ */
+static gpointer bufio_prefetch(gpointer data);
+
+/**
+ * AVIOContext read_packet callback
+ *
+ * @param opaque the bufio object
+ * @param buf destination
+ * @param size max bytes to be read
+ * @return number of bytes read, AVERROR_EOF or a negative AVERROR
+ */
+static int bufio_read_packet(void* opaque, uint8_t* buf, int size);
+
+/**
+ * AVIOContext seek callback
+ *
+ * seeking within the current block keeps the block
+ *
+ * @param opaque the bufio object
+ * @param offset the offset
+ * @param whence SEEK_SET, SEEK_CUR, SEEK_END or AVSEEK_SIZE
+ * @return the new position, the size or a negative AVERROR
+ */
+static int64_t bufio_seek(void* opaque, int64_t offset, int whence);
+
+/**
+ * Stop the read ahead thread and free the bufio object
+ *
+ * @param this the bufio object or NULL
+ */
+static void bufio_free(BufIO* this);
+
+
+/*******************************************************************************
+ * extern functions
+ */
+
+
+AVIOContext* bufio_open(const char* path, size_t block, int prefetch,
+Fingerprint* fingerprint)
+{
+    struct stat st;
+    unsigned char* buffer = NULL;
+    AVIOContext* pb = NULL;
+    BufIO* this;
+
+    if (!(this = calloc(1, sizeof(BufIO)))) {
+        fprintf(stderr, "failed to allocate bufio\n");
+        return NULL;
+    }
+    this->fd = -1;
+    this->size = -1;
+    this->block = block;
+    this->next_start = -1;
+    if (block % FINGERPRINT_BLOCK == 0) this->fingerprint = fingerprint;
+    g_mutex_init(&this->lock);
+    g_cond_init(&this->cond);
+
+    if ((this->fd = open(path, O_RDONLY)) < 0) {
+        fprintf(stderr, "failed to open \"%s\"\n > %s\n", path, g_strerror(errno));
+        goto fail;
+    }
+
+    /* only regular files have a size and can be seeked */
+    if (fstat(this->fd, &st) == 0 && S_ISREG(st.st_mode)) {
+        this->size = (int64_t)st.st_size;
+    }
+
+#ifdef POSIX_FADV_SEQUENTIAL
+    posix_fadvise(this->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+    if (!(this->data = malloc(block))) {
+        fprintf(stderr, "failed to allocate bufio block\n");
+        goto fail;
+    }
+
+    /* without a thread the file is still read in large blocks */
+
+    if (prefetch && (this->next = malloc(block))) {
+        this->thread = g_thread_try_new("bufio", bufio_prefetch, this, NULL);
+        if (!this->thread) {
+            free(this->next);
+            this->next = NULL;
+        }
+    }
+
+    if (    !(buffer = av_malloc(BUFIO_AVIO_BUFFER))
+            || !(pb = avio_alloc_context(buffer, BUFIO_AVIO_BUFFER, 0, this,
+                    bufio_read_packet, NULL,
+                    this->size >= 0 ? bufio_seek : NULL)))
+    {
+        fprintf(stderr, "failed to allocate io context for \"%s\"\n", path);
+        goto fail;
+    }
+    return pb;
+
+fail:
+    av_free(buffer);
+    bufio_free(this);
+    return NULL;
+}
+
+void bufio_close(AVIOContext** pb)
+{
+    if (!pb || !*pb) return;
+
+    bufio_free((*pb)->opaque);
+    av_freep(&(*pb)->buffer);
+    avio_context_free(pb);
+}
+
+
+/*******************************************************************************
+ * static functions
+ *
+ */
+
+
+ssize_t bufio_pread(int fd, unsigned char* dest, size_t size, int64_t offset)
+{
+    size_t done = 0;
+
+    while (done < size) {
+        ssize_t n = pread(fd, dest + done, size - done, (off_t)offset + (off_t)done);
+
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -errno;
+        }
+        if (n == 0) break;
+        done += (size_t)n;
+    }
+    return (ssize_t)done;
+}
+
+int bufio_fill(BufIO* this)
+{
+    int64_t position = this->start + (int64_t)this->pos;
+    int64_t offset = position - position % (int64_t)this->block;
+    ssize_t len = -1;
+
+    if (this->thread) {
+        g_mutex_lock(&this->lock);
+
+        /* a block read ahead for another position (after a seek) must be
+         * finished before its buffer can be reused
+         */
+
+        while (this->busy) g_cond_wait(&this->cond, &this->lock);
+
+        if (this->next_start == offset && this->next_len >= 0) {
+            unsigned char* data = this->data;
+            this->data = this->next;
+            this->next = data;
+            len = this->next_len;
+        }
+        this->next_start = -1;
+        g_mutex_unlock(&this->lock);
+    }
+
+    /* a failed read ahead is retried here, so its error is reported */
+
+    if (len < 0 && (len = bufio_pread(this->fd, this->data, this->block, offset)) < 0) {
+        return AVERROR((int)-len);
+    }
+
+    this->start = offset;
+    this->len = (size_t)len;
+    this->pos = (size_t)(position - offset);
+
+    /* blocks read again after a seek are skipped by the fingerprint */
+    fingerprint_add(this->fingerprint, this->size, this->start, this->data, this->len);
+
+    /* a short block is the last one */
+
+    if (this->thread && this->len == this->block) {
+        g_mutex_lock(&this->lock);
+        this->next_start = offset + len;
+        this->busy = 1;
+        g_cond_broadcast(&this->cond);
+        g_mutex_unlock(&this->lock);
+    }
+    return 0;
+}
+
+gpointer bufio_prefetch(gpointer data)
+{
+    BufIO* this = data;
+
+    g_mutex_lock(&this->lock);
+
+    for (;;) {
+        int64_t offset;
+        ssize_t len;
+
+        while (!this->quit && !this->busy) g_cond_wait(&this->cond, &this->lock);
+        if (this->quit) break;
+
+        offset = this->next_start;
+        g_mutex_unlock(&this->lock);
+
+        /* the kernel starts fetching the block after this one while this
+         * one is being read, so two blocks are in flight
+         */
+
+#ifdef POSIX_FADV_WILLNEED
+        posix_fadvise(this->fd, (off_t)(offset + (int64_t)this->block),
+                (off_t)this->block, POSIX_FADV_WILLNEED);
+#endif
+        len = bufio_pread(this->fd, this->next, this->block, offset);
+
+        g_mutex_lock(&this->lock);
+        this->next_len = len;
+        this->busy = 0;
+        g_cond_broadcast(&this->cond);
+    }
+
+    g_mutex_unlock(&this->lock);
+    return NULL;
+}
+
+int bufio_read_packet(void* opaque, uint8_t* buf, int size)
+{
+    int status;
+    size_t n;
+    BufIO* this = opaque;
+
+    /* past the end of the file pos is beyond the last block */
+
+    if (this->pos >= this->len) {
+        if ((status = bufio_fill(this)) < 0) return status;
+        if (this->pos >= this->len) return AVERROR_EOF;
+    }
+
+    n = MIN((size_t)size, this->len - this->pos);
+    memcpy(buf, this->data + this->pos, n);
+    this->pos += n;
+    return (int)n;
+}
+
+int64_t bufio_seek(void* opaque, int64_t offset, int whence)
+{
+    BufIO* this = opaque;
+
+    switch (whence & ~AVSEEK_FORCE) {
+        case AVSEEK_SIZE:
+            return this->size;
+
+        case SEEK_SET:
+            break;
+
+        case SEEK_CUR:
+            offset += this->start + (int64_t)this->pos;
+            break;
+
+        case SEEK_END:
+            offset += this->size;
+            break;
+
+        default:
+            return AVERROR(EINVAL);
+    }
+
+    if (offset < 0) return AVERROR(EINVAL);
+
+    /* libav seeks back and forth within the header while probing */
+
+    if (offset >= this->start && offset <= this->start + (int64_t)this->len) {
+        this->pos = (size_t)(offset - this->start);
+    } else {
+        this->start = offset;
+        this->len = 0;
+        this->pos = 0;
+    }
+    return offset;
+}
+
+void bufio_free(BufIO* this)
+{
+    if (!this) return;
+
+    if (this->thread) {
+        g_mutex_lock(&this->lock);
+        this->quit = 1;
+        g_cond_broadcast(&this->cond);
+        g_mutex_unlock(&this->lock);
+        g_thread_join(this->thread);
+    }
+
+    if (this->fd >= 0) close(this->fd);
+    free(this->data);
+    free(this->next);
+    g_mutex_clear(&this->lock);
+    g_cond_clear(&this->cond);
+    free(this);
+}
@@ -0,0 +1,479 @@
+/**
+ * @author      Arno Lievens (arnolievens@gmail.com)
+ * @date        14/10/2026
+ * @file        cache.c
+ * @brief       persistent analysis cache
+ * @copyright   Copyright (c) 2021 Arno Lievens
+ */
+
+#include <errno.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "../include/config.h"
+#include "../include/fingerprint.h"
+#include "../include/track.h"
+
+#include "../include/cache.h"
+
+/**
+ * magic bytes at the start of each cache entry
+ */
+#define CACHE_MAGIC "ALPHABET"
+
+/**
+ * Cache entry header
+ *
+ * an entry is a single file containing this header, followed by
+ * waveform_len int16 points and strings_len bytes of NUL-terminated tags
+ * (name, artist, album, date - empty string means not set)
+ * the entry of a file with a fingerprint is linked under the fingerprint
+ * as well, so identical files find it regardless of their path and mtime
+ * the fingerprint only covers head and tail, such an entry is used when
+ * the hash of the whole file matches content
+ * all fields are stored in native byte order, the cache is not portable
+ */
+typedef struct CacheHeader {
+    char magic[8];              /**< CACHE_MAGIC, not NUL-terminated */
+    uint32_t version;           /**< CACHE_VERSION */
+    uint32_t time_window;       /**< TIME_WINDOW used for the waveform */
+    int64_t size;               /**< size of the audio file in bytes */
+    int64_t mtime;              /**< modification time of the audio file */
+    char fingerprint[FINGERPRINT_LEN]; /**< of the audio file, zeros = unknown */
+    char content[FINGERPRINT_LEN]; /**< hash of the whole audio file, zeros = unknown */
+    double length;              /**< track length in seconds */
+    double lufs;                /**< integrated loudness */
+    double peak;                /**< sample peak level */
+    double true_peak;           /**< true peak level, NAN = not measured */
+    uint32_t sample_rate;       /**< sample rate in Hz */
+    uint32_t strings_len;       /**< size of the tags block in bytes */
+    uint64_t waveform_len;      /**< number of waveform points */
+} CacheHeader;
+
+/**
+ * number of tags stored in an entry
+ */
+#define CACHE_STRINGS 4
+
+/**
+ * Build the cache entry filename for a file
+ *
+ * the name is a hash of the key (path, size, mtime and analysis parameters)
+ * so renaming or touching a file automatically invalidates its entry
+ *
+ * @param path absolute path of the audio file
+ * @param st stat of the audio file
+ * @return newly allocated filename, free with g_free
+ */
+static gchar* cache_filename(const char* path, GStatBuf* st);
+
+/**
+ * Build the cache entry filename for a fingerprint
+ *
+ * @param fingerprint the fingerprint of the audio file
+ * @return newly allocated filename, free with g_free
+ */
+static gchar* cache_content_filename(const char* fingerprint);
+
+/**
+ * Map the cache entry of a track and validate its header
+ *
+ * the entry of the path is tried first, then the one of the fingerprint
+ *
+ * @param track the track, path must be set
+ * @param header destination of the header
+ * @return the mapped entry or NULL on a cache miss, unref when done
+ */
+static GMappedFile* cache_map(Track* track, CacheHeader* header);
+
+/**
+ * Map a cache entry and validate its header
+ *
+ * @param filename the cache entry
+ * @param st stat of the audio file
+ * @param fingerprint match the fingerprint, NULL = match the mtime
+ * @param content match the hash of the whole file, NULL = any known hash
+ * @param header destination of the header
+ * @return the mapped entry or NULL on a cache miss, unref when done
+ */
+static GMappedFile* cache_map_entry(const char* filename, GStatBuf* st,
+        const char* fingerprint, const char* content, CacheHeader* header);
+
+/**
+ * Copy the cached tag into dest
+ *
+ * @param dest the track property to be set
+ * @param src the string as stored in the cache
+ */
+static void cache_set_string(char** dest, const char* src);
+
+
+/*******************************************************************************
+ * extern functions
+ */
+
+
+gboolean cache_load(Track* this)
+{
+    GMappedFile* mapped;
+    const char* data;
+    const char* strings[CACHE_STRINGS];
+    CacheHeader header;
+    gsize len, offset, wave_size;
+
+    if (!this || !this->path) return FALSE;
+    if (!(mapped = cache_map(this, &header))) return FALSE;
+
+    data = g_mapped_file_get_contents(mapped);
+    len = g_mapped_file_get_length(mapped);
+    wave_size = header.waveform_len * sizeof(int16_t);
+
+    /* tags are stored as consecutive NUL-terminated strings
+     * make sure all of them are actually terminated within the entry
+     */
+
+    offset = sizeof(CacheHeader) + wave_size;
+    for (size_t i = 0; i < CACHE_STRINGS; i++) {
+        const char* end;
+        if (offset >= len) goto fail;
+        end = memchr(data + offset, '\0', len - offset);
+        if (!end) goto fail;
+        strings[i] = data + offset;
+        offset = (gsize)(end - data) + 1;
+    }
+
+    free(this->waveform);
+    if (!(this->waveform = malloc(MAX(wave_size, sizeof(int16_t))))) {
+        fprintf(stderr, "failed to allocate waveform\n");
+        this->waveform_len = 0;
+        goto fail;
+    }
+    memcpy(this->waveform, data + sizeof(CacheHeader), wave_size);
+    this->waveform_len = header.waveform_len;
+
+    this->length = header.length;
+    this->lufs = header.lufs;
+    this->peak = header.peak;
+    this->true_peak = header.true_peak;
+
+    free(this->sample_rate);
+    if ((this->sample_rate = calloc(8, sizeof(char)))) {
+        snprintf(this->sample_rate, 8, "%u", header.sample_rate);
+    }
+
+    if (*strings[0]) cache_set_string(&this->name, strings[0]);
+    cache_set_string(&this->artist, strings[1]);
+    cache_set_string(&this->album, strings[2]);
+    cache_set_string(&this->date, strings[3]);
+
+    if (!this->fingerprint && header.fingerprint[0]) {
+        this->fingerprint = strndup(header.fingerprint, FINGERPRINT_LEN);
+    }
+
+    /* the entry matched the mtime or the content, either way it is ours */
+    g_mutex_lock(&this->lock);
+    if (!this->content && header.content[0]) {
+        this->content = strndup(header.content, FINGERPRINT_LEN);
+    }
+    g_mutex_unlock(&this->lock);
+
+    g_mapped_file_unref(mapped);
+    return TRUE;
+
+fail:
+    g_mapped_file_unref(mapped);
+    return FALSE;
+}
+
+gboolean cache_load_waveform(Track* this, int16_t** waveform, size_t* len)
+{
+    GMappedFile* mapped;
+    CacheHeader header;
+    gsize wave_size;
+
+    if (!this || !this->path) return FALSE;
+    if (!(mapped = cache_map(this, &header))) return FALSE;
+
+    /* only the pages of the waveform are read, the tags are skipped */
+
+    wave_size = header.waveform_len * sizeof(int16_t);
+    if (!(*waveform = malloc(MAX(wave_size, sizeof(int16_t))))) {
+        fprintf(stderr, "failed to allocate waveform\n");
+        g_mapped_file_unref(mapped);
+        return FALSE;
+    }
+    memcpy(*waveform, g_mapped_file_get_contents(mapped) + sizeof(CacheHeader),
+            wave_size);
+    *len = header.waveform_len;
+
+    g_mapped_file_unref(mapped);
+    return TRUE;
+}
+
+void cache_save(Track* this)
+{
+    GStatBuf st;
+    GByteArray* entry;
+    GError* err = NULL;
+    gchar* filename, * content = NULL, * dir;
+    CacheHeader header = { 0 }, old;
+    const char* strings[CACHE_STRINGS];
+    const char* hash;
+    const int16_t* waveform;
+    GMappedFile* mapped = NULL;
+
+    if (!this || !this->path) return;
+    if (g_stat(this->path, &st) != 0) return;
+
+    /* the waveform may be evicted by the main thread at any time so the
+     * entry is built with the lock held
+     */
+
+    g_mutex_lock(&this->lock);
+
+    /* an evicted (or shared, never loaded) waveform is copied from the
+     * entry cache_load would find, so a late true peak or the entry of a
+     * new path is saved without loading the waveform
+     */
+
+    if (!this->waveform) {
+        g_mutex_unlock(&this->lock);
+        if (!(mapped = cache_map(this, &old))) return;
+        g_mutex_lock(&this->lock);
+    }
+
+    if (this->waveform) {
+        waveform = this->waveform;
+        header.waveform_len = this->waveform_len;
+    } else {
+        waveform = (const int16_t*)(g_mapped_file_get_contents(mapped)
+                + sizeof(CacheHeader));
+        header.waveform_len = old.waveform_len;
+    }
+
+    strings[0] = this->name ? this->name : "";
+    strings[1] = this->artist ? this->artist : "";
+    strings[2] = this->album ? this->album : "";
+    strings[3] = this->date ? this->date : "";
+
+    memcpy(header.magic, CACHE_MAGIC, sizeof(header.magic));
+    header.version = CACHE_VERSION;
+    header.time_window = TIME_WINDOW;
+    header.size = (int64_t)st.st_size;
+    header.mtime = (int64_t)st.st_mtime;
+    if (this->fingerprint) {
+        memcpy(header.fingerprint, this->fingerprint, FINGERPRINT_LEN);
+    }
+
+    /* the alias is only useful when it can be confirmed, the content is
+     * hashed while the file is analyzed, it is not read again for it
+     */
+
+    hash = this->content;
+    if (hash) memcpy(header.content, hash, FINGERPRINT_LEN);
+    header.length = this->length;
+    header.lufs = this->lufs;
+    header.peak = this->peak;
+    header.true_peak = this->true_peak;
+    header.sample_rate = this->sample_rate
+        ? (uint32_t)strtoul(this->sample_rate, NULL, 10) : 0;
+    for (size_t i = 0; i < CACHE_STRINGS; i++) {
+        header.strings_len += (uint32_t)strlen(strings[i]) + 1;
+    }
+
+    entry = g_byte_array_sized_new((guint)(sizeof(CacheHeader)
+                + header.waveform_len * sizeof(int16_t) + header.strings_len));
+
+    g_byte_array_append(entry, (const guint8*)&header, sizeof(CacheHeader));
+    g_byte_array_append(entry, (const guint8*)waveform,
+            (guint)(header.waveform_len * sizeof(int16_t)));
+    for (size_t i = 0; i < CACHE_STRINGS; i++) {
+        g_byte_array_append(entry, (const guint8*)strings[i],
+                (guint)strlen(strings[i]) + 1);
+    }
+
+    g_mutex_unlock(&this->lock);
+    if (mapped) g_mapped_file_unref(mapped);
+
+    /* g_file_set_contents writes to a temporary file and renames it
+     * so concurrent loaders never see a partially written entry
+     */
+
+    filename = cache_filename(this->path, &st);
+    dir = g_path_get_dirname(filename);
+
+    if (g_mkdir_with_parents(dir, 0755) != 0) {
+        g_printerr("failed to create cache directory \"%s\"\n", dir);
+
+    } else if (!g_file_set_contents(filename, (const gchar*)entry->data,
+                (gssize)entry->len, &err))
+    {
+        g_printerr("%s\n", err->message);
+        g_error_free(err);
+
+    } else if (this->fingerprint && hash) {
+
+        /* the link is replaced, it still points to the previous entry
+         * when the entry of the path was written before
+         */
+
+        content = cache_content_filename(this->fingerprint);
+        g_unlink(content);
+        if (    link(filename, content) != 0
+                && !g_file_set_contents(content, (const gchar*)entry->data,
+                    (gssize)entry->len, &err))
+        {
+            g_printerr("%s\n", err->message);
+            g_error_free(err);
+        }
+    }
+
+    g_free(dir);
+    g_free(content);
+    g_free(filename);
+    g_byte_array_free(entry, TRUE);
+}
+
+gboolean cache_find_copy(Track* this)
+{
+    GStatBuf st;
+    GMappedFile* mapped;
+    CacheHeader header;
+    gchar* filename;
+
+    if (!this || !this->path || !this->fingerprint) return FALSE;
+    if (g_stat(this->path, &st) != 0) return FALSE;
+
+    filename = cache_content_filename(this->fingerprint);
+    mapped = cache_map_entry(filename, &st, this->fingerprint, NULL, &header);
+    g_free(filename);
+
+    if (!mapped) return FALSE;
+    g_mapped_file_unref(mapped);
+    return TRUE;
+}
+
+
+/*******************************************************************************
+ * static functions
+ *
+ */
+
+
+gchar* cache_filename(const char* path, GStatBuf* st)
+{
+    gchar* key, * hash, * filename;
+
+    key = g_strdup_printf("%s\n%" G_GINT64_FORMAT "\n%" G_GINT64_FORMAT
+            "\n%lu\n%d", path, (gint64)st->st_size, (gint64)st->st_mtime,
+            TIME_WINDOW, CACHE_VERSION);
+
+    hash = g_compute_checksum_for_string(G_CHECKSUM_SHA1, key, -1);
+    filename = g_build_filename(g_get_user_cache_dir(), ID, hash, NULL);
+
+    g_free(hash);
+    g_free(key);
+    return filename;
+}
+
+gchar* cache_content_filename(const char* fingerprint)
+{
+    gchar* key, * hash, * filename;
+
+    key = g_strdup_printf("%s\n%lu\n%d", fingerprint, TIME_WINDOW, CACHE_VERSION);
+
+    hash = g_compute_checksum_for_string(G_CHECKSUM_SHA1, key, -1);
+    filename = g_build_filename(g_get_user_cache_dir(), ID, hash, NULL);
+
+    g_free(hash);
+    g_free(key);
+    return filename;
+}
+
+GMappedFile* cache_map(Track* this, CacheHeader* header)
+{
+    GStatBuf st;
+    GMappedFile* mapped;
+    gchar* filename;
+    const char* content;
+
+    if (g_stat(this->path, &st) != 0) return NULL;
+
+    filename = cache_filename(this->path, &st);
+    mapped = cache_map_entry(filename, &st, NULL, NULL, header);
+    g_free(filename);
+    if (mapped || !this->fingerprint) return mapped;
+
+    /* the file is never hashed here, that takes as long as reading it */
+
+    g_mutex_lock(&this->lock);
+    content = this->content;
+    g_mutex_unlock(&this->lock);
+    if (!content) return NULL;
+
+    filename = cache_content_filename(this->fingerprint);
+    mapped = cache_map_entry(filename, &st, this->fingerprint, content, header);
+    g_free(filename);
+    return mapped;
+}
+
+GMappedFile* cache_map_entry(const char* filename, GStatBuf* st,
+const char* fingerprint, const char* content, CacheHeader* header)
+{
+    GMappedFile* mapped;
+    gsize len;
+
+    /* a missing or unreadable entry is simply a cache miss
+     * the entry is memory-mapped so only the pages we copy are read
+     */
+
+    if (!(mapped = g_mapped_file_new(filename, FALSE, NULL))) return NULL;
+
+    len = g_mapped_file_get_length(mapped);
+
+    if (len < sizeof(CacheHeader)) goto fail;
+    memcpy(header, g_mapped_file_get_contents(mapped), sizeof(CacheHeader));
+
+    if (    memcmp(header->magic, CACHE_MAGIC, sizeof(header->magic)) != 0
+            || header->version != CACHE_VERSION
+            || header->time_window != TIME_WINDOW
+            || header->size != (int64_t)st->st_size)
+    {
+        goto fail;
+    }
+
+    /* a copy has an mtime of its own, its content is what matters */
+
+    if (!fingerprint) {
+        if (header->mtime != (int64_t)st->st_mtime) goto fail;
+
+    } else if (    memcmp(header->fingerprint, fingerprint, FINGERPRINT_LEN) != 0
+                || !header->content[0]
+                || (content && memcmp(header->content, content, FINGERPRINT_LEN) != 0))
+    {
+        goto fail;
+    }
+
+    if (len != sizeof(CacheHeader) + header->waveform_len * sizeof(int16_t)
+            + header->strings_len)
+    {
+        goto fail;
+    }
+    return mapped;
+
+fail:
+    g_mapped_file_unref(mapped);
+    return NULL;
+}
+
+void cache_set_string(char** dest, const char* src)
+{
+    free(*dest);
+    *dest = *src ? strdup(src) : NULL;
+}
@@ -28,6 +28,12 @@ void counter_update(Counter* this)
     char count[100];
     gdouble seconds = this->player->position;
     seconds *= seconds < 0 ? -1 : 1;
+
+    /* the label is only set when the displayed text changes */
+    seconds = floor(seconds * 1000) / 1000;
+    if (seconds == this->position) return;
+    this->position = seconds;
+
     sprintf(count, "<big><tt>%02d:%02d.%03d</tt></big>", (int)(seconds/60), (int)(fmod(seconds,60)), (int)(fmod(seconds,1)*1000));
     gtk_label_set_markup(GTK_LABEL(this->label), count);
     /* FIXME: setting label emits size-allocate !!! check by connect signal and start playback*/
@@ -40,7 +46,7 @@ Counter* counter_new(Player* player)
 
     this->player = player;
     this->box = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 0);
-    this->position = 0;
+    this->position = -1;
 
     frame = gtk_frame_new(NULL);
     gtk_box_pack_start(GTK_BOX(this->box), frame, TRUE, TRUE, 0);
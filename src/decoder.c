@@ -0,0 +1,509 @@
+/**
+ * @author      Arno Lievens (arnolievens@gmail.com)
+ * @date        14/10/2026
+ * @file        decoder.c
+ * @brief       libav audio decoder
+ * @copyright   Copyright (c) 2021 Arno Lievens
+ */
+
+#include <errno.h>
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+#include <libavutil/channel_layout.h>
+#include <libavutil/dict.h>
+#include <libavutil/mathematics.h>
+#include <libswresample/swresample.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../include/bufio.h"
+#include "../include/config.h"
+#include "../include/stats.h"
+
+#include "../include/decoder.h"
+
+/**
+ * the AVChannelLayout api replaced channel_layout/channels in libavutil 57.28
+ */
+#if LIBAVUTIL_VERSION_INT >= AV_VERSION_INT(57, 28, 100)
+#define DECODER_CH_LAYOUT
+#endif
+
+/**
+ * Open the container and select the best audio stream
+ *
+ * sets format, stream, channels, sample_rate and frames from the
+ * codec parameters of the stream
+ *
+ * @param this the decoder object
+ * @param path the file to be opened
+ * @param probe read the header only, search the stream info within
+ *        DECODER_PROBESIZE when the header is incomplete
+ * @return 0 on success, -1 when failed
+ */
+static int decoder_open_input(Decoder* this, const char* path, int probe);
+
+/**
+ * Create the sample format converter
+ *
+ * decoded frames are converted to packed (interleaved) floats
+ * most codecs decode to (planar) float natively so this is mostly an
+ * interleave, and it keeps the memory traffic of the analysis at half
+ * that of doubles
+ * the sample rate and channel layout are left untouched
+ *
+ * @param this the decoder object
+ * @return 0 on success or a negative AVERROR
+ */
+static int decoder_init_swr(Decoder* this);
+
+/**
+ * Decode the next frame into the buffer
+ *
+ * @param this the decoder object
+ * @return 1 when new frames are available, 0 at end of file or on error
+ */
+static int decoder_fill(Decoder* this);
+
+/**
+ * Print libav error
+ *
+ * @param msg message to be included in error
+ * @param path the file that caused the error
+ * @param status the libav status code
+ */
+static void decoder_print_status(const char* msg, const char* path, int status);
+
+
+/*******************************************************************************
+ * extern functions
+ */
+
+
+Decoder* decoder_open(const char* path)
+{
+    return decoder_open_hashed(path, NULL);
+}
+
+Decoder* decoder_open_hashed(const char* path, Fingerprint* fingerprint)
+{
+    int status;
+    Decoder* this;
+    AVStream* stream;
+    const AVCodec* codec = NULL;
+    gint64 start = stats_begin();
+
+    if (!path) return NULL;
+
+    if (!(this = calloc(1, sizeof(Decoder)))) {
+        fprintf(stderr, "failed to allocate decoder\n");
+        return NULL;
+    }
+    this->stream = -1;
+    this->seek_to = -1;
+    this->fingerprint = fingerprint;
+
+    if (decoder_open_input(this, path, 0) < 0) goto fail;
+    stream = this->format->streams[this->stream];
+
+    if (!(codec = avcodec_find_decoder(stream->codecpar->codec_id))) {
+        fprintf(stderr, "no decoder for \"%s\"\n", path);
+        goto fail;
+    }
+
+    if (!(this->codec = avcodec_alloc_context3(codec))) {
+        fprintf(stderr, "failed to allocate codec for \"%s\"\n", path);
+        goto fail;
+    }
+
+    if ((status = avcodec_parameters_to_context(this->codec, stream->codecpar)) < 0
+            || (status = avcodec_open2(this->codec, codec, NULL)) < 0)
+    {
+        decoder_print_status("failed to open codec", path, status);
+        goto fail;
+    }
+    this->codec->pkt_timebase = stream->time_base;
+
+#ifdef DECODER_CH_LAYOUT
+    this->channels = (unsigned int)this->codec->ch_layout.nb_channels;
+#else
+    this->channels = (unsigned int)this->codec->channels;
+#endif
+    this->sample_rate = (unsigned int)this->codec->sample_rate;
+
+    if (!this->channels || !this->sample_rate) {
+        fprintf(stderr, "invalid audio stream in \"%s\"\n", path);
+        goto fail;
+    }
+
+    if ((status = decoder_init_swr(this)) < 0) {
+        decoder_print_status("failed to create converter", path, status);
+        goto fail;
+    }
+
+    if (!(this->packet = av_packet_alloc()) || !(this->frame = av_frame_alloc())) {
+        fprintf(stderr, "failed to allocate frame for \"%s\"\n", path);
+        goto fail;
+    }
+
+    stats_end(STATS_FILE_OPEN, start);
+    return this;
+
+fail:
+    decoder_close(this);
+    return NULL;
+}
+
+Decoder* decoder_probe(const char* path)
+{
+    Decoder* this;
+    gint64 start = stats_begin();
+
+    if (!path) return NULL;
+
+    if (!(this = calloc(1, sizeof(Decoder)))) {
+        fprintf(stderr, "failed to allocate decoder\n");
+        return NULL;
+    }
+    this->stream = -1;
+    this->seek_to = -1;
+
+    if (decoder_open_input(this, path, 1) < 0) {
+        decoder_close(this);
+        return NULL;
+    }
+
+    stats_end(STATS_FILE_OPEN, start);
+    return this;
+}
+
+size_t decoder_read(Decoder* this, float* dest, size_t frames)
+{
+    size_t done = 0;
+
+    while (done < frames) {
+        size_t n;
+
+        if (this->buffer_pos == this->buffer_len) {
+            if (!decoder_fill(this)) break;
+            continue;
+        }
+
+        n = MIN(frames - done, this->buffer_len - this->buffer_pos);
+        memcpy(dest + done * this->channels,
+                this->buffer + this->buffer_pos * this->channels,
+                n * this->channels * sizeof(float));
+
+        this->buffer_pos += n;
+        done += n;
+    }
+    return done;
+}
+
+int decoder_seek(Decoder* this, int64_t frame)
+{
+    int status;
+    int64_t ts;
+    AVStream* stream = this->format->streams[this->stream];
+
+    if (frame < 0) frame = 0;
+
+    ts = av_rescale_q(frame, (AVRational){ 1, (int)this->sample_rate },
+            stream->time_base);
+    if (stream->start_time != AV_NOPTS_VALUE) ts += stream->start_time;
+
+    status = av_seek_frame(this->format, this->stream, ts, AVSEEK_FLAG_BACKWARD);
+    if (status < 0) return status;
+
+    avcodec_flush_buffers(this->codec);
+    this->eof = 0;
+    this->buffer_len = 0;
+    this->buffer_pos = 0;
+    this->seek_to = frame;
+    this->error = 0;
+    return 0;
+}
+
+void decoder_close(Decoder* this)
+{
+    if (!this) return;
+
+    av_frame_free(&this->frame);
+    av_packet_free(&this->packet);
+    swr_free(&this->swr);
+    avcodec_free_context(&this->codec);
+    avformat_close_input(&this->format);
+    bufio_close(&this->io);
+    free(this->buffer);
+    free(this);
+}
+
+
+/*******************************************************************************
+ * static functions
+ *
+ */
+
+
+int decoder_open_input(Decoder* this, const char* path, int probe)
+{
+    int status;
+    AVStream* stream;
+    AVCodecParameters* par;
+    AVDictionary* options = NULL;
+
+    /* the container metadata (tags) is available right after opening
+     * find_stream_info is needed for formats that do not store the codec
+     * parameters in the header, the packets it reads are kept by libav
+     * so nothing is read twice
+     * a probe only needs the header, libav is kept from reading ahead
+     */
+
+    if (probe) {
+        av_dict_set_int(&options, "probesize", DECODER_PROBESIZE, 0);
+        av_dict_set_int(&options, "analyzeduration", DECODER_ANALYZEDURATION, 0);
+    }
+
+    /* the file is read in large blocks instead of libav's small reads, each
+     * of which costs a round trip on a network share
+     * when decoding, the next block is read ahead while this one is decoded
+     */
+
+    this->io = bufio_open(path, probe ? BUFIO_PROBE_BLOCK : BUFIO_BLOCK, !probe,
+            this->fingerprint);
+    if (!this->io) {
+        av_dict_free(&options);
+        return -1;
+    }
+    if (!(this->format = avformat_alloc_context())) {
+        fprintf(stderr, "failed to allocate format for \"%s\"\n", path);
+        av_dict_free(&options);
+        return -1;
+    }
+    this->format->pb = this->io;
+    this->format->flags |= AVFMT_FLAG_CUSTOM_IO;
+
+    status = avformat_open_input(&this->format, path, NULL, &options);
+    av_dict_free(&options);
+    if (status < 0) {
+        decoder_print_status("failed to open file", path, status);
+        return -1;
+    }
+
+    status = av_find_best_stream(this->format, AVMEDIA_TYPE_AUDIO, -1, -1, NULL, 0);
+    if (status >= 0) {
+        par = this->format->streams[status]->codecpar;
+#ifdef DECODER_CH_LAYOUT
+        this->channels = (unsigned int)par->ch_layout.nb_channels;
+#else
+        this->channels = (unsigned int)par->channels;
+#endif
+        this->sample_rate = (unsigned int)par->sample_rate;
+    }
+
+    if (    !probe || status < 0 || !this->channels || !this->sample_rate
+            || this->format->streams[status]->duration == AV_NOPTS_VALUE)
+    {
+        if ((status = avformat_find_stream_info(this->format, NULL)) < 0) {
+            decoder_print_status("failed to read stream info", path, status);
+            return -1;
+        }
+        status = av_find_best_stream(this->format, AVMEDIA_TYPE_AUDIO, -1, -1, NULL, 0);
+    }
+
+    if (status < 0) {
+        decoder_print_status("no audio stream", path, status);
+        return -1;
+    }
+    this->stream = status;
+    stream = this->format->streams[this->stream];
+    par = stream->codecpar;
+
+#ifdef DECODER_CH_LAYOUT
+    this->channels = (unsigned int)par->ch_layout.nb_channels;
+#else
+    this->channels = (unsigned int)par->channels;
+#endif
+    this->sample_rate = (unsigned int)par->sample_rate;
+
+    if (!this->channels || !this->sample_rate) {
+        fprintf(stderr, "invalid audio stream in \"%s\"\n", path);
+        return -1;
+    }
+
+    /* discard all other streams (eg cover art) so the demuxer skips them */
+    for (unsigned int i = 0; i < this->format->nb_streams; i++) {
+        if ((int)i != this->stream) {
+            this->format->streams[i]->discard = AVDISCARD_ALL;
+        }
+    }
+
+    /* the number of frames is an estimate taken from the stream or container
+     * duration, the exact number is only known after decoding everything
+     */
+
+    if (stream->duration != AV_NOPTS_VALUE) {
+        this->frames = av_rescale_q(stream->duration, stream->time_base,
+                (AVRational){ 1, (int)this->sample_rate });
+    } else if (this->format->duration != AV_NOPTS_VALUE) {
+        this->frames = av_rescale(this->format->duration,
+                this->sample_rate, AV_TIME_BASE);
+    }
+    return 0;
+}
+
+int decoder_init_swr(Decoder* this)
+{
+    int status;
+    int sr = (int)this->sample_rate;
+
+#ifdef DECODER_CH_LAYOUT
+    AVChannelLayout layout;
+
+    /* some decoders only report the channel count, assume default order */
+    if (this->codec->ch_layout.order == AV_CHANNEL_ORDER_UNSPEC) {
+        av_channel_layout_default(&layout, (int)this->channels);
+    } else if ((status = av_channel_layout_copy(&layout, &this->codec->ch_layout)) < 0) {
+        return status;
+    }
+
+    status = swr_alloc_set_opts2(&this->swr,
+            &layout, AV_SAMPLE_FMT_FLT, sr,
+            &layout, this->codec->sample_fmt, sr,
+            0, NULL);
+
+    av_channel_layout_uninit(&layout);
+    if (status < 0) return status;
+#else
+    int64_t layout = (int64_t)this->codec->channel_layout;
+
+    if (!layout) layout = av_get_default_channel_layout((int)this->channels);
+
+    this->swr = swr_alloc_set_opts(NULL,
+            layout, AV_SAMPLE_FMT_FLT, sr,
+            layout, this->codec->sample_fmt, sr,
+            0, NULL);
+
+    if (!this->swr) return AVERROR(ENOMEM);
+#endif
+
+    return swr_init(this->swr);
+}
+
+int decoder_fill(Decoder* this)
+{
+    int status;
+    int64_t ts;
+
+    /* pull frames from the decoder and feed it packets when it asks for more
+     * at end of file the decoder is flushed with an empty packet and drained
+     */
+
+    for (;;) {
+        status = avcodec_receive_frame(this->codec, this->frame);
+
+        if (status == 0) {
+            uint8_t* out;
+            size_t needed = (size_t)this->frame->nb_samples;
+
+            if (needed > this->buffer_size) {
+                float* buffer = realloc(this->buffer,
+                        needed * this->channels * sizeof(float));
+                if (!buffer) {
+                    fprintf(stderr, "failed to allocate decoder buffer\n");
+                    av_frame_unref(this->frame);
+                    return 0;
+                }
+                this->buffer = buffer;
+                this->buffer_size = needed;
+            }
+
+            ts = this->frame->best_effort_timestamp;
+            if (ts == AV_NOPTS_VALUE) ts = this->frame->pts;
+
+            out = (uint8_t*)this->buffer;
+            status = swr_convert(this->swr, &out, (int)this->buffer_size,
+                    (const uint8_t**)this->frame->extended_data,
+                    this->frame->nb_samples);
+            av_frame_unref(this->frame);
+
+            if (status < 0) {
+                decoder_print_status("failed to convert frame", NULL, status);
+                return 0;
+            }
+
+            this->buffer_len = (size_t)status;
+            this->buffer_pos = 0;
+
+            /* after seeking, drop everything before the requested frame
+             * the position of the decoded frame is taken from its timestamp
+             */
+
+            if (this->seek_to >= 0) {
+                int64_t pos;
+                AVStream* stream = this->format->streams[this->stream];
+
+                if (ts == AV_NOPTS_VALUE) {
+                    fprintf(stderr, "libav frame without timestamp after seek\n");
+                    this->error = 1;
+                    return 0;
+                }
+                if (stream->start_time != AV_NOPTS_VALUE) ts -= stream->start_time;
+                pos = av_rescale_q(ts, stream->time_base,
+                        (AVRational){ 1, (int)this->sample_rate });
+
+                if (pos > this->seek_to) {
+                    fprintf(stderr, "libav seeked past requested frame\n");
+                    this->error = 1;
+                    return 0;
+                }
+                if (pos + (int64_t)this->buffer_len <= this->seek_to) continue;
+
+                this->buffer_pos = (size_t)(this->seek_to - pos);
+                this->seek_to = -1;
+            }
+            return 1;
+        }
+
+        if (status == AVERROR_EOF) return 0;
+
+        if (status != AVERROR(EAGAIN)) {
+            decoder_print_status("failed to decode frame", NULL, status);
+            return 0;
+        }
+
+        /* decoder needs more input */
+
+        if (this->eof) return 0;
+
+        if ((status = av_read_frame(this->format, this->packet)) < 0) {
+            if (status != AVERROR_EOF) {
+                decoder_print_status("failed to read packet", NULL, status);
+            }
+            this->eof = 1;
+            avcodec_send_packet(this->codec, NULL);
+            continue;
+        }
+
+        /* a corrupt packet is skipped rather than aborting the whole file */
+        if (this->packet->stream_index == this->stream) {
+            status = avcodec_send_packet(this->codec, this->packet);
+            if (status < 0 && status != AVERROR(EAGAIN)) {
+                decoder_print_status("failed to send packet", NULL, status);
+            }
+        }
+        av_packet_unref(this->packet);
+    }
+}
+
+void decoder_print_status(const char* msg, const char* path, int status)
+{
+    char err[AV_ERROR_MAX_STRING_SIZE] = { 0 };
+
+    av_strerror(status, err, sizeof(err));
+    if (path) fprintf(stderr, "libav %s \"%s\"\n > %s\n", msg, path, err);
+    else fprintf(stderr, "libav %s\n > %s\n", msg, err);
+}
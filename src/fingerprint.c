@@ -0,0 +1,283 @@
+/**
+ * @author      Arno Lievens (arnolievens@gmail.com)
+ * @date        14/10/2026
+ * @file        fingerprint.c
+ * @brief       content hash of audio files
+ * @copyright   Copyright (c) 2021 Arno Lievens
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <glib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "../include/config.h"
+
+#include "../include/fingerprint.h"
+
+/**
+ * Read size bytes at offset
+ *
+ * @param fd the file
+ * @param buffer at least size bytes
+ * @param size number of bytes
+ * @param offset position in the file
+ * @return 0 on success, -1 when the file could not be read entirely
+ */
+static int fingerprint_read(int fd, unsigned char* buffer, size_t size,
+        off_t offset);
+
+/**
+ * Hash size bytes at offset
+ *
+ * @param checksum the checksum to be updated
+ * @param fd the file
+ * @param buffer at least size bytes
+ * @param size number of bytes
+ * @param offset position in the file
+ * @return 0 on success, -1 when the file could not be read entirely
+ */
+static int fingerprint_update(GChecksum* checksum, int fd, unsigned char* buffer,
+        size_t size, off_t offset);
+
+
+/*******************************************************************************
+ * extern functions
+ */
+
+
+char* fingerprint_file(const char* path)
+{
+    struct stat st;
+    GChecksum* checksum = NULL;
+    unsigned char* buffer = NULL;
+    char* fingerprint = NULL;
+    int64_t size;
+    size_t head, tail;
+    int fd;
+
+    if ((fd = open(path, O_RDONLY)) < 0) {
+        fprintf(stderr, "failed to open \"%s\"\n > %s\n", path, g_strerror(errno));
+        return NULL;
+    }
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) goto done;
+
+    /* head and tail overlap for small files, which are hashed once */
+
+    size = (int64_t)st.st_size;
+    head = (size_t)MIN(size, FINGERPRINT_BLOCK);
+    tail = (size_t)MIN(size - (int64_t)head, FINGERPRINT_BLOCK);
+
+    if (!(buffer = malloc(MAX(head, 1)))) {
+        fprintf(stderr, "failed to allocate fingerprint buffer\n");
+        goto done;
+    }
+
+    checksum = g_checksum_new(G_CHECKSUM_SHA1);
+    g_checksum_update(checksum, (const guchar*)&size, sizeof(size));
+
+    if (    fingerprint_update(checksum, fd, buffer, head, 0) < 0
+            || fingerprint_update(checksum, fd, buffer, tail,
+                (off_t)(size - (int64_t)tail)) < 0)
+    {
+        fprintf(stderr, "failed to read \"%s\"\n", path);
+        goto done;
+    }
+    fingerprint = strdup(g_checksum_get_string(checksum));
+
+done:
+    if (checksum) g_checksum_free(checksum);
+    free(buffer);
+    close(fd);
+    return fingerprint;
+}
+
+char* fingerprint_content(const char* path, GCancellable* cancellable)
+{
+    struct stat st;
+    Fingerprint* fingerprint = NULL;
+    unsigned char* buffer = NULL;
+    char* content = NULL;
+    int64_t size, offset;
+    int fd;
+
+    if ((fd = open(path, O_RDONLY)) < 0) {
+        fprintf(stderr, "failed to open \"%s\"\n > %s\n", path, g_strerror(errno));
+        return NULL;
+    }
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) goto done;
+
+#ifdef POSIX_FADV_SEQUENTIAL
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+    if (    !(buffer = malloc(FINGERPRINT_BLOCK))
+            || !(fingerprint = fingerprint_new()))
+    {
+        fprintf(stderr, "failed to allocate fingerprint buffer\n");
+        goto done;
+    }
+
+    size = (int64_t)st.st_size;
+    fingerprint_add(fingerprint, size, 0, buffer, 0);
+
+    for (offset = 0; offset < size; offset += FINGERPRINT_BLOCK) {
+        size_t n = (size_t)MIN(size - offset, FINGERPRINT_BLOCK);
+
+        if (g_cancellable_is_cancelled(cancellable)) goto done;
+        if (fingerprint_read(fd, buffer, n, (off_t)offset) < 0) {
+            fprintf(stderr, "failed to read \"%s\"\n", path);
+            goto done;
+        }
+        fingerprint_add(fingerprint, size, offset, buffer, n);
+    }
+    content = fingerprint_finish(fingerprint);
+
+done:
+    fingerprint_free(fingerprint);
+    free(buffer);
+    close(fd);
+    return content;
+}
+
+Fingerprint* fingerprint_new(void)
+{
+    Fingerprint* this;
+
+    if (!(this = calloc(1, sizeof(Fingerprint)))) {
+        fprintf(stderr, "failed to allocate fingerprint\n");
+        return NULL;
+    }
+    this->size = -1;
+    g_mutex_init(&this->lock);
+    return this;
+}
+
+void fingerprint_add(Fingerprint* this, int64_t size, int64_t offset,
+const unsigned char* data, size_t len)
+{
+    if (!this || size < 0 || offset < 0 || offset % FINGERPRINT_BLOCK) return;
+
+    /* the blocks are laid out on the size seen first, a file that changes
+     * size while it is read can not be hashed
+     */
+
+    g_mutex_lock(&this->lock);
+    if (this->size < 0 && !this->failed) {
+        this->size = size;
+        this->n_blocks = (size_t)((size + FINGERPRINT_BLOCK - 1) / FINGERPRINT_BLOCK);
+        this->missing = this->n_blocks;
+        this->digests = malloc(MAX(this->n_blocks, 1) * FINGERPRINT_DIGEST);
+        this->hashed = calloc(MAX(this->n_blocks, 1), 1);
+        if (!this->digests || !this->hashed) {
+            fprintf(stderr, "failed to allocate fingerprint digests\n");
+            this->failed = 1;
+        }
+    } else if (this->size != size) {
+        this->failed = 1;
+    }
+    g_mutex_unlock(&this->lock);
+
+    while (len > 0 && offset < size) {
+        size_t n = (size_t)MIN((int64_t)len, FINGERPRINT_BLOCK);
+        size_t index = (size_t)(offset / FINGERPRINT_BLOCK);
+        guint8 digest[FINGERPRINT_DIGEST];
+        gsize digest_len = sizeof(digest);
+        GChecksum* checksum;
+        int skip;
+
+        /* a short block must be the last one */
+        if (n < FINGERPRINT_BLOCK && offset + (int64_t)n != size) return;
+
+        g_mutex_lock(&this->lock);
+        skip = this->failed || this->hashed[index];
+        g_mutex_unlock(&this->lock);
+
+        if (!skip) {
+            checksum = g_checksum_new(G_CHECKSUM_SHA1);
+            g_checksum_update(checksum, data, (gssize)n);
+            g_checksum_get_digest(checksum, digest, &digest_len);
+            g_checksum_free(checksum);
+
+            g_mutex_lock(&this->lock);
+            if (!this->failed && !this->hashed[index]) {
+                memcpy(this->digests + index * FINGERPRINT_DIGEST, digest,
+                        FINGERPRINT_DIGEST);
+                this->hashed[index] = 1;
+                this->missing--;
+            }
+            g_mutex_unlock(&this->lock);
+        }
+
+        data += n;
+        offset += (int64_t)n;
+        len -= n;
+    }
+}
+
+char* fingerprint_finish(Fingerprint* this)
+{
+    GChecksum* checksum;
+    char* content = NULL;
+
+    if (!this) return NULL;
+
+    g_mutex_lock(&this->lock);
+    if (!this->failed && this->size >= 0 && !this->missing) {
+        checksum = g_checksum_new(G_CHECKSUM_SHA1);
+        g_checksum_update(checksum, (const guchar*)&this->size, sizeof(this->size));
+        g_checksum_update(checksum, this->digests,
+                (gssize)(this->n_blocks * FINGERPRINT_DIGEST));
+        content = strdup(g_checksum_get_string(checksum));
+        g_checksum_free(checksum);
+    }
+    g_mutex_unlock(&this->lock);
+    return content;
+}
+
+void fingerprint_free(Fingerprint* this)
+{
+    if (!this) return;
+
+    free(this->digests);
+    free(this->hashed);
+    g_mutex_clear(&this->lock);
+    free(this);
+}
+
+
+/*******************************************************************************
+ * static functions
+ *
+ */
+
+
+int fingerprint_read(int fd, unsigned char* buffer, size_t size, off_t offset)
+{
+    size_t done = 0;
+
+    while (done < size) {
+        ssize_t n = pread(fd, buffer + done, size - done, offset + (off_t)done);
+
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        if (n == 0) return -1;
+        done += (size_t)n;
+    }
+    return 0;
+}
+
+int fingerprint_update(GChecksum* checksum, int fd, unsigned char* buffer,
+size_t size, off_t offset)
+{
+    if (fingerprint_read(fd, buffer, size, offset) < 0) return -1;
+    g_checksum_update(checksum, buffer, (gssize)size);
+    return 0;
+}
@@ -0,0 +1,1166 @@
+/**
+ * @author      Arno Lievens (arnolievens@gmail.com)
+ * @date        14/10/2026
+ * @file        loader.c
+ * @brief       bounded scheduler for loading tracks from files
+ * @copyright   Copyright (c) 2021 Arno Lievens
+ */
+
+#include <gtk/gtk.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../include/align.h"
+#include "../include/cache.h"
+#include "../include/config.h"
+#include "../include/stats.h"
+#include "../include/track.h"
+
+#include "../include/loader.h"
+
+/**
+ * Attributes of a file needed to load it, fetched in a single query
+ */
+#define LOADER_ATTRIBUTES                       \
+    G_FILE_ATTRIBUTE_STANDARD_NAME ","          \
+    G_FILE_ATTRIBUTE_STANDARD_TYPE ","          \
+    G_FILE_ATTRIBUTE_STANDARD_CONTENT_TYPE ","  \
+    G_FILE_ATTRIBUTE_STANDARD_DISPLAY_NAME ","  \
+    G_FILE_ATTRIBUTE_ID_FILE
+
+/**
+ * Cancellation and priority shared by the decode jobs of a track
+ */
+typedef struct LoaderTask {
+    GCancellable* cancellable;  /**< aborts the jobs of the track */
+    gint priority;              /**< order in the decode pool (atomic) */
+    guint jobs;                 /**< number of jobs using the task */
+} LoaderTask;
+
+/**
+ * A single file on its way through the loader
+ */
+typedef struct LoaderJob {
+    Loader* loader;             /**< reference to the loader */
+    GFile* file;                /**< the file or directory to be loaded */
+    GFileInfo* info;            /**< LOADER_ATTRIBUTES of file or NULL */
+    GFileEnumerator* children;  /**< open enumerator of a directory */
+    GHashTable* visited;        /**< ID_FILE of the directories of the drop (main thread) */
+    gchar* path;                /**< local path of file */
+    gchar* name;                /**< display name of file */
+    Track* track;               /**< the track being analyzed or aligned */
+    Track* reference;           /**< the track to align to, NULL = analyze */
+    LoaderTask* task;           /**< task of track, set with track */
+    gboolean true_peak;         /**< measure the true peak of track */
+    gboolean joined;            /**< looked for a copy of track (decode pool) */
+    guint serial;               /**< order of the job within its priority */
+    gpointer data;              /**< closure for the callback */
+    gint64 queued;              /**< time pushed to a pool (stats) */
+    GBoxedCopyFunc copy;        /**< function to copy data (directory) */
+    GDestroyNotify destroy;     /**< function to free data */
+} LoaderJob;
+
+/**
+ * Analysis of a file shared with identical files
+ */
+typedef struct LoaderShare {
+    Track* track;               /**< the track being analyzed */
+    GSList* aliases;            /**< parked LoaderJob of the identical tracks */
+} LoaderShare;
+
+/**
+ * A result on its way to the main thread
+ */
+typedef struct LoaderMessage {
+    Loader* loader;             /**< reference to the loader */
+    LoaderEvent event;          /**< kind of result */
+    Track* track;               /**< reference to the track or NULL if failed */
+    gpointer data;              /**< closure for the callback */
+    GDestroyNotify destroy;     /**< function to free data */
+} LoaderMessage;
+
+/**
+ * Probe file and look it up in the cache
+ *
+ * io pool function
+ *
+ * @param data the job
+ * @param user_data the loader object
+ */
+static void loader_probe(gpointer data, gpointer user_data);
+
+/**
+ * Start enumerating a directory
+ *
+ * runs on the main context so the asynchronous enumeration, and the copies
+ * of the data, are made on the main thread
+ *
+ * @param data the job of the directory
+ * @return G_SOURCE_REMOVE
+ */
+static gboolean loader_enumerate(gpointer data);
+
+/**
+ * Directory opened, request the first batch of entries
+ *
+ * @param source the directory
+ * @param res the result
+ * @param data the job of the directory
+ */
+static void loader_enumerate_opened(GObject* source, GAsyncResult* res,
+        gpointer data);
+
+/**
+ * Queue a batch of entries and request the next one
+ *
+ * @param source the enumerator
+ * @param res the result
+ * @param data the job of the directory
+ */
+static void loader_enumerate_next(GObject* source, GAsyncResult* res,
+        gpointer data);
+
+/**
+ * Create a job
+ *
+ * @param this the loader object
+ * @param file the file, the reference is passed on
+ * @param info the attributes of file or NULL, the reference is passed on
+ * @param data closure for the callback
+ * @param copy function to copy data or NULL
+ * @param destroy function to free data or NULL
+ * @return the job or NULL when failed (data is destroyed)
+ */
+static LoaderJob* loader_job_new(Loader* this, GFile* file, GFileInfo* info,
+        gpointer data, GBoxedCopyFunc copy, GDestroyNotify destroy);
+
+/**
+ * Check whether a content type is audio
+ *
+ * @param type the content type or NULL
+ * @return TRUE for audio files
+ */
+static gboolean loader_is_audio(const gchar* type);
+
+/**
+ * Get the task of a track, created when needed
+ *
+ * @param this the loader object
+ * @param track the track
+ * @return the task, release with loader_task_release
+ */
+static LoaderTask* loader_task_get(Loader* this, Track* track);
+
+/**
+ * Release a task, it is freed when the last job of the track is done
+ *
+ * @param this the loader object
+ * @param track the track
+ * @param task the task of track
+ */
+static void loader_task_release(Loader* this, Track* track, LoaderTask* task);
+
+/**
+ * Queue job on the decode pool
+ *
+ * the job is freed when it can't be queued
+ *
+ * @param this the loader object
+ * @param job the job
+ */
+static void loader_push_decode(Loader* this, LoaderJob* job);
+
+/**
+ * Park a job behind the analysis of an identical track
+ *
+ * the first job of a fingerprint is registered as the one analyzing it
+ * the others are parked when the hash of the whole file matches as well,
+ * a different file with the same fingerprint is analyzed on its own
+ *
+ * @param this the loader object
+ * @param job a job analyzing its track or measuring its true peak
+ * @return TRUE when the job was parked, loader_share_release picks it up
+ */
+static gboolean loader_share_join(Loader* this, LoaderJob* job);
+
+/**
+ * Pass the results of an analyzed track on to the parked identical tracks
+ *
+ * the parked jobs wait for the true peak
+ *
+ * @param this the loader object
+ * @param track the analyzed track
+ */
+static void loader_share_results(Loader* this, Track* track);
+
+/**
+ * Stop sharing the analysis of a track
+ *
+ * called when the last job of the track is done, the parked jobs are
+ * finished with its results (and their own cache entry) or queued to do
+ * the missing part themselves
+ *
+ * @param this the loader object
+ * @param track the track
+ */
+static void loader_share_release(Loader* this, Track* track);
+
+/**
+ * Order of the jobs in the decode pool
+ *
+ * analysis and alignment are served by priority and first-come
+ * first-served within a priority, true peak jobs are only started when no
+ * other job is waiting
+ *
+ * @param a the first job
+ * @param b the second job
+ * @param user_data unused
+ * @return <0 when a comes first, >0 when b comes first
+ */
+static gint loader_compare(gconstpointer a, gconstpointer b, gpointer user_data);
+
+/**
+ * Cancel a task
+ *
+ * hash table foreach function
+ *
+ * @param key the track
+ * @param value the task
+ * @param user_data unused
+ */
+static void loader_task_cancel(gpointer key, gpointer value, gpointer user_data);
+
+/**
+ * Decode and analyze the file, align the track or measure its true peak
+ *
+ * decode pool function
+ *
+ * @param data the job
+ * @param user_data the loader object
+ */
+static void loader_decode(gpointer data, gpointer user_data);
+
+/**
+ * Report analysis progress
+ *
+ * track progress handler, called from the analyzing thread
+ *
+ * @param track the track being analyzed
+ * @param data the loader object
+ */
+static void loader_progress(Track* track, void* data);
+
+/**
+ * Queue a result for the main thread and schedule a drain when needed
+ *
+ * @param this the loader object
+ * @param event kind of result
+ * @param track the track, the reference is passed on, or NULL when failed
+ * @param data closure for the callback
+ * @param destroy function to free data or NULL
+ */
+static void loader_post(Loader* this, LoaderEvent event, Track* track,
+        gpointer data, GDestroyNotify destroy);
+
+/**
+ * Start draining the results on the main thread
+ *
+ * idle function, installs a tick callback on the clock widget when it is
+ * mapped, otherwise the results are drained from this idle callback
+ *
+ * @param data the loader object
+ * @return G_SOURCE_CONTINUE while results are pending
+ */
+static gboolean loader_schedule(gpointer data);
+
+/**
+ * Drain one batch of results per frame
+ *
+ * @param widget the clock widget
+ * @param clock its frame clock
+ * @param data the loader object
+ * @return G_SOURCE_CONTINUE while results are pending
+ */
+static gboolean loader_tick(GtkWidget* widget, GdkFrameClock* clock,
+        gpointer data);
+
+/**
+ * Tick callback destroy notify
+ *
+ * @param data the loader object
+ */
+static void loader_tick_destroy(gpointer data);
+
+/**
+ * Hand one batch of results to the callback and free the jobs
+ *
+ * @param this the loader object
+ * @return TRUE when more results are pending
+ */
+static gboolean loader_drain(Loader* this);
+
+/**
+ * Free job and release its references
+ *
+ * data still owned by the job is passed to the main thread to be destroyed
+ *
+ * @param job the job
+ */
+static void loader_job_free(LoaderJob* job);
+
+/**
+ * Free message and release its references
+ *
+ * @param msg the message
+ */
+static void loader_message_free(LoaderMessage* msg);
+
+/**
+ * Release a reference, the loader is freed when the last one is dropped
+ *
+ * @param this the loader object
+ */
+static void loader_unref(gpointer this);
+
+
+/*******************************************************************************
+ * extern functions
+ */
+
+
+Loader* loader_new(LoaderCallback callback, gpointer user_data)
+{
+    GError* err = NULL;
+    gint threads = LOADER_DECODE_THREADS;
+    Loader* this;
+
+    if (!(this = calloc(1, sizeof(Loader)))) {
+        fprintf(stderr, "failed to allocate loader\n");
+        return NULL;
+    }
+    this->callback = callback;
+    this->user_data = user_data;
+    this->ref = 1;
+    this->results = g_async_queue_new();
+    this->tasks = g_hash_table_new(g_direct_hash, g_direct_equal);
+    this->shares = g_hash_table_new(g_str_hash, g_str_equal);
+    this->cancellable = g_cancellable_new();
+    g_mutex_init(&this->lock);
+
+    /* decoding is cpu bound, one thread per core saturates the machine
+     * probing is io bound and mostly seeking, a couple of threads hide the
+     * latency without thrashing spinning disks or network shares
+     */
+
+    if (threads <= 0) threads = (gint)g_get_num_processors();
+
+    this->io = g_thread_pool_new(loader_probe, this, LOADER_IO_THREADS,
+            FALSE, &err);
+    if (!err) {
+        this->decode = g_thread_pool_new(loader_decode, this, threads,
+                FALSE, &err);
+    }
+    if (!err) g_thread_pool_set_sort_function(this->decode, loader_compare, NULL);
+
+    if (err) {
+        g_printerr("%s\n", err->message);
+        g_error_free(err);
+        loader_free(this);
+        return NULL;
+    }
+    return this;
+}
+
+void loader_set_clock(Loader* this, GtkWidget* widget)
+{
+    if (this->clock) {
+        g_object_remove_weak_pointer(G_OBJECT(this->clock),
+                (gpointer*)&this->clock);
+    }
+
+    /* a running tick callback stays on the old widget until it runs dry */
+
+    if ((this->clock = widget)) {
+        g_object_add_weak_pointer(G_OBJECT(this->clock),
+                (gpointer*)&this->clock);
+    }
+}
+
+void loader_push(Loader* this, GFile* file, GHashTable* visited,
+gpointer data, GBoxedCopyFunc copy, GDestroyNotify destroy)
+{
+    GError* err = NULL;
+    LoaderJob* job;
+
+    if (!(job = loader_job_new(this, file, NULL, data, copy, destroy))) return;
+
+    if (visited) job->visited = g_hash_table_ref(visited);
+    job->queued = stats_begin();
+    if (!g_thread_pool_push(this->io, job, &err)) {
+        g_printerr("%s\n", err->message);
+        g_error_free(err);
+        loader_job_free(job);
+    }
+}
+
+void loader_align(Loader* this, Track* reference, Track* track)
+{
+    LoaderJob* job;
+
+    if (!(job = calloc(1, sizeof(LoaderJob)))) {
+        fprintf(stderr, "failed to allocate loader job\n");
+        return;
+    }
+
+    g_atomic_int_inc(&this->ref);
+    job->loader = this;
+    job->track = track_ref(track);
+    job->reference = track_ref(reference);
+    job->task = loader_task_get(this, track);
+
+    loader_push_decode(this, job);
+}
+
+void loader_cancel(Loader* this, Track* track)
+{
+    LoaderTask* task;
+
+    g_mutex_lock(&this->lock);
+    if ((task = g_hash_table_lookup(this->tasks, track))) {
+        g_cancellable_cancel(task->cancellable);
+    }
+    g_mutex_unlock(&this->lock);
+}
+
+void loader_set_priority(Loader* this, Track* track, gint priority)
+{
+    LoaderTask* task;
+
+    g_mutex_lock(&this->lock);
+    if ((task = g_hash_table_lookup(this->tasks, track))) {
+        g_atomic_int_set(&task->priority, priority);
+    }
+    g_mutex_unlock(&this->lock);
+}
+
+void loader_sort(Loader* this)
+{
+    /* setting the sort function sorts the jobs that are already queued */
+
+    g_mutex_lock(&this->lock);
+    if (this->decode) g_thread_pool_set_sort_function(this->decode, loader_compare, NULL);
+    g_mutex_unlock(&this->lock);
+}
+
+void loader_free(Loader* this)
+{
+    if (!this) return;
+
+    /* files that did not start yet are skipped by the workers
+     * waiting for the io pool guarantees nothing is pushed to the decode pool
+     * after it's gone, the io jobs only read headers and hash head and tail
+     * so this does not block for long
+     * the decode pool is released without waiting, a running analysis or
+     * hash of a whole file is cancelled and drops its reference when it
+     * stopped
+     */
+
+    g_mutex_lock(&this->lock);
+    g_atomic_int_set(&this->closed, 1);
+    g_hash_table_foreach(this->tasks, loader_task_cancel, NULL);
+    g_mutex_unlock(&this->lock);
+
+    /* the enumerations still running finish with G_IO_ERROR_CANCELLED */
+    g_cancellable_cancel(this->cancellable);
+
+    if (this->io) g_thread_pool_free(this->io, FALSE, TRUE);
+    if (this->decode) g_thread_pool_free(this->decode, FALSE, FALSE);
+
+    g_mutex_lock(&this->lock);
+    this->io = NULL;
+    this->decode = NULL;
+    g_mutex_unlock(&this->lock);
+
+    if (this->tick && this->clock) {
+        gtk_widget_remove_tick_callback(this->clock, this->tick);
+    }
+    loader_set_clock(this, NULL);
+
+    loader_unref(this);
+}
+
+
+/*******************************************************************************
+ * static functions
+ *
+ */
+
+
+void loader_probe(gpointer data, gpointer user_data)
+{
+    LoaderJob* job = data;
+    Loader* this = user_data;
+    GFileInfo* info = job->info;
+    GError* err = NULL;
+    const gchar* type, * name;
+    Track* track;
+
+    stats_end(STATS_IO_WAIT, job->queued);
+    if (g_atomic_int_get(&this->closed)) goto done;
+
+    if (!(job->path = g_file_get_path(job->file))) {
+        gchar* uri = g_file_get_uri(job->file);
+        g_printerr("Error loading file \"%s\": Not a local file\n", uri);
+        g_free(uri);
+        goto done;
+    }
+
+    /* type, mimetype and display name are fetched in a single query
+     * files found in a directory come with the attributes of the enumerator
+     */
+
+    if (!info) {
+        info = job->info = g_file_query_info(job->file, LOADER_ATTRIBUTES,
+                G_FILE_QUERY_INFO_NONE, NULL, &err);
+        if (err) {
+            g_printerr("%s\n", err->message);
+            g_error_free(err);
+            goto done;
+        }
+    }
+
+    if (g_file_info_get_file_type(info) == G_FILE_TYPE_DIRECTORY) {
+        g_main_context_invoke(NULL, loader_enumerate, job);
+        return;
+    }
+
+    type = g_file_info_get_content_type(info);
+    name = g_file_info_get_display_name(info);
+
+    if (!type) {
+        g_printerr("Error getting mimetype for file \"%s\"\n", job->path);
+        goto done;
+    }
+
+    if (!loader_is_audio(type)) {
+        g_printerr("Error loading file \"%s\": Not and audio file\n", job->path);
+        goto done;
+    }
+
+    job->name = g_strdup(name ? name : job->path);
+
+    /* cache hits are finished right away, only misses need a decoder
+     * a miss is added as soon as its header is read and analyzed later
+     * the entry of an identical file is found in the decode pool, it takes
+     * as long as reading the file to confirm it
+     * a hit saved before its true peak was measured only needs that pass
+     */
+
+    if (    !(track = track_new_from_cache(job->name, job->path))
+            && !(track = track_probe(job->name, job->path)))
+    {
+        goto done;
+
+    } else if (track_get_state(track) == TRACK_STATE_PENDING) {
+        job->track = track_ref(track);
+
+    } else if (isnan(track->true_peak)) {
+        job->track = track_ref(track);
+        job->true_peak = TRUE;
+    }
+
+    /* the task exists before the track is handed to the main thread so
+     * the track can be cancelled or prioritized as soon as it is listed
+     */
+
+    if (job->track) job->task = loader_task_get(this, job->track);
+
+    loader_post(this, LOADER_TRACK_ADDED, track, job->data, job->destroy);
+    job->data = NULL;
+    job->destroy = NULL;
+
+    if (!job->track) goto done;
+
+    loader_push_decode(this, job);
+    return;
+
+done:
+    loader_job_free(job);
+}
+
+gboolean loader_enumerate(gpointer data)
+{
+    LoaderJob* job = data;
+    const char* id;
+
+    if (g_atomic_int_get(&job->loader->closed)) {
+        loader_job_free(job);
+        return G_SOURCE_REMOVE;
+    }
+
+    /* symlinks to directories are followed, a directory reached again
+     * (eg a link to a parent) is skipped so a loop ends
+     * the set is shared by the pushes of one drop so a subtree reached
+     * from two dropped folders is listed once, separate drops list it again
+     */
+
+    if (!job->visited) {
+        job->visited = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    }
+    id = job->info ? g_file_info_get_attribute_string(job->info,
+            G_FILE_ATTRIBUTE_ID_FILE) : NULL;
+    if (id) {
+        if (g_hash_table_contains(job->visited, id)) {
+            loader_job_free(job);
+            return G_SOURCE_REMOVE;
+        }
+        g_hash_table_add(job->visited, g_strdup(id));
+    }
+
+    g_file_enumerate_children_async(job->file, LOADER_ATTRIBUTES,
+            G_FILE_QUERY_INFO_NONE, G_PRIORITY_DEFAULT, job->loader->cancellable,
+            loader_enumerate_opened, job);
+    return G_SOURCE_REMOVE;
+}
+
+void loader_enumerate_opened(GObject* source, GAsyncResult* res, gpointer data)
+{
+    LoaderJob* job = data;
+    GError* err = NULL;
+
+    job->children = g_file_enumerate_children_finish(G_FILE(source), res, &err);
+    if (err) {
+        if (!g_error_matches(err, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+            g_printerr("%s\n", err->message);
+        }
+        g_error_free(err);
+        loader_job_free(job);
+        return;
+    }
+
+    g_file_enumerator_next_files_async(job->children, LOADER_ENUMERATE_BATCH,
+            G_PRIORITY_DEFAULT, job->loader->cancellable, loader_enumerate_next, job);
+}
+
+void loader_enumerate_next(GObject* source, GAsyncResult* res, gpointer data)
+{
+    LoaderJob* job = data;
+    Loader* this = job->loader;
+    GError* err = NULL;
+    GList* infos;
+
+    infos = g_file_enumerator_next_files_finish(G_FILE_ENUMERATOR(source), res, &err);
+    if (err) {
+        if (!g_error_matches(err, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+            g_printerr("%s\n", err->message);
+        }
+        g_error_free(err);
+    }
+
+    /* an empty batch is the end of the directory */
+
+    if (!infos || g_atomic_int_get(&this->closed)) {
+        g_list_free_full(infos, g_object_unref);
+        loader_job_free(job);
+        return;
+    }
+
+    /* subdirectories are enumerated right away, audio files are queued with
+     * their attributes so the io pool does not query them again
+     */
+
+    for (GList* item = infos; item; item = item->next) {
+        GFileInfo* info = item->data;
+        GFileType type = g_file_info_get_file_type(info);
+        GFile* file;
+        LoaderJob* child;
+
+        if (    type != G_FILE_TYPE_DIRECTORY
+                && (type != G_FILE_TYPE_REGULAR
+                    || !loader_is_audio(g_file_info_get_content_type(info))))
+        {
+            g_object_unref(info);
+            continue;
+        }
+
+        file = g_file_enumerator_get_child(job->children, info);
+        child = job->copy
+            ? loader_job_new(this, file, info, job->copy(job->data), job->copy, job->destroy)
+            : loader_job_new(this, file, info, NULL, NULL, NULL);
+        if (!child) continue;
+
+        child->queued = stats_begin();
+        if (type == G_FILE_TYPE_DIRECTORY) child->visited = g_hash_table_ref(job->visited);
+        if (type == G_FILE_TYPE_DIRECTORY) {
+            loader_enumerate(child);
+        } else if (!g_thread_pool_push(this->io, child, &err)) {
+            g_printerr("%s\n", err->message);
+            g_clear_error(&err);
+            loader_job_free(child);
+        }
+    }
+    g_list_free(infos);
+
+    g_file_enumerator_next_files_async(job->children, LOADER_ENUMERATE_BATCH,
+            G_PRIORITY_DEFAULT, this->cancellable, loader_enumerate_next, job);
+}
+
+LoaderJob* loader_job_new(Loader* this, GFile* file, GFileInfo* info,
+gpointer data, GBoxedCopyFunc copy, GDestroyNotify destroy)
+{
+    LoaderJob* job;
+
+    if (!(job = calloc(1, sizeof(LoaderJob)))) {
+        fprintf(stderr, "failed to allocate loader job\n");
+        if (destroy) destroy(data);
+        if (info) g_object_unref(info);
+        g_object_unref(file);
+        return NULL;
+    }
+
+    g_atomic_int_inc(&this->ref);
+    job->loader = this;
+    job->file = file;
+    job->info = info;
+    job->data = data;
+    job->copy = copy;
+    job->destroy = destroy;
+    return job;
+}
+
+gboolean loader_is_audio(const gchar* type)
+{
+    /* TODO: find a better way (lib?) to determine file == audio file??? */
+    return type && (g_strstr_len(type, -1, "audio")
+            || g_strstr_len(type, -1, "org.xiph.flac"));
+}
+
+LoaderTask* loader_task_get(Loader* this, Track* track)
+{
+    LoaderTask* task;
+
+    g_mutex_lock(&this->lock);
+    if (!(task = g_hash_table_lookup(this->tasks, track))) {
+        task = g_new0(LoaderTask, 1);
+        task->cancellable = g_cancellable_new();
+        task->priority = G_PRIORITY_DEFAULT;
+        g_hash_table_insert(this->tasks, track, task);
+    }
+    task->jobs++;
+    g_mutex_unlock(&this->lock);
+    return task;
+}
+
+void loader_task_release(Loader* this, Track* track, LoaderTask* task)
+{
+    g_mutex_lock(&this->lock);
+    if (--task->jobs == 0) {
+        g_hash_table_remove(this->tasks, track);
+        g_object_unref(task->cancellable);
+        g_free(task);
+    }
+    g_mutex_unlock(&this->lock);
+}
+
+void loader_task_cancel(UNUSED gpointer key, gpointer value,
+UNUSED gpointer user_data)
+{
+    LoaderTask* task = value;
+    g_cancellable_cancel(task->cancellable);
+}
+
+void loader_push_decode(Loader* this, LoaderJob* job)
+{
+    static gint serial = 0;
+    GError* err = NULL;
+    gboolean queued = FALSE;
+
+    /* a job that is queued again from the decode pool may race loader_free
+     * closed and the pool are checked together with the lock held
+     */
+
+    job->serial = (guint)g_atomic_int_add(&serial, 1);
+    job->queued = stats_begin();
+
+    g_mutex_lock(&this->lock);
+    if (!g_atomic_int_get(&this->closed) && this->decode) {
+        queued = g_thread_pool_push(this->decode, job, &err);
+    }
+    g_mutex_unlock(&this->lock);
+
+    if (err) {
+        g_printerr("%s\n", err->message);
+        g_error_free(err);
+    }
+    if (!queued) loader_job_free(job);
+}
+
+gboolean loader_share_join(Loader* this, LoaderJob* job)
+{
+    LoaderShare* share;
+    const char* fingerprint = job->track->fingerprint;
+    const char* content, * other;
+    Track* track = NULL;
+    gboolean parked = FALSE;
+
+    if (!fingerprint) return FALSE;
+
+    g_mutex_lock(&this->lock);
+    if ((share = g_hash_table_lookup(this->shares, fingerprint))) {
+        track = track_ref(share->track);
+    } else {
+        share = g_new0(LoaderShare, 1);
+        share->track = job->track;
+        g_hash_table_insert(this->shares, (gpointer)fingerprint, share);
+    }
+    g_mutex_unlock(&this->lock);
+
+    if (!track) return FALSE;
+
+    /* both files are hashed without the lock, the analysis may finish (and
+     * the share be released) in the meantime, then the job runs on its own
+     * a parked job already has both hashes when it is released
+     */
+
+    content = track_content(job->track, job->task->cancellable);
+    other = track_content(track, job->task->cancellable);
+
+    if (content && other && strcmp(content, other) == 0) {
+        g_mutex_lock(&this->lock);
+        share = g_hash_table_lookup(this->shares, fingerprint);
+        if (share && share->track == track) {
+            share->aliases = g_slist_prepend(share->aliases, job);
+            parked = TRUE;
+        }
+        g_mutex_unlock(&this->lock);
+    }
+    track_free(track);
+    return parked;
+}
+
+void loader_share_results(Loader* this, Track* track)
+{
+    LoaderShare* share;
+
+    if (!track->fingerprint) return;
+
+    g_mutex_lock(&this->lock);
+    share = g_hash_table_lookup(this->shares, track->fingerprint);
+    if (share && share->track == track) {
+        for (GSList* l = share->aliases; l; l = l->next) {
+            LoaderJob* alias = l->data;
+            track_share(alias->track, track);
+            loader_post(this, LOADER_TRACK_CHANGED, track_ref(alias->track),
+                    NULL, NULL);
+        }
+    }
+    g_mutex_unlock(&this->lock);
+}
+
+void loader_share_release(Loader* this, Track* track)
+{
+    LoaderShare* share;
+    TrackState state;
+    double true_peak;
+
+    if (!track->fingerprint) return;
+
+    g_mutex_lock(&this->lock);
+    share = g_hash_table_lookup(this->shares, track->fingerprint);
+    if (share && share->track == track) {
+        g_hash_table_remove(this->shares, track->fingerprint);
+    } else {
+        share = NULL;
+    }
+    g_mutex_unlock(&this->lock);
+
+    if (!share) return;
+
+    state = track_get_state(track);
+    g_mutex_lock(&track->lock);
+    true_peak = track->true_peak;
+    g_mutex_unlock(&track->lock);
+
+    /* when the analysis failed or was cancelled (the track was removed) the
+     * first parked job takes over and the others wait for it in turn
+     */
+
+    for (GSList* l = share->aliases; l; l = l->next) {
+        LoaderJob* alias = l->data;
+
+        if (state == TRACK_STATE_READY) {
+            track_share(alias->track, track);
+            loader_post(this, LOADER_TRACK_CHANGED, track_ref(alias->track),
+                    NULL, NULL);
+            if (!isnan(true_peak)) {
+                cache_save(alias->track);
+                loader_job_free(alias);
+                continue;
+            }
+            alias->true_peak = TRUE;
+        }
+        if (!loader_share_join(this, alias)) loader_push_decode(this, alias);
+    }
+
+    g_slist_free(share->aliases);
+    g_free(share);
+}
+
+gint loader_compare(gconstpointer a, gconstpointer b, UNUSED gpointer user_data)
+{
+    const LoaderJob* x = a;
+    const LoaderJob* y = b;
+    gint px, py;
+
+    if (x->true_peak != y->true_peak) return x->true_peak ? 1 : -1;
+
+    px = g_atomic_int_get(&x->task->priority);
+    py = g_atomic_int_get(&y->task->priority);
+    if (px != py) return px < py ? -1 : 1;
+
+    /* serials wrap around, their difference does not */
+    return (gint)(x->serial - y->serial);
+}
+
+void loader_decode(gpointer data, gpointer user_data)
+{
+    LoaderJob* job = data;
+    Loader* this = user_data;
+    GCancellable* cancellable;
+    double offset;
+
+    stats_end(STATS_DECODE_WAIT, job->queued);
+    if (g_atomic_int_get(&this->closed)) goto done;
+
+    /* jobs of removed tracks are dropped without opening the file */
+    cancellable = job->task->cancellable;
+    if (g_cancellable_is_cancelled(cancellable)) goto done;
+
+    /* the entry of a copy in the cache is taken over, identical files that
+     * are loading are decoded once and the others wait for the results
+     * both hash whole files, so they run here and not in the io pool
+     */
+
+    if (!job->reference && !job->joined) {
+        job->joined = TRUE;
+        if (!job->true_peak && track_restore(job->track, cancellable) == 0) {
+            loader_post(this, LOADER_TRACK_CHANGED, track_ref(job->track), NULL, NULL);
+            g_mutex_lock(&job->track->lock);
+            job->true_peak = isnan(job->track->true_peak);
+            g_mutex_unlock(&job->track->lock);
+            if (!job->true_peak) goto done;
+        }
+        if (loader_share_join(this, job)) return;
+        if (g_cancellable_is_cancelled(cancellable)) goto done;
+    }
+
+    /* rows are usable (and gain matched) as soon as the lufs are known
+     * the true peak is measured once the decode pool has nothing else to do
+     */
+
+    if (job->true_peak) {
+        track_set_true_peak(job->track, cancellable);
+        loader_post(this, LOADER_TRACK_CHANGED, track_ref(job->track), NULL, NULL);
+        goto done;
+    }
+
+    if (!job->reference) {
+        if (track_analyze(job->track, cancellable, loader_progress, this) == 0) {
+            loader_share_results(this, job->track);
+            job->true_peak = TRUE;
+            loader_push_decode(this, job);
+            return;
+        }
+        goto done;
+    }
+
+    if (align_track(job->reference, job->track, &offset) == 0) {
+        g_mutex_lock(&job->track->lock);
+        job->track->offset = offset;
+        g_mutex_unlock(&job->track->lock);
+        loader_post(this, LOADER_TRACK_CHANGED, track_ref(job->track), NULL, NULL);
+    }
+
+done:
+    loader_job_free(job);
+}
+
+void loader_progress(Track* track, void* data)
+{
+    loader_post(data, LOADER_TRACK_CHANGED, track_ref(track), NULL, NULL);
+}
+
+void loader_post(Loader* this, LoaderEvent event, Track* track,
+gpointer data, GDestroyNotify destroy)
+{
+    LoaderMessage* msg;
+
+    if (!(msg = calloc(1, sizeof(LoaderMessage)))) {
+        fprintf(stderr, "failed to allocate loader message\n");
+        track_free(track);
+        return;
+    }
+
+    g_atomic_int_inc(&this->ref);
+    msg->loader = this;
+    msg->event = event;
+    msg->track = track;
+    msg->data = data;
+    msg->destroy = destroy;
+
+    /* results are handed to the callback on the main thread only
+     * so the callback is free to touch gtk objects
+     * only the first result of a burst schedules a drain, the drain keeps
+     * running until the queue is empty
+     */
+
+    g_async_queue_push(this->results, msg);
+
+    if (g_atomic_int_compare_and_exchange(&this->scheduled, 0, 1)) {
+        g_atomic_int_inc(&this->ref);
+        g_idle_add_full(G_PRIORITY_DEFAULT_IDLE, loader_schedule, this,
+                loader_unref);
+    }
+}
+
+gboolean loader_schedule(gpointer data)
+{
+    Loader* this = data;
+
+    /* tick callbacks only run for mapped widgets, before the window is shown
+     * (eg files passed on the command line) the idle callback drains instead
+     */
+
+    if (    !g_atomic_int_get(&this->closed)
+            && this->clock && !this->tick
+            && gtk_widget_get_mapped(this->clock))
+    {
+        g_atomic_int_inc(&this->ref);
+        this->tick = gtk_widget_add_tick_callback(this->clock, loader_tick,
+                this, loader_tick_destroy);
+        return G_SOURCE_REMOVE;
+    }
+
+    return loader_drain(this) ? G_SOURCE_CONTINUE : G_SOURCE_REMOVE;
+}
+
+gboolean loader_tick(UNUSED GtkWidget* widget, UNUSED GdkFrameClock* clock,
+gpointer data)
+{
+    return loader_drain(data) ? G_SOURCE_CONTINUE : G_SOURCE_REMOVE;
+}
+
+void loader_tick_destroy(gpointer data)
+{
+    Loader* this = data;
+
+    /* also called when the widget is destroyed with the callback installed
+     * pending results are picked up by the next scheduled drain
+     */
+
+    this->tick = 0;
+    if (g_async_queue_length(this->results) > 0) {
+        g_atomic_int_set(&this->scheduled, 0);
+        if (g_atomic_int_compare_and_exchange(&this->scheduled, 0, 1)) {
+            g_atomic_int_inc(&this->ref);
+            g_idle_add_full(G_PRIORITY_DEFAULT_IDLE, loader_schedule, this,
+                    loader_unref);
+        }
+    }
+    loader_unref(this);
+}
+
+gboolean loader_drain(Loader* this)
+{
+    LoaderResult results[LOADER_BATCH];
+    LoaderMessage* msgs[LOADER_BATCH];
+    LoaderMessage* msg;
+    guint n = 0;
+    gboolean closed = g_atomic_int_get(&this->closed);
+
+    /* failed files are freed right away and do not count towards the batch
+     * after loader_free everything is dropped in one go
+     */
+
+    while ((closed || n < LOADER_BATCH)
+            && (msg = g_async_queue_try_pop(this->results)))
+    {
+        if (!msg->track || closed) {
+            loader_message_free(msg);
+            continue;
+        }
+
+        /* clear before the results are read so no progress is missed */
+        if (msg->event == LOADER_TRACK_CHANGED) {
+            g_atomic_int_set(&msg->track->dirty, 0);
+        }
+
+        results[n].event = msg->event;
+        results[n].track = msg->track;
+        results[n].data = msg->data;
+        msgs[n++] = msg;
+    }
+
+    if (n) this->callback(results, n, this->user_data);
+    for (guint i = 0; i < n; i++) loader_message_free(msgs[i]);
+
+    if (g_async_queue_length(this->results) > 0) return TRUE;
+
+    /* a worker might have queued a result right before the flag is reset
+     * it did not schedule a drain itself so take care of it here
+     */
+
+    g_atomic_int_set(&this->scheduled, 0);
+    return g_async_queue_length(this->results) > 0
+        && g_atomic_int_compare_and_exchange(&this->scheduled, 0, 1);
+}
+
+void loader_job_free(LoaderJob* job)
+{
+    /* jobs analyzing a track may have identical tracks waiting on them */
+    if (job->track && !job->reference) loader_share_release(job->loader, job->track);
+
+    /* the data of a failed file must still be destroyed on the main thread */
+
+    if (job->destroy) {
+        loader_post(job->loader, LOADER_TRACK_ADDED, NULL,
+                job->data, job->destroy);
+    }
+    if (job->task) loader_task_release(job->loader, job->track, job->task);
+    track_free(job->track);
+    track_free(job->reference);
+    if (job->file) g_object_unref(job->file);
+    if (job->info) g_object_unref(job->info);
+    if (job->children) g_object_unref(job->children);
+    if (job->visited) g_hash_table_unref(job->visited);
+    g_free(job->path);
+    g_free(job->name);
+    loader_unref(job->loader);
+    free(job);
+}
+
+void loader_message_free(LoaderMessage* msg)
+{
+    if (msg->destroy) msg->destroy(msg->data);
+    track_free(msg->track);
+    loader_unref(msg->loader);
+    free(msg);
+}
+
+void loader_unref(gpointer data)
+{
+    Loader* this = data;
+
+    /* every queued message holds a reference, the queue is empty by now */
+
+    if (g_atomic_int_dec_and_test(&this->ref)) {
+        g_async_queue_unref(this->results);
+        g_hash_table_destroy(this->tasks);
+        g_hash_table_destroy(this->shares);
+        g_object_unref(this->cancellable);
+        g_mutex_clear(&this->lock);
+        free(this);
+    }
+}
@@ -0,0 +1,503 @@
+/**
+ * @author      Arno Lievens (arnolievens@gmail.com)
+ * @date        14/10/2026
+ * @file        loopcache.c
+ * @brief       decoded pcm of the loop region of each track
+ * @copyright   Copyright (c) 2021 Arno Lievens
+ */
+
+#include <glib.h>
+#include <mpv/client.h>
+#include <mpv/stream_cb.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../include/config.h"
+#include "../include/decoder.h"
+#include "../include/track.h"
+
+#include "../include/loopcache.h"
+
+/**
+ * Size of the wav header in front of the pcm
+ */
+#define LOOP_CACHE_HEADER 44
+
+/**
+ * State of a buffer
+ */
+typedef enum LoopBufferState {
+    LOOP_BUFFER_PENDING,        /**< waiting for or being decoded */
+    LOOP_BUFFER_READY,          /**< pcm is complete and immutable */
+    LOOP_BUFFER_FAILED,         /**< could not be decoded or over budget */
+} LoopBufferState;
+
+/**
+ * The decoded region of one track
+ */
+typedef struct LoopBuffer {
+    LoopCache* cache;           /**< reference to the cache */
+    Track* track;               /**< reference to the track */
+    guint id;                   /**< stream id, part of the url */
+    guint generation;           /**< region generation it was requested for */
+    double start;               /**< position of the first frame in seconds */
+    double stop;                /**< requested end of the region in seconds */
+    float* pcm;                 /**< interleaved frames */
+    size_t frames;              /**< number of frames decoded */
+    size_t bytes;               /**< bytes counted against the budget */
+    unsigned int channels;      /**< number of channels */
+    unsigned int sample_rate;   /**< sample rate in Hz */
+    guint8 header[LOOP_CACHE_HEADER]; /**< wav header of the stream */
+    gint state;                 /**< LoopBufferState (atomic) */
+    gint ref;                   /**< reference count (atomic) */
+} LoopBuffer;
+
+/**
+ * An open mpv stream
+ */
+typedef struct LoopStream {
+    LoopBuffer* buffer;         /**< reference to the buffer */
+    uint64_t pos;               /**< read position in the wav file */
+} LoopStream;
+
+/**
+ * Decode the region of a track
+ *
+ * pool function
+ *
+ * @param data the buffer, the reference is passed on
+ * @param user_data the loop cache object
+ */
+static void loop_cache_decode(gpointer data, gpointer user_data);
+
+/**
+ * Report a decoded region on the main thread
+ *
+ * idle function
+ *
+ * @param data the buffer
+ * @return G_SOURCE_REMOVE
+ */
+static gboolean loop_cache_notify(gpointer data);
+
+/**
+ * Write the wav header of a decoded buffer
+ *
+ * @param buffer the buffer
+ */
+static void loop_buffer_header(LoopBuffer* buffer);
+
+/**
+ * Release a reference, the buffer is freed when the last one is dropped
+ *
+ * @param data the buffer
+ */
+static void loop_buffer_unref(gpointer data);
+
+/**
+ * Release a reference, the cache is freed when the last one is dropped
+ *
+ * @param this the loop cache object
+ */
+static void loop_cache_unref(LoopCache* this);
+
+/*
+ * mpv stream callbacks, called from the mpv demuxer thread
+ */
+
+static int loop_stream_open(void* user_data, char* uri, mpv_stream_cb_info* info);
+
+static int64_t loop_stream_read(void* cookie, char* buf, uint64_t nbytes);
+
+static int64_t loop_stream_seek(void* cookie, int64_t offset);
+
+static int64_t loop_stream_size(void* cookie);
+
+static void loop_stream_close(void* cookie);
+
+
+/*******************************************************************************
+ * extern functions
+ */
+
+
+LoopCache* loop_cache_new(LoopCacheReady ready, void* data)
+{
+    GError* err = NULL;
+    LoopCache* this;
+
+    if (!(this = calloc(1, sizeof(LoopCache)))) {
+        fprintf(stderr, "failed to allocate loop cache\n");
+        return NULL;
+    }
+    this->ready = ready;
+    this->ready_data = data;
+    this->ref = 1;
+    this->next_id = 1;
+    g_mutex_init(&this->lock);
+    this->buffers = g_hash_table_new(g_direct_hash, g_direct_equal);
+    this->ids = g_hash_table_new(g_direct_hash, g_direct_equal);
+
+    this->pool = g_thread_pool_new(loop_cache_decode, this, LOOP_CACHE_THREADS,
+            FALSE, &err);
+    if (err) {
+        g_printerr("%s\n", err->message);
+        g_error_free(err);
+        loop_cache_free(this);
+        return NULL;
+    }
+    return this;
+}
+
+int loop_cache_register(LoopCache* this, mpv_handle* mpv)
+{
+    return mpv_stream_cb_add_ro(mpv, LOOP_CACHE_PROTOCOL, this, loop_stream_open);
+}
+
+void loop_cache_set_region(LoopCache* this, double start, double stop)
+{
+    GList* dropped;
+
+    if (stop > start) {
+        start = MAX(start - LOOP_CACHE_PREROLL, 0.0);
+        stop += LOOP_CACHE_PREROLL;
+    } else {
+        start = stop = 0.0;
+    }
+
+    g_mutex_lock(&this->lock);
+
+    if (start == this->start && stop == this->stop) {
+        g_mutex_unlock(&this->lock);
+        return;
+    }
+
+    this->generation++;
+    this->start = start;
+    this->stop = stop;
+
+    dropped = g_hash_table_get_values(this->buffers);
+    g_hash_table_steal_all(this->buffers);
+    g_hash_table_remove_all(this->ids);
+
+    g_mutex_unlock(&this->lock);
+
+    /* the buffers take the lock when freed */
+    g_list_free_full(dropped, loop_buffer_unref);
+}
+
+void loop_cache_request(LoopCache* this, Track* track)
+{
+    GError* err = NULL;
+    LoopBuffer* buffer;
+
+    if (g_atomic_int_get(&this->closed)) return;
+
+    g_mutex_lock(&this->lock);
+
+    if (this->stop <= this->start || g_hash_table_contains(this->buffers, track)) {
+        g_mutex_unlock(&this->lock);
+        return;
+    }
+
+    if (!(buffer = calloc(1, sizeof(LoopBuffer)))) {
+        g_mutex_unlock(&this->lock);
+        fprintf(stderr, "failed to allocate loop buffer\n");
+        return;
+    }
+
+    /* one reference for the tables, one for the decode job */
+
+    g_atomic_int_inc(&this->ref);
+    buffer->cache = this;
+    buffer->track = track_ref(track);
+    buffer->id = this->next_id++;
+    buffer->generation = this->generation;
+
+    /* the region is shifted to the same moment of the music in each track */
+
+    g_mutex_lock(&track->lock);
+    buffer->start = MAX(this->start + track->offset, 0.0);
+    buffer->stop = this->stop + track->offset;
+    g_mutex_unlock(&track->lock);
+
+    buffer->state = LOOP_BUFFER_PENDING;
+    buffer->ref = 2;
+
+    g_hash_table_insert(this->buffers, track, buffer);
+    g_hash_table_insert(this->ids, GUINT_TO_POINTER(buffer->id), buffer);
+
+    g_mutex_unlock(&this->lock);
+
+    if (!g_thread_pool_push(this->pool, buffer, &err)) {
+        g_printerr("%s\n", err->message);
+        g_error_free(err);
+        g_atomic_int_set(&buffer->state, LOOP_BUFFER_FAILED);
+        loop_buffer_unref(buffer);
+    }
+}
+
+int loop_cache_lookup(LoopCache* this, Track* track, double position,
+char* url, size_t n, double* origin)
+{
+    LoopBuffer* buffer;
+    int found = 0;
+
+    g_mutex_lock(&this->lock);
+
+    buffer = g_hash_table_lookup(this->buffers, track);
+    if (buffer && g_atomic_int_get(&buffer->state) == LOOP_BUFFER_READY) {
+        double stop = buffer->start + (double)buffer->frames / buffer->sample_rate;
+
+        if (position >= buffer->start && position < stop) {
+            g_snprintf(url, n, "%s://%u", LOOP_CACHE_PROTOCOL, buffer->id);
+            *origin = buffer->start;
+            found = 1;
+        }
+    }
+
+    g_mutex_unlock(&this->lock);
+    return found;
+}
+
+void loop_cache_free(LoopCache* this)
+{
+    if (!this) return;
+
+    /* queued jobs still run but return right away
+     * a region being decoded is finished in the background
+     */
+
+    g_atomic_int_set(&this->closed, 1);
+    if (this->pool) g_thread_pool_free(this->pool, FALSE, FALSE);
+    this->pool = NULL;
+
+    loop_cache_set_region(this, 0.0, 0.0);
+    loop_cache_unref(this);
+}
+
+
+/*******************************************************************************
+ * static functions
+ *
+ */
+
+
+void loop_cache_decode(gpointer data, gpointer user_data)
+{
+    LoopBuffer* buffer = data;
+    LoopCache* this = user_data;
+    Decoder* decoder = NULL;
+    size_t budget = (size_t)LOOP_CACHE_BUDGET << 20;
+    size_t frames, bytes;
+    int64_t first;
+    int ok;
+
+    if (g_atomic_int_get(&this->closed)) goto fail;
+
+    if (!(decoder = decoder_open(buffer->track->path))) goto fail;
+
+    first = (int64_t)(buffer->start * decoder->sample_rate);
+    frames = (size_t)((buffer->stop - buffer->start) * decoder->sample_rate);
+    bytes = frames * decoder->channels * sizeof(float);
+
+    /* the region is dropped when it was changed while waiting in the queue
+     * tracks that do not fit in the budget are played from disk
+     */
+
+    g_mutex_lock(&this->lock);
+    ok = buffer->generation == this->generation && this->used + bytes <= budget;
+    if (ok) {
+        this->used += bytes;
+        buffer->bytes = bytes;
+    }
+    g_mutex_unlock(&this->lock);
+
+    if (!ok) goto fail;
+
+    if (!(buffer->pcm = malloc(bytes))) {
+        fprintf(stderr, "failed to allocate loop region of \"%s\"\n",
+                buffer->track->path);
+        goto fail;
+    }
+
+    if (first > 0 && decoder_seek(decoder, first) < 0) goto fail;
+
+    buffer->frames = decoder_read(decoder, buffer->pcm, frames);
+    if (decoder->error || !buffer->frames) goto fail;
+
+    buffer->channels = decoder->channels;
+    buffer->sample_rate = decoder->sample_rate;
+    buffer->start = (double)first / decoder->sample_rate;
+    loop_buffer_header(buffer);
+    decoder_close(decoder);
+
+    /* the buffer is immutable from here on, readers check the state first */
+
+    g_atomic_int_set(&buffer->state, LOOP_BUFFER_READY);
+    g_idle_add_full(G_PRIORITY_DEFAULT_IDLE, loop_cache_notify, buffer,
+            loop_buffer_unref);
+    return;
+
+fail:
+    decoder_close(decoder);
+    g_atomic_int_set(&buffer->state, LOOP_BUFFER_FAILED);
+    loop_buffer_unref(buffer);
+}
+
+gboolean loop_cache_notify(gpointer data)
+{
+    LoopBuffer* buffer = data;
+    LoopCache* this = buffer->cache;
+
+    if (    !g_atomic_int_get(&this->closed)
+            && buffer->generation == this->generation
+            && this->ready)
+    {
+        this->ready(buffer->track, this->ready_data);
+    }
+    return G_SOURCE_REMOVE;
+}
+
+void loop_buffer_header(LoopBuffer* buffer)
+{
+    guint8* h = buffer->header;
+    uint32_t data = (uint32_t)(buffer->frames * buffer->channels * sizeof(float));
+    uint32_t align = (uint32_t)(buffer->channels * sizeof(float));
+    uint32_t rate = buffer->sample_rate;
+
+    /* RIFF/WAVE with a single fmt and data chunk, IEEE float samples
+     * all fields are little endian
+     */
+
+#define PUT16(p, v) do { (p)[0] = (guint8)(v); (p)[1] = (guint8)((v) >> 8); } while (0)
+#define PUT32(p, v) do { PUT16(p, v); PUT16((p) + 2, (v) >> 16); } while (0)
+
+    memcpy(h, "RIFF", 4);
+    PUT32(h + 4, 36 + data);
+    memcpy(h + 8, "WAVEfmt ", 8);
+    PUT32(h + 16, 16);                  /* fmt chunk size */
+    PUT16(h + 20, 3);                   /* WAVE_FORMAT_IEEE_FLOAT */
+    PUT16(h + 22, buffer->channels);
+    PUT32(h + 24, rate);
+    PUT32(h + 28, rate * align);        /* bytes per second */
+    PUT16(h + 32, align);               /* block align */
+    PUT16(h + 34, 32);                  /* bits per sample */
+    memcpy(h + 36, "data", 4);
+    PUT32(h + 40, data);
+
+#undef PUT32
+#undef PUT16
+}
+
+void loop_buffer_unref(gpointer data)
+{
+    LoopBuffer* buffer = data;
+    LoopCache* this = buffer->cache;
+
+    if (!g_atomic_int_dec_and_test(&buffer->ref)) return;
+
+    g_mutex_lock(&this->lock);
+    this->used -= buffer->bytes;
+    g_mutex_unlock(&this->lock);
+
+    free(buffer->pcm);
+    track_free(buffer->track);
+    free(buffer);
+    loop_cache_unref(this);
+}
+
+void loop_cache_unref(LoopCache* this)
+{
+    if (!g_atomic_int_dec_and_test(&this->ref)) return;
+
+    g_hash_table_destroy(this->buffers);
+    g_hash_table_destroy(this->ids);
+    g_mutex_clear(&this->lock);
+    free(this);
+}
+
+int loop_stream_open(void* user_data, char* uri, mpv_stream_cb_info* info)
+{
+    LoopCache* this = user_data;
+    LoopBuffer* buffer;
+    LoopStream* stream;
+    const char* id;
+
+    if (!(id = strstr(uri, "://"))) return MPV_ERROR_LOADING_FAILED;
+    id += 3;
+
+    g_mutex_lock(&this->lock);
+    buffer = g_hash_table_lookup(this->ids,
+            GUINT_TO_POINTER((guint)strtoul(id, NULL, 10)));
+    if (buffer && g_atomic_int_get(&buffer->state) == LOOP_BUFFER_READY) {
+        g_atomic_int_inc(&buffer->ref);
+    } else {
+        buffer = NULL;
+    }
+    g_mutex_unlock(&this->lock);
+
+    if (!buffer) return MPV_ERROR_LOADING_FAILED;
+
+    if (!(stream = calloc(1, sizeof(LoopStream)))) {
+        loop_buffer_unref(buffer);
+        return MPV_ERROR_LOADING_FAILED;
+    }
+    stream->buffer = buffer;
+
+    info->cookie = stream;
+    info->read_fn = loop_stream_read;
+    info->seek_fn = loop_stream_seek;
+    info->size_fn = loop_stream_size;
+    info->close_fn = loop_stream_close;
+    return 0;
+}
+
+int64_t loop_stream_read(void* cookie, char* buf, uint64_t nbytes)
+{
+    LoopStream* stream = cookie;
+    LoopBuffer* buffer = stream->buffer;
+    uint64_t size = (uint64_t)loop_stream_size(cookie);
+    uint64_t done = 0;
+
+    nbytes = MIN(nbytes, size - MIN(stream->pos, size));
+
+    if (stream->pos < LOOP_CACHE_HEADER && nbytes) {
+        done = MIN(nbytes, LOOP_CACHE_HEADER - stream->pos);
+        memcpy(buf, buffer->header + stream->pos, done);
+    }
+
+    if (done < nbytes) {
+        uint64_t offset = stream->pos + done - LOOP_CACHE_HEADER;
+        memcpy(buf + done, (const guint8*)buffer->pcm + offset, nbytes - done);
+    }
+
+    stream->pos += nbytes;
+    return (int64_t)nbytes;
+}
+
+int64_t loop_stream_seek(void* cookie, int64_t offset)
+{
+    LoopStream* stream = cookie;
+
+    if (offset < 0 || offset > loop_stream_size(cookie)) return MPV_ERROR_GENERIC;
+    stream->pos = (uint64_t)offset;
+    return offset;
+}
+
+int64_t loop_stream_size(void* cookie)
+{
+    LoopBuffer* buffer = ((LoopStream*)cookie)->buffer;
+
+    return (int64_t)(LOOP_CACHE_HEADER + buffer->frames * buffer->channels * sizeof(float));
+}
+
+void loop_stream_close(void* cookie)
+{
+    LoopStream* stream = cookie;
+
+    loop_buffer_unref(stream->buffer);
+    free(stream);
+}
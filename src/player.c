@@ -7,6 +7,7 @@
  */
 
 #include <errno.h>
+#include <inttypes.h>
 #include <locale.h>
 #include <math.h>
 #include <mpv/client.h>
@@ -17,6 +18,7 @@
 #include <unistd.h>
 
 #include "../include/config.h"
+#include "../include/stats.h"
 #include "../include/track.h"
 
 #include "../include/player.h"
@@ -37,6 +39,153 @@ static double db_to_volume(double volume);
  */
 static void mpv_print_status(const char* cmd, int status);
 
+/**
+ * Flag state changed on the main thread
+ *
+ * the event callback is fired so the change is picked up the same way as
+ * changes reported by mpv
+ *
+ * @param this the player object
+ * @param dirty the PlayerDirty flags to set
+ */
+static void player_touch(Player* this, guint dirty);
+
+/**
+ * Update the playback clock
+ *
+ * main thread only, there is a single writer
+ *
+ * @param this the player object
+ * @param position the new position or a negative value to keep the
+ *        extrapolated position
+ * @param playing whether the position advances with time
+ */
+static void player_clock_set(Player* this, double position, int playing);
+
+/**
+ * Get the mpv volume of a track
+ *
+ * a track that is still being analyzed plays at unity gain, its loudness
+ * is not known yet
+ *
+ * @param this the player object
+ * @param track the track
+ * @return mpv volume
+ */
+static double player_track_volume(Player* this, Track* track);
+
+/**
+ * Find the source of a track
+ *
+ * @param this the player object
+ * @param track the track
+ * @return the source or NULL when track was not added
+ */
+static PlayerSource* player_find_source(Player* this, Track* track);
+
+/**
+ * Load track into mpv
+ *
+ * the decoded loop region is loaded when a loop is set and it contains
+ * position, the file itself otherwise
+ *
+ * @param this the player object
+ * @param track the track
+ * @param position the start position in seconds
+ */
+static void player_open(Player* this, Track* track, double position);
+
+/**
+ * Pass the loop points to mpv
+ *
+ * the points are relative to the start of the loaded file
+ *
+ * @param this the player object
+ */
+static void player_set_ab_loop(Player* this);
+
+/**
+ * Loop cache ready handler
+ *
+ * switches to the loop region of the current track and adds the regions
+ * of the other tracks once they are decoded
+ *
+ * @param track the track whose region was decoded
+ * @param data the player object
+ */
+static void player_loop_ready(Track* track, void* data);
+
+/**
+ * Get the offset of a track
+ *
+ * @param track the track or NULL
+ * @return the offset in seconds, 0 for NULL
+ */
+static double player_track_offset(Track* track);
+
+/**
+ * Convert a position of the current track to the time of the loaded file
+ *
+ * @param this the player object
+ * @param position position in the current track
+ * @return position in the stream of the primary
+ */
+static double player_to_file(Player* this, double position);
+
+/**
+ * Drop the audio tracks of the loaded file
+ *
+ * @param this the player object
+ */
+static void player_reset_sources(Player* this);
+
+/**
+ * Switch to the audio track of a source of the loaded file
+ *
+ * @param this the player object
+ * @param source the source, its aid must be known
+ * @return 0 on success, -1 when mpv refused
+ */
+static int player_switch_source(Player* this, PlayerSource* source);
+
+/**
+ * Add the sources to the loaded file as external audio tracks
+ *
+ * @param this the player object
+ */
+static void player_add_sources(Player* this);
+
+/**
+ * Map the audio tracks of the loaded file to the sources
+ *
+ * @param this the player object
+ * @param list the track-list property
+ */
+static void player_update_sources(Player* this, mpv_node* list);
+
+/**
+ * Init thread, runs mpv_initialize and schedules player_initialized
+ *
+ * @param data the player object
+ * @return NULL
+ */
+static gpointer player_initialize(gpointer data);
+
+/**
+ * Idle callback on the main thread once mpv is initialized
+ *
+ * @param data the player object
+ * @return G_SOURCE_REMOVE
+ */
+static gboolean player_initialized(gpointer data);
+
+/**
+ * Join the init thread and send what was queued while mpv was not ready
+ *
+ * @param this the player object
+ */
+static void player_ready(Player* this);
+
 
 /*******************************************************************************
  * extern functions
@@ -46,14 +195,58 @@ static void mpv_print_status(const char* cmd, int status);
 void player_set_speed(Player* this, gdouble speed)
 {
     int status;
-    if (speed < 0.1 || speed > 10.0) return;
+    if (speed < VARISPEED_MIN_SPEED || speed > VARISPEED_MAX_SPEED) return;
+
+    /* the stretch is muted outside its range */
+    if (this->stretch) {
+        speed = CLAMP(speed, PLAYER_STRETCH_MIN_SPEED, PLAYER_STRETCH_MAX_SPEED);
+    }
     this->speed = speed;
 
+    /* the position so far advanced at the old speed */
+    player_clock_set(this, -1.0, this->clock.playing);
+    if (!this->ready) return;
+
     if ((status = mpv_set_property(this->mpv, "speed", MPV_FORMAT_DOUBLE, &this->speed)) < 0) {
         mpv_print_status("speed", status);
     }
 }
 
+void player_set_stretch(Player* this, int stretch)
+{
+    int status;
+    char filter[128];
+    const char* cmd[] = {"af", stretch ? "add" : "remove", filter, NULL};
+
+    if (!stretch == !this->stretch) return;
+    this->stretch = stretch;
+
+    /* the speed is brought into the range of the stretch first */
+    if (stretch) player_set_speed(this, this->speed);
+    if (!this->ready) return;
+
+    /* with pitch correction mpv hands the speed to the first filter that
+     * takes it instead of resampling, the filter is labeled so it can be
+     * removed again and configured for a short window
+     * the chain is rebuilt, which also moves the current speed over
+     */
+
+    if ((status = mpv_set_property(this->mpv, "audio-pitch-correction",
+                    MPV_FORMAT_FLAG, &stretch)) < 0) {
+        mpv_print_status("audio-pitch-correction", status);
+    }
+
+    snprintf(filter, sizeof(filter),
+            "@stretch:scaletempo2=window-size=%d:search-interval=%d"
+            ":min-speed=%g:max-speed=%g",
+            PLAYER_STRETCH_WINDOW, PLAYER_STRETCH_SEARCH,
+            PLAYER_STRETCH_MIN_SPEED, PLAYER_STRETCH_MAX_SPEED);
+
+    if ((status = mpv_command(this->mpv, cmd)) < 0) {
+        mpv_print_status("af", status);
+    }
+}
+
 void player_stop(Player* this)
 {
     int status;
@@ -66,8 +259,11 @@ void player_stop(Player* this)
      */
 
     this->play_state = PLAY_STATE_STOP;
+    player_reset_sources(this);
+    player_clock_set(this, 0.0, 0);
+    player_touch(this, PLAYER_DIRTY_STATE);
 
-    if ((status = mpv_command(this->mpv, cmd)) < 0) {
+    if (this->ready && (status = mpv_command(this->mpv, cmd)) < 0) {
         mpv_print_status("stop", status);
     }
 
@@ -83,7 +279,9 @@ void player_pause(Player* this)
     int status;
     int pause = 1;
 
-    if ((status = mpv_set_property(this->mpv, "pause", MPV_FORMAT_FLAG, &pause)) < 0) {
+    if (!this->ready) {
+        this->queued_pause = pause;
+    } else if ((status = mpv_set_property(this->mpv, "pause", MPV_FORMAT_FLAG, &pause)) < 0) {
         mpv_print_status("pause", status);
     }
     if (this->rtn) player_goto(this, 0);
@@ -94,7 +292,11 @@ void player_toggle(Player* this)
     int status;
 
     const char* cmd[] = {"cycle", "pause", NULL};
-    if ((status = mpv_command(this->mpv, cmd)) < 0) {
+
+    /* mpv starts unpaused */
+    if (!this->ready) {
+        this->queued_pause = this->queued_pause != 1;
+    } else if ((status = mpv_command(this->mpv, cmd)) < 0) {
         mpv_print_status("cycle, pause", status);
     }
     if (this->rtn) player_goto(this, 0);
@@ -104,6 +306,13 @@ void player_seek(Player* this, double secs)
 {
     int status;
     char secstr[10];
+
+    /* the loop region might not contain the destination */
+    if (this->looping || !this->ready) {
+        player_goto(this, player_get_position(this) + secs);
+        return;
+    }
+
     sprintf(secstr, "%f", secs);
     const char* cmd[] = {"seek", secstr, NULL};
     if ((status = mpv_command(this->mpv, cmd)) < 0) {
@@ -113,61 +322,137 @@ void player_seek(Player* this, double secs)
 
 void player_loop(Player* this)
 {
-    int status;
-    const char* cmd[] = {"ab-loop", NULL};
+    double offset = player_track_offset(this->current);
 
     /* cancel loop */
     if (this->loop_start != 0.0 && this->loop_stop != 0.0) {
         this->loop_start = 0.0;
         this->loop_stop = 0.0;
+        loop_cache_set_region(this->loop_cache, 0.0, 0.0);
 
     /* mark loop stop (B) */
     } else if (this->loop_start != 0.0) {
         this->loop_stop = player_get_position(this);
 
+        /* every track is decoded once, switching and looping are served
+         * from memory as soon as the regions are ready
+         * the region is passed without the offset of the current track, the
+         * cache adds the offset of each track
+         */
+
+        loop_cache_set_region(this->loop_cache,
+                this->loop_start - offset, this->loop_stop - offset);
+        if (this->current) loop_cache_request(this->loop_cache, this->current);
+        for (guint i = 0; i < this->sources->len; i++) {
+            loop_cache_request(this->loop_cache,
+                    g_array_index(this->sources, PlayerSource, i).track);
+        }
+
     /* mark loop start (A) */
     } else {
         this->loop_stop = 0.0;
         this->loop_start = player_get_position(this);
     }
+    player_touch(this, PLAYER_DIRTY_LOOP);
 
-    if ((status = mpv_command(this->mpv, cmd)) < 0) {
-        mpv_print_status("ab-loop", status);
+    /* back to the file once the loop is canceled */
+    if (this->looping && this->loop_stop == 0.0) {
+        player_open(this, this->current, player_get_position(this));
+        return;
     }
+    player_set_ab_loop(this);
 }
 
 void player_mark(Player* this)
 {
     this->marker = player_get_position(this);
+    player_touch(this, PLAYER_DIRTY_MARKER);
 }
 
 void player_goto(Player* this, double position)
 {
     if (!this->current) return;
     int status;
+    char url[64];
+    double origin, file;
     position = CLAMP(position, 0, this->current->length);
+    file = player_to_file(this, position);
+
+    /* leaving the loop region reloads the file */
+    if (this->looping && !loop_cache_lookup(this->loop_cache, this->primary,
+                file + this->origin, url, sizeof(url), &origin))
+    {
+        player_open(this, this->current, position);
+        return;
+    }
+
+    /* the file is opened at the position once mpv is ready */
+    if (!this->ready) {
+        player_clock_set(this, position, this->clock.playing);
+        return;
+    }
 
-    char posstr[9];
-    g_snprintf(posstr, ELEMENTS(posstr), "%f", position);
+    char posstr[32];
+    g_snprintf(posstr, ELEMENTS(posstr), "%f", file);
 
     const char* cmd[] = {"seek", posstr, "absolute+keyframes", NULL};
     if ((status = mpv_command_async(this->mpv, 0, cmd)) < 0) {
         mpv_print_status("seek", status);
+        return;
     }
+
+    /* the seek is async, assume it lands until mpv reports otherwise */
+    player_clock_set(this, position, this->clock.playing);
 }
 
-/** deprecated */
 double player_get_position(Player* this)
 {
-    mpv_get_property(this->mpv, "time-pos", MPV_FORMAT_DOUBLE, &this->position);
-    return this->position;
+    PlayerClock* clock = &this->clock;
+    double position, speed;
+    gint64 time;
+    gint seq;
+    int playing;
+
+    do {
+        seq = g_atomic_int_get(&clock->seq);
+        if (seq & 1) continue;
+        position = clock->position;
+        time = clock->time;
+        speed = clock->speed;
+        playing = clock->playing;
+    } while ((seq & 1) || seq != g_atomic_int_get(&clock->seq));
+
+    if (playing) {
+        position += (double)(g_get_monotonic_time() - time) / G_USEC_PER_SEC * speed;
+    }
+
+    if (this->current && this->current->length > 0.0) {
+        position = MIN(position, this->current->length);
+    }
+    return position;
 }
 
 void player_load_track(Player* this, Track* track)
 {
-    int status;
-    char posstr[99];
-    double gain, volume, position = 0.0;
+    double position = 0.0;
+    double shift = player_track_offset(track) - player_track_offset(this->current);
+    double* points[] = {&this->marker, &this->loop_start, &this->loop_stop};
+    PlayerSource* source;
+    gint64 start = stats_begin();
+
+    /* the time to the events mpv sends when the new track plays is
+     * measured from here, including the wait for the next ui frame
+     */
+
+    this->restart_since = this->reconfig_since = start;
+
+    /* the marker and loop points move along to the same moment in the new
+     * track, 0 means not set so they are kept just above it
+     */
+
+    for (size_t i = 0; i < ELEMENTS(points); i++) {
+        if (*points[i] != 0.0) *points[i] = MAX(*points[i] + shift, 0.001);
+    }
 
     /* automatically deduce the position
      * when STOPPED position reverts to 0
@@ -181,36 +466,99 @@ void player_load_track(Player* this, Track* track)
             position = this->marker;
 
         } else if (!this->rtn) {
-            position = player_get_position(this);
+            position = MAX(player_get_position(this) + shift, 0.0);
         }
     }
 
-    gain = this->min_lufs - track->lufs;
-    volume = db_to_volume(gain);
+    /* the track is open in the loaded file, mpv keeps playing and feeds
+     * the output from the other audio track from the current position on
+     * so only the position rules other than "continue" need a seek
+     */
+
+    source = player_find_source(this, track);
+    if (this->loaded && source && source->aid > 0
+            && player_switch_source(this, source) == 0)
+    {
+        this->current = track;
+        player_clock_set(this, position, this->clock.playing);
+        player_touch(this, PLAYER_DIRTY_TRACK | PLAYER_DIRTY_LOOP | PLAYER_DIRTY_MARKER);
+        player_set_ab_loop(this);
+
+        if (this->play_state == PLAY_STATE_STOP || this->marker != 0.0 || this->rtn) {
+            player_goto(this, position);
+        }
+        stats_end(STATS_LOAD_TRACK, start);
+        return;
+    }
+
+    player_open(this, track, position);
+    stats_end(STATS_LOAD_TRACK, start);
+}
+
+void player_open(Player* this, Track* track, double position)
+{
+    int status;
+    char posstr[99], url[64];
+    const char* path = track->path;
+    double volume, origin = 0.0, delay = 0.0;
+
+    this->looping = this->loop_start != 0.0 && this->loop_stop != 0.0
+            && loop_cache_lookup(this->loop_cache, track, position,
+                    url, sizeof(url), &origin);
+    if (this->looping) path = url;
+    this->origin = this->looping ? origin : 0.0;
+
+    volume = player_track_volume(this, track);
+    this->volume = volume;
 
     /* compensation for time-gap? */
     /* if (position != 0.0) position += 0.050; */
 
+    /* LC_NUMERIC is "C", so %f always uses a decimal point */
     g_snprintf(posstr,
             ELEMENTS(posstr),
-            "start=%d.%d,volume=%d.%d",
-            (int)position,
-            (int)(fmod(position, 1.0)*10000000),
-            (int)volume,
-            (int)(fmod(volume, 1.0)*10000000)
+            "start=%f,volume=%f",
+            position - this->origin,
+            volume
     );
 
     this->current = track;
+    player_clock_set(this, position, this->clock.playing);
+    player_touch(this, PLAYER_DIRTY_TRACK | PLAYER_DIRTY_LOOP | PLAYER_DIRTY_MARKER);
 
-    const char *cmd[] = {"loadfile", track->path, "replace", posstr, NULL};
+    /* the external audio tracks are dropped with the old file and added
+     * again once the new one is loaded
+     */
+
+    track_ref(track);
+    track_free(this->primary);
+    this->primary = track;
+    player_reset_sources(this);
+
+    if (!this->ready) {
+        this->queued_open = 1;
+        return;
+    }
+
+    /* the delay persists across files and is only set for external tracks */
+    if ((status = mpv_set_property(this->mpv, "audio-delay", MPV_FORMAT_DOUBLE, &delay)) < 0) {
+        mpv_print_status("audio-delay", status);
+    }
+
+    const char *cmd[] = {"loadfile", path, "replace", posstr, NULL};
     if ((status = mpv_command_async(this->mpv, 0, cmd)) < 0) {
         mpv_print_status("loadfile", status);
     }
+
+    /* the loop points persist across files, they move with the origin */
+    player_set_ab_loop(this);
 }
 
-int player_event_handler(Player* this)
+guint player_event_handler(Player* this)
 {
-	while (this->mpv) {
+    guint dirty;
+
+	while (this->mpv && this->ready) {
 
 		mpv_event *event = mpv_wait_event(this->mpv, 0);
 
@@ -220,47 +568,137 @@ int player_event_handler(Player* this)
                 if (!prop->data) break;
 
                 if (g_strcmp0(prop->name, "time-pos") == 0) {
-                    this->position = *(double*)(prop->data);
+                    this->position = *(double*)(prop->data) + this->origin
+                            - player_track_offset(this->primary)
+                            + player_track_offset(this->current);
+                    player_clock_set(this, this->position, this->clock.playing);
+                    this->dirty |= PLAYER_DIRTY_POSITION;
 
                 } else if (g_strcmp0(prop->name, "core-idle") == 0) {
                     int core_idle = *(int*)(prop->data);
                     this->play_state = core_idle ? PLAY_STATE_PAUSE : PLAY_STATE_PLAY;
+                    player_clock_set(this, -1.0, !core_idle);
+                    this->dirty |= PLAYER_DIRTY_STATE;
 
-                } else if (g_strcmp0(prop->name, "length") == 0) {
-                    if (this->current) {
-                        this->current->length = *(double*)(prop->data);
-                    }
+                } else if (g_strcmp0(prop->name, "track-list") == 0) {
+                    player_update_sources(this, prop->data);
                 }
                 break;
             }
+            case MPV_EVENT_FILE_LOADED: {
+                this->loaded = 1;
+                player_add_sources(this);
+                break;
+            }
+            case MPV_EVENT_PLAYBACK_RESTART: {
+                stats_end(STATS_RESTART, this->restart_since);
+                this->restart_since = 0;
+                break;
+            }
+            case MPV_EVENT_AUDIO_RECONFIG: {
+                stats_end(STATS_AUDIO_RECONFIG, this->reconfig_since);
+                this->reconfig_since = 0;
+                break;
+            }
             case MPV_EVENT_LOG_MESSAGE: {
-                printf("mpv log: %s", (char*)event->data);
+                mpv_event_log_message* msg = event->data;
+                fprintf(stderr, "%10.6f mpv [%s] %s: %s", stats_time(),
+                        msg->prefix, msg->level, msg->text);
                 break;
             }
             case MPV_EVENT_SHUTDOWN:
             case MPV_EVENT_NONE: {
-                return FALSE;
+                goto done;
             }
             default: {
                 break;
             };
         }
     }
-    return FALSE;
+
+done:
+    dirty = this->dirty;
+    this->dirty = 0;
+    return dirty;
 }
 
 void player_set_gain(Player* this, double gain)
 {
     int status;
 
+    this->gain = gain;
+    if (!this->ready) return;
+
     if ((status = mpv_set_property(this->mpv, "replaygain-preamp", MPV_FORMAT_DOUBLE, &gain)) < 0) {
         mpv_print_status("replay-gain-preamp", status);
     }
 }
 
+void player_set_min_lufs(Player* this, double min_lufs)
+{
+    int status;
+    double volume;
+
+    this->min_lufs = min_lufs;
+    if (!this->current) return;
+
+    /* the reference only moves when the quietest track is added or removed
+     * so most calls leave the volume as it is and nothing is sent
+     */
+
+    volume = player_track_volume(this, this->current);
+    if (!this->ready || volume == this->volume) return;
+
+    if ((status = mpv_set_property(this->mpv, "volume", MPV_FORMAT_DOUBLE, &volume)) < 0) {
+        mpv_print_status("volume", status);
+        return;
+    }
+    this->volume = volume;
+}
+
+void player_add_track(Player* this, Track* track)
+{
+    PlayerSource source = { .aid = -1, .added = 0 };
+
+    if (this->sources->len >= PLAYER_SOURCES || player_find_source(this, track)) {
+        return;
+    }
+
+    source.track = track_ref(track);
+    g_array_append_val(this->sources, source);
+    if (this->loop_stop != 0.0) loop_cache_request(this->loop_cache, track);
+    if (this->loaded) player_add_sources(this);
+}
+
+void player_remove_track(Player* this, Track* track)
+{
+    int status;
+    char aidstr[21];
+
+    for (guint i = 0; i < this->sources->len; i++) {
+        PlayerSource* source = &g_array_index(this->sources, PlayerSource, i);
+        if (source->track != track) continue;
+
+        /* the primary track can not be removed from the loaded file */
+        if (this->loaded && source->aid > 0 && track != this->primary) {
+            g_snprintf(aidstr, ELEMENTS(aidstr), "%"PRId64, source->aid);
+            const char* cmd[] = {"audio-remove", aidstr, NULL};
+            if ((status = mpv_command_async(this->mpv, 0, cmd)) < 0) {
+                mpv_print_status("audio-remove", status);
+            }
+        }
+
+        g_free(source->url);
+        track_free(source->track);
+        g_array_remove_index(this->sources, i);
+        return;
+    }
+}
+
 void player_set_event_callback(Player* this, void(*event_callback)(void*))
 {
-	mpv_set_wakeup_callback(this->mpv, event_callback, this);
+    this->event_callback = event_callback;
+    if (this->ready) mpv_set_wakeup_callback(this->mpv, event_callback, this);
 }
 
 Player* player_init()
@@ -278,6 +716,33 @@ Player* player_init()
     this->play_state = PLAY_STATE_STOP;
     this->position = 0;
     this->rtn = 0;
+    this->speed = 1.0;
+    this->stretch = 0;
+    this->min_lufs = 0.0;
+    this->volume = 100.0;
+    this->dirty = 0;
+    this->event_callback = NULL;
+    memset(&this->clock, 0, sizeof(PlayerClock));
+    this->clock.speed = 1.0;
+    this->clock.time = g_get_monotonic_time();
+    this->sources = g_array_new(FALSE, FALSE, sizeof(PlayerSource));
+    this->primary = NULL;
+    this->loaded = 0;
+    this->looping = 0;
+    this->origin = 0.0;
+    this->restart_since = 0;
+    this->reconfig_since = 0;
+    this->gain = 0.0;
+    this->init_thread = NULL;
+    this->init_source = 0;
+    this->init_since = stats_begin();
+    this->ready = 0;
+    this->queued_open = 0;
+    this->queued_pause = -1;
+
+    if (!(this->loop_cache = loop_cache_new(player_loop_ready, this))) {
+        return NULL;
+    }
 
     setlocale(LC_NUMERIC, "C");
     this->mpv = mpv_create();
@@ -285,9 +750,22 @@ Player* player_init()
         fprintf(stderr, "failed creating context\n");
         return NULL;
     }
+    /* log messages are captured with timestamps when asked for */
+    if (g_getenv(STATS_MPV_LOG_ENV)) {
+        mpv_request_log_messages(this->mpv, g_getenv(STATS_MPV_LOG_ENV));
+    }
+
+    /* the length is not observed, it comes from the analysis and the
+     * loaded file is only the loop region while looping
+     */
+
 	mpv_observe_property(this->mpv, 0, "core-idle", MPV_FORMAT_FLAG);
     mpv_observe_property(this->mpv, 0, "time-pos", MPV_FORMAT_DOUBLE);
-	mpv_observe_property(this->mpv, 0, "length", MPV_FORMAT_DOUBLE);
+	mpv_observe_property(this->mpv, 0, "track-list", MPV_FORMAT_NODE);
+
+    if ((status = loop_cache_register(this->loop_cache, this->mpv)) < 0) {
+        mpv_print_status("stream_cb_add_ro", status);
+    }
 
     if ((status = mpv_set_property(this->mpv, "audio-pitch-correction", MPV_FORMAT_FLAG, &false)) < 0) {
         mpv_print_status("audio-pitch-correction", status);
@@ -297,18 +775,38 @@ Player* player_init()
         mpv_print_status("audio-display", status);
     }
 
-    if ((status = mpv_initialize(this->mpv)) < 0) {
-        mpv_print_status("initialize", status);
+    /* loading the config, scripts and the core takes longer than building
+     * the window, the ui keeps using the player in the meantime
+     */
+
+    if (!(this->init_thread = g_thread_try_new("mpv-init", player_initialize,
+                    this, NULL)))
+    {
+        player_initialize(this);
     }
     return this;
 }
 
+void player_wait(Player* this)
+{
+    if (!this->ready) player_ready(this);
+}
+
 void player_free(Player* this)
 {
     if (!this) return;
 
+    if (this->init_thread) g_thread_join(this->init_thread);
+    if (this->init_source) g_source_remove(this->init_source);
     mpv_terminate_destroy(this->mpv);
-    if (this->current) free(this->current);
+    loop_cache_free(this->loop_cache);
+    track_free(this->primary);
+    for (guint i = 0; i < this->sources->len; i++) {
+        PlayerSource* source = &g_array_index(this->sources, PlayerSource, i);
+        g_free(source->url);
+        track_free(source->track);
+    }
+    g_array_free(this->sources, TRUE);
     free(this);
 }
 
@@ -322,6 +820,300 @@ double db_to_volume(double db)
     return exp(log(10.0)*(db/60.0 + 2));
 }
 
+void player_touch(Player* this, guint dirty)
+{
+    this->dirty |= dirty;
+    if (this->event_callback) this->event_callback(this);
+}
+
+double player_track_volume(Player* this, Track* track)
+{
+    double gain = 0.0;
+
+    if (track_get_state(track) == TRACK_STATE_READY) {
+        gain = this->min_lufs - track->lufs;
+    }
+    return db_to_volume(gain);
+}
+
+PlayerSource* player_find_source(Player* this, Track* track)
+{
+    for (guint i = 0; i < this->sources->len; i++) {
+        PlayerSource* source = &g_array_index(this->sources, PlayerSource, i);
+        if (source->track == track) return source;
+    }
+    return NULL;
+}
+
+int player_switch_source(Player* this, PlayerSource* source)
+{
+    int status;
+    double volume = player_track_volume(this, source->track);
+    double delay;
+
+    /* mpv plays all audio tracks in sync with the time of the file, the
+     * delay makes the same moment of the music of both line up
+     */
+
+    delay = (source->origin - player_track_offset(source->track))
+          - (this->origin - player_track_offset(this->primary));
+
+    if ((status = mpv_set_property(this->mpv, "audio-delay", MPV_FORMAT_DOUBLE, &delay)) < 0) {
+        mpv_print_status("audio-delay", status);
+    }
+
+    if ((status = mpv_set_property(this->mpv, "aid", MPV_FORMAT_INT64, &source->aid)) < 0) {
+        mpv_print_status("aid", status);
+        return -1;
+    }
+
+    if ((status = mpv_set_property(this->mpv, "volume", MPV_FORMAT_DOUBLE, &volume)) < 0) {
+        mpv_print_status("volume", status);
+    }
+    this->volume = volume;
+    return 0;
+}
+
+void player_add_sources(Player* this)
+{
+    int status;
+    char url[64];
+    double origin = 0.0;
+    double start = this->loop_start - player_track_offset(this->current);
+
+    for (guint i = 0; i < this->sources->len; i++) {
+        PlayerSource* source = &g_array_index(this->sources, PlayerSource, i);
+        const char* path = source->track->path;
+
+        if (source->added || source->track == this->primary) continue;
+
+        /* a loop region is only added once decoded */
+
+        if (this->looping) {
+            if (!loop_cache_lookup(this->loop_cache, source->track,
+                        start + player_track_offset(source->track),
+                        url, sizeof(url), &origin))
+            {
+                continue;
+            }
+            path = url;
+        }
+
+        /* auto: the track is opened but not selected */
+        const char* cmd[] = {"audio-add", path, "auto", NULL};
+        if ((status = mpv_command_async(this->mpv, 0, cmd)) < 0) {
+            mpv_print_status("audio-add", status);
+            continue;
+        }
+        source->added = 1;
+        source->url = g_strdup(path);
+        source->origin = this->looping ? origin : 0.0;
+    }
+}
+
+void player_update_sources(Player* this, mpv_node* list)
+{
+    if (list->format != MPV_FORMAT_NODE_ARRAY) return;
+
+    for (guint i = 0; i < this->sources->len; i++) {
+        g_array_index(this->sources, PlayerSource, i).aid = -1;
+    }
+
+    /* external tracks are matched by filename, the one track that is not
+     * external is the primary
+     */
+
+    for (int i = 0; i < list->u.list->num; i++) {
+        mpv_node* entry = &list->u.list->values[i];
+        const char* type = NULL, * filename = NULL;
+        int64_t id = -1;
+        int external = 0;
+
+        if (entry->format != MPV_FORMAT_NODE_MAP) continue;
+
+        for (int j = 0; j < entry->u.list->num; j++) {
+            const char* key = entry->u.list->keys[j];
+            mpv_node* value = &entry->u.list->values[j];
+
+            if (g_strcmp0(key, "type") == 0 && value->format == MPV_FORMAT_STRING) {
+                type = value->u.string;
+            } else if (g_strcmp0(key, "id") == 0 && value->format == MPV_FORMAT_INT64) {
+                id = value->u.int64;
+            } else if (g_strcmp0(key, "external") == 0 && value->format == MPV_FORMAT_FLAG) {
+                external = value->u.flag;
+            } else if (g_strcmp0(key, "external-filename") == 0 && value->format == MPV_FORMAT_STRING) {
+                filename = value->u.string;
+            }
+        }
+
+        if (g_strcmp0(type, "audio") != 0 || id < 0) continue;
+
+        for (guint k = 0; k < this->sources->len; k++) {
+            PlayerSource* source = &g_array_index(this->sources, PlayerSource, k);
+
+            if (external ? g_strcmp0(filename, source->url) == 0
+                         : source->track == this->primary) {
+                source->aid = id;
+                if (!external) source->origin = this->origin;
+            }
+        }
+    }
+}
+
+void player_set_ab_loop(Player* this)
+{
+    int status;
+    const char* no = "no";
+    const char* names[] = {"ab-loop-a", "ab-loop-b"};
+    double points[] = {this->loop_start, this->loop_stop};
+
+    if (!this->ready) return;
+
+    for (size_t i = 0; i < ELEMENTS(points); i++) {
+        double point = player_to_file(this, points[i]);
+
+        if (points[i] != 0.0) {
+            status = mpv_set_property(this->mpv, names[i], MPV_FORMAT_DOUBLE, &point);
+        } else {
+            status = mpv_set_property(this->mpv, names[i], MPV_FORMAT_STRING, &no);
+        }
+        if (status < 0) mpv_print_status(names[i], status);
+    }
+}
+
+void player_loop_ready(Track* track, void* data)
+{
+    Player* this = data;
+
+    /* the current track moves to its region right away, the others are
+     * added to it as they come in
+     */
+
+    if (!this->looping) {
+        if (track == this->current && this->play_state != PLAY_STATE_STOP) {
+            player_open(this, track, player_get_position(this));
+        }
+    } else if (this->loaded) {
+        player_add_sources(this);
+    }
+}
+
+double player_track_offset(Track* track)
+{
+    double offset;
+
+    if (!track) return 0.0;
+
+    g_mutex_lock(&track->lock);
+    offset = track->offset;
+    g_mutex_unlock(&track->lock);
+    return offset;
+}
+
+double player_to_file(Player* this, double position)
+{
+    return position - player_track_offset(this->current)
+        + player_track_offset(this->primary) - this->origin;
+}
+
+void player_reset_sources(Player* this)
+{
+    this->loaded = 0;
+    for (guint i = 0; i < this->sources->len; i++) {
+        PlayerSource* source = &g_array_index(this->sources, PlayerSource, i);
+        source->aid = -1;
+        source->added = 0;
+        g_free(source->url);
+        source->url = NULL;
+    }
+}
+
+gpointer player_initialize(gpointer data)
+{
+    int status;
+    Player* this = data;
+    gint64 start = stats_begin();
+
+    if ((status = mpv_initialize(this->mpv)) < 0) {
+        mpv_print_status("initialize", status);
+    }
+    stats_end(STATS_MPV_INIT, start);
+
+    this->init_source = g_idle_add(player_initialized, this);
+    return NULL;
+}
+
+gboolean player_initialized(gpointer data)
+{
+    player_ready(data);
+    return G_SOURCE_REMOVE;
+}
+
+void player_ready(Player* this)
+{
+    int status;
+
+    /* the thread is done once it scheduled the idle callback, the join also
+     * makes init_source visible, even when the callback runs first
+     */
+
+    if (this->init_thread) g_thread_join(this->init_thread);
+    this->init_thread = NULL;
+    if (this->init_source) g_source_remove(this->init_source);
+    this->init_source = 0;
+    this->ready = 1;
+
+    if (this->event_callback) {
+        mpv_set_wakeup_callback(this->mpv, this->event_callback, this);
+    }
+
+    /* the state set by the ui is sent before the file is opened, a pause
+     * set now already applies to the file
+     */
+
+    if (this->speed != 1.0) player_set_speed(this, this->speed);
+    if (this->stretch) {
+        this->stretch = 0;
+        player_set_stretch(this, 1);
+    }
+    if (this->gain != 0.0) player_set_gain(this, this->gain);
+
+    if (this->queued_pause >= 0 && (status = mpv_set_property(this->mpv,
+                    "pause", MPV_FORMAT_FLAG, &this->queued_pause)) < 0)
+    {
+        mpv_print_status("pause", status);
+    }
+    this->queued_pause = -1;
+
+    if (this->queued_open && this->current) {
+        player_open(this, this->current, player_get_position(this));
+    }
+    this->queued_open = 0;
+
+    stats_end(STATS_PLAYER_READY, this->init_since);
+    player_touch(this, PLAYER_DIRTY_STATE);
+}
+
+void player_clock_set(Player* this, double position, int playing)
+{
+    PlayerClock* clock = &this->clock;
+    gint64 now = g_get_monotonic_time();
+
+    if (position < 0.0) {
+        position = clock->position;
+        if (clock->playing) {
+            position += (double)(now - clock->time) / G_USEC_PER_SEC * clock->speed;
+        }
+    }
+
+    g_atomic_int_inc(&clock->seq);
+    clock->position = position;
+    clock->time = now;
+    clock->speed = this->speed;
+    clock->playing = playing;
+    g_atomic_int_inc(&clock->seq);
+}
+
 void mpv_print_status(const char* cmd, int status)
 {
     fprintf(stderr, "mpv error for command: \"%s\"\n > %s\n",
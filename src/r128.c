@@ -0,0 +1,637 @@
+/**
+ * @author      Arno Lievens (arnolievens@gmail.com)
+ * @date        14/10/2026
+ * @file        r128.c
+ * @brief       built-in EBU R128 loudness and peak meter
+ * @copyright   Copyright (c) 2021 Arno Lievens
+ */
+
+#include <ebur128.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../include/config.h"
+
+#include "../include/r128.h"
+
+/**
+ * Kernels are compiled for AVX-512, AVX2 and baseline x86-64, the best one
+ * for the cpu is picked when the program is loaded (needs ifunc)
+ * NEON is the baseline on arm64, so no clones are needed there
+ * the kernels are optimized regardless of the build flags so the vectors
+ * are kept in registers
+ */
+#if defined(__x86_64__) && defined(__linux__) && defined(__has_attribute)
+#if __has_attribute(target_clones)
+#define R128_CLONES __attribute__((target_clones("avx512f", "avx2", "default")))
+#endif
+#endif
+#ifndef R128_CLONES
+#define R128_CLONES
+#endif
+
+/**
+ * Vector helpers are always inlined and store their result through a
+ * pointer, a vector returned from a baseline function into a kernel clone
+ * would not agree on the abi (psabi)
+ */
+#define R128_INLINE __attribute__((always_inline))
+
+#if defined(__GNUC__) && !defined(__clang__)
+#define R128_KERNEL R128_CLONES __attribute__((optimize("O3")))
+#else
+#define R128_KERNEL R128_CLONES
+#endif
+
+/**
+ * Result of comparing vectors, all bits set (-1) or 0 per lane
+ */
+typedef __typeof__((R128Vec){ 0 } > (R128Vec){ 0 }) R128Mask;
+
+/**
+ * Lane wise maximum and absolute value
+ *
+ * macros rather than functions, vector arguments trigger abi notes
+ */
+#define R128_VEC_MAX(a, b) \
+    ((R128Vec)((((a) > (b)) & (R128Mask)(a)) | (~((a) > (b)) & (R128Mask)(b))))
+#define R128_VEC_ABS(a) R128_VEC_MAX(a, -(a))
+
+/**
+ * Energy of the absolute gate, -70 LUFS
+ */
+#define R128_ABSOLUTE_GATE 1.1724653045822981e-07
+
+/**
+ * Factor of the relative gate, -10 LU
+ */
+#define R128_RELATIVE_GATE 0.1
+
+/**
+ * Filter state below this is flushed to zero, so silence does not decay
+ * through (slow) denormals
+ */
+#define R128_DENORMAL 1e-20
+
+/**
+ * Weight of a channel in the default channel map of libebur128
+ *
+ * @param channels number of channels
+ * @param channel index of the channel
+ * @return 1.0 for front, 1.41 for surround and 0.0 for unused (LFE) channels
+ */
+static double r128_channel_weight(unsigned int channels, unsigned int channel);
+
+/**
+ * Set the coefficients of the K-weighting filter (pre-filter and RLB
+ * high-pass combined into one 4th order filter)
+ *
+ * @param this the meter
+ */
+static void r128_init_filter(R128* this);
+
+/**
+ * Set the phases of the true peak interpolator
+ *
+ * @param this the meter
+ */
+static void r128_init_interpolator(R128* this);
+
+/**
+ * K-weight frames and store their energy
+ *
+ * the sample peak is measured as well unless the interpolator does
+ * frames must not cross a gating step
+ *
+ * @param this the meter
+ * @param src interleaved frames
+ * @param frames number of frames
+ * @return sum of the weighted energy of the frames
+ */
+static double r128_filter(R128* this, const float* src, size_t frames)
+    R128_KERNEL;
+
+/**
+ * Measure the sample peak and interpolated true peak of frames
+ *
+ * @param this the meter
+ * @param src interleaved frames
+ * @param frames number of frames
+ */
+static void r128_interpolate(R128* this, const float* src, size_t frames)
+    R128_KERNEL;
+
+/**
+ * Finish a 100ms gating step, adding a 400ms block from the last 4 steps
+ *
+ * @param this the meter
+ */
+static void r128_step(R128* this);
+
+/**
+ * Convert energy to loudness
+ *
+ * @param energy mean square, weighted
+ * @return loudness in LUFS
+ */
+static double r128_energy_to_loudness(double energy);
+
+/**
+ * Print a result that differs from libebur128
+ *
+ * @param what name of the result
+ * @param value result of the built-in meter
+ * @param reference result of libebur128
+ */
+static void r128_validate(const char* what, double value, double reference);
+
+/**
+ * Allocate aligned, zeroed vectors
+ *
+ * @param n number of vectors
+ * @return the vectors or NULL when failed
+ */
+static R128Vec* r128_vec_alloc(size_t n);
+
+/**
+ * Set all lanes of a vector to value
+ */
+static inline R128_INLINE void r128_vec_set(R128Vec* dest, double value)
+{
+    for (unsigned int l = 0; l < R128_LANES; l++) (*dest)[l] = value;
+}
+
+/**
+ * Load the channels of a group from an interleaved frame
+ *
+ * lanes beyond the last channel are 0.0
+ */
+static inline R128_INLINE void r128_vec_load(R128Vec* dest, const float* frame,
+        unsigned int channels, size_t group)
+{
+    for (unsigned int l = 0; l < R128_LANES; l++) {
+        size_t c = group * R128_LANES + l;
+        (*dest)[l] = c < channels ? frame[c] : 0.0;
+    }
+}
+
+
+/*******************************************************************************
+ * extern functions
+ */
+
+
+R128* r128_new(unsigned int channels, unsigned int sample_rate, int mode)
+{
+    R128* this;
+    size_t groups = (channels + R128_LANES - 1) / R128_LANES;
+
+    if (!channels || !sample_rate) return NULL;
+
+    if (!(this = aligned_alloc(sizeof(R128Vec), sizeof(R128)))) {
+        fprintf(stderr, "failed to allocate r128\n");
+        return NULL;
+    }
+    memset(this, 0, sizeof(R128));
+
+    /* the true peak is never reported lower than the sample peak */
+    if (mode & R128_MODE_TRUE_PEAK) mode |= R128_MODE_SAMPLE_PEAK;
+
+    this->channels = channels;
+    this->sample_rate = sample_rate;
+    this->mode = mode;
+    this->groups = groups;
+
+    /* gating steps and the energy of the last frames are rounded like
+     * libebur128 does, so blocks and windows cover the same frames
+     */
+
+    this->step = (sample_rate + 5) / 10;
+    this->energy_len = (size_t)sample_rate * 400 / 1000;
+    if (this->energy_len % this->step) {
+        this->energy_len += this->step - this->energy_len % this->step;
+    }
+
+    this->weight = r128_vec_alloc(groups);
+    this->v = r128_vec_alloc(4 * groups);
+    this->peak = r128_vec_alloc(groups);
+    this->true_peak = r128_vec_alloc(groups);
+    this->energy = calloc(this->energy_len, sizeof(double));
+    this->blocks = g_array_new(FALSE, FALSE, sizeof(double));
+
+    if (!this->weight || !this->v || !this->peak || !this->true_peak || !this->energy) {
+        fprintf(stderr, "failed to allocate r128\n");
+        goto fail;
+    }
+
+    for (unsigned int c = 0; c < channels; c++) {
+        this->weight[c / R128_LANES][c % R128_LANES] = r128_channel_weight(channels, c);
+    }
+    r128_init_filter(this);
+
+    if (mode & R128_MODE_TRUE_PEAK) {
+        r128_init_interpolator(this);
+        if (this->factor && !(this->z = r128_vec_alloc(this->delay * groups))) {
+            fprintf(stderr, "failed to allocate r128\n");
+            goto fail;
+        }
+    }
+
+    if (!R128_BUILTIN || R128_VALIDATE) {
+        int flags = EBUR128_MODE_M;
+        if (mode & R128_MODE_I) flags |= EBUR128_MODE_I;
+        if (mode & R128_MODE_SAMPLE_PEAK) flags |= EBUR128_MODE_SAMPLE_PEAK;
+        if (mode & R128_MODE_TRUE_PEAK) flags |= EBUR128_MODE_TRUE_PEAK;
+
+        if (!(this->reference = ebur128_init(channels, sample_rate, flags))) {
+            fprintf(stderr, "ebur128 could not create ebur128_state!\n");
+            goto fail;
+        }
+    }
+    return this;
+
+fail:
+    r128_free(this);
+    return NULL;
+}
+
+void r128_add_frames(R128* this, const float* src, size_t frames)
+{
+    if (this->reference) ebur128_add_frames_float(this->reference, src, frames);
+    if (!R128_BUILTIN) return;
+
+    if (this->mode & R128_MODE_TRUE_PEAK) r128_interpolate(this, src, frames);
+    if (!(this->mode & R128_MODE_I)) return;
+
+    /* the frames are filtered up to each step boundary, where a block
+     * is added once 4 steps are done
+     */
+
+    while (frames) {
+        size_t n = MIN(frames, this->step - this->step_frames);
+
+        this->step_energy += r128_filter(this, src, n);
+        this->step_frames += n;
+        if (this->step_frames == this->step) r128_step(this);
+
+        src += n * this->channels;
+        frames -= n;
+    }
+
+    for (size_t i = 0; i < 4 * this->groups; i++) {
+        for (unsigned int l = 0; l < R128_LANES; l++) {
+            if (fabs(this->v[i][l]) < R128_DENORMAL) this->v[i][l] = 0.0;
+        }
+    }
+}
+
+double r128_loudness_window(R128* this, unsigned long window)
+{
+    double energy = 0.0, loudness, reference;
+    size_t frames = (size_t)this->sample_rate * window / 1000;
+
+    if (this->reference) {
+        if (ebur128_loudness_window(this->reference, window, &reference) != EBUR128_SUCCESS) {
+            reference = NAN;
+        }
+        if (!R128_BUILTIN) return reference;
+    }
+
+    if (!(this->mode & R128_MODE_I) || frames > this->energy_len) return NAN;
+
+    /* frames before the first one count as silence, like in libebur128 */
+
+    for (size_t i = 0, pos = this->energy_pos; i < frames; i++) {
+        pos = pos ? pos - 1 : this->energy_len - 1;
+        energy += this->energy[pos];
+    }
+    loudness = r128_energy_to_loudness(energy / (double)frames);
+
+    if (this->reference) r128_validate("window loudness", loudness, reference);
+    return loudness;
+}
+
+double r128_loudness_global(R128* this)
+{
+    return r128_loudness_global_multiple(&this, 1);
+}
+
+double r128_loudness_global_multiple(R128** meters, size_t n)
+{
+    double sum = 0.0, threshold, loudness, reference = NAN;
+    size_t count = 0;
+
+    if (meters[0]->reference) {
+        ebur128_state** states = malloc(n * sizeof(ebur128_state*));
+
+        if (states) {
+            for (size_t i = 0; i < n; i++) states[i] = meters[i]->reference;
+            if (ebur128_loudness_global_multiple(states, n, &reference) != EBUR128_SUCCESS) {
+                reference = NAN;
+            }
+            free(states);
+        }
+        if (!R128_BUILTIN) return reference;
+    }
+
+    /* the relative gate is 10 LU below the mean of all blocks that passed
+     * the absolute gate, the loudness is the mean of the blocks above it
+     */
+
+    for (size_t i = 0; i < n; i++) {
+        GArray* blocks = meters[i]->blocks;
+        for (guint j = 0; j < blocks->len; j++) sum += g_array_index(blocks, double, j);
+        count += blocks->len;
+    }
+    if (!count) {
+        loudness = -INFINITY;
+        goto done;
+    }
+    threshold = sum / (double)count * R128_RELATIVE_GATE;
+
+    sum = 0.0;
+    count = 0;
+    for (size_t i = 0; i < n; i++) {
+        GArray* blocks = meters[i]->blocks;
+        for (guint j = 0; j < blocks->len; j++) {
+            double energy = g_array_index(blocks, double, j);
+            if (energy >= threshold) {
+                sum += energy;
+                count++;
+            }
+        }
+    }
+    loudness = count ? r128_energy_to_loudness(sum / (double)count) : -INFINITY;
+
+done:
+    if (meters[0]->reference) r128_validate("global loudness", loudness, reference);
+    return loudness;
+}
+
+double r128_peak(R128* this, gboolean true_peak)
+{
+    double peak = 0.0, reference = 0.0;
+
+    if (this->reference) {
+        for (unsigned int i = 0; i < this->channels; i++) {
+            double value;
+            int status = true_peak
+                ? ebur128_true_peak(this->reference, i, &value)
+                : ebur128_sample_peak(this->reference, i, &value);
+            if (status == EBUR128_SUCCESS) reference = MAX(reference, value);
+        }
+        if (!R128_BUILTIN) return reference;
+    }
+
+    for (size_t g = 0; g < this->groups; g++) {
+        R128Vec v = this->peak[g];
+        if (true_peak) v = R128_VEC_MAX(v, this->true_peak[g]);
+        for (unsigned int l = 0; l < R128_LANES; l++) peak = MAX(peak, v[l]);
+    }
+
+    if (this->reference) {
+        r128_validate(true_peak ? "true peak" : "sample peak",
+                20.0 * log10(peak), 20.0 * log10(reference));
+    }
+    return peak;
+}
+
+void r128_free(R128* this)
+{
+    if (!this) return;
+
+    if (this->reference) ebur128_destroy(&this->reference);
+    if (this->blocks) g_array_free(this->blocks, TRUE);
+    free(this->energy);
+    free(this->z);
+    free(this->true_peak);
+    free(this->peak);
+    free(this->v);
+    free(this->weight);
+    free(this);
+}
+
+
+/*******************************************************************************
+ * static functions
+ *
+ */
+
+
+double r128_channel_weight(unsigned int channels, unsigned int channel)
+{
+    /* L R Ls Rs, L R C Ls Rs and L R C LFE Ls Rs (others unused) */
+
+    if (channels == 4) return channel < 2 ? 1.0 : 1.41;
+    if (channels == 5) return channel < 3 ? 1.0 : 1.41;
+
+    switch (channel) {
+        case 0:
+        case 1:
+        case 2:
+            return 1.0;
+
+        case 4:
+        case 5:
+            return 1.41;
+
+        default:
+            return 0.0;
+    }
+}
+
+void r128_init_filter(R128* this)
+{
+    double f0 = 1681.974450955533;
+    double G = 3.999843853973347;
+    double Q = 0.7071752369554196;
+    double K = tan(M_PI * f0 / (double)this->sample_rate);
+    double Vh = pow(10.0, G / 20.0);
+    double Vb = pow(Vh, 0.4996667741545416);
+    double a0 = 1.0 + K / Q + K * K;
+    double pb[3], pa[3], rb[3] = { 1.0, -2.0, 1.0 }, ra[3];
+
+    /* high shelf pre-filter, modelling the head */
+
+    pb[0] = (Vh + Vb * K / Q + K * K) / a0;
+    pb[1] = 2.0 * (K * K - Vh) / a0;
+    pb[2] = (Vh - Vb * K / Q + K * K) / a0;
+    pa[0] = 1.0;
+    pa[1] = 2.0 * (K * K - 1.0) / a0;
+    pa[2] = (1.0 - K / Q + K * K) / a0;
+
+    /* RLB high-pass */
+
+    f0 = 38.13547087602444;
+    Q = 0.5003270373238773;
+    K = tan(M_PI * f0 / (double)this->sample_rate);
+
+    ra[0] = 1.0;
+    ra[1] = 2.0 * (K * K - 1.0) / (1.0 + K / Q + K * K);
+    ra[2] = (1.0 - K / Q + K * K) / (1.0 + K / Q + K * K);
+
+    r128_vec_set(&this->b[0], pb[0] * rb[0]);
+    r128_vec_set(&this->b[1], pb[0] * rb[1] + pb[1] * rb[0]);
+    r128_vec_set(&this->b[2], pb[0] * rb[2] + pb[1] * rb[1] + pb[2] * rb[0]);
+    r128_vec_set(&this->b[3], pb[1] * rb[2] + pb[2] * rb[1]);
+    r128_vec_set(&this->b[4], pb[2] * rb[2]);
+
+    r128_vec_set(&this->a[0], pa[0] * ra[0]);
+    r128_vec_set(&this->a[1], pa[0] * ra[1] + pa[1] * ra[0]);
+    r128_vec_set(&this->a[2], pa[0] * ra[2] + pa[1] * ra[1] + pa[2] * ra[0]);
+    r128_vec_set(&this->a[3], pa[1] * ra[2] + pa[2] * ra[1]);
+    r128_vec_set(&this->a[4], pa[2] * ra[2]);
+}
+
+void r128_init_interpolator(R128* this)
+{
+    /* windowed sinc, split in one phase per output sample
+     * above 192kHz the sample peak is the true peak
+     */
+
+    this->factor = this->sample_rate < 96000 ? 4 : this->sample_rate < 192000 ? 2 : 0;
+    if (!this->factor) return;
+
+    this->delay = (R128_TAPS + this->factor - 1) / this->factor;
+
+    for (unsigned int j = 0; j < R128_TAPS; j++) {
+        double m = (double)j - (double)(R128_TAPS - 1) / 2.0;
+        double c = 1.0;
+
+        if (fabs(m) > 0.000001) {
+            c = sin(m * M_PI / this->factor) / (m * M_PI / this->factor);
+        }
+        c *= 0.5 * (1.0 - cos(2.0 * M_PI * j / (R128_TAPS - 1)));
+
+        if (fabs(c) > 0.000001) {
+            unsigned int f = j % this->factor;
+            unsigned int t = this->taps[f]++;
+            r128_vec_set(&this->coeff[f][t], c);
+            this->index[f][t] = j / this->factor;
+        }
+    }
+}
+
+double r128_filter(R128* this, const float* src, size_t frames)
+{
+    double sum = 0.0;
+    size_t groups = this->groups;
+    unsigned int channels = this->channels;
+    int peak = (this->mode & R128_MODE_SAMPLE_PEAK)
+            && !(this->mode & R128_MODE_TRUE_PEAK);
+
+    /* each lane is a channel, the filter runs on all of them at once
+     * direct form II of the combined 4th order filter
+     */
+
+    for (size_t i = 0; i < frames; i++, src += channels) {
+        R128Vec e = { 0 };
+        double energy = 0.0;
+
+        for (size_t g = 0; g < groups; g++) {
+            R128Vec* v = this->v + 4 * g;
+            R128Vec x;
+            R128Vec v0, y;
+
+            r128_vec_load(&x, src, channels, g);
+
+            if (peak) this->peak[g] = R128_VEC_MAX(this->peak[g], R128_VEC_ABS(x));
+
+            v0 = x - this->a[1] * v[0] - this->a[2] * v[1]
+                   - this->a[3] * v[2] - this->a[4] * v[3];
+            y = this->b[0] * v0 + this->b[1] * v[0] + this->b[2] * v[1]
+              + this->b[3] * v[2] + this->b[4] * v[3];
+
+            v[3] = v[2];
+            v[2] = v[1];
+            v[1] = v[0];
+            v[0] = v0;
+
+            e += this->weight[g] * y * y;
+        }
+
+        for (unsigned int l = 0; l < R128_LANES; l++) energy += e[l];
+
+        this->energy[this->energy_pos] = energy;
+        if (++this->energy_pos == this->energy_len) this->energy_pos = 0;
+        sum += energy;
+    }
+    return sum;
+}
+
+void r128_interpolate(R128* this, const float* src, size_t frames)
+{
+    size_t groups = this->groups;
+    unsigned int channels = this->channels;
+    unsigned int factor = this->factor, delay = this->delay;
+
+    for (size_t i = 0; i < frames; i++, src += channels) {
+        for (size_t g = 0; g < groups; g++) {
+            R128Vec x;
+            R128Vec* z = this->z + g * delay;
+
+            r128_vec_load(&x, src, channels, g);
+
+            this->peak[g] = R128_VEC_MAX(this->peak[g], R128_VEC_ABS(x));
+            if (!factor) continue;
+
+            /* each phase yields one of the factor interpolated samples */
+
+            z[this->zi] = x;
+            for (unsigned int f = 0; f < factor; f++) {
+                R128Vec acc = { 0 };
+
+                for (unsigned int t = 0; t < this->taps[f]; t++) {
+                    int k = (int)this->zi - (int)this->index[f][t];
+                    if (k < 0) k += (int)delay;
+                    acc += z[k] * this->coeff[f][t];
+                }
+                this->true_peak[g] = R128_VEC_MAX(this->true_peak[g], R128_VEC_ABS(acc));
+            }
+        }
+        if (factor && ++this->zi == delay) this->zi = 0;
+    }
+}
+
+void r128_step(R128* this)
+{
+    double energy;
+
+    this->steps[this->steps_done++ % 4] = this->step_energy;
+    this->step_energy = 0.0;
+    this->step_frames = 0;
+    if (this->steps_done < 4) return;
+
+    /* blocks of 400ms overlap by 300ms, blocks below -70 LUFS never count */
+
+    energy = (this->steps[0] + this->steps[1] + this->steps[2] + this->steps[3])
+           / (double)(4 * this->step);
+    if (energy >= R128_ABSOLUTE_GATE) g_array_append_val(this->blocks, energy);
+}
+
+double r128_energy_to_loudness(double energy)
+{
+    return 10.0 * log10(energy) - 0.691;
+}
+
+void r128_validate(const char* what, double value, double reference)
+{
+    if (value == reference || (isnan(value) && isnan(reference))) return;
+    if (fabs(value - reference) <= R128_VALIDATE_TOLERANCE) return;
+
+    fprintf(stderr, "r128 %s differs from libebur128: %f != %f\n",
+            what, value, reference);
+}
+
+R128Vec* r128_vec_alloc(size_t n)
+{
+    R128Vec* v;
+
+    if (!n) n = 1;
+    if (!(v = aligned_alloc(sizeof(R128Vec), n * sizeof(R128Vec)))) return NULL;
+    memset(v, 0, n * sizeof(R128Vec));
+    return v;
+}
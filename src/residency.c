@@ -0,0 +1,103 @@
+/**
+ * @author      Arno Lievens (arnolievens@gmail.com)
+ * @date        14/10/2026
+ * @file        residency.c
+ * @brief       memory budget for the waveforms of listed tracks
+ * @copyright   Copyright (c) 2021 Arno Lievens
+ */
+
+#include <glib.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../include/track.h"
+
+#include "../include/residency.h"
+
+
+/*******************************************************************************
+ * extern functions
+ */
+
+
+Residency* residency_new(size_t budget, ResidencyPinned pinned, void* data)
+{
+    Residency* this;
+
+    if (!(this = malloc(sizeof(Residency)))) {
+        fprintf(stderr, "failed to allocate residency\n");
+        return NULL;
+    }
+    g_queue_init(&this->lru);
+    this->links = g_hash_table_new(g_direct_hash, g_direct_equal);
+    this->budget = budget;
+    this->pinned = pinned;
+    this->pinned_data = data;
+    return this;
+}
+
+void residency_add(Residency* this, Track* track)
+{
+    if (g_hash_table_contains(this->links, track)) return;
+
+    g_queue_push_head(&this->lru, track);
+    g_hash_table_insert(this->links, track, this->lru.head);
+}
+
+int residency_touch(Residency* this, Track* track)
+{
+    GList* link = g_hash_table_lookup(this->links, track);
+
+    if (!link) {
+        residency_add(this, track);
+    } else if (link != this->lru.head) {
+        g_queue_unlink(&this->lru, link);
+        g_queue_push_head_link(&this->lru, link);
+    }
+    return track_waveform_load(track);
+}
+
+void residency_remove(Residency* this, Track* track)
+{
+    GList* link = g_hash_table_lookup(this->links, track);
+
+    if (!link) return;
+
+    g_queue_delete_link(&this->lru, link);
+    g_hash_table_remove(this->links, track);
+}
+
+size_t residency_trim(Residency* this)
+{
+    size_t used = 0, freed = 0;
+
+    /* the most recently used waveforms are counted first, everything past
+     * the budget is evicted, so a single pass is enough
+     * evicted tracks count 0 bytes, they are skipped cheaply
+     */
+
+    for (GList* link = this->lru.head; link; link = link->next) {
+        Track* track = link->data;
+        size_t bytes = track_waveform_bytes(track);
+
+        if (!bytes) continue;
+
+        if (    used + bytes <= this->budget
+                || (this->pinned && this->pinned(track, this->pinned_data)))
+        {
+            used += bytes;
+            continue;
+        }
+        freed += track_waveform_evict(track);
+    }
+    return freed;
+}
+
+void residency_free(Residency* this)
+{
+    if (!this) return;
+
+    g_queue_clear(&this->lru);
+    g_hash_table_destroy(this->links);
+    free(this);
+}
@@ -0,0 +1,459 @@
+/**
+ * @author      Arno Lievens (arnolievens@gmail.com)
+ * @date        14/10/2026
+ * @file        spectrogram.c
+ * @brief       tiled spectrogram computed in the background
+ * @copyright   Copyright (c) 2021 Arno Lievens
+ */
+
+#include <glib.h>
+#include <libavutil/common.h>
+#include <libavutil/mem.h>
+#include <libavutil/version.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../include/config.h"
+#include "../include/decoder.h"
+#include "../include/track.h"
+
+#include "../include/spectrogram.h"
+
+/**
+ * the real fft of av_tx is only in libavutil 58, older versions use the
+ * rdft of libavcodec which was removed later on
+ */
+#if LIBAVUTIL_VERSION_INT >= AV_VERSION_INT(58, 0, 100)
+#define SPECTROGRAM_TX
+#include <libavutil/tx.h>
+typedef AVComplexFloat SpectrogramComplex;
+#else
+#include <libavcodec/avfft.h>
+typedef struct SpectrogramComplex {
+    float re;
+    float im;
+} SpectrogramComplex;
+#endif
+
+/**
+ * Decode the file and compute the tiles
+ *
+ * thread function, holds a reference
+ *
+ * @param data the spectrogram object
+ * @return NULL
+ */
+static gpointer spectrogram_run(gpointer data);
+
+/**
+ * Get a column of a level
+ *
+ * the data of its tile is allocated when needed
+ *
+ * @param this the spectrogram object
+ * @param level the level
+ * @param column index of the column
+ * @return the first byte of the column (stride SPECTROGRAM_TILE) or NULL
+ * when failed to allocate
+ */
+static uint8_t* spectrogram_column(Spectrogram* this, int level, size_t column);
+
+/**
+ * Store the peak power of each bin as a column of level 0
+ *
+ * @param this the spectrogram object
+ * @param column index of the column
+ * @param power peak power of SPECTROGRAM_BINS bins, NULL = silence
+ * @return 0 on success, -1 when failed to allocate
+ */
+static int spectrogram_store(Spectrogram* this, size_t column,
+        const float* power);
+
+/**
+ * Finish a tile of level 0 and the levels above as far as it completes them
+ *
+ * @param this the spectrogram object
+ * @param index index of the tile of level 0
+ * @return 0 on success, -1 when failed to allocate
+ */
+static int spectrogram_finish(Spectrogram* this, size_t index);
+
+/**
+ * Call the ready handler
+ *
+ * idle function, holds a reference
+ *
+ * @param data the spectrogram object
+ * @return G_SOURCE_REMOVE
+ */
+static gboolean spectrogram_notify(gpointer data);
+
+/**
+ * Release a reference, everything is freed when the last one is dropped
+ *
+ * @param data the spectrogram object
+ */
+static void spectrogram_unref(gpointer data);
+
+
+/*******************************************************************************
+ * extern functions
+ */
+
+
+Spectrogram* spectrogram_new(Track* track, SpectrogramReady ready, void* data)
+{
+    Spectrogram* this;
+    GThread* thread;
+    double length;
+    size_t columns;
+
+    if (!(this = calloc(1, sizeof(Spectrogram)))) {
+        fprintf(stderr, "failed to allocate spectrogram\n");
+        return NULL;
+    }
+    this->track = track_ref(track);
+    this->ready = ready;
+    this->ready_data = data;
+    this->ref = 1;
+
+    g_mutex_lock(&track->lock);
+    length = track->length;
+    g_mutex_unlock(&track->lock);
+
+    /* the columns are laid out on the length found by the analysis, the
+     * tiles are allocated while they are computed
+     */
+
+    columns = (size_t)MAX(length * SPECTROGRAM_COLUMNS_PER_SECOND, 1.0);
+    this->columns = MIN(columns, SPECTROGRAM_COLUMNS);
+
+    for (int k = 0; k < SPECTROGRAM_LEVELS; k++) {
+        SpectrogramLevel* level = &this->levels[k];
+
+        level->columns = k ? (this->levels[k-1].columns + 1) / 2 : this->columns;
+        level->n_tiles = (level->columns + SPECTROGRAM_TILE - 1) / SPECTROGRAM_TILE;
+
+        if (!(level->tiles = calloc(level->n_tiles, sizeof(SpectrogramTile)))) {
+            fprintf(stderr, "failed to allocate spectrogram tiles\n");
+            spectrogram_unref(this);
+            return NULL;
+        }
+        for (size_t i = 0; i < level->n_tiles; i++) {
+            level->tiles[i].columns = MIN(SPECTROGRAM_TILE,
+                    level->columns - i * SPECTROGRAM_TILE);
+        }
+    }
+
+    /* the thread is not joined, it drops its reference when it stops */
+
+    g_atomic_int_inc(&this->ref);
+    if (!(thread = g_thread_try_new("spectrogram", spectrogram_run, this, NULL))) {
+        fprintf(stderr, "failed to start spectrogram thread\n");
+        spectrogram_unref(this);
+        spectrogram_unref(this);
+        return NULL;
+    }
+    g_thread_unref(thread);
+    return this;
+}
+
+int spectrogram_level(Spectrogram* this, size_t width)
+{
+    for (int k = SPECTROGRAM_LEVELS - 1; k > 0; k--) {
+        if (this->levels[k].columns >= width) return k;
+    }
+    return 0;
+}
+
+SpectrogramTile* spectrogram_tile(Spectrogram* this, int level, size_t index)
+{
+    SpectrogramTile* tile;
+
+    if (level < 0 || level >= SPECTROGRAM_LEVELS) return NULL;
+    if (index >= this->levels[level].n_tiles) return NULL;
+
+    tile = &this->levels[level].tiles[index];
+    return g_atomic_int_get(&tile->done) ? tile : NULL;
+}
+
+gboolean spectrogram_finished(Spectrogram* this)
+{
+    size_t total = 0;
+
+    for (int k = 0; k < SPECTROGRAM_LEVELS; k++) total += this->levels[k].n_tiles;
+    return (size_t)g_atomic_int_get(&this->tiles_done) == total;
+}
+
+void spectrogram_free(Spectrogram* this)
+{
+    if (!this) return;
+
+    g_atomic_int_set(&this->cancelled, 1);
+    this->ready = NULL;
+    spectrogram_unref(this);
+}
+
+
+/*******************************************************************************
+ * static functions
+ *
+ */
+
+
+gpointer spectrogram_run(gpointer data)
+{
+    Spectrogram* this = data;
+    Decoder* decoder;
+#ifdef SPECTROGRAM_TX
+    AVTXContext* tx = NULL;
+    av_tx_fn tx_fn;
+    float scale = 1.0f;
+#else
+    RDFTContext* tx = NULL;
+#endif
+    SpectrogramComplex* out = NULL;
+    float* pcm = NULL, * mono = NULL, * in = NULL, * window = NULL;
+    float power[SPECTROGRAM_BINS];
+    double column_frames, length;
+    size_t hop, filled = 0, column = 0;
+    int64_t start = 0;
+    gboolean any = FALSE;
+
+    if (!(decoder = decoder_open(this->track->path))) goto done;
+
+    g_mutex_lock(&this->track->lock);
+    length = this->track->length;
+    g_mutex_unlock(&this->track->lock);
+
+    /* a column spans at least one frame of the file, short columns get
+     * overlapping fft frames so none of them is empty
+     */
+
+    column_frames = decoder->frames > 0
+        ? (double)decoder->frames : length * decoder->sample_rate;
+    column_frames = MAX(1.0, column_frames / (double)this->columns);
+    hop = (size_t)MIN((double)SPECTROGRAM_FFT, column_frames);
+
+    pcm = malloc(hop * decoder->channels * sizeof(float));
+    mono = malloc(SPECTROGRAM_FFT * sizeof(float));
+    window = malloc(SPECTROGRAM_FFT * sizeof(float));
+    in = av_malloc(SPECTROGRAM_FFT * sizeof(float));
+    out = av_malloc((SPECTROGRAM_BINS + 1) * sizeof(SpectrogramComplex));
+    if (!pcm || !mono || !window || !in || !out) {
+        fprintf(stderr, "failed to allocate spectrogram buffers\n");
+        goto done;
+    }
+
+#ifdef SPECTROGRAM_TX
+    if (av_tx_init(&tx, &tx_fn, AV_TX_FLOAT_RDFT, 0, SPECTROGRAM_FFT, &scale, 0) < 0) {
+#else
+    if (!(tx = av_rdft_init(av_log2(SPECTROGRAM_FFT), DFT_R2C))) {
+#endif
+        fprintf(stderr, "failed to create fft of size %d\n", SPECTROGRAM_FFT);
+        goto done;
+    }
+
+    for (size_t i = 0; i < SPECTROGRAM_FFT; i++) {
+        window[i] = (float)(0.5 - 0.5 * cos(2.0 * M_PI * (double)i / SPECTROGRAM_FFT));
+    }
+
+    for (;;) {
+        size_t n, c;
+
+        if (g_atomic_int_get(&this->cancelled)) goto done;
+
+        /* the last SPECTROGRAM_FFT frames are kept in mono, hop at a time */
+
+        if (!(n = decoder_read(decoder, pcm, hop))) break;
+
+        if (filled + n > SPECTROGRAM_FFT) {
+            size_t drop = filled + n - SPECTROGRAM_FFT;
+            memmove(mono, mono + drop, (filled - drop) * sizeof(float));
+            filled -= drop;
+            start += (int64_t)drop;
+        }
+        for (size_t i = 0; i < n; i++) {
+            float sum = 0.0f;
+            for (unsigned int ch = 0; ch < decoder->channels; ch++) {
+                sum += pcm[i * decoder->channels + ch];
+            }
+            mono[filled++] = sum / (float)decoder->channels;
+        }
+        if (filled < SPECTROGRAM_FFT) continue;
+
+        /* the estimate of the length may be short, the rest goes into the
+         * last column
+         */
+
+        c = MIN((size_t)((double)start / column_frames), this->columns - 1);
+
+        while (column < c) {
+            if (spectrogram_store(this, column, any ? power : NULL) < 0) goto done;
+            if (    ((column + 1) % SPECTROGRAM_TILE == 0)
+                    && spectrogram_finish(this, column / SPECTROGRAM_TILE) < 0)
+            {
+                goto done;
+            }
+            column++;
+            any = FALSE;
+        }
+
+        for (size_t i = 0; i < SPECTROGRAM_FFT; i++) in[i] = mono[i] * window[i];
+#ifdef SPECTROGRAM_TX
+        tx_fn(tx, out, in, sizeof(float));
+#else
+        /* in place, the real nyquist bin is packed in the imaginary part of
+         * the dc bin and is not used
+         */
+
+        av_rdft_calc(tx, in);
+        out[0].re = in[0];
+        out[0].im = 0.0f;
+        for (size_t i = 1; i < SPECTROGRAM_BINS; i++) {
+            out[i].re = in[2 * i];
+            out[i].im = in[2 * i + 1];
+        }
+#endif
+
+        for (size_t i = 0; i < SPECTROGRAM_BINS; i++) {
+            float p = out[i].re * out[i].re + out[i].im * out[i].im;
+            power[i] = any ? MAX(power[i], p) : p;
+        }
+        any = TRUE;
+    }
+    if (decoder->error) goto done;
+
+    /* the columns after the end of a file shorter than estimated are silent */
+
+    for (; column < this->columns; column++) {
+        if (spectrogram_store(this, column, any ? power : NULL) < 0) goto done;
+        any = FALSE;
+        if (    ((column + 1) % SPECTROGRAM_TILE == 0 || column + 1 == this->columns)
+                && spectrogram_finish(this, column / SPECTROGRAM_TILE) < 0)
+        {
+            goto done;
+        }
+    }
+
+done:
+#ifdef SPECTROGRAM_TX
+    av_tx_uninit(&tx);
+#else
+    av_rdft_end(tx);
+#endif
+    av_free(in);
+    av_free(out);
+    free(window);
+    free(mono);
+    free(pcm);
+    decoder_close(decoder);
+    spectrogram_unref(this);
+    return NULL;
+}
+
+uint8_t* spectrogram_column(Spectrogram* this, int level, size_t column)
+{
+    SpectrogramTile* tile = &this->levels[level].tiles[column / SPECTROGRAM_TILE];
+
+    if (!tile->data && !(tile->data = calloc(SPECTROGRAM_BINS * SPECTROGRAM_TILE, 1))) {
+        fprintf(stderr, "failed to allocate spectrogram tile\n");
+        return NULL;
+    }
+    return tile->data + column % SPECTROGRAM_TILE;
+}
+
+int spectrogram_store(Spectrogram* this, size_t column, const float* power)
+{
+    const double ref = (SPECTROGRAM_FFT / 4.0) * (SPECTROGRAM_FFT / 4.0);
+    uint8_t* dest;
+
+    if (!(dest = spectrogram_column(this, 0, column))) return -1;
+    if (!power) return 0;
+
+    /* 0 .. -SPECTROGRAM_RANGE dB to 255 .. 0, the highest bin on top
+     * a full scale sine peaks at N/4 through the hann window
+     */
+
+    for (size_t i = 0; i < SPECTROGRAM_BINS; i++) {
+        double db = 10.0 * log10(power[i] / ref + 1e-30);
+        double v = (db + SPECTROGRAM_RANGE) / SPECTROGRAM_RANGE * 255.0;
+        dest[(SPECTROGRAM_BINS - 1 - i) * SPECTROGRAM_TILE] = (uint8_t)CLAMP(v, 0.0, 255.0);
+    }
+    return 0;
+}
+
+int spectrogram_finish(Spectrogram* this, size_t index)
+{
+    SpectrogramLevel* base = &this->levels[0];
+
+    g_atomic_int_set(&base->tiles[index].done, 1);
+    g_atomic_int_inc(&this->tiles_done);
+
+    /* the tile of level 0 covers whole columns of every level above, a
+     * tile of level k is done with the last of its 2^k tiles of level 0
+     */
+
+    for (int k = 1; k < SPECTROGRAM_LEVELS; k++) {
+        SpectrogramLevel* below = &this->levels[k-1];
+        size_t from = (index * SPECTROGRAM_TILE) >> (k - 1);
+        size_t to = MIN(((index + 1) * SPECTROGRAM_TILE) >> (k - 1), below->columns);
+
+        for (size_t j = from / 2; j < (to + 1) / 2; j++) {
+            uint8_t* dest, * a, * b = NULL;
+
+            if (!(dest = spectrogram_column(this, k, j))) return -1;
+            a = spectrogram_column(this, k - 1, 2 * j);
+            if (2 * j + 1 < below->columns) b = spectrogram_column(this, k - 1, 2 * j + 1);
+
+            for (size_t r = 0; r < SPECTROGRAM_BINS; r++) {
+                size_t i = r * SPECTROGRAM_TILE;
+                dest[i] = b ? MAX(a[i], b[i]) : a[i];
+            }
+        }
+
+        if ((index + 1) % (1u << k) == 0 || index + 1 == base->n_tiles) {
+            g_atomic_int_set(&this->levels[k].tiles[index >> k].done, 1);
+            g_atomic_int_inc(&this->tiles_done);
+        }
+    }
+
+    /* bursts of tiles are coalesced in a single call */
+
+    if (g_atomic_int_compare_and_exchange(&this->scheduled, 0, 1)) {
+        g_atomic_int_inc(&this->ref);
+        g_idle_add_full(G_PRIORITY_DEFAULT_IDLE, spectrogram_notify, this,
+                spectrogram_unref);
+    }
+    return 0;
+}
+
+gboolean spectrogram_notify(gpointer data)
+{
+    Spectrogram* this = data;
+
+    g_atomic_int_set(&this->scheduled, 0);
+    if (!g_atomic_int_get(&this->cancelled) && this->ready) {
+        this->ready(this->ready_data);
+    }
+    return G_SOURCE_REMOVE;
+}
+
+void spectrogram_unref(gpointer data)
+{
+    Spectrogram* this = data;
+
+    if (!g_atomic_int_dec_and_test(&this->ref)) return;
+
+    for (int k = 0; k < SPECTROGRAM_LEVELS; k++) {
+        for (size_t i = 0; this->levels[k].tiles && i < this->levels[k].n_tiles; i++) {
+            free(this->levels[k].tiles[i].data);
+        }
+        free(this->levels[k].tiles);
+    }
+    track_free(this->track);
+    free(this);
+}
@@ -0,0 +1,165 @@
+/**
+ * @author      Arno Lievens (arnolievens@gmail.com)
+ * @date        14/10/2026
+ * @file        stats.c
+ * @brief       timing probes on the hot paths
+ * @copyright   Copyright (c) 2021 Arno Lievens
+ */
+
+#include <glib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "../include/config.h"
+
+#include "../include/stats.h"
+
+/**
+ * Histogram of a probe
+ */
+typedef struct StatsHistogram {
+    guint buckets[STATS_BUCKETS];   /**< bucket k: durations below 2^k us */
+    guint count;                    /**< number of samples */
+    gint64 sum;                     /**< total duration in us */
+    gint64 max;                     /**< longest duration in us */
+} StatsHistogram;
+
+/**
+ * Names of the probes, in StatsProbe order
+ */
+static const char* stats_names[STATS_PROBES] = {
+    "file-open",
+    "tags",
+    "r128",
+    "io-wait",
+    "decode-wait",
+    "list-insert",
+    "load-track",
+    "restart",
+    "audio-reconfig",
+    "mpv-init",
+    "player-ready",
+    "startup-window",
+};
+
+/**
+ * Set once by stats_init, read without locking
+ */
+static int stats_enabled;
+static gint64 stats_epoch;
+
+static GMutex stats_lock;
+static StatsHistogram stats_histograms[STATS_PROBES];
+
+/**
+ * Get an upper bound of a percentile
+ *
+ * @param histogram the histogram
+ * @param p the percentile (0-1)
+ * @return the upper bound of the bucket containing p in us
+ */
+static gint64 stats_percentile(StatsHistogram* histogram, double p);
+
+
+/*******************************************************************************
+ * extern functions
+ */
+
+
+int stats_init(void)
+{
+    const char* env = g_getenv(STATS_ENV);
+
+    stats_epoch = g_get_monotonic_time();
+    stats_enabled = env && *env;
+    return stats_enabled;
+}
+
+gint64 stats_begin(void)
+{
+    return stats_enabled ? g_get_monotonic_time() : 0;
+}
+
+void stats_end(StatsProbe probe, gint64 start)
+{
+    StatsHistogram* histogram = &stats_histograms[probe];
+    gint64 us;
+    guint k = 0;
+
+    if (!start) return;
+
+    us = MAX(g_get_monotonic_time() - start, 0);
+    while (k < STATS_BUCKETS - 1 && us >= ((gint64)1 << k)) k++;
+
+    g_mutex_lock(&stats_lock);
+    histogram->buckets[k]++;
+    histogram->count++;
+    histogram->sum += us;
+    histogram->max = MAX(histogram->max, us);
+    g_mutex_unlock(&stats_lock);
+}
+
+double stats_time(void)
+{
+    return (double)(g_get_monotonic_time() - stats_epoch) / G_USEC_PER_SEC;
+}
+
+void stats_dump(FILE* stream)
+{
+    StatsHistogram histograms[STATS_PROBES];
+
+    g_mutex_lock(&stats_lock);
+    memcpy(histograms, stats_histograms, sizeof(histograms));
+    g_mutex_unlock(&stats_lock);
+
+    /* times in ms, the percentiles are the upper bounds of their buckets
+     * the histogram lists count@bucket for the buckets in use
+     */
+
+    fprintf(stream, "stats at %.3fs\n", stats_time());
+    fprintf(stream, "%-15s %8s %10s %10s %10s %10s %10s  %s\n", "probe", "count",
+            "mean", "p50", "p90", "p99", "max", "histogram (<us)");
+
+    for (size_t i = 0; i < STATS_PROBES; i++) {
+        StatsHistogram* histogram = &histograms[i];
+
+        if (!histogram->count) continue;
+
+        fprintf(stream, "%-15s %8u %10.3f %10.3f %10.3f %10.3f %10.3f ",
+                stats_names[i], histogram->count,
+                (double)histogram->sum / histogram->count / 1e3,
+                (double)stats_percentile(histogram, 0.50) / 1e3,
+                (double)stats_percentile(histogram, 0.90) / 1e3,
+                (double)stats_percentile(histogram, 0.99) / 1e3,
+                (double)histogram->max / 1e3);
+
+        for (guint k = 0; k < STATS_BUCKETS; k++) {
+            if (histogram->buckets[k]) {
+                fprintf(stream, " %u@%" G_GINT64_FORMAT, histogram->buckets[k],
+                        (gint64)1 << k);
+            }
+        }
+        fprintf(stream, "\n");
+    }
+    fflush(stream);
+}
+
+
+/*******************************************************************************
+ * static functions
+ *
+ */
+
+
+gint64 stats_percentile(StatsHistogram* histogram, double p)
+{
+    guint total = 0;
+    guint target = (guint)(p * histogram->count);
+
+    for (guint k = 0; k < STATS_BUCKETS; k++) {
+        total += histogram->buckets[k];
+        if (total > target) return MIN((gint64)1 << k, histogram->max);
+    }
+    return histogram->max;
+}
@@ -9,6 +9,7 @@
 #include <assert.h>
 #include <errno.h>
 #include <gtk/gtk.h>
+#include <math.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -18,6 +19,8 @@
 
 #include "../include/track.h"
 #include "../include/player.h"
+#include "../include/spectrogram.h"
+#include "../include/waveform.h"
 #include "../include/config.h"
 
 #include "../include/timeline.h"
@@ -37,38 +40,321 @@ static gboolean on_click(Timeline* this, GdkEvent* event, GtkWidget* darea)
     return FALSE;
 }
 
+/**
+ * Check whether the cached waveform surface is outdated
+ *
+ * the surface depends on the track, the widget size and, while analyzing,
+ * on the number of points and the (partial) loudness
+ */
+static gboolean wave_outdated(Timeline* this, Track* track, gint w, gint h)
+{
+    gboolean outdated;
+
+    if (!this->surface || track != this->wave_track
+            || w != this->wave_w || h != this->wave_h) {
+        return TRUE;
+    }
+
+    g_mutex_lock(&track->lock);
+    outdated = track->lod.len != this->wave_len || track->lufs != this->wave_lufs;
+    g_mutex_unlock(&track->lock);
+
+    return outdated;
+}
+
+/**
+ * Render the waveform of track into the cached surface
+ */
+static void render_wave(Timeline* this, Track* track, GtkWidget* darea,
+gint w, gint h)
+{
+    cairo_t* cr;
+
+    if (this->surface) cairo_surface_destroy(this->surface);
+
+    /* similar surface: same format and scale factor as the window */
+    this->surface = gdk_window_create_similar_surface(
+            gtk_widget_get_window(darea), CAIRO_CONTENT_COLOR_ALPHA, w, h);
+
+    cr = cairo_create(this->surface);
+    gdk_cairo_set_source_rgba(cr, &this->wave);
+    cairo_set_line_width(cr, 1);
+
+    /* the waveform grows while the track is being analyzed
+     * it is scaled to the expected number of points so the part that's
+     * known is drawn in place
+     *
+     * one vertex per pixel column: the highest point of the points falling
+     * in the column is looked up in the min/max pyramid of the track so the
+     * cost depends on the width of the widget, not the length of the track
+     */
+
+    g_mutex_lock(&track->lock);
+
+    size_t len = track->lod.len;
+    gdouble norm = h * TIMELINE_AVG_HEIGHT + track->lufs;
+    gdouble points = MAX((gdouble)len, track->length * 1000.0 / TIME_WINDOW);
+    gdouble step = points / w;
+
+    if (len) {
+        gint x_end = 0;
+
+        cairo_move_to(cr, 0, h);
+        for (gint i = 0; i < w; i++) {
+            int16_t min, max;
+            size_t from = (size_t)(i * step);
+            size_t to = MAX((size_t)((i + 1) * step), from + 1);
+
+            if (waveform_range(&track->lod, track->waveform, from, to,
+                        &min, &max) < 0) {
+                break;
+            }
+            cairo_line_to(cr, i, - track_level_decode(max) + norm);
+            x_end = i;
+        }
+        cairo_line_to(cr, x_end, h);
+
+        cairo_close_path(cr);
+        cairo_fill(cr);
+    }
+
+    this->wave_track = track;
+    this->wave_w = w;
+    this->wave_h = h;
+    this->wave_len = len;
+    this->wave_lufs = track->lufs;
+
+    g_mutex_unlock(&track->lock);
+
+    cairo_destroy(cr);
+}
+
+/**
+ * Free the uploaded tiles
+ */
+static void clear_tiles(Timeline* this)
+{
+    for (size_t i = 0; i < this->n_tiles; i++) {
+        if (this->tiles[i]) cairo_surface_destroy(this->tiles[i]);
+    }
+    free(this->tiles);
+    this->tiles = NULL;
+    this->n_tiles = 0;
+    this->tiles_level = -1;
+}
+
+/**
+ * Height of the waveform, the spectrogram lane is below it
+ */
+static gint wave_height(Timeline* this, gint h)
+{
+    if (!this->spectrogram_shown) return h;
+    return h - (gint)(h * TIMELINE_SPECTROGRAM_HEIGHT);
+}
+
+/**
+ * Redraw the spectrogram lane when tiles were finished
+ */
+static void spectrogram_ready(void* data)
+{
+    Timeline* this = data;
+    gint w = gtk_widget_get_allocated_width(this->darea);
+    gint h = gtk_widget_get_allocated_height(this->darea);
+    gint y = wave_height(this, h);
+
+    gtk_widget_queue_draw_area(this->darea, 0, y, w, h - y);
+}
+
+/**
+ * Compute the spectrogram of the current track while the lane is shown
+ *
+ * tracks are only decoded again once they are analyzed, the finished
+ * spectrograms of the last SPECTROGRAM_RECENT tracks are kept so switching
+ * back does not decode the file again
+ */
+static void update_spectrogram(Timeline* this, Track* track)
+{
+    gboolean wanted = this->spectrogram_shown && track
+        && track_get_state(track) == TRACK_STATE_READY && track->length > 0.0;
+
+    if (this->spectrogram && (!wanted || this->spectrogram->track != track)) {
+        if (spectrogram_finished(this->spectrogram)) {
+            g_queue_push_head(&this->recent, this->spectrogram);
+            while (this->recent.length > SPECTROGRAM_RECENT) {
+                spectrogram_free(g_queue_pop_tail(&this->recent));
+            }
+        } else {
+            spectrogram_free(this->spectrogram);
+        }
+        this->spectrogram = NULL;
+        clear_tiles(this);
+    }
+    if (wanted && !this->spectrogram) {
+        for (GList* l = this->recent.head; l; l = l->next) {
+            Spectrogram* recent = l->data;
+            if (recent->track == track) {
+                g_queue_delete_link(&this->recent, l);
+                this->spectrogram = recent;
+                break;
+            }
+        }
+    }
+    if (wanted && !this->spectrogram) {
+        this->spectrogram = spectrogram_new(track, spectrogram_ready, this);
+    }
+}
+
+/**
+ * Map a spectrogram level to a color (0x00RRGGBB)
+ *
+ * black through blue, red and orange to yellow
+ */
+static guint32 spectrogram_color(uint8_t v)
+{
+    static const guint8 stops[5][3] = {
+        { 0, 0, 0 }, { 0, 0, 160 }, { 200, 0, 80 }, { 255, 140, 0 }, { 255, 255, 200 },
+    };
+    guint i = MIN(v / 64u, 3u);
+    guint f = v - i * 64u;
+    guint32 color = 0;
+
+    for (guint c = 0; c < 3; c++) {
+        gint a = stops[i][c], b = stops[i+1][c];
+        color = color << 8 | (guint32)(a + (b - a) * (gint)f / 64);
+    }
+    return color;
+}
+
+/**
+ * Convert a finished tile to an image surface
+ */
+static cairo_surface_t* upload_tile(SpectrogramTile* tile)
+{
+    cairo_surface_t* surface;
+    unsigned char* data;
+    int stride;
+
+    surface = cairo_image_surface_create(CAIRO_FORMAT_RGB24,
+            (int)tile->columns, SPECTROGRAM_BINS);
+    if (cairo_surface_status(surface) != CAIRO_STATUS_SUCCESS) {
+        cairo_surface_destroy(surface);
+        return NULL;
+    }
+
+    cairo_surface_flush(surface);
+    data = cairo_image_surface_get_data(surface);
+    stride = cairo_image_surface_get_stride(surface);
+
+    for (size_t r = 0; r < SPECTROGRAM_BINS; r++) {
+        guint32* row = (guint32*)(void*)(data + r * (size_t)stride);
+        for (size_t c = 0; c < tile->columns; c++) {
+            row[c] = spectrogram_color(tile->data[r * SPECTROGRAM_TILE + c]);
+        }
+    }
+    cairo_surface_mark_dirty(surface);
+    return surface;
+}
+
+/**
+ * Draw the finished tiles of the spectrogram in the lane at y
+ *
+ * the level with about one column per pixel is drawn, only the tiles
+ * within the clip are uploaded and drawn
+ */
+static void draw_spectrogram(Timeline* this, cairo_t* cr, gint w, gint y, gint h)
+{
+    GdkRectangle clip;
+    SpectrogramLevel* level;
+    gint k = spectrogram_level(this->spectrogram, (size_t)w);
+    gdouble scale;
+
+    level = &this->spectrogram->levels[k];
+
+    if (k != this->tiles_level) {
+        clear_tiles(this);
+        if (!(this->tiles = calloc(level->n_tiles, sizeof(cairo_surface_t*)))) return;
+        this->n_tiles = level->n_tiles;
+        this->tiles_level = k;
+    }
+
+    if (!gdk_cairo_get_clip_rectangle(cr, &clip)) return;
+
+    scale = (gdouble)w / (gdouble)level->columns;
+
+    for (size_t i = 0; i < this->n_tiles; i++) {
+        SpectrogramTile* tile;
+        gdouble x0 = (gdouble)(i * SPECTROGRAM_TILE) * scale;
+        gdouble x1 = x0 + (gdouble)level->tiles[i].columns * scale;
+
+        if (x1 < clip.x || x0 > clip.x + clip.width) continue;
+        if (!(tile = spectrogram_tile(this->spectrogram, k, i))) continue;
+        if (!this->tiles[i] && !(this->tiles[i] = upload_tile(tile))) continue;
+
+        cairo_save(cr);
+        cairo_rectangle(cr, x0, y, x1 - x0, h);
+        cairo_clip(cr);
+        cairo_translate(cr, x0, y);
+        cairo_scale(cr, scale, (gdouble)h / SPECTROGRAM_BINS);
+        cairo_set_source_surface(cr, this->tiles[i], 0, 0);
+        cairo_pattern_set_filter(cairo_get_source(cr), CAIRO_FILTER_BILINEAR);
+        cairo_paint(cr);
+        cairo_restore(cr);
+    }
+}
+
+/**
+ * Queue a redraw of a vertical line at x
+ */
+static void queue_draw_line(Timeline* this, gdouble x)
+{
+    gint h = gtk_widget_get_allocated_height(this->darea);
+
+    /* lines are 2px wide centered on x, with a pixel of margin for
+     * antialiasing
+     */
+
+    gtk_widget_queue_draw_area(this->darea, (gint)floor(x) - 2, 0, 5, h);
+}
+
 static gboolean on_draw(Timeline* this, cairo_t* cr, GtkWidget* darea)
 {
     gint w = gtk_widget_get_allocated_width(darea);
     gint h = gtk_widget_get_allocated_height(darea);
+    gint wave_h = wave_height(this, h);
     gdouble x;
     gdouble scale;
+    Track* track = this->player->current;
 
-    if (!this->player->current || this->player->current->length == 0.0) {
-        return FALSE;
-    }
+    /* remember what is drawn so timeline_update can tell what changed */
 
-    gdk_cairo_set_source_rgba(cr, &this->wave);
-    cairo_set_line_width(cr, 1);
+    this->drawn_track = track;
+    this->drawn_loop_start = this->player->loop_start;
+    this->drawn_loop_stop = this->player->loop_stop;
+    this->drawn_marker = this->player->marker;
+    this->drawn_x = -1.0;
 
-    gdouble* wave = this->player->current->waveform;
-    size_t len = this->player->current->waveform_len;
-    gdouble norm = h * TIMELINE_AVG_HEIGHT + this->player->current->lufs;
+    update_spectrogram(this, track);
 
-    cairo_scale(cr, w / (gdouble)len, 1.0);
+    if (!track || track->length == 0.0) {
+        return FALSE;
+    }
 
-    for (size_t i = 0; i < len; i++) {
-        gdouble y = - wave[i] + norm ;
-        cairo_line_to(cr, (gdouble)i, y);
+    /* the waveform only changes with the track, the size or while the
+     * track is being analyzed, it is blitted from the cached surface
+     * otherwise and gtk clips the blit to the damaged area
+     */
+
+    if (wave_outdated(this, track, w, wave_h)) {
+        render_wave(this, track, darea, w, wave_h);
     }
 
-    cairo_close_path(cr);
+    cairo_set_source_surface(cr, this->surface, 0, 0);
+    cairo_paint(cr);
 
-    cairo_fill(cr);
-    cairo_scale(cr, (gdouble)len / w, 1.0);
+    if (this->spectrogram) draw_spectrogram(this, cr, w, wave_h, h - wave_h);
 
     /* TODO: use cairo scale instead of calculating scale factor manually ?*/
-    scale = this->player->current->length / w;
+    scale = track->length / w;
 
     /* draw loop */
     if (this->player->loop_start != 0.0) {
@@ -104,21 +390,51 @@ static gboolean on_draw(Timeline* this, cairo_t* cr, GtkWidget* darea)
     cairo_line_to(cr, x, h);
     cairo_stroke(cr);
 
+    this->drawn_x = x;
 
     return FALSE;
 }
 
 void timeline_update(Timeline* this)
 {
-    gtk_widget_queue_draw(this->box);
+    Track* track = this->player->current;
+    gint w = gtk_widget_get_allocated_width(this->darea);
+    gint h = gtk_widget_get_allocated_height(this->darea);
+    gdouble x;
+
+    /* anything but the playhead moving redraws the whole timeline */
+
+    if (    track != this->drawn_track
+            || this->player->loop_start != this->drawn_loop_start
+            || this->player->loop_stop != this->drawn_loop_stop
+            || this->player->marker != this->drawn_marker
+            || (track && wave_outdated(this, track, w, wave_height(this, h))))
+    {
+        gtk_widget_queue_draw(this->darea);
+        return;
+    }
+
+    if (!track || track->length == 0.0) return;
+
+    /* only the old and the new playhead are damaged
+     * nothing is queued when it did not move a full pixel
+     */
+
+    x = this->player->position / (track->length / w);
+    if (this->drawn_x >= 0.0 && floor(x) == floor(this->drawn_x)) return;
+
+    if (this->drawn_x >= 0.0) queue_draw_line(this, this->drawn_x);
+    queue_draw_line(this, x);
 }
 
 Timeline* timeline_new(Player* player)
 {
     GtkWidget* frame, * darea;
-    Timeline* this = malloc(sizeof(Timeline));
+    Timeline* this = calloc(1, sizeof(Timeline));
 
     this->player = player;
+    this->drawn_x = -1.0;
+    this->tiles_level = -1;
     this->box = gtk_box_new(GTK_ORIENTATION_VERTICAL, 0);
 
     frame = gtk_frame_new(NULL);
@@ -134,6 +450,7 @@ Timeline* timeline_new(Player* player)
     gtk_container_add(GTK_CONTAINER(frame), darea);
     gtk_widget_set_size_request(darea, WINDOW_X/12, -1);
     gtk_widget_set_hexpand(darea, TRUE);
+    this->darea = darea;
 
     gtk_widget_add_events(darea, GDK_BUTTON_PRESS_MASK);
     g_signal_connect_swapped(darea, "button-press-event", G_CALLBACK(on_click), this);
@@ -144,9 +461,20 @@ Timeline* timeline_new(Player* player)
     return this;
 }
 
+void timeline_toggle_spectrogram(Timeline* this)
+{
+    this->spectrogram_shown = !this->spectrogram_shown;
+    update_spectrogram(this, this->player->current);
+    gtk_widget_queue_draw(this->darea);
+}
+
 void timeline_free(Timeline* this)
 {
     if (!this) return;
+    spectrogram_free(this->spectrogram);
+    while (this->recent.length) spectrogram_free(g_queue_pop_head(&this->recent));
+    clear_tiles(this);
     gtk_widget_destroy(this->box);
+    if (this->surface) cairo_surface_destroy(this->surface);
     free(this);
 }
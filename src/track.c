@@ -6,19 +6,23 @@
  * @copyright   Copyright (c) 2021 Arno Lievens
  */
 
-#include <ebur128.h>
 #include <errno.h>
 #include <libavformat/avformat.h>
 #include <libavutil/dict.h>
 #include <math.h>
-#include <sndfile.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
+#include "../include/cache.h"
 #include "../include/config.h"
+#include "../include/decoder.h"
+#include "../include/fingerprint.h"
+#include "../include/r128.h"
+#include "../include/stats.h"
+#include "../include/waveform.h"
 
 #include "../include/track.h"
 
@@ -26,29 +30,116 @@
  * Set metadata if available
  *
  * overrides the .name property if TITLE or NAME is available
+ * container tags take precedence over stream tags (eg ogg vorbis comments)
  *
  * @param track the Track object
+ * @param decoder the opened file
  */
-static void track_set_libav_tags(Track* this);
+static void track_set_libav_tags(Track* this, Decoder* decoder);
 
 /**
  * Calculate aver loudness
  *
- * sets the loudness .lufs property in track
+ * sets the loudness .lufs and sample .peak properties in track
+ * all remaining frames of the decoder are consumed
  *
  * @param this the track object
+ * @param decoder the opened file
+ * @return 0 on success, -1 when failed
  */
-static void track_set_r128(Track* this, SF_INFO* file_info, SNDFILE* file);
+static int track_set_r128(Track* this, Decoder* decoder);
 
 /**
- * Read file info with libsndfile
+ * Calculate loudness of a long file in parallel
+ *
+ * the file is split in frame ranges of a multiple of TIME_WINDOW, each
+ * analyzed by its own meter on a separate thread
+ * every range but the first is preceded by 300ms of pre-roll so its gating
+ * blocks line up exactly with the blocks of a serial pass and the filters
+ * are settled before the first owned frame
+ * the results are merged with r128_loudness_global_multiple
+ *
+ * @param this the track object
+ * @param decoder the opened file, used for stream info only
+ * @return 1 when the track was analyzed, 0 when the serial path must be used
+ */
+static int track_set_r128_segmented(Track* this, Decoder* decoder);
+
+/**
+ * Analyze a single segment
+ *
+ * thread function used by track_set_r128_segmented
+ *
+ * @param data the TrackSegment to be analyzed
+ * @return NULL
+ */
+static gpointer track_segment_r128(gpointer data);
+
+
+/**
+ * Read stream info
  *
  * sets the samplerate, format, ... properties in track
  *
  * @param this the track object
- * @param file_info the file info object
+ * @param decoder the opened file
+ */
+static void track_set_file_info(Track* this, Decoder* decoder);
+
+/**
+ * Get tag from container or stream metadata
+ *
+ * @param decoder the opened file
+ * @param key name of the tag
+ * @return the tag value or NULL when not present
+ */
+static const char* track_get_tag(Decoder* decoder, const char* key);
+
+/**
+ * Append a point to the waveform
+ *
+ * grows the waveform as needed, called with the lock released
+ *
+ * @param this the track object
+ * @param level encoded loudness of the window
+ * @return 0 on success, -1 when failed to allocate
+ */
+static int track_waveform_push(Track* this, int16_t level);
+
+/**
+ * Publish partial loudness and peak and report progress
+ *
+ * @param this the track object
+ * @param st the state of the (first part of the) analysis
+ */
+static void track_set_progress(Track* this, R128* st);
+
+/**
+ * Report progress, coalesced by the dirty flag
+ *
+ * @param this the track object
  */
-static void track_set_file_info(Track* this, SF_INFO* file_info);
+static void track_changed(Track* this);
+
+/**
+ * Set the hash of the whole file
+ *
+ * a hash set before is kept, the hash of the same file is the same
+ *
+ * @param this the track object
+ * @param content FINGERPRINT_LEN hex digits or NULL, taken over
+ * @return the hash of the track
+ */
+static const char* track_set_content(Track* this, char* content);
+
+/**
+ * Allocate track and set defaults
+ *
+ * @param name displayed name of the file or NULL to use the path
+ * @param path absolute path of the file
+ * @return the newly allocated track or NULL when failed
+ */
+static Track* track_alloc(const char* name, const char* path);
 
 /**
  * Allocate and copy string
@@ -61,6 +152,62 @@ static void track_set_file_info(Track* this, SF_INFO* file_info);
  */
 static char* stralloc(const char* src);
 
+/**
+ * Frame range of a file analyzed by track_set_r128_segmented
+ */
+typedef struct TrackSegment {
+    const char* path;           /**< file to be analyzed */
+    Track* track;               /**< publish progress to track (first only) */
+    GCancellable* cancellable;  /**< aborts the segment or NULL */
+    int64_t start;              /**< first frame owned by the segment */
+    int64_t stop;               /**< frame after the last one, -1 = eof */
+    size_t window;              /**< frames per waveform point */
+    size_t preroll;             /**< frames read before start */
+    R128* st;                   /**< loudness meter of the segment */
+    int16_t* waveform;          /**< waveform points of the segment */
+    size_t waveform_len;        /**< number of waveform points */
+    size_t waveform_size;       /**< allocated number of waveform points */
+    int64_t frames;             /**< number of owned frames read */
+    Fingerprint* fingerprint;   /**< hashes the blocks read or NULL */
+    double peak;                /**< peak level of the segment */
+    int failed;                 /**< segment could not be analyzed exactly */
+} TrackSegment;
+
+/**
+ * Append a point to the waveform of a segment
+ *
+ * the first segment appends to the track directly so it is drawn while
+ * the other segments are still being analyzed
+ *
+ * @param seg the segment
+ * @param level encoded loudness of the window
+ * @return 0 on success, -1 when failed to allocate
+ */
+static int track_segment_push(TrackSegment* seg, int16_t level);
+
+/**
+ * Reserve helper threads for segments
+ *
+ * the helpers of all analyses in the process share one budget of one per
+ * core, the analyzing threads themselves (the decode pool) are not counted
+ *
+ * @param want number of helpers wanted
+ * @return number of helpers reserved, 0 to want
+ */
+static guint track_segment_acquire(guint want);
+
+/**
+ * Return helpers reserved with track_segment_acquire
+ *
+ * @param n number of helpers
+ */
+static void track_segment_release(guint n);
+
+/**
+ * Helper threads running (or reserved) in the process (atomic)
+ */
+static gint track_segment_helpers;
+
 
 /*******************************************************************************
  * extern functions
@@ -69,59 +216,369 @@ static char* stralloc(const char* src);
 
 Track* track_new(const char* name, const char* path)
 {
-    Track* this = NULL;
-    SF_INFO file_info = { 0 };
-    SNDFILE* file;
+    Track* this;
 
-    /* allocate new track and set defaults
-     * the name used by default is probided by the argument but overwritten
-     * by TITLE or NAME tag if present
-     * average loudness is calculated by r123
+    /* previously analyzed files are loaded from the cache
+     * skipping the decoder and the analysis entirely
      */
 
-    if (!path) goto fail;
+    if ((this = track_new_from_cache(name, path))) return this;
+    return track_scan(name, path);
+}
 
-    if (!(this = malloc(sizeof(Track)))) {
-        fprintf(stderr, "failed to allocate track\n");
-        goto fail;
+Track* track_new_from_cache(const char* name, const char* path)
+{
+    Track* this;
+
+    if (!(this = track_alloc(name, path))) return NULL;
+
+    if (!cache_load(this)) {
+        track_free(this);
+        return NULL;
     }
+    this->waveform_size = this->waveform_len;
+    waveform_append(&this->lod, this->waveform, this->waveform_len);
+    this->state = TRACK_STATE_READY;
+    return this;
+}
 
-    this->artist = NULL;
-    this->album = NULL;
-    this->date = NULL;
-    this->offset = 0;
-    this->lufs = 0;
-    this->peak = 0;
-    this->format = 0;
-    this->length = 0;
-    this->sample_rate = NULL;
+Track* track_scan(const char* name, const char* path)
+{
+    Track* this;
+
+    if (!(this = track_probe(name, path))) return NULL;
+    track_analyze(this, NULL, NULL, NULL);
+    return this;
+}
+
+Track* track_probe(const char* name, const char* path)
+{
+    Track* this;
+    Decoder* decoder;
+    gint64 start;
+
+    if (!(this = track_alloc(name, path))) return NULL;
+
+    /* only the header is read, the row can be shown right away
+     * track_analyze opens the file again for decoding, keeping the decoder
+     * open in between would pin a file handle for every queued file
+     */
+
+    if (!(decoder = decoder_probe(this->path))) {
+        track_free(this);
+        return NULL;
+    }
+
+    start = stats_begin();
+    track_set_libav_tags(this, decoder);
+    stats_end(STATS_TAGS, start);
+    track_set_file_info(this, decoder);
+
+    decoder_close(decoder);
+
+    /* the head of the file was just read, it is still in the page cache */
+    this->fingerprint = fingerprint_file(this->path);
+
+    return this;
+}
+
+int track_restore(Track* this, GCancellable* cancellable)
+{
+    Track* source;
+    const char* content;
+    int status = -1;
+
+    if (!this->fingerprint || track_get_state(this) != TRACK_STATE_PENDING) {
+        return -1;
+    }
+
+    /* the whole file is only hashed when an entry may be of a copy */
+
+    if (!cache_find_copy(this)) return -1;
+    if (!(content = track_content(this, cancellable))) return -1;
+
+    /* the entry is loaded into a track of its own, this one may be listed
+     * and is only changed with the lock held
+     */
+
+    if (!(source = track_alloc(this->name, this->path))) return -1;
+    source->fingerprint = strdup(this->fingerprint);
+    source->content = strdup(content);
+
+    if (source->fingerprint && source->content && cache_load(source)) {
+        source->state = TRACK_STATE_READY;
+        track_share(this, source);
+        status = 0;
+    }
+    track_free(source);
+
+    /* the next lookup of this path is a plain one */
+    if (status == 0) cache_save(this);
+    return status;
+}
+
+const char* track_content(Track* this, GCancellable* cancellable)
+{
+    char* content;
+
+    g_mutex_lock(&this->lock);
+    content = this->content;
+    g_mutex_unlock(&this->lock);
+    if (content) return content;
+
+    /* the file is read without the lock, a concurrent hash of the same file
+     * has the same result and the one set first is kept
+     */
+
+    return track_set_content(this, fingerprint_content(this->path, cancellable));
+}
+
+void track_share(Track* this, Track* source)
+{
+    TrackState state = track_get_state(source);
+    double length, lufs, peak, true_peak;
+
+    g_mutex_lock(&source->lock);
+    length = source->length;
+    lufs = source->lufs;
+    peak = source->peak;
+    true_peak = source->true_peak;
+    g_mutex_unlock(&source->lock);
+
+    /* the waveform starts out evicted, analyzed tracks have a cache entry */
+
+    g_mutex_lock(&this->lock);
+    this->length = length;
+    this->lufs = lufs;
+    this->peak = peak;
+    this->true_peak = true_peak;
+    free(this->waveform);
     this->waveform = NULL;
     this->waveform_len = 0;
+    this->waveform_size = 0;
+    waveform_clear(&this->lod);
+    this->evicted = state == TRACK_STATE_READY;
+    g_mutex_unlock(&this->lock);
 
-    this->path = stralloc(path);
-    if (name) this->name = stralloc(name);
-    else this->name = stralloc(path);
+    g_atomic_int_set(&this->state, state);
+    g_atomic_int_set(&this->dirty, 1);
+}
+
+int track_set_true_peak(Track* this, GCancellable* cancellable)
+{
+    Decoder* decoder;
+    Fingerprint* fingerprint = NULL;
+    R128* st = NULL;
+    float* buffer = NULL;
+    size_t frames_read, window;
+    double peak;
+    int status = -1;
 
-    track_set_libav_tags(this);
+    /* only the oversampling true peak meter is enabled, the gated loudness
+     * was calculated by the first pass already
+     * the content is hashed on the way when the first pass could not
+     */
 
-    if (!(file = sf_open(this->path, SFM_READ, &file_info))) {
-        fprintf(stderr, "sndfile failed to open file\"%s\"\n", this->path);
-        return NULL;
+    g_mutex_lock(&this->lock);
+    if (this->fingerprint && !this->content) fingerprint = fingerprint_new();
+    g_mutex_unlock(&this->lock);
+
+    if (!(decoder = decoder_open_hashed(this->path, fingerprint))) goto done;
+
+    if (!(st = r128_new(decoder->channels, decoder->sample_rate,
+                    R128_MODE_TRUE_PEAK))) {
+        goto done;
+    }
+
+    window = (size_t)((gdouble)st->sample_rate * TIME_WINDOW/1000.0);
+    if (!(buffer = malloc(window * st->channels * sizeof(float)))) {
+        fprintf(stderr, "ebur128 malloc failed\n");
+        goto done;
+    }
+
+    while ((frames_read = decoder_read(decoder, buffer, window))) {
+        if (g_cancellable_is_cancelled(cancellable)) goto done;
+        r128_add_frames(st, buffer, frames_read);
     }
+    if (decoder->error) goto done;
 
-    track_set_file_info(this, &file_info);
-    track_set_r128(this, &file_info, file);
+    /* a failed or cancelled pass leaves true_peak NAN so it runs again */
 
-    if (sf_close(file) != 0) {
-        fprintf(stderr, "sndfile failed to close file\"%s\"\n", this->path);
-        return NULL;
+    if (!isfinite(peak = r128_peak(st, TRUE))) goto done;
+    status = 0;
+
+    decoder_close(decoder);
+    decoder = NULL;
+    track_set_content(this, fingerprint_finish(fingerprint));
+
+    g_mutex_lock(&this->lock);
+    this->true_peak = peak;
+    g_mutex_unlock(&this->lock);
+
+    cache_save(this);
+
+done:
+    free(buffer);
+    r128_free(st);
+    decoder_close(decoder);
+    fingerprint_free(fingerprint);
+    return status;
+}
+
+int track_analyze(Track* this, GCancellable* cancellable,
+TrackProgress progress, void* data)
+{
+    Decoder* decoder;
+    Fingerprint* fingerprint = NULL;
+    TrackState state = TRACK_STATE_FAILED;
+    gint64 start;
+
+    this->progress = progress;
+    this->progress_data = data;
+    this->cancellable = cancellable;
+
+    /* the content is hashed from the blocks the analysis reads anyway,
+     * the segments of a long file each hash their own blocks
+     */
+
+    if (this->fingerprint) fingerprint = fingerprint_new();
+
+    if ((decoder = decoder_open_hashed(this->path, fingerprint))) {
+        start = stats_begin();
+        g_atomic_int_set(&this->state, TRACK_STATE_ANALYZING);
+        if (track_set_r128(this, decoder) == 0) state = TRACK_STATE_READY;
+        stats_end(STATS_R128, start);
+        decoder_close(decoder);
+    }
+    if (state == TRACK_STATE_READY) {
+        track_set_content(this, fingerprint_finish(fingerprint));
+    }
+    fingerprint_free(fingerprint);
+
+    /* the final state is always reported, regardless of the dirty flag */
+
+    g_atomic_int_set(&this->state, state);
+    g_atomic_int_set(&this->dirty, 1);
+    if (this->progress) this->progress(this, this->progress_data);
+
+    this->progress = NULL;
+    this->progress_data = NULL;
+    this->cancellable = NULL;
+
+    if (state != TRACK_STATE_READY) return -1;
+
+    /* the waveform grew in doubling steps, the slack is given back */
+
+    g_mutex_lock(&this->lock);
+    if (this->waveform_len && this->waveform_len < this->waveform_size) {
+        int16_t* waveform = realloc(this->waveform,
+                this->waveform_len * sizeof(int16_t));
+        if (waveform) {
+            this->waveform = waveform;
+            this->waveform_size = this->waveform_len;
+        }
+    }
+    g_mutex_unlock(&this->lock);
+
+    cache_save(this);
+    return 0;
+}
+
+size_t track_waveform_evict(Track* this)
+{
+    size_t bytes = 0;
+
+    g_mutex_lock(&this->lock);
+
+    if (    !this->evicted && this->waveform
+            && track_get_state(this) == TRACK_STATE_READY)
+    {
+        bytes = this->waveform_size * sizeof(int16_t) + waveform_bytes(&this->lod);
+        free(this->waveform);
+        this->waveform = NULL;
+        this->waveform_len = 0;
+        this->waveform_size = 0;
+        waveform_clear(&this->lod);
+        this->evicted = TRUE;
+    }
+
+    g_mutex_unlock(&this->lock);
+    return bytes;
+}
+
+int track_waveform_load(Track* this)
+{
+    int16_t* waveform;
+    size_t len;
+    gboolean evicted;
+
+    g_mutex_lock(&this->lock);
+    evicted = this->evicted;
+    g_mutex_unlock(&this->lock);
+
+    if (!evicted) return 0;
+
+    if (!cache_load_waveform(this, &waveform, &len)) {
+        fprintf(stderr, "failed to load waveform of \"%s\" from cache\n",
+                this->path);
+        return -1;
+    }
+
+    /* another thread may have loaded it in the meantime */
+
+    g_mutex_lock(&this->lock);
+    if (this->evicted) {
+        this->waveform = waveform;
+        this->waveform_len = len;
+        this->waveform_size = len;
+        waveform_append(&this->lod, this->waveform, this->waveform_len);
+        this->evicted = FALSE;
+        waveform = NULL;
     }
+    g_mutex_unlock(&this->lock);
+
+    free(waveform);
+    return 0;
+}
+
+size_t track_waveform_bytes(Track* this)
+{
+    size_t bytes;
 
+    g_mutex_lock(&this->lock);
+    bytes = this->waveform_size * sizeof(int16_t) + waveform_bytes(&this->lod);
+    g_mutex_unlock(&this->lock);
+    return bytes;
+}
 
-fail:
+TrackState track_get_state(Track* this)
+{
+    return (TrackState)g_atomic_int_get(&this->state);
+}
+
+Track* track_ref(Track* this)
+{
+    g_atomic_int_inc(&this->ref);
     return this;
 }
 
+int16_t track_level_encode(double lufs)
+{
+    /* silence is reported as -inf by r128, it ends up at the floor */
+
+    if (isnan(lufs) || lufs <= TRACK_LEVEL_MIN / TRACK_LEVEL_SCALE) {
+        return TRACK_LEVEL_MIN;
+    }
+    if (lufs >= TRACK_LEVEL_MAX / TRACK_LEVEL_SCALE) return TRACK_LEVEL_MAX;
+
+    return (int16_t)lrint(lufs * TRACK_LEVEL_SCALE);
+}
+
+double track_level_decode(int16_t level)
+{
+    return level / TRACK_LEVEL_SCALE;
+}
+
 void track_print(Track* this)
 {
     printf("path       = %s\n", this->path);
@@ -133,13 +590,16 @@ void track_print(Track* this)
     printf("samplerate = %s\n", this->sample_rate);
     printf("lufs       = %f\n", this->lufs);
     printf("peak       = %f\n", this->peak);
+    printf("true peak  = %f\n", this->true_peak);
     printf("\n");
 }
 
 void track_free(Track* this)
 {
     if (!this) return;
+    if (!g_atomic_int_dec_and_test(&this->ref)) return;
 
+    g_mutex_clear(&this->lock);
     free(this->path);
     free(this->name);
     free(this->artist);
@@ -147,7 +607,10 @@ void track_free(Track* this)
     free(this->date);
     free(this->format);
     free(this->sample_rate);
+    free(this->fingerprint);
+    free(this->content);
     free(this->waveform);
+    waveform_clear(&this->lod);
     free(this);
 }
 
@@ -158,6 +621,55 @@ void track_free(Track* this)
  */
 
 
+Track* track_alloc(const char* name, const char* path)
+{
+    Track* this = NULL;
+
+    /* allocate new track and set defaults
+     * the name used by default is probided by the argument but overwritten
+     * by TITLE or NAME tag if present
+     * average loudness is calculated by r123
+     */
+
+    if (!path) return NULL;
+
+    if (!(this = malloc(sizeof(Track)))) {
+        fprintf(stderr, "failed to allocate track\n");
+        return NULL;
+    }
+
+    this->artist = NULL;
+    this->album = NULL;
+    this->date = NULL;
+    this->offset = 0;
+    this->lufs = 0;
+    this->peak = 0;
+    this->true_peak = NAN;
+    this->format = 0;
+    this->length = 0;
+    this->sample_rate = NULL;
+    this->fingerprint = NULL;
+    this->content = NULL;
+    this->waveform = NULL;
+    this->waveform_len = 0;
+    this->waveform_size = 0;
+    this->evicted = FALSE;
+    this->state = TRACK_STATE_PENDING;
+    this->dirty = 0;
+    this->ref = 1;
+    this->progress = NULL;
+    this->progress_data = NULL;
+    this->cancellable = NULL;
+    waveform_init(&this->lod);
+    g_mutex_init(&this->lock);
+
+    this->path = stralloc(path);
+    if (name) this->name = stralloc(name);
+    else this->name = stralloc(path);
+
+    return this;
+}
+
 char* stralloc(const char* src)
 {
     char* dest;
@@ -172,108 +684,455 @@ char* stralloc(const char* src)
     return dest;
 }
 
-void track_set_libav_tags(Track* this)
+void track_set_libav_tags(Track* this, Decoder* decoder)
 {
-    AVFormatContext* ctx = avformat_alloc_context();
-    AVDictionaryEntry* tag = NULL;
-    int flags = AV_DICT_IGNORE_SUFFIX;
-
-    avformat_open_input(&ctx, this->path, NULL, NULL);
-    avformat_find_stream_info(ctx, NULL);
+    const char* tag;
 
     /* print all tags */
-    /* while ((tag = av_dict_get(ctx->metadata, "", tag, flags))) {
-        printf("TAG: %s = %s\n", tag->key, tag->value);
+    /* AVDictionaryEntry* entry = NULL;
+    while ((entry = av_dict_get(decoder->format->metadata, "", entry, AV_DICT_IGNORE_SUFFIX))) {
+        printf("TAG: %s = %s\n", entry->key, entry->value);
     } */
 
-    if ((tag = av_dict_get(ctx->metadata, "title", NULL, flags))) {
+    if ((tag = track_get_tag(decoder, "title"))) {
         free(this->name);
-        this->name = stralloc(tag->value);
+        this->name = stralloc(tag);
     }
-    if ((tag = av_dict_get(ctx->metadata, "name", NULL, flags))) {
+    if ((tag = track_get_tag(decoder, "name"))) {
         free(this->name);
-        this->name = stralloc(tag->value);
+        this->name = stralloc(tag);
     }
-    if ((tag = av_dict_get(ctx->metadata, "artist", NULL, flags))) {
-        this->artist = stralloc(tag->value);
+    if ((tag = track_get_tag(decoder, "artist"))) {
+        this->artist = stralloc(tag);
     }
-    if ((tag = av_dict_get(ctx->metadata, "album", NULL, flags))) {
-        this->album = stralloc(tag->value);
+    if ((tag = track_get_tag(decoder, "album"))) {
+        this->album = stralloc(tag);
     }
-    if ((tag = av_dict_get(ctx->metadata, "date", NULL, flags))) {
-        this->date = stralloc(tag->value);
+    if ((tag = track_get_tag(decoder, "date"))) {
+        this->date = stralloc(tag);
     }
+}
+
+const char* track_get_tag(Decoder* decoder, const char* key)
+{
+    AVDictionaryEntry* tag;
+    int flags = AV_DICT_IGNORE_SUFFIX;
 
-    avformat_close_input(&ctx);
-    avformat_free_context(ctx);
+    tag = av_dict_get(decoder->format->metadata, key, NULL, flags);
+    if (!tag) {
+        AVStream* stream = decoder->format->streams[decoder->stream];
+        tag = av_dict_get(stream->metadata, key, NULL, flags);
+    }
+    return tag ? tag->value : NULL;
 }
 
-void track_set_file_info(Track* this, SF_INFO* file_info)
+void track_set_file_info(Track* this, Decoder* decoder)
 {
     const size_t len = 7;
     this->sample_rate = calloc(len+1, sizeof(char));
-    snprintf(this->sample_rate, len, "%d", file_info->samplerate);
+    snprintf(this->sample_rate, len, "%u", decoder->sample_rate);
 
-    this->length = (double)file_info->frames / file_info->samplerate;
+    this->length = (double)decoder->frames / decoder->sample_rate;
     return;
 }
 
-void track_set_r128(Track* this, SF_INFO* file_info, SNDFILE* file)
+int track_set_r128(Track* this, Decoder* decoder)
 {
-    sf_count_t frames_read;
-    ebur128_state* st = NULL;
-    double* buffer;
-    double lufs, peak;
-    int flags = EBUR128_MODE_I | EBUR128_MODE_TRUE_PEAK;
-    unsigned int sr = (unsigned int)file_info->samplerate;
-    unsigned int chs = (unsigned int)file_info->channels;
-    sf_count_t window;
+    size_t frames_read, frames_total = 0;
+    size_t n, window;
+    R128* st = NULL;
+    float* buffer;
+    double lufs;
+    int flags = R128_MODE_I | R128_MODE_SAMPLE_PEAK;
+    int status = 0;
+    unsigned int sr = decoder->sample_rate;
+    unsigned int chs = decoder->channels;
 
-    if (!(st = ebur128_init(chs, sr, flags))) {
-        fprintf(stderr, "ebur128 could not create ebur128_state!\n");
-        return;
-    }
+    if (track_set_r128_segmented(this, decoder)) return 0;
+    if (g_cancellable_is_cancelled(this->cancellable)) return -1;
+
+    if (!(st = r128_new(chs, sr, flags))) return -1;
+
+    /* calculate the amount of samples we should read in order to get enough
+     * for the time window used for the waveform
+     */
+
+    window = (size_t)((gdouble)st->sample_rate * TIME_WINDOW/1000.0);
 
     /* allocate buffer used to read chunks of size "window"
      */
 
-    if (!(buffer = malloc(st->samplerate * st->channels * sizeof(double)))) {
+    if (!(buffer = malloc(window * st->channels * sizeof(float)))) {
         fprintf(stderr, "ebur128 malloc failed\n");
-        return;
+        r128_free(st);
+        return -1;
     }
 
-    /* calculate the amount of samples we should read in order to get enough
-     * for the time window used for the waveform
+    /* the waveform is published point by point so it can be drawn while
+     * growing, a failed segmented pass may have left points behind
      */
 
-    window = (sf_count_t)((gdouble)st->samplerate * TIME_WINDOW/1000.0);
+    g_mutex_lock(&this->lock);
+    this->waveform_len = 0;
+    this->evicted = FALSE;
+    waveform_clear(&this->lod);
+    g_mutex_unlock(&this->lock);
+
+    for (n = 0; (frames_read = decoder_read(decoder, buffer, window));) {
+        double value;
+
+        if (g_cancellable_is_cancelled(this->cancellable)) {
+            status = -1;
+            break;
+        }
+
+        r128_add_frames(st, buffer, frames_read);
+        value = r128_loudness_window(st, TIME_WINDOW);
+        if (track_waveform_push(this, track_level_encode(value)) < 0) {
+            status = -1;
+            break;
+        }
+        frames_total += frames_read;
+
+        if (++n % TRACK_PROGRESS_INTERVAL == 0) track_set_progress(this, st);
+    }
+
+    lufs = r128_loudness_global(st);
+
+    g_mutex_lock(&this->lock);
+    this->lufs = lufs;
+    this->peak = r128_peak(st, FALSE);
+
+    /* the decoded frame count is exact, unlike the header estimate */
+    if (frames_total) this->length = (double)frames_total / sr;
+    g_mutex_unlock(&this->lock);
+
+    free(buffer);
+    r128_free(st);
 
-    /* allocate waveform buffer - we add one to make sure we don't get
-     * round-down erro due to int conversion
+    return status;
+}
+
+int track_set_r128_segmented(Track* this, Decoder* decoder)
+{
+    TrackSegment* segments;
+    GThread** threads;
+    R128** states;
+    guint n;
+    int ok = 1;
+    int64_t length, frames_total = 0;
+    size_t waveform_len = 0;
+    unsigned int sr = decoder->sample_rate;
+    size_t window = (size_t)((gdouble)sr * TIME_WINDOW/1000.0);
+
+    /* r128 calculates a gating block of 400ms every 100ms
+     * segment boundaries must be a multiple of both the waveform window
+     * and the 100ms block step (using the same rounding as r128) for the
+     * segmented blocks to be identical to the serial ones
      */
 
-    this->waveform_len = 1 + (size_t)(file_info->frames / window);
+    size_t block = (sr + 5) / 10;
+
+    if (!window || window % block != 0) return 0;
+    if (!decoder->format->pb || !decoder->format->pb->seekable) return 0;
 
-    if (!(this->waveform = malloc(this->waveform_len * sizeof(double)))) {
+    n = MIN(g_get_num_processors(),
+            (guint)(decoder->frames / ((int64_t)sr * TRACK_SEGMENT_LENGTH)));
+    if (n < 2) return 0;
+
+    /* every decode worker may split a long file, the helpers are bounded
+     * for the whole process so a folder of long files does not start a
+     * thread per core for each of them, without helpers it is serial
+     */
+
+    n = track_segment_acquire(n - 1) + 1;
+    if (n < 2) return 0;
+
+    length = decoder->frames / n;
+    length -= length % (int64_t)window;
+
+    segments = calloc(n, sizeof(TrackSegment));
+    threads = calloc(n, sizeof(GThread*));
+    states = calloc(n, sizeof(R128*));
+
+    if (!segments || !threads || !states) {
         fprintf(stderr, "ebur128 malloc failed\n");
-        return;
+        free(segments);
+        free(threads);
+        free(states);
+        track_segment_release(n - 1);
+        return 0;
     }
 
-    for (size_t n = 0; (frames_read = sf_readf_double(file, buffer, window));) {
-        ebur128_add_frames_double(st, buffer, (size_t)frames_read);
-        ebur128_loudness_window(st, TIME_WINDOW, &this->waveform[n++]);
+    for (guint i = 0; i < n; i++) {
+        segments[i].path = this->path;
+        segments[i].track = i ? NULL : this;
+        segments[i].cancellable = this->cancellable;
+        segments[i].start = i * length;
+        segments[i].stop = i == n-1 ? -1 : (i+1) * length;
+        segments[i].window = window;
+        segments[i].preroll = i ? 3 * block : 0;
+        segments[i].fingerprint = decoder->fingerprint;
     }
 
-    ebur128_loudness_global(st, &lufs);
-    this->lufs = lufs;
+    /* the first segment is analyzed by the calling thread
+     * a segment for which no thread can be created is analyzed inline
+     */
+
+    g_mutex_lock(&this->lock);
+    this->waveform_len = 0;
+    this->evicted = FALSE;
+    waveform_clear(&this->lod);
+    g_mutex_unlock(&this->lock);
+
+    for (guint i = 1; i < n; i++) {
+        threads[i] = g_thread_try_new("r128", track_segment_r128,
+                &segments[i], NULL);
+        if (!threads[i]) track_segment_release(1);
+    }
+    track_segment_r128(&segments[0]);
+
+    for (guint i = 0; i < n; i++) {
+        if (i && threads[i]) {
+            g_thread_join(threads[i]);
+            track_segment_release(1);
+        } else if (i) {
+            track_segment_r128(&segments[i]);
+        }
+
+        ok = ok && !segments[i].failed;
+        waveform_len += segments[i].waveform_len;
+        frames_total += segments[i].frames;
+        states[i] = segments[i].st;
+    }
+
+    /* the first segment is already in the track, append the others */
+
+    g_mutex_lock(&this->lock);
+
+    if (ok && waveform_len > this->waveform_size) {
+        int16_t* waveform = realloc(this->waveform, waveform_len * sizeof(int16_t));
+        if (waveform) {
+            this->waveform = waveform;
+            this->waveform_size = waveform_len;
+        } else {
+            fprintf(stderr, "ebur128 malloc failed\n");
+            ok = 0;
+        }
+    }
+
+    if (ok) {
+        double lufs;
+
+        /* stitch the waveforms of all segments back together */
+        this->peak = segments[0].peak;
+        for (guint i = 1; i < n; i++) {
+            memcpy(this->waveform + this->waveform_len, segments[i].waveform,
+                    segments[i].waveform_len * sizeof(int16_t));
+            waveform_append(&this->lod, segments[i].waveform,
+                    segments[i].waveform_len);
+            this->waveform_len += segments[i].waveform_len;
+            this->peak = MAX(this->peak, segments[i].peak);
+        }
+
+        lufs = r128_loudness_global_multiple(states, n);
+        this->lufs = lufs;
+        this->length = (double)frames_total / sr;
+    }
 
-    /* TODO: unclear what peak value really is exactly
-     * -dBFS ?
+    g_mutex_unlock(&this->lock);
+
+    for (guint i = 0; i < n; i++) {
+        r128_free(segments[i].st);
+        free(segments[i].waveform);
+    }
+    free(segments);
+    free(threads);
+    free(states);
+
+    return ok;
+}
+
+gpointer track_segment_r128(gpointer data)
+{
+    TrackSegment* seg = data;
+    Decoder* decoder;
+    float* buffer = NULL;
+    size_t frames_read, size;
+    int flags = R128_MODE_I | R128_MODE_SAMPLE_PEAK;
+
+    seg->failed = 1;
+
+    if (!(decoder = decoder_open_hashed(seg->path, seg->fingerprint))) return NULL;
+
+    if (!(seg->st = r128_new(decoder->channels, decoder->sample_rate, flags))) {
+        goto done;
+    }
+
+    size = 1 + (size_t)MAX(decoder->frames - seg->start, 0) / seg->window;
+    if (seg->stop >= 0) size = (size_t)(seg->stop - seg->start) / seg->window;
+
+    buffer = malloc(MAX(seg->window, seg->preroll) * decoder->channels * sizeof(float));
+    if (!seg->track) seg->waveform = malloc(MAX(size, 1) * sizeof(int16_t));
+    if (!buffer || (!seg->track && !seg->waveform)) {
+        fprintf(stderr, "ebur128 malloc failed\n");
+        goto done;
+    }
+    seg->waveform_size = MAX(size, 1);
+
+    /* the pre-roll only feeds the gating blocks and filters
+     * waveform points and frame count start at the segment start
      */
-    ebur128_sample_peak(st, 0, &peak);
-    this->peak = peak;
 
+    if (seg->start > 0) {
+        if (decoder_seek(decoder, seg->start - (int64_t)seg->preroll) < 0) goto done;
+        if (decoder_read(decoder, buffer, seg->preroll) != seg->preroll) goto done;
+        r128_add_frames(seg->st, buffer, seg->preroll);
+    }
+
+    for (;;) {
+        size_t frames = seg->window;
+        double value;
+
+        if (seg->stop >= 0) {
+            int64_t left = seg->stop - seg->start - seg->frames;
+            if (left <= 0) break;
+            frames = MIN(frames, (size_t)left);
+        }
+
+        if (!(frames_read = decoder_read(decoder, buffer, frames))) break;
+        if (g_cancellable_is_cancelled(seg->cancellable)) goto done;
+
+        r128_add_frames(seg->st, buffer, frames_read);
+        value = r128_loudness_window(seg->st, TIME_WINDOW);
+        if (track_segment_push(seg, track_level_encode(value)) < 0) goto done;
+        seg->frames += (int64_t)frames_read;
+    }
+
+    if (decoder->error) goto done;
+    if (seg->stop >= 0 && seg->frames != seg->stop - seg->start) goto done;
+
+    seg->peak = r128_peak(seg->st, FALSE);
+    seg->failed = 0;
+
+done:
     free(buffer);
-    ebur128_destroy(&st);
+    decoder_close(decoder);
+    return NULL;
+}
+
+int track_segment_push(TrackSegment* seg, int16_t level)
+{
+    if (seg->track) {
+        if (track_waveform_push(seg->track, level) < 0) return -1;
+        if (++seg->waveform_len % TRACK_PROGRESS_INTERVAL == 0) {
+            track_set_progress(seg->track, seg->st);
+        }
+        return 0;
+    }
+
+    if (seg->waveform_len == seg->waveform_size) {
+        int16_t* waveform;
+        size_t size = seg->waveform_size * 2;
+        if (!(waveform = realloc(seg->waveform, size * sizeof(int16_t)))) {
+            fprintf(stderr, "ebur128 malloc failed\n");
+            return -1;
+        }
+        seg->waveform = waveform;
+        seg->waveform_size = size;
+    }
+    seg->waveform[seg->waveform_len++] = level;
+    return 0;
 }
 
+guint track_segment_acquire(guint want)
+{
+    gint max = (gint)g_get_num_processors();
+    gint used, n;
+
+    do {
+        used = g_atomic_int_get(&track_segment_helpers);
+        n = MIN((gint)want, max - used);
+        if (n <= 0) return 0;
+    } while (!g_atomic_int_compare_and_exchange(&track_segment_helpers,
+                used, used + n));
+
+    return (guint)n;
+}
+
+void track_segment_release(guint n)
+{
+    g_atomic_int_add(&track_segment_helpers, -(gint)n);
+}
+
+int track_waveform_push(Track* this, int16_t level)
+{
+    g_mutex_lock(&this->lock);
+
+    /* the frame count is only an estimate so the waveform grows when needed
+     * readers hold the lock so the waveform may move
+     */
+
+    if (this->waveform_len == this->waveform_size) {
+        int16_t* waveform;
+        size_t size = this->waveform_size ? this->waveform_size * 2
+            : 1 + (size_t)(this->length * 1000.0 / TIME_WINDOW);
+
+        if (!(waveform = realloc(this->waveform, size * sizeof(int16_t)))) {
+            g_mutex_unlock(&this->lock);
+            fprintf(stderr, "ebur128 malloc failed\n");
+            return -1;
+        }
+        this->waveform = waveform;
+        this->waveform_size = size;
+    }
+    this->waveform[this->waveform_len++] = level;
+
+    if (waveform_push(&this->lod, level) < 0) {
+        g_mutex_unlock(&this->lock);
+        return -1;
+    }
+
+    g_mutex_unlock(&this->lock);
+    return 0;
+}
+
+void track_set_progress(Track* this, R128* st)
+{
+    double lufs, peak;
+
+    /* the global loudness of a partial file is only an indication
+     * it is skipped until the first block passed the gates
+     */
+
+    if (!isfinite(lufs = r128_loudness_global(st))) return;
+    peak = r128_peak(st, FALSE);
+
+    g_mutex_lock(&this->lock);
+    this->lufs = lufs;
+    this->peak = MAX(this->peak, peak);
+    g_mutex_unlock(&this->lock);
+
+    track_changed(this);
+}
+
+void track_changed(Track* this)
+{
+    if (!this->progress) return;
+    if (g_atomic_int_compare_and_exchange(&this->dirty, 0, 1)) {
+        this->progress(this, this->progress_data);
+    }
+}
+
+const char* track_set_content(Track* this, char* content)
+{
+    g_mutex_lock(&this->lock);
+    if (this->content) {
+        free(content);
+        content = this->content;
+    } else {
+        this->content = content;
+    }
+    g_mutex_unlock(&this->lock);
+    return content;
+}
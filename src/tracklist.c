@@ -9,6 +9,7 @@
 #include <assert.h>
 #include <errno.h>
 #include <gtk/gtk.h>
+#include <math.h>
 #include <signal.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -17,7 +18,9 @@
 #include <unistd.h>
 
 #include "../include/config.h"
+#include "../include/loader.h"
 #include "../include/player.h"
+#include "../include/stats.h"
 #include "../include/track.h"
 #include "../include/tracklist.h"
 
@@ -30,12 +33,178 @@
 static void selection_changed(Tracklist* this, GtkTreeSelection* selection);
 
 /**
- * function used by load_thread threadpool to async load tracks
+ * Destination of the files of a drop that are being loaded
  *
- * @param data file closure from thread_pool_push call
- * @param user_data tracklist object closure from thread_pool_new
+ * shared by the files of the drop, only used on the main thread
  */
-static void load_async(gpointer data, gpointer user_data);
+typedef struct TracklistDrop {
+    GtkTreeRowReference* row;       /**< row to insert at or NULL to append */
+    GtkTreeViewDropPosition pos;    /**< insert before or after row */
+    GHashTable* visited;            /**< ID_FILE of the directories enumerated */
+    guint ref;                      /**< reference count */
+} TracklistDrop;
+
+/**
+ * Insert a row for track, without updating min_lufs
+ *
+ * tracks that are not analyzed yet are remembered in pending so their row
+ * can be updated when results come in
+ *
+ * @param this tracklist object
+ * @param track the track to be added
+ * @param path insert the new track before or after this row or NULL to append
+ * @param pos insert before or after path
+ * @param iter set to the new row or NULL
+ */
+static void tracklist_insert_row(Tracklist* this, Track* track,
+        GtkTreePath* path, GtkTreeViewDropPosition pos, GtkTreeIter* iter);
+
+/**
+ * Order the loudness index by lufs
+ *
+ * tracks with the same loudness are ordered by address so every track has
+ * a unique position and can be looked up
+ *
+ * @param a track
+ * @param b track
+ * @param data unused
+ * @return negative, zero or positive like strcmp
+ */
+static gint tracklist_index_compare(gconstpointer a, gconstpointer b,
+        gpointer data);
+
+/**
+ * Add an analyzed track to the loudness index
+ *
+ * tracks that are not ready or silent (no finite lufs) are skipped, as
+ * are tracks that are indexed already
+ *
+ * @param this tracklist object
+ * @param track the track
+ */
+static void tracklist_index_add(Tracklist* this, Track* track);
+
+/**
+ * Remove a track from the loudness index
+ *
+ * @param this tracklist object
+ * @param track the track
+ */
+static void tracklist_index_remove(Tracklist* this, Track* track);
+
+/**
+ * Estimate the offset of an analyzed track
+ *
+ * the first track to be analyzed becomes the reference, every other track
+ * is aligned to it once on the loader
+ *
+ * @param this tracklist object
+ * @param track the analyzed track
+ */
+static void tracklist_align(Tracklist* this, Track* track);
+
+/**
+ * Check whether the results of a track may still change
+ *
+ * @param track the track
+ * @return TRUE while analyzing or waiting for the true peak
+ */
+static gboolean tracklist_is_pending(Track* track);
+
+/**
+ * Tell the residency which waveforms must stay in memory
+ *
+ * the playing track is drawn, the reference is used for every alignment and
+ * the waveform of an analyzing track is still being written
+ * tracks waiting for their true peak are not pinned, that pass runs last
+ * and does not touch the waveform
+ *
+ * @param track the track
+ * @param data tracklist object
+ * @return TRUE when the waveform must not be evicted
+ */
+static gboolean tracklist_is_pinned(Track* track, void* data);
+
+/**
+ * Follow the vertical adjustment of the tree
+ *
+ * the adjustment is set when the tree is put in a scrolled window
+ *
+ * @param this tracklist object
+ */
+static void tracklist_vadjustment_changed(Tracklist* this);
+
+/**
+ * Schedule an update of the analysis priorities
+ *
+ * @param this tracklist object
+ */
+static void tracklist_schedule_priorities(Tracklist* this);
+
+/**
+ * Analyze the selected track first, then the visible rows
+ *
+ * idle function, the rows that are scrolled offscreen come last
+ *
+ * @param data tracklist object
+ * @return G_SOURCE_REMOVE
+ */
+static gboolean tracklist_update_priorities(gpointer data);
+
+/**
+ * Update the row of a track that is being analyzed
+ *
+ * @param this tracklist object
+ * @param track the track that changed
+ */
+static void tracklist_update_row(Tracklist* this, Track* track);
+
+/**
+ * Loader callback, add a batch of loaded tracks at their drop positions
+ * and update the rows of tracks being analyzed
+ *
+ * @param results the newly loaded tracks and their TracklistDrop
+ * @param n number of results
+ * @param user_data the tracklist object
+ */
+static void load_finished(LoaderResult* results, guint n, gpointer user_data);
+
+/**
+ * Create a TracklistDrop
+ *
+ * @param this tracklist object
+ * @param path insert before or after this row or NULL to append
+ * @param pos insert before or after path
+ * @return the drop or NULL when failed to allocate
+ */
+static TracklistDrop* load_drop_new(Tracklist* this, GtkTreePath* path,
+        GtkTreeViewDropPosition pos);
+
+/**
+ * Load a file into a drop
+ *
+ * the files of a drop share its visited directories
+ *
+ * @param this tracklist object
+ * @param file file to be added, freed when the loader has finished
+ * @param drop destination, a reference is taken
+ */
+static void load_drop_push(Tracklist* this, GFile* file, TracklistDrop* drop);
+
+/**
+ * Release a reference to a TracklistDrop
+ *
+ * @param data the TracklistDrop
+ */
+static void load_drop_free(gpointer data);
+
+/**
+ * Share TracklistDrop with the files of a directory
+ *
+ * @param data the TracklistDrop
+ * @return a new reference to the drop
+ */
+static gpointer load_drop_copy(gpointer data);
 
 /*
  * Drag-and-Drop signal handlers
@@ -99,32 +268,43 @@ GtkDragResult result, gpointer user_data);
 
 Tracklist* tracklist_new(Player* player)
 {
-    GError* err = NULL;
     Tracklist* this = malloc(sizeof(Tracklist));
     this->player = player;
     this->min_lufs = 0.0;
+    this->loudness = g_sequence_new(NULL);
     this->tree = NULL;
+    this->changed = NULL;
+    this->changed_data = NULL;
+    this->pending = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+            NULL, (GDestroyNotify)gtk_tree_row_reference_free);
+    this->aligned = g_hash_table_new(g_direct_hash, g_direct_equal);
+    this->reference = NULL;
+    this->vadjustment = NULL;
+    this->priorities = 0;
+    this->residency = NULL;
+    this->loader = NULL;
+
+    /* the model formats the cells of the visible rows only and sorts on
+     * numbers, lufs and peak are not compared as strings
+     */
 
-    this->list = gtk_list_store_new(TRACKLIST_COLUMNS,
-                                    G_TYPE_STRING,      /* NAME */
-                                    G_TYPE_STRING,      /* LUFS */
-                                    G_TYPE_STRING,      /* PEAK */
-                                    G_TYPE_STRING,      /* DURATION */
-                                    G_TYPE_POINTER);    /* DATA */
+    this->list = track_model_new();
 
-    /* create threadpool for async loading of files
-     * files can be added: g_thread_pool_push(this->load_thread, file, &err);
+    if (!(this->residency = residency_new(RESIDENCY_BUDGET,
+                    tracklist_is_pinned, this)))
+    {
+        tracklist_free(this);
+        return NULL;
+    }
+
+    /* create loader for async loading of files
      * functions to add track from file asynchronously
      *  - tracklist_append_file
      *  - tracklist_inset_file
-     * FIXME: only works for MAX THREADS = -1 - segfault for limited threads
+     * loaded tracks are added in batches by load_finished on the main thread
      */
 
-    this->load_thread = g_thread_pool_new(
-            load_async, this, -1, FALSE, &err);
-
-    if (err) {
-        g_printerr("%s\n", err->message);
+    if (!(this->loader = loader_new(load_finished, this))) {
         tracklist_free(this);
         return NULL;
     }
@@ -151,6 +331,9 @@ void tracklist_init(Tracklist* this)
     g_signal_connect_swapped( selection, "changed",
             G_CALLBACK(selection_changed), this);
 
+    g_signal_connect_swapped(this->tree, "notify::vadjustment",
+            G_CALLBACK(tracklist_vadjustment_changed), this);
+
     id = TRACKLIST_COLUMN_NAME;
     column = gtk_tree_view_column_new();
     gtk_tree_view_append_column(this->tree, column);
@@ -260,6 +443,9 @@ void tracklist_init(Tracklist* this)
     g_signal_connect(this->tree, "drag-leave",
             G_CALLBACK(drag_leave), this);
 
+    /* loaded tracks are added once per frame of the tree */
+    loader_set_clock(this->loader, GTK_WIDGET(this->tree));
+
     gtk_widget_show_all(GTK_WIDGET(this->tree));
 }
 
@@ -267,126 +453,25 @@ void tracklist_add_track(Tracklist* this, Track* track, GtkTreePath* path,
 GtkTreeViewDropPosition pos)
 {
     if (!track) return;
-    GtkTreeIter iter, prev;
-    GtkTreeModel* model = GTK_TREE_MODEL(this->list);
-
-    gchar lufs[7];
-    g_snprintf(lufs, G_N_ELEMENTS(lufs), "%.2f", track->lufs);
-
-    gchar peak[7];
-    g_snprintf(peak, G_N_ELEMENTS(peak), "%.2f", track->peak);
-
-    gchar duration[10];
-    dtoduration(duration, track->length);
-
-    if (path && gtk_tree_model_get_iter(model, &prev, path)) {
-        switch (pos) {
-            case GTK_TREE_VIEW_DROP_BEFORE:
-            case GTK_TREE_VIEW_DROP_INTO_OR_BEFORE:
-                gtk_list_store_insert_before(this->list, &iter, &prev);
-                break;
-
-            case GTK_TREE_VIEW_DROP_AFTER:
-            case GTK_TREE_VIEW_DROP_INTO_OR_AFTER:
-            default:
-                gtk_list_store_insert_after(this->list, &iter, &prev);
-        }
-    } else {
-        gtk_list_store_append(this->list, &iter);
-    }
-    gtk_list_store_set(
-            this->list, &iter,
-            TRACKLIST_COLUMN_NAME, track->name,
-            TRACKLIST_COLUMN_LUFS, lufs,
-            TRACKLIST_COLUMN_PEAK, peak,
-            TRACKLIST_COLUMN_DURATION, duration,
-            TRACKLIST_COLUMN_DATA, track,
-            -1);
-
-    /* set the min_lufs value to the lowest loudness
-     * min_should accurately contain the lowest value even after deleting tracks
-     * so it's not neccessary to run through all tracks on each add
-     * min_lufs is stored in tracklist but must be sit in player to take effect
-     */
-
-    this->min_lufs = MIN(this->min_lufs, track->lufs);
-    this->player->min_lufs = this->min_lufs;
-}
-
-Track* tracklist_file_to_track(UNUSED Tracklist* this, GFile* file)
-{
-    if (!G_IS_FILE(file)) return NULL;
-    Track* track = NULL;
-    const gchar* type;
-    const gchar* name = NULL;
-    gchar* path = NULL;
-    GError *err = NULL;
-    GFileInfo* info;
 
-    path = g_file_get_path(file);
+    tracklist_insert_row(this, track, path, pos, NULL);
+    if (track_get_state(track) != TRACK_STATE_READY) return;
 
-    /* get mimetype */
-    info = g_file_query_info(file, G_FILE_ATTRIBUTE_STANDARD_CONTENT_TYPE,
-            G_FILE_QUERY_INFO_NONE, NULL, &err);
-    if (err) {
-        g_printerr("%s\n", err->message);
-        g_error_free(err);
-        goto fail;
-    }
-    if (!(type = g_file_info_get_content_type(info))) {
-        g_printerr("Error getting mimetype for file \"%s\"\n", path);
-        goto fail;
-    }
-
-    /* TODO: find a better way (lib?) to determine file == audio file??? */
-    if (    !g_strstr_len(type, -1, "audio") &&
-            !g_strstr_len(type, -1, "org.xiph.flac"))
-    {
-        g_printerr("Error loading file \"%s\": Not and audio file\n", path);
-        goto fail;
-    }
-
-    /* get filename */
-    info = g_file_query_info(file, G_FILE_ATTRIBUTE_STANDARD_DISPLAY_NAME,
-            G_FILE_QUERY_INFO_NONE, NULL, &err);
-    if (err) {
-        g_printerr("%s\n", err->message);
-        g_error_free(err);
-        goto fail;
-    }
-    if (!(name = g_file_info_get_display_name(info))) {
-        g_printerr("Error getting display name for file \"%s\"\n", path);
-        goto fail;
-    }
-
-    track = track_new(name, path);
-
-fail:
-    /* delete file here if creating track failed
-     * because it cannot be unreffed in load_async */
-    if (!track) g_object_unref(file);
-    if (info) g_object_unref(info);
-    g_free(path);
-    return track;
+    tracklist_index_add(this, track);
+    tracklist_update_min_lufs(this);
 }
 
 void tracklist_insert_file(Tracklist* this, GFile* file, GtkTreePath* path,
 GtkTreeViewDropPosition pos)
 {
-    GError* err = NULL;
-
-    /* allocate position to allow storing in GObject, free-ed by async loader */
-    GtkTreeViewDropPosition* position = malloc(sizeof(GtkTreeViewDropPosition));
-    *position = pos;
+    TracklistDrop* drop;
 
-    g_object_set_data(G_OBJECT(file), "path", path);
-    g_object_set_data(G_OBJECT(file), "position", position);
-
-    /* send data to load thread pool */
-    g_thread_pool_push(this->load_thread, file, &err);
-    if (err) {
-        g_printerr("%s\n", err->message);
+    if (!(drop = load_drop_new(this, path, pos))) {
+        g_object_unref(file);
+        return;
     }
+    load_drop_push(this, file, drop);
+    load_drop_free(drop);
 }
 
 void tracklist_append_file(Tracklist* this, GFile* file)
@@ -396,36 +481,27 @@ void tracklist_append_file(Tracklist* this, GFile* file)
     tracklist_insert_file(this, file, NULL, 0);
 }
 
-void tracklist_update_min_lufs(Tracklist* this)
+void tracklist_set_changed_callback(Tracklist* this,
+void (*changed)(Track*, void*), void* data)
 {
-    GtkTreeIter iter;
-    GtkTreeModel* model;
-    gdouble min = 0.0;
-
-    model = gtk_tree_view_get_model(this->tree);
-
-    /* get the first track, when no tracks left, min_lufs must be set to 0.0
-     * to make sure adding new tracks get proper min_lufs value in add_track
-     */
+    this->changed = changed;
+    this->changed_data = data;
+}
 
-    if (!(gtk_tree_model_get_iter_first(model, &iter))) {
-        this->min_lufs = 0.0;
-        return;
-    }
+void tracklist_update_min_lufs(Tracklist* this)
+{
+    GSequenceIter* first = g_sequence_get_begin_iter(this->loudness);
 
-    do {
-        Track* track;
-        gtk_tree_model_get(model, &iter, TRACKLIST_COLUMN_DATA, &track, -1);
-        min = MIN(track->lufs, min);
+    /* when no tracks are left, min_lufs is 0.0 again */
 
-    } while (gtk_tree_model_iter_next(model, &iter));
+    this->min_lufs = g_sequence_iter_is_end(first)
+        ? 0.0 : ((Track*)g_sequence_get(first))->lufs;
 
-     /* min_lufs is stored in tracklist but must be updated in player to take
-      * effect
-      */
+    /* min_lufs is stored in tracklist but must be set in player to take
+     * effect, the player updates the volume of the playing track
+     */
 
-    this->min_lufs = min;
-    this->player->min_lufs = this->min_lufs;
+    player_set_min_lufs(this->player, this->min_lufs);
 }
 
 void tracklist_remove_selected(Tracklist* this)
@@ -441,7 +517,13 @@ void tracklist_remove_selected(Tracklist* this)
 
     if (!gtk_tree_selection_get_selected(selection, &model, &iter)) return;
     gtk_tree_model_get(model, &iter, TRACKLIST_COLUMN_DATA, &track, -1);
-    gtk_list_store_remove(this->list, &iter);
+    track_model_remove(this->list, &iter);
+    g_hash_table_remove(this->pending, track);
+    g_hash_table_remove(this->aligned, track);
+    tracklist_index_remove(this, track);
+    residency_remove(this->residency, track);
+    loader_cancel(this->loader, track);
+    player_remove_track(this->player, track);
     track_free(track);
 
     /* it's possible the removed track had the lowest loudness so we must
@@ -469,19 +551,29 @@ void tracklist_free(Tracklist* this)
     if (this->tree) {
         selection = gtk_tree_view_get_selection(GTK_TREE_VIEW(this->tree));
         g_signal_handlers_disconnect_by_data(selection, this);
+        g_signal_handlers_disconnect_by_data(this->tree, this);
     }
+    if (this->vadjustment) {
+        g_signal_handlers_disconnect_by_data(this->vadjustment, this);
+        g_object_unref(this->vadjustment);
+    }
+    if (this->priorities) g_source_remove(this->priorities);
 
-    gtk_tree_model_get_iter_first(model, &iter);
-
-    while (gtk_list_store_iter_is_valid(this->list, &iter)) {
-        gtk_tree_model_get(model, &iter, TRACKLIST_COLUMN_DATA, &track, -1);
-        track_free(track);
-        gtk_list_store_remove(this->list, &iter);
+    if (gtk_tree_model_get_iter_first(model, &iter)) {
+        do {
+            gtk_tree_model_get(model, &iter, TRACKLIST_COLUMN_DATA, &track, -1);
+            track_free(track);
+        } while (track_model_remove(this->list, &iter));
     }
 
     if (this->player) this->player->current = NULL;
 
-    g_thread_pool_free(this->load_thread, FALSE, FALSE);
+    loader_free(this->loader);
+    residency_free(this->residency);
+    g_hash_table_destroy(this->pending);
+    g_hash_table_destroy(this->aligned);
+    g_sequence_free(this->loudness);
+    track_free(this->reference);
     g_object_unref(this->list);
     if (this->tree) {
 
@@ -514,30 +606,338 @@ void selection_changed(Tracklist* this, GtkTreeSelection* selection)
     }
 
     gtk_tree_model_get(model, &iter, TRACKLIST_COLUMN_DATA, &track, -1);
+
+    /* an evicted waveform is loaded again before the track is drawn
+     * the track that was playing may be evicted now
+     */
+
+    residency_touch(this->residency, track);
     player_load_track(this->player, track);
+    residency_trim(this->residency);
+
+    /* a track that is still being analyzed is moved to the front */
+    tracklist_schedule_priorities(this);
 }
 
-void load_async(gpointer file_data, gpointer tracklist_data)
+void tracklist_insert_row(Tracklist* this, Track* track, GtkTreePath* path,
+GtkTreeViewDropPosition pos, GtkTreeIter* iter)
 {
-    /* the load-async handler is invoked when the thread_pool receives new data
-     * (called by g_thread_pool_push() in insert_file() or append_file()
-     * the file GObject in "file_data" has the row (path) as well as the
-     * before/after (pos) information embedded as data
-     * it is extracted here to call add_track
-     * file is unreffed here as it needs to stay alive until file_to_track
-     * has finished
+    gint position = -1;
+    GtkTreeIter row_iter;
+    gint64 start = stats_begin();
+
+    if (path && gtk_tree_path_get_depth(path) > 0) {
+        position = gtk_tree_path_get_indices(path)[0];
+        switch (pos) {
+            case GTK_TREE_VIEW_DROP_BEFORE:
+            case GTK_TREE_VIEW_DROP_INTO_OR_BEFORE:
+                break;
+
+            case GTK_TREE_VIEW_DROP_AFTER:
+            case GTK_TREE_VIEW_DROP_INTO_OR_AFTER:
+            default:
+                position++;
+        }
+    }
+
+    /* nothing is formatted here, the cells are formatted when drawn */
+    track_model_insert(this->list, track, position, &row_iter);
+    if (iter) *iter = row_iter;
+    residency_add(this->residency, track);
+
+    /* the player keeps the track open so switching to it is instant */
+    player_add_track(this->player, track);
+
+    /* the reference follows the row when it is moved or sorted */
+
+    if (tracklist_is_pending(track)) {
+        GtkTreeModel* model = GTK_TREE_MODEL(this->list);
+        GtkTreePath* row = gtk_tree_model_get_path(model, &row_iter);
+        g_hash_table_replace(this->pending, track,
+                gtk_tree_row_reference_new(model, row));
+        gtk_tree_path_free(row);
+    }
+    stats_end(STATS_LIST_INSERT, start);
+}
+
+void tracklist_align(Tracklist* this, Track* track)
+{
+    /* the reference is kept when removed from the list so the offsets
+     * of the remaining and later tracks stay comparable
      */
 
-    Tracklist* this = tracklist_data;
-    GFile* file = file_data;
-    GtkTreePath* path = g_object_get_data(G_OBJECT(file), "path");
-    GtkTreeViewDropPosition* pos = g_object_get_data(G_OBJECT(file), "position");
-    Track* track = tracklist_file_to_track(this, file);
-    if (track) tracklist_add_track(this, track, path, *pos);
+    if (track == this->reference || g_hash_table_contains(this->aligned, track)) {
+        return;
+    }
 
-    gtk_tree_path_free(path);
-    free(pos);
-    g_object_unref(file);
+    if (!this->reference) {
+        this->reference = track_ref(track);
+        return;
+    }
+
+    g_hash_table_add(this->aligned, track);
+    loader_align(this->loader, this->reference, track);
+}
+
+void tracklist_update_row(Tracklist* this, Track* track)
+{
+    GtkTreeRowReference* ref;
+    GtkTreePath* path;
+    GtkTreeIter iter;
+    TrackState state = track_get_state(track);
+
+    /* the track may have been removed from the list while analyzing */
+
+    if (!(ref = g_hash_table_lookup(this->pending, track))) return;
+
+    if ((path = gtk_tree_row_reference_get_path(ref))) {
+        if (gtk_tree_model_get_iter(GTK_TREE_MODEL(this->list), &iter, path)) {
+            track_model_changed(this->list, &iter);
+        }
+        gtk_tree_path_free(path);
+    }
+
+    if (!tracklist_is_pending(track)) g_hash_table_remove(this->pending, track);
+    if (state == TRACK_STATE_READY) tracklist_index_add(this, track);
+}
+
+gint tracklist_index_compare(gconstpointer a, gconstpointer b, gpointer data)
+{
+    const Track* x = a, * y = b;
+    (void)data;
+
+    if (x->lufs != y->lufs) return x->lufs < y->lufs ? -1 : 1;
+    return (uintptr_t)x < (uintptr_t)y ? -1 : (uintptr_t)x > (uintptr_t)y;
+}
+
+void tracklist_index_add(Tracklist* this, Track* track)
+{
+    /* the lufs of a ready track no longer changes, so its position in the
+     * index stays valid until it is removed
+     */
+
+    if (track_get_state(track) != TRACK_STATE_READY) return;
+    if (!isfinite(track->lufs)) return;
+    if (g_sequence_lookup(this->loudness, track, tracklist_index_compare, NULL)) {
+        return;
+    }
+    g_sequence_insert_sorted(this->loudness, track, tracklist_index_compare, NULL);
+}
+
+void tracklist_index_remove(Tracklist* this, Track* track)
+{
+    GSequenceIter* iter;
+
+    if (!isfinite(track->lufs)) return;
+    iter = g_sequence_lookup(this->loudness, track, tracklist_index_compare, NULL);
+    if (iter) g_sequence_remove(iter);
+}
+
+void tracklist_vadjustment_changed(Tracklist* this)
+{
+    GtkAdjustment* adjustment = gtk_scrollable_get_vadjustment(
+            GTK_SCROLLABLE(this->tree));
+
+    if (this->vadjustment) {
+        g_signal_handlers_disconnect_by_data(this->vadjustment, this);
+        g_object_unref(this->vadjustment);
+    }
+
+    /* value changes when scrolling, the page size when resizing */
+
+    if ((this->vadjustment = adjustment)) {
+        g_object_ref(adjustment);
+        g_signal_connect_swapped(adjustment, "value-changed",
+                G_CALLBACK(tracklist_schedule_priorities), this);
+        g_signal_connect_swapped(adjustment, "changed",
+                G_CALLBACK(tracklist_schedule_priorities), this);
+    }
+}
+
+void tracklist_schedule_priorities(Tracklist* this)
+{
+    if (this->priorities) return;
+    this->priorities = g_idle_add(tracklist_update_priorities, this);
+}
+
+gboolean tracklist_update_priorities(gpointer data)
+{
+    Tracklist* this = data;
+    GtkTreePath* start = NULL, * end = NULL, * path;
+    GtkTreeModel* model;
+    GtkTreeIter iter;
+    GHashTableIter pending;
+    gpointer key, value;
+    Track* selected = NULL;
+
+    this->priorities = 0;
+    if (!this->tree) return G_SOURCE_REMOVE;
+
+    if (gtk_tree_selection_get_selected(gtk_tree_view_get_selection(this->tree),
+                &model, &iter)) {
+        gtk_tree_model_get(model, &iter, TRACKLIST_COLUMN_DATA, &selected, -1);
+    }
+
+    /* there's no visible range before the tree is shown */
+    if (!gtk_tree_view_get_visible_range(this->tree, &start, &end)) {
+        start = end = NULL;
+    }
+
+    /* only the tracks that are listed and not finished have decode jobs */
+
+    g_hash_table_iter_init(&pending, this->pending);
+    while (g_hash_table_iter_next(&pending, &key, &value)) {
+        gint priority = G_PRIORITY_LOW;
+
+        if (key == selected) {
+            priority = G_PRIORITY_HIGH;
+        } else if (start && (path = gtk_tree_row_reference_get_path(value))) {
+            if (    gtk_tree_path_compare(path, start) >= 0
+                    && gtk_tree_path_compare(path, end) <= 0)
+            {
+                priority = G_PRIORITY_DEFAULT;
+            }
+            gtk_tree_path_free(path);
+        }
+        loader_set_priority(this->loader, key, priority);
+    }
+    loader_sort(this->loader);
+
+    gtk_tree_path_free(start);
+    gtk_tree_path_free(end);
+    return G_SOURCE_REMOVE;
+}
+
+gboolean tracklist_is_pending(Track* track)
+{
+    TrackState state = track_get_state(track);
+    gboolean pending;
+
+    if (state == TRACK_STATE_FAILED) return FALSE;
+    if (state != TRACK_STATE_READY) return TRUE;
+
+    g_mutex_lock(&track->lock);
+    pending = isnan(track->true_peak);
+    g_mutex_unlock(&track->lock);
+    return pending;
+}
+
+gboolean tracklist_is_pinned(Track* track, void* data)
+{
+    Tracklist* this = data;
+
+    return track == this->player->current
+        || track == this->reference
+        || track_get_state(track) == TRACK_STATE_ANALYZING;
+}
+
+void load_finished(LoaderResult* results, guint n, gpointer user_data)
+{
+    Tracklist* this = user_data;
+
+    /* the model keeps a sorted list in order on its own, inserted and
+     * updated rows are moved to their place with a binary search
+     */
+
+    for (guint i = 0; i < n; i++) {
+        Track* track = results[i].track;
+
+        if (results[i].event == LOADER_TRACK_CHANGED) {
+            gboolean listed = g_hash_table_contains(this->pending, track);
+
+            tracklist_update_row(this, track);
+            if (listed && track_get_state(track) == TRACK_STATE_READY) {
+                tracklist_align(this, track);
+            }
+            if (this->changed) this->changed(track, this->changed_data);
+            continue;
+        }
+
+        TracklistDrop* drop = results[i].data;
+        GtkTreePath* path = NULL;
+        GtkTreeIter iter;
+
+        /* a removed destination row means the track is appended */
+        if (drop && drop->row) path = gtk_tree_row_reference_get_path(drop->row);
+
+        /* the loader releases its reference after the batch */
+        tracklist_insert_row(this, track_ref(track), path, drop ? drop->pos : 0, &iter);
+        if (track_get_state(track) == TRACK_STATE_READY) {
+            tracklist_index_add(this, track);
+            tracklist_align(this, track);
+        }
+
+        /* the next file of the drop goes after this one, files inserted
+         * before the row are in order already
+         */
+
+        if (path && (drop->pos == GTK_TREE_VIEW_DROP_AFTER
+                    || drop->pos == GTK_TREE_VIEW_DROP_INTO_OR_AFTER))
+        {
+            GtkTreePath* row = gtk_tree_model_get_path(GTK_TREE_MODEL(this->list), &iter);
+            gtk_tree_row_reference_free(drop->row);
+            drop->row = gtk_tree_row_reference_new(GTK_TREE_MODEL(this->list), row);
+            gtk_tree_path_free(row);
+        }
+
+        gtk_tree_path_free(path);
+    }
+
+    /* new rows start at the default priority, offscreen ones are moved back */
+    tracklist_schedule_priorities(this);
+
+    /* the batch may hold a new quietest track */
+    tracklist_update_min_lufs(this);
+
+    /* analyzed and cached tracks of the batch add to the waveforms */
+    residency_trim(this->residency);
+}
+
+TracklistDrop* load_drop_new(Tracklist* this, GtkTreePath* path,
+GtkTreeViewDropPosition pos)
+{
+    TracklistDrop* drop;
+
+    /* the drop gets its own reference to the destination row so the caller
+     * keeps ownership of path
+     * the reference follows the row when rows are added, moved or removed
+     * while the files are loading
+     */
+
+    if (!(drop = malloc(sizeof(TracklistDrop)))) {
+        fprintf(stderr, "failed to allocate drop position\n");
+        return NULL;
+    }
+    drop->row = path
+        ? gtk_tree_row_reference_new(GTK_TREE_MODEL(this->list), path) : NULL;
+    drop->pos = pos;
+    drop->visited = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    drop->ref = 1;
+    return drop;
+}
+
+void load_drop_push(Tracklist* this, GFile* file, TracklistDrop* drop)
+{
+    loader_push(this->loader, file, drop->visited, load_drop_copy(drop),
+            load_drop_copy, load_drop_free);
+}
+
+gpointer load_drop_copy(gpointer data)
+{
+    TracklistDrop* drop = data;
+
+    drop->ref++;
+    return drop;
+}
+
+void load_drop_free(gpointer data)
+{
+    TracklistDrop* drop = data;
+
+    if (!drop || --drop->ref) return;
+    if (drop->row) gtk_tree_row_reference_free(drop->row);
+    g_hash_table_unref(drop->visited);
+    free(drop);
 }
 
 void drag_begin(UNUSED GtkTreeView *tree, UNUSED GdkDragContext *ctx,
@@ -579,7 +979,7 @@ UNUSED gint y, guint time, Tracklist* this)
     /* data-drop handler is connected to the drag destination and therefore
      * relevant to drops from within the tree as well as external files
      * we call get_data() here in order to override stock data-received handler
-     * first we set the ListStore to un-sortable to allow drops in the tree
+     * first we set the model to un-sortable to allow drops in the tree
      */
 
     GdkAtom target = gtk_drag_dest_find_target(GTK_WIDGET(tree), ctx, NULL);
@@ -641,6 +1041,7 @@ GtkSelectionData *selection, guint info, guint32 time, Tracklist* this)
 
             GtkTreePath* path;
             GtkTreeViewDropPosition pos;
+            TracklistDrop* drop;
             char* uri, * str;
             const gchar* delim = "\r\n";
             const guchar* uris = gtk_selection_data_get_data(selection);
@@ -650,19 +1051,26 @@ GtkSelectionData *selection, guint info, guint32 time, Tracklist* this)
              * somehow the file uris are line separated with <CR><LF>
              * we split them here and create files from uri for each line
              *
-             * the destination row position (path) is retrieved here but
-             * free-ed by the async_loader
+             * the files share the destination so they keep the order of
+             * the list when inserted after the row
              */
 
             gtk_tree_view_get_dest_row_at_pos(tree, x, y, &path, &pos);
+            drop = load_drop_new(this, path, pos);
 
             str = g_strdup((const char*)uris);
             uri = strtok(str, delim);
             do {
                 GFile* file = g_file_new_for_uri(uri);
-                tracklist_insert_file(this, file, path, pos);
+                if (drop) {
+                    load_drop_push(this, file, drop);
+                } else {
+                    tracklist_append_file(this, file);
+                }
             } while ((uri = strtok(NULL, delim)));
 
+            load_drop_free(drop);
+            gtk_tree_path_free(path);
             g_free(str);
             gtk_drag_finish(ctx, TRUE, FALSE, time);
             break;
@@ -691,15 +1099,12 @@ GtkSelectionData *selection, guint info, guint32 time, Tracklist* this)
             }
 
             /* when no drop position found, (drop released underneath last row)
-             * the row should be appended at the end of the list by calling
-             * ..._move_before(..., ..., NULL) which is a bit counterinuitive
+             * the row should be appended at the end of the list by moving it
+             * before NULL, which is a bit counterinuitive
              */
 
-            if (pos == GTK_TREE_VIEW_DROP_BEFORE || !destination) {
-                gtk_list_store_move_before(this->list, &src_iter, destination);
-            } else {
-                gtk_list_store_move_after(this->list, &src_iter, destination);
-            }
+            track_model_move(this->list, &src_iter, destination,
+                    pos != GTK_TREE_VIEW_DROP_BEFORE && destination != NULL);
 
             gtk_tree_path_free(src_path);
             gtk_tree_path_free(dst_path);
@@ -0,0 +1,603 @@
+/**
+ * @author      Arno Lievens (arnolievens@gmail.com)
+ * @date        14/10/2026
+ * @file        trackmodel.c
+ * @brief       list model of tracks for the tracklist tree
+ * @copyright   Copyright (c) 2021 Arno Lievens
+ */
+
+#include <gtk/gtk.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "../include/config.h"
+#include "../include/track.h"
+
+#include "../include/trackmodel.h"
+
+/**
+ * A row of the model
+ */
+typedef struct TrackModelRow {
+    Track* track;               /**< the track, not owned */
+    gchar* name_key;            /**< collation key of the name */
+    gdouble lufs;               /**< loudness, -inf while not known */
+    gdouble peak;               /**< true or sample peak, -inf while not known */
+    gdouble length;             /**< length in seconds */
+    guint index;                /**< position before sorting */
+} TrackModelRow;
+
+/**
+ * Track model
+ */
+struct _TrackModel {
+    GObject parent;             /**< parent instance */
+    GArray* rows;               /**< TrackModelRow in display order */
+    gint stamp;                 /**< stamp of the iters of the model */
+    gint sort_column;           /**< sort column id, < 0 = unsorted */
+    GtkSortType order;          /**< sort order */
+};
+
+/**
+ * the row at index i
+ */
+#define TRACK_MODEL_ROW(this, i) (&g_array_index((this)->rows, TrackModelRow, (i)))
+
+/**
+ * the row index of an iter
+ */
+#define TRACK_MODEL_INDEX(iter) ((guint)GPOINTER_TO_INT((iter)->user_data))
+
+/**
+ * Implement GtkTreeModel
+ *
+ * @param iface the interface vtable
+ */
+static void track_model_tree_model_init(GtkTreeModelIface* iface);
+
+/**
+ * Implement GtkTreeSortable
+ *
+ * @param iface the interface vtable
+ */
+static void track_model_sortable_init(GtkTreeSortableIface* iface);
+
+G_DEFINE_TYPE_WITH_CODE(TrackModel, track_model, G_TYPE_OBJECT,
+        G_IMPLEMENT_INTERFACE(GTK_TYPE_TREE_MODEL, track_model_tree_model_init)
+        G_IMPLEMENT_INTERFACE(GTK_TYPE_TREE_SORTABLE, track_model_sortable_init))
+
+/**
+ * Free the rows
+ *
+ * @param object the model
+ */
+static void track_model_finalize(GObject* object);
+
+/**
+ * Copy the sort keys from the track of a row
+ *
+ * @param row the row
+ */
+static void track_model_row_update(TrackModelRow* row);
+
+/**
+ * Compare the sort keys of two rows in the current sort order
+ *
+ * @param a the first row
+ * @param b the second row
+ * @param data the model
+ * @return <0 when a comes first, >0 when b comes first, 0 when equal
+ */
+static gint track_model_compare(gconstpointer a, gconstpointer b, gpointer data);
+
+/**
+ * Find the sorted position of a row that is not in the model
+ *
+ * equal rows keep their order, the row goes after them
+ *
+ * @param this the model
+ * @param row the row
+ * @return the index to insert the row at
+ */
+static guint track_model_search(TrackModel* this, const TrackModelRow* row);
+
+/**
+ * Sort all rows and report the new order
+ *
+ * @param this the model
+ */
+static void track_model_sort(TrackModel* this);
+
+/**
+ * Move a single row and report the new order
+ *
+ * @param this the model
+ * @param from index of the row
+ * @param to index of the row once moved
+ */
+static void track_model_reorder(TrackModel* this, guint from, guint to);
+
+/**
+ * Point iter to a row
+ *
+ * @param this the model
+ * @param iter the iter to be set
+ * @param i the index of the row
+ * @return FALSE when there is no such row
+ */
+static gboolean track_model_set_iter(TrackModel* this, GtkTreeIter* iter, gint i);
+
+/**
+ * GtkTreeModel implementation
+ */
+static GtkTreeModelFlags track_model_get_flags(GtkTreeModel* model);
+static gint track_model_get_n_columns(GtkTreeModel* model);
+static GType track_model_get_column_type(GtkTreeModel* model, gint column);
+static gboolean track_model_get_iter(GtkTreeModel* model, GtkTreeIter* iter,
+        GtkTreePath* path);
+static GtkTreePath* track_model_get_path(GtkTreeModel* model, GtkTreeIter* iter);
+static void track_model_get_value(GtkTreeModel* model, GtkTreeIter* iter,
+        gint column, GValue* value);
+static gboolean track_model_iter_next(GtkTreeModel* model, GtkTreeIter* iter);
+static gboolean track_model_iter_previous(GtkTreeModel* model, GtkTreeIter* iter);
+static gboolean track_model_iter_children(GtkTreeModel* model,
+        GtkTreeIter* iter, GtkTreeIter* parent);
+static gboolean track_model_iter_has_child(GtkTreeModel* model, GtkTreeIter* iter);
+static gint track_model_iter_n_children(GtkTreeModel* model, GtkTreeIter* iter);
+static gboolean track_model_iter_nth_child(GtkTreeModel* model,
+        GtkTreeIter* iter, GtkTreeIter* parent, gint n);
+static gboolean track_model_iter_parent(GtkTreeModel* model, GtkTreeIter* iter,
+        GtkTreeIter* child);
+
+/**
+ * GtkTreeSortable implementation
+ *
+ * only the columns can be sorted on, custom sort functions are not supported
+ */
+static gboolean track_model_get_sort_column_id(GtkTreeSortable* sortable,
+        gint* column, GtkSortType* order);
+static void track_model_set_sort_column_id(GtkTreeSortable* sortable,
+        gint column, GtkSortType order);
+static gboolean track_model_has_default_sort_func(GtkTreeSortable* sortable);
+
+
+/*******************************************************************************
+ * extern functions
+ */
+
+
+TrackModel* track_model_new(void)
+{
+    return g_object_new(TRACK_TYPE_MODEL, NULL);
+}
+
+void track_model_insert(TrackModel* this, Track* track, gint position,
+GtkTreeIter* iter)
+{
+    TrackModelRow row = { .track = track };
+    GtkTreeIter tmp;
+    GtkTreePath* path;
+    guint i;
+
+    /* names do not change once listed, the collation key is made once */
+
+    row.name_key = g_utf8_collate_key(track->name ? track->name : "", -1);
+    track_model_row_update(&row);
+
+    if (this->sort_column >= 0) {
+        i = track_model_search(this, &row);
+    } else if (position < 0 || (guint)position > this->rows->len) {
+        i = this->rows->len;
+    } else {
+        i = (guint)position;
+    }
+    g_array_insert_val(this->rows, i, row);
+
+    if (!iter) iter = &tmp;
+    track_model_set_iter(this, iter, (gint)i);
+
+    path = gtk_tree_path_new_from_indices((gint)i, -1);
+    gtk_tree_model_row_inserted(GTK_TREE_MODEL(this), path, iter);
+    gtk_tree_path_free(path);
+}
+
+gboolean track_model_remove(TrackModel* this, GtkTreeIter* iter)
+{
+    GtkTreePath* path;
+    guint i;
+
+    g_return_val_if_fail(iter->stamp == this->stamp, FALSE);
+
+    i = TRACK_MODEL_INDEX(iter);
+    g_free(TRACK_MODEL_ROW(this, i)->name_key);
+    g_array_remove_index(this->rows, i);
+
+    path = gtk_tree_path_new_from_indices((gint)i, -1);
+    gtk_tree_model_row_deleted(GTK_TREE_MODEL(this), path);
+    gtk_tree_path_free(path);
+
+    if (track_model_set_iter(this, iter, (gint)i)) return TRUE;
+    iter->stamp = 0;
+    return FALSE;
+}
+
+void track_model_move(TrackModel* this, GtkTreeIter* iter,
+GtkTreeIter* position, gboolean after)
+{
+    guint from, to;
+
+    g_return_if_fail(iter->stamp == this->stamp);
+    g_return_if_fail(!position || position->stamp == this->stamp);
+
+    from = TRACK_MODEL_INDEX(iter);
+    if (position) {
+        to = TRACK_MODEL_INDEX(position) + (after ? 1 : 0);
+    } else {
+        to = after ? 0 : this->rows->len;
+    }
+
+    /* the destination is counted with the moved row taken out */
+    if (to > from) to--;
+
+    track_model_reorder(this, from, to);
+}
+
+void track_model_changed(TrackModel* this, GtkTreeIter* iter)
+{
+    TrackModelRow row;
+    GtkTreePath* path;
+    guint i, to;
+
+    g_return_if_fail(iter->stamp == this->stamp);
+
+    i = TRACK_MODEL_INDEX(iter);
+    track_model_row_update(TRACK_MODEL_ROW(this, i));
+
+    path = gtk_tree_path_new_from_indices((gint)i, -1);
+    gtk_tree_model_row_changed(GTK_TREE_MODEL(this), path, iter);
+    gtk_tree_path_free(path);
+
+    if (this->sort_column < 0) return;
+
+    /* a sorted row moves to its new place without sorting everything */
+
+    row = *TRACK_MODEL_ROW(this, i);
+    g_array_remove_index(this->rows, i);
+    to = track_model_search(this, &row);
+    g_array_insert_val(this->rows, i, row);
+
+    track_model_reorder(this, i, to);
+}
+
+
+/*******************************************************************************
+ * static functions
+ *
+ */
+
+
+void track_model_class_init(TrackModelClass* klass)
+{
+    G_OBJECT_CLASS(klass)->finalize = track_model_finalize;
+}
+
+void track_model_init(TrackModel* this)
+{
+    this->rows = g_array_new(FALSE, FALSE, sizeof(TrackModelRow));
+    this->stamp = (gint)g_random_int();
+    this->sort_column = GTK_TREE_SORTABLE_UNSORTED_SORT_COLUMN_ID;
+    this->order = GTK_SORT_ASCENDING;
+}
+
+void track_model_tree_model_init(GtkTreeModelIface* iface)
+{
+    iface->get_flags = track_model_get_flags;
+    iface->get_n_columns = track_model_get_n_columns;
+    iface->get_column_type = track_model_get_column_type;
+    iface->get_iter = track_model_get_iter;
+    iface->get_path = track_model_get_path;
+    iface->get_value = track_model_get_value;
+    iface->iter_next = track_model_iter_next;
+    iface->iter_previous = track_model_iter_previous;
+    iface->iter_children = track_model_iter_children;
+    iface->iter_has_child = track_model_iter_has_child;
+    iface->iter_n_children = track_model_iter_n_children;
+    iface->iter_nth_child = track_model_iter_nth_child;
+    iface->iter_parent = track_model_iter_parent;
+}
+
+void track_model_sortable_init(GtkTreeSortableIface* iface)
+{
+    iface->get_sort_column_id = track_model_get_sort_column_id;
+    iface->set_sort_column_id = track_model_set_sort_column_id;
+    iface->has_default_sort_func = track_model_has_default_sort_func;
+}
+
+void track_model_finalize(GObject* object)
+{
+    TrackModel* this = TRACK_MODEL(object);
+
+    for (guint i = 0; i < this->rows->len; i++) {
+        g_free(TRACK_MODEL_ROW(this, i)->name_key);
+    }
+    g_array_free(this->rows, TRUE);
+
+    G_OBJECT_CLASS(track_model_parent_class)->finalize(object);
+}
+
+void track_model_row_update(TrackModelRow* row)
+{
+    Track* track = row->track;
+    TrackState state = track_get_state(track);
+    gboolean known;
+
+    /* a value is known once the analysis publishes (partial) results,
+     * 0 LUFS or 0 dBFS are measurements too, unknown values sort first
+     */
+
+    g_mutex_lock(&track->lock);
+    known = (state == TRACK_STATE_ANALYZING || state == TRACK_STATE_READY)
+        && !isnan(track->lufs);
+    row->lufs = known ? track->lufs : -INFINITY;
+    row->peak = !known ? -INFINITY
+        : isfinite(track->true_peak) ? track->true_peak : track->peak;
+    row->length = track->length;
+    g_mutex_unlock(&track->lock);
+}
+
+gint track_model_compare(gconstpointer a, gconstpointer b, gpointer data)
+{
+    const TrackModelRow* x = a;
+    const TrackModelRow* y = b;
+    TrackModel* this = data;
+    gint order;
+
+    switch (this->sort_column) {
+        case TRACK_MODEL_COLUMN_NAME:
+            order = strcmp(x->name_key, y->name_key);
+            break;
+        case TRACK_MODEL_COLUMN_LUFS:
+            order = (x->lufs > y->lufs) - (x->lufs < y->lufs);
+            break;
+        case TRACK_MODEL_COLUMN_PEAK:
+            order = (x->peak > y->peak) - (x->peak < y->peak);
+            break;
+        case TRACK_MODEL_COLUMN_DURATION:
+            order = (x->length > y->length) - (x->length < y->length);
+            break;
+        default:
+            order = 0;
+    }
+    return this->order == GTK_SORT_DESCENDING ? -order : order;
+}
+
+guint track_model_search(TrackModel* this, const TrackModelRow* row)
+{
+    guint low = 0, high = this->rows->len;
+
+    while (low < high) {
+        guint mid = low + (high - low) / 2;
+        if (track_model_compare(TRACK_MODEL_ROW(this, mid), row, this) <= 0) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+void track_model_sort(TrackModel* this)
+{
+    GtkTreePath* path;
+    gint* order;
+    guint n = this->rows->len;
+    gboolean moved = FALSE;
+
+    if (this->sort_column < 0 || n < 2) return;
+
+    /* g_array_sort_with_data is stable, equal rows keep their order
+     * the old index of each row makes up the new_order of rows-reordered
+     */
+
+    for (guint i = 0; i < n; i++) TRACK_MODEL_ROW(this, i)->index = i;
+    g_array_sort_with_data(this->rows, track_model_compare, this);
+
+    order = g_new(gint, n);
+    for (guint i = 0; i < n; i++) {
+        order[i] = (gint)TRACK_MODEL_ROW(this, i)->index;
+        moved = moved || order[i] != (gint)i;
+    }
+
+    if (moved) {
+        path = gtk_tree_path_new();
+        gtk_tree_model_rows_reordered(GTK_TREE_MODEL(this), path, NULL, order);
+        gtk_tree_path_free(path);
+    }
+    g_free(order);
+}
+
+void track_model_reorder(TrackModel* this, guint from, guint to)
+{
+    TrackModelRow row;
+    GtkTreePath* path;
+    GArray* order;
+    guint n = this->rows->len;
+    gint old = (gint)from;
+
+    if (from == to || from >= n || to >= n) return;
+
+    row = *TRACK_MODEL_ROW(this, from);
+    g_array_remove_index(this->rows, from);
+    g_array_insert_val(this->rows, to, row);
+
+    /* new_order holds the old index of the row at each position */
+
+    order = g_array_sized_new(FALSE, FALSE, sizeof(gint), n);
+    for (gint i = 0; i < (gint)n; i++) g_array_append_val(order, i);
+    g_array_remove_index(order, from);
+    g_array_insert_val(order, to, old);
+
+    path = gtk_tree_path_new();
+    gtk_tree_model_rows_reordered(GTK_TREE_MODEL(this), path, NULL,
+            (gint*)(void*)order->data);
+    gtk_tree_path_free(path);
+    g_array_free(order, TRUE);
+}
+
+gboolean track_model_set_iter(TrackModel* this, GtkTreeIter* iter, gint i)
+{
+    if (i < 0 || (guint)i >= this->rows->len) return FALSE;
+
+    iter->stamp = this->stamp;
+    iter->user_data = GINT_TO_POINTER(i);
+    iter->user_data2 = NULL;
+    iter->user_data3 = NULL;
+    return TRUE;
+}
+
+GtkTreeModelFlags track_model_get_flags(UNUSED GtkTreeModel* model)
+{
+    return GTK_TREE_MODEL_LIST_ONLY;
+}
+
+gint track_model_get_n_columns(UNUSED GtkTreeModel* model)
+{
+    return TRACK_MODEL_COLUMNS;
+}
+
+GType track_model_get_column_type(UNUSED GtkTreeModel* model, gint column)
+{
+    return column == TRACK_MODEL_COLUMN_DATA ? G_TYPE_POINTER : G_TYPE_STRING;
+}
+
+gboolean track_model_get_iter(GtkTreeModel* model, GtkTreeIter* iter,
+GtkTreePath* path)
+{
+    if (gtk_tree_path_get_depth(path) != 1) return FALSE;
+    return track_model_set_iter(TRACK_MODEL(model), iter,
+            gtk_tree_path_get_indices(path)[0]);
+}
+
+GtkTreePath* track_model_get_path(GtkTreeModel* model, GtkTreeIter* iter)
+{
+    g_return_val_if_fail(iter->stamp == TRACK_MODEL(model)->stamp, NULL);
+    return gtk_tree_path_new_from_indices((gint)TRACK_MODEL_INDEX(iter), -1);
+}
+
+void track_model_get_value(GtkTreeModel* model, GtkTreeIter* iter,
+gint column, GValue* value)
+{
+    TrackModel* this = TRACK_MODEL(model);
+    TrackModelRow* row;
+    gchar text[10];
+
+    g_return_if_fail(iter->stamp == this->stamp);
+    row = TRACK_MODEL_ROW(this, TRACK_MODEL_INDEX(iter));
+
+    /* the tree only asks for the cells it draws, formatting is done here
+     * from the keys so the track lock is not taken
+     */
+
+    g_value_init(value, track_model_get_column_type(model, column));
+
+    switch (column) {
+        case TRACK_MODEL_COLUMN_NAME:
+            g_value_set_string(value, row->track->name);
+            break;
+        case TRACK_MODEL_COLUMN_LUFS:
+            if (isinf(row->lufs)) g_strlcpy(text, "-", sizeof(text));
+            else g_snprintf(text, 7, "%.2f", row->lufs);
+            g_value_set_string(value, text);
+            break;
+        case TRACK_MODEL_COLUMN_PEAK:
+            if (isinf(row->peak)) g_strlcpy(text, "-", sizeof(text));
+            else g_snprintf(text, 7, "%.2f", row->peak);
+            g_value_set_string(value, text);
+            break;
+        case TRACK_MODEL_COLUMN_DURATION:
+            dtoduration(text, row->length);
+            g_value_set_string(value, text);
+            break;
+        case TRACK_MODEL_COLUMN_DATA:
+            g_value_set_pointer(value, row->track);
+            break;
+        default: break;
+    }
+}
+
+gboolean track_model_iter_next(GtkTreeModel* model, GtkTreeIter* iter)
+{
+    return track_model_set_iter(TRACK_MODEL(model), iter,
+            (gint)TRACK_MODEL_INDEX(iter) + 1);
+}
+
+gboolean track_model_iter_previous(GtkTreeModel* model, GtkTreeIter* iter)
+{
+    return track_model_set_iter(TRACK_MODEL(model), iter,
+            (gint)TRACK_MODEL_INDEX(iter) - 1);
+}
+
+gboolean track_model_iter_children(GtkTreeModel* model, GtkTreeIter* iter,
+GtkTreeIter* parent)
+{
+    if (parent) return FALSE;
+    return track_model_set_iter(TRACK_MODEL(model), iter, 0);
+}
+
+gboolean track_model_iter_has_child(UNUSED GtkTreeModel* model,
+UNUSED GtkTreeIter* iter)
+{
+    return FALSE;
+}
+
+gint track_model_iter_n_children(GtkTreeModel* model, GtkTreeIter* iter)
+{
+    return iter ? 0 : (gint)TRACK_MODEL(model)->rows->len;
+}
+
+gboolean track_model_iter_nth_child(GtkTreeModel* model, GtkTreeIter* iter,
+GtkTreeIter* parent, gint n)
+{
+    if (parent) return FALSE;
+    return track_model_set_iter(TRACK_MODEL(model), iter, n);
+}
+
+gboolean track_model_iter_parent(UNUSED GtkTreeModel* model,
+UNUSED GtkTreeIter* iter, UNUSED GtkTreeIter* child)
+{
+    return FALSE;
+}
+
+gboolean track_model_get_sort_column_id(GtkTreeSortable* sortable,
+gint* column, GtkSortType* order)
+{
+    TrackModel* this = TRACK_MODEL(sortable);
+
+    if (column) *column = this->sort_column;
+    if (order) *order = this->order;
+    return this->sort_column >= 0;
+}
+
+void track_model_set_sort_column_id(GtkTreeSortable* sortable, gint column,
+GtkSortType order)
+{
+    TrackModel* this = TRACK_MODEL(sortable);
+
+    /* the default sort column has no sort function, it means unsorted */
+
+    if (column == GTK_TREE_SORTABLE_DEFAULT_SORT_COLUMN_ID) {
+        column = GTK_TREE_SORTABLE_UNSORTED_SORT_COLUMN_ID;
+    }
+    if (column == this->sort_column && order == this->order) return;
+
+    this->sort_column = column;
+    this->order = order;
+    gtk_tree_sortable_sort_column_changed(sortable);
+    track_model_sort(this);
+}
+
+gboolean track_model_has_default_sort_func(UNUSED GtkTreeSortable* sortable)
+{
+    return FALSE;
+}
@@ -28,6 +28,25 @@ static void on_value_changed(Varispeed* this, GtkSpinButton *spin_button)
     player_set_speed(this->player, value);
 }
 
+static void on_stretch_changed(Varispeed* this, UNUSED GParamSpec* pspec,
+GtkSwitch* widget)
+{
+    gboolean stretch = gtk_switch_get_active(widget);
+
+    /* the stretch is muted outside its range, narrowing the range clamps
+     * the speed before the filter is inserted
+     */
+
+    if (stretch) {
+        gtk_spin_button_set_range(GTK_SPIN_BUTTON(this->spin),
+                PLAYER_STRETCH_MIN_SPEED, PLAYER_STRETCH_MAX_SPEED);
+    } else {
+        gtk_spin_button_set_range(GTK_SPIN_BUTTON(this->spin),
+                VARISPEED_MIN_SPEED, VARISPEED_MAX_SPEED);
+    }
+    player_set_stretch(this->player, stretch);
+}
+
 Varispeed* varispeed_new(Player* player)
 {
     Varispeed* this = malloc(sizeof(Varispeed));
@@ -36,9 +55,17 @@ Varispeed* varispeed_new(Player* player)
 
     this->box = gtk_box_new(GTK_ORIENTATION_VERTICAL, MARGIN);
 
-    /* this->switch = gtk_switch_new( */
+    /* off is varispeed: the pitch follows the speed */
+
+    this->stretch = gtk_switch_new();
+    gtk_widget_set_tooltip_text(this->stretch, "Time-stretch");
+    gtk_widget_set_halign(this->stretch, GTK_ALIGN_CENTER);
+    gtk_box_pack_start(GTK_BOX(this->box), this->stretch, FALSE, FALSE, 0);
+    g_signal_connect_swapped(this->stretch, "notify::active",
+            G_CALLBACK(on_stretch_changed), this);
 
-    this->spin = gtk_spin_button_new_with_range(0.1, 10.0, 0.001);
+    this->spin = gtk_spin_button_new_with_range(VARISPEED_MIN_SPEED,
+            VARISPEED_MAX_SPEED, 0.001);
     gtk_box_pack_start(GTK_BOX(this->box), this->spin, FALSE, FALSE, 0);
     gtk_spin_button_set_value(GTK_SPIN_BUTTON(this->spin), 1.0);
     g_signal_connect_swapped(this->spin, "value-changed", G_CALLBACK(on_value_changed), this);
@@ -56,5 +83,6 @@ void varispeed_free(Varispeed* this)
     if (!this) return;
 
     g_signal_handlers_disconnect_by_data(this->spin, this);
+    g_signal_handlers_disconnect_by_data(this->stretch, this);
     gtk_widget_destroy(this->box);
 }
@@ -0,0 +1,156 @@
+/**
+ * @author      Arno Lievens (arnolievens@gmail.com)
+ * @date        14/10/2026
+ * @file        waveform.c
+ * @brief       min/max level-of-detail pyramid of a waveform
+ * @copyright   Copyright (c) 2021 Arno Lievens
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../include/config.h"
+
+#include "../include/waveform.h"
+
+/**
+ * Make room for one more block
+ *
+ * @param level the level to grow
+ * @return 0 on success, -1 when failed to allocate
+ */
+static int waveform_level_grow(WaveformLevel* level);
+
+
+/*******************************************************************************
+ * extern functions
+ */
+
+
+void waveform_init(Waveform* this)
+{
+    memset(this, 0, sizeof(Waveform));
+}
+
+int waveform_push(Waveform* this, int16_t point)
+{
+    size_t i = this->len;
+
+    /* the point either starts a new block or extends the last one
+     * level k (index k-1) holds blocks of 2^k points
+     */
+
+    for (size_t k = 1; k <= WAVEFORM_LEVELS; k++) {
+        WaveformLevel* level = &this->levels[k-1];
+        size_t block = i >> k;
+
+        if (block == level->len) {
+            if (waveform_level_grow(level) < 0) return -1;
+            level->min[block] = point;
+            level->max[block] = point;
+            level->len++;
+        } else {
+            level->min[block] = MIN(level->min[block], point);
+            level->max[block] = MAX(level->max[block], point);
+        }
+    }
+
+    this->len++;
+    return 0;
+}
+
+int waveform_append(Waveform* this, const int16_t* points, size_t len)
+{
+    for (size_t i = 0; i < len; i++) {
+        if (waveform_push(this, points[i]) < 0) return -1;
+    }
+    return 0;
+}
+
+int waveform_range(Waveform* this, const int16_t* points, size_t from,
+size_t to, int16_t* min, int16_t* max)
+{
+    int16_t lo = INT16_MAX, hi = INT16_MIN;
+
+    to = MIN(to, this->len);
+    if (from >= to) return -1;
+
+    /* take the largest block that starts at from and ends before to
+     * from is aligned to 2^k for a block of level k
+     */
+
+    while (from < to) {
+        size_t k = 0;
+
+        while (     k < WAVEFORM_LEVELS
+                && (from & ((2UL << k) - 1)) == 0
+                && from + (2UL << k) <= to)
+        {
+            k++;
+        }
+
+        if (k == 0) {
+            lo = MIN(lo, points[from]);
+            hi = MAX(hi, points[from]);
+        } else {
+            WaveformLevel* level = &this->levels[k-1];
+            lo = MIN(lo, level->min[from >> k]);
+            hi = MAX(hi, level->max[from >> k]);
+        }
+        from += 1UL << k;
+    }
+
+    *min = lo;
+    *max = hi;
+    return 0;
+}
+
+void waveform_clear(Waveform* this)
+{
+    for (size_t k = 0; k < WAVEFORM_LEVELS; k++) {
+        free(this->levels[k].min);
+        free(this->levels[k].max);
+    }
+    waveform_init(this);
+}
+
+size_t waveform_bytes(Waveform* this)
+{
+    size_t bytes = 0;
+
+    for (size_t k = 0; k < WAVEFORM_LEVELS; k++) {
+        bytes += 2 * this->levels[k].size * sizeof(int16_t);
+    }
+    return bytes;
+}
+
+
+/*******************************************************************************
+ * static functions
+ *
+ */
+
+
+int waveform_level_grow(WaveformLevel* level)
+{
+    int16_t* min, * max;
+    size_t size;
+
+    if (level->len < level->size) return 0;
+
+    size = level->size ? level->size * 2 : 64;
+
+    if (!(min = realloc(level->min, size * sizeof(int16_t)))) goto fail;
+    level->min = min;
+    if (!(max = realloc(level->max, size * sizeof(int16_t)))) goto fail;
+    level->max = max;
+
+    level->size = size;
+    return 0;
+
+fail:
+    fprintf(stderr, "failed to allocate waveform level\n");
+    return -1;
+}